@@ -50,6 +50,7 @@
 #include "lib/plist.h"
 #include "lib/pslist.h"
 #include "lib/stringify.h"
+#include "lib/unsigned.h"
 #include "lib/vmm.h"
 #include "lib/walloc.h"
 
@@ -1950,6 +1951,86 @@ bio_sendto(bio_source_t *bio, const gnet_host_t *to,
 	return r;
 }
 
+/**
+ * Send several UDP datagrams at once, as bandwidth permits.
+ *
+ * Only the leading datagrams that fit in the available bandwidth are sent,
+ * the same leeway as in bio_sendto() being granted to the whole batch.
+ * Each datagram sent is accounted for individually, including the IP and
+ * UDP overhead.
+ *
+ * @param bio		the I/O source
+ * @param dg		the datagrams to send
+ * @param cnt		amount of datagrams in `dg'
+ *
+ * @return the amount of datagrams sent, -1 with errno set if none could be
+ * sent, errno being EAGAIN if we are out of bandwidth.
+ */
+int
+bio_sendmmsg(bio_source_t *bio, const wrap_dgram_t *dg, int cnt)
+{
+	size_t available, len;
+	int i, n, r;
+
+	bio_check(bio);
+	g_assert(bio->flags & BIO_F_WRITE);
+	g_assert(cnt > 0);
+
+	for (i = 0, len = 0; i < cnt; i++)
+		len = size_saturate_add(len, dg[i].len);
+
+	available = bw_available(bio, MIN(len, INT_MAX));
+
+	if (0 == available) {
+		errno = VAL_EAGAIN;
+		return -1;
+	}
+
+	/*
+	 * Datagrams are atomic, so only send the ones that fit.
+	 */
+
+	for (n = 0, len = 0; n < cnt; n++) {
+		if (available + BW_UDP_OVERSIZE < len + dg[n].len)
+			break;
+		len += dg[n].len;
+	}
+
+	if (0 == n) {
+		errno = VAL_EAGAIN;
+		return -1;
+	}
+
+	if (GNET_PROPERTY(bsched_debug) > 7)
+		g_debug("BSCHED %s(wio=%d, cnt=%d, len=%zu) available=%zu",
+			G_STRFUNC, bio->wio->fd(bio->wio), n, len, available);
+
+	g_assert(bio->wio != NULL);
+	g_assert(bio->wio->sendmmsg != NULL);
+	r = (*bio->wio->sendmmsg)(bio->wio, dg, n);
+
+	if (-1 == r && 0 == errno) {
+		g_warning("wio->sendmmsg(fd=%d, cnt=%d) returned -1 with errno = 0, "
+			"assuming EAGAIN", bio->wio->fd(bio->wio), n);
+		errno = VAL_EAGAIN;
+	}
+
+	if (r > 0) {
+		size_t sent;
+
+		g_assert(r <= n);
+
+		for (i = 0, sent = 0; i < r; i++)
+			sent += dg[i].len;
+
+		bsched_bw_update(bsched_get(bio->bws),
+			sent + r * BW_UDP_MSG, len + n * BW_UDP_MSG);
+		bio_bw_update(bio, sent + r * BW_UDP_MSG);
+	}
+
+	return r;
+}
+
 /**
  * Write at most `len' bytes to source's fd, as bandwidth permits.
  *
@@ -55,6 +55,7 @@
 #include "if/gnet_property.h"
 #include "if/gnet_property_priv.h"
 
+#include "lib/array_util.h"
 #include "lib/ascii.h"
 #include "lib/atoms.h"
 #include "lib/base32.h"
@@ -75,6 +76,7 @@
 #include "lib/pslist.h"
 #include "lib/shuffle.h"
 #include "lib/str.h"
+#include "lib/stringify.h"
 #include "lib/strtok.h"
 #include "lib/timestamp.h"
 #include "lib/tm.h"
@@ -94,22 +96,49 @@ dmesh_url_error_t dmesh_url_errno;	/**< Error from dmesh_url_parse() */
  */
 static hikset_t *mesh = NULL;
 
+/**
+ * A mesh bucket keeps its entries in a packed array, oldest first.
+ *
+ * Since there are at most MAX_ENTRIES per bucket, locating an entry by host
+ * or by GUID is done by scanning that array, which is cheaper in memory than
+ * maintaining per-bucket hash tables and list cells for each entry.
+ */
 struct dmesh {				/**< A download mesh bucket */
-	list_t *entries;		/**< The download mesh entries, dmesh_entry data */
-	htable_t *by_host;		/**< Entries indexed by host (IP:port) */
-	htable_t *by_guid;		/**< Entries indexed by GUID (firewalled entries) */
+	struct dmesh_entry *entries;	/**< Packed array of entries, oldest first */
+	uint count;				/**< Amount of entries in array */
+	uint size;				/**< Allocated size of array */
 	time_t last_update;		/**< Timestamp of last insert/expire in the mesh */
 	const sha1_t *sha1;		/**< The SHA1 of this mesh */
+	const char *urn;		/**< Canonical "urn:sha1:" name (atom) */
+	char *alt;				/**< Cached compact X-Alt fragments, or NULL */
+	uint16 *alt_off;		/**< Offset of each entry's fragment in `alt' */
+};
+
+/**
+ * A firewalled host known to the mesh.
+ *
+ * These are interned: there is only one such record per GUID, shared by
+ * all the mesh entries referring to that servent, whatever the SHA1.
+ */
+struct dmesh_fwhost {
+	dmesh_fwinfo_t info;	/**< GUID (atom, also the key) and push-proxies */
+	int refcnt;				/**< Amount of mesh entries referring to it */
 };
 
+static htable_t *fwhosts;	/**< Interned firewalled hosts, by GUID */
+
 struct dmesh_entry {
 	time_t inserted;		/**< When entry was inserted in mesh */
 	time_t stamp;			/**< When entry was last seen */
+	hash_list_t *bad;		/**< Keeps track of IPs reporting entry as bad */
 	union {
-		dmesh_urlinfo_t url;	/**< URL info */
-		dmesh_fwinfo_t fwh;		/**< Firewalled host */
+		struct {
+			const char *name;	/**< File name (atom), NULL if canonical URN */
+			uint32 idx;			/**< File index, URN_INDEX for /uri-res */
+			struct packed_host host;	/**< Host IP:port */
+		} url;
+		struct dmesh_fwhost *fwh;	/**< Firewalled host */
 	} e;
-	hash_list_t *bad;		/**< Keeps track of IPs reporting entry as bad */
 	uint8 good;				/**< Whether marked as being a good entry */
 	uint8 fw_entry;			/**< Whether entry is that of a firewalled host */
 };
@@ -209,28 +238,111 @@ dmesh_init(void)
 	ban_mesh = hikset_create_any(offsetof(struct dmesh_banned, info),
 		urlinfo_hash, urlinfo_eq);
 	ban_mesh_by_sha1 = htable_create(HASH_KEY_FIXED, SHA1_RAW_SIZE);
+	fwhosts = htable_create(HASH_KEY_FIXED, GUID_RAW_SIZE);
 	dmesh_cq = cq_main_submake("dmesh", DMESH_CALLOUT);
 	dmesh_retrieve();
 	dmesh_ban_retrieve();
 }
 
 /**
- * Free download mesh entry.
+ * Get interned firewalled host for the GUID, creating it if needed.
+ *
+ * @return the firewalled host, with one more reference taken.
+ */
+static struct dmesh_fwhost *
+dmesh_fwhost_get(const guid_t *guid)
+{
+	struct dmesh_fwhost *fwh;
+
+	fwh = htable_lookup(fwhosts, guid);
+
+	if (NULL == fwh) {
+		WALLOC0(fwh);
+		fwh->info.guid = atom_guid_get(guid);
+		htable_insert(fwhosts, fwh->info.guid, fwh);
+	}
+
+	fwh->refcnt++;
+	return fwh;
+}
+
+/**
+ * Release reference on interned firewalled host, freeing it when the last
+ * mesh entry referring to it is gone.
+ */
+static void
+dmesh_fwhost_release(struct dmesh_fwhost *fwh)
+{
+	g_assert(fwh != NULL);
+	g_assert(fwh->refcnt > 0);
+
+	if (0 != --fwh->refcnt)
+		return;
+
+	htable_remove(fwhosts, fwh->info.guid);
+	atom_guid_free_null(&fwh->info.guid);
+	hash_list_free_all(&fwh->info.proxies, gnet_host_free);
+	WFREE(fwh);
+}
+
+/**
+ * Free resources held by download mesh entry.
  */
 static void
-dmesh_entry_free(struct dmesh_entry *dme)
+dmesh_entry_clear(struct dmesh_entry *dme)
 {
 	g_assert(dme);
 
 	if (dme->fw_entry) {
-		atom_guid_free_null(&dme->e.fwh.guid);
-		hash_list_free_all(&dme->e.fwh.proxies, gnet_host_free);
+		dmesh_fwhost_release(dme->e.fwh);
 	} else {
 		if (dme->e.url.name)
 			atom_str_free(dme->e.url.name);
 	}
 	hash_list_free_all(&dme->bad, wfree_host_addr1);
-	WFREE(dme);
+}
+
+/**
+ * @return the address of a non-firewalled mesh entry.
+ */
+static inline host_addr_t
+dmesh_entry_addr(const struct dmesh_entry *dme)
+{
+	host_addr_t addr;
+
+	g_assert(!dme->fw_entry);
+
+	packed_host_unpack_addr(&dme->e.url.host, &addr);
+	return addr;
+}
+
+/**
+ * @return the port of a non-firewalled mesh entry.
+ */
+static inline uint16
+dmesh_entry_port(const struct dmesh_entry *dme)
+{
+	g_assert(!dme->fw_entry);
+
+	return peek_be16(dme->e.url.host.port);
+}
+
+/**
+ * Fill URL info describing a non-firewalled mesh entry.
+ *
+ * The filled name refers to data held in the mesh bucket, hence the URL info
+ * remains valid only as long as the entry is not removed.
+ */
+static void
+dmesh_entry_urlinfo(const struct dmesh *dm, const struct dmesh_entry *dme,
+	dmesh_urlinfo_t *info)
+{
+	g_assert(!dme->fw_entry);
+
+	packed_host_unpack_addr(&dme->e.url.host, &info->addr);
+	info->port = peek_be16(dme->e.url.host.port);
+	info->idx = dme->e.url.idx;
+	info->name = NULL == dme->e.url.name ? dm->urn : dme->e.url.name;
 }
 
 /**
@@ -583,128 +695,161 @@ dmesh_url_parse(const char *url, dmesh_urlinfo_t *info)
 static struct dmesh *
 dm_alloc(const struct sha1 *sha1)
 {
+	static const char urnsha1[] = "urn:sha1:";
+	char urn[SHA1_BASE32_SIZE + sizeof urnsha1];
 	struct dmesh *dm;
 
-	WALLOC(dm);
-	dm->last_update = 0;
-	dm->entries = list_new();
+	concat_strings(urn, sizeof urn, urnsha1, sha1_base32(sha1), NULL_PTR);
+
+	WALLOC0(dm);
 	dm->sha1 = atom_sha1_get(sha1);
-	dm->by_host = htable_create_any(packed_host_hash_func,
-		packed_host_hash_func2, packed_host_eq_func);
-	dm->by_guid = htable_create(HASH_KEY_FIXED, GUID_RAW_SIZE);
+	dm->urn = atom_str_get(urn);
 
 	return dm;
 }
 
+/**
+ * Discard the cached X-Alt fragments of the mesh bucket.
+ *
+ * This must be called whenever the entries of the bucket change, since
+ * the cached fragments are indexed by entry position.
+ */
+static inline void
+dm_alt_invalidate(struct dmesh *dm)
+{
+	HFREE_NULL(dm->alt);
+	HFREE_NULL(dm->alt_off);
+}
+
 /**
  * Free download mesh structure.
  */
 static void
 dm_free(struct dmesh *dm)
 {
-	list_free_all(&dm->entries,
-		cast_to_list_destroy((func_ptr_t) dmesh_entry_free));
+	uint i;
 
-	/*
-	 * Values in the dme->by_host table were the dmesh_entry structures
-	 * we just disposed of above, so we only need to get rid of the keys.
-	 */
-
-	htable_foreach_key(dm->by_host, wfree_packed_host, NULL);
-	htable_free_null(&dm->by_host);
-
-	/* Keys were GUID in the dmesh_entry, no need to free them */
-	htable_free_null(&dm->by_guid);
+	for (i = 0; i < dm->count; i++)
+		dmesh_entry_clear(&dm->entries[i]);
 
+	dm_alt_invalidate(dm);
+	HFREE_NULL(dm->entries);
 	atom_sha1_free_null(&dm->sha1);
+	atom_str_free_null(&dm->urn);
 	WFREE(dm);
 }
 
 /**
- * Remove specified entry from mesh bucket and reclaim it.
+ * Append a new entry at the tail of the mesh bucket.
+ *
+ * @return pointer to the new zeroed entry, valid until the next insertion
+ * or removal in the bucket.
  */
-static void
-dm_remove_entry(struct dmesh *dm, struct dmesh_entry *dme)
+static struct dmesh_entry *
+dm_append(struct dmesh *dm)
 {
-	struct packed_host packed;
-	const void *key;
-	void *value;
-	bool found;
+	struct dmesh_entry *dme;
 
-	g_assert(dm);
-	g_assert(list_length(dm->entries) > 0);
+	g_assert(dm->count < MAX_ENTRIES);
 
-	if (GNET_PROPERTY(dmesh_debug) > 1) {
-		g_debug("dmesh %sentry removed for urn:sha1:%s at %s",
-			dme->fw_entry ? "firewalled " : "", sha1_base32(dm->sha1),
-			dme->fw_entry ?
-				guid_hex_str(dme->e.fwh.guid) :
-				host_addr_port_to_string(dme->e.url.addr, dme->e.url.port));
-	}
+	dm_alt_invalidate(dm);
 
-	if (dme->fw_entry) {
-		found = htable_lookup_extended(dm->by_guid,
-					dme->e.fwh.guid, &key, &value);
-	} else {
-		packed = host_pack(dme->e.url.addr, dme->e.url.port);
-		found = htable_lookup_extended(dm->by_host,
-					&packed, &key, &value);
+	if G_UNLIKELY(dm->count == dm->size) {
+		dm->size = MIN(MAX_ENTRIES, MAX(4, 2 * dm->size));
+		HREALLOC_ARRAY(dm->entries, dm->size);
 	}
 
-	g_assert(found);
-	g_assert(value == (void *) dme);
+	dme = &dm->entries[dm->count++];
+	ZERO(dme);
 
-	found = list_remove(dm->entries, dme);		/* Remove from list... */
+	return dme;
+}
 
-	g_assert(found);
+/**
+ * Lookup non-firewalled entry for given host in the mesh bucket.
+ *
+ * @return the entry if found, NULL otherwise.
+ */
+static struct dmesh_entry *
+dm_lookup_host(const struct dmesh *dm, const host_addr_t addr, uint16 port)
+{
+	struct packed_host packed = host_pack(addr, port);
+	uint i;
 
-	/* ...and from the proper hash table */
+	for (i = 0; i < dm->count; i++) {
+		struct dmesh_entry *dme = &dm->entries[i];
 
-	if (dme->fw_entry) {
-		htable_remove(dm->by_guid, dme->e.fwh.guid);
-	} else {
-		htable_remove(dm->by_host, &packed);
-		wfree_packed_host(deconstify_pointer(key), NULL);
+		if (!dme->fw_entry && packed_host_eq_func(&dme->e.url.host, &packed))
+			return dme;
 	}
 
-	dmesh_entry_free(dme);
+	return NULL;
 }
 
 /**
- * Remove the addr:port entry from mesh bucket, if present.
+ * Lookup firewalled entry for given GUID in the mesh bucket.
+ *
+ * @return the entry if found, NULL otherwise.
+ */
+static struct dmesh_entry *
+dm_lookup_guid(const struct dmesh *dm, const guid_t *guid)
+{
+	uint i;
+
+	for (i = 0; i < dm->count; i++) {
+		struct dmesh_entry *dme = &dm->entries[i];
+
+		if (dme->fw_entry && guid_eq(dme->e.fwh->info.guid, guid))
+			return dme;
+	}
+
+	return NULL;
+}
+
+/**
+ * Remove specified entry from mesh bucket and reclaim it.
  */
 static void
-dm_remove(struct dmesh *dm, const host_addr_t addr, uint16 port)
+dm_remove_entry(struct dmesh *dm, struct dmesh_entry *dme)
 {
-	struct packed_host packed;
-	struct dmesh_entry *dme;
-	const void *key;
-	void *value;
-	bool found;
+	uint i;
 
 	g_assert(dm);
+	g_assert(dm->count > 0);
+	g_assert(ptr_cmp(dme, dm->entries) >= 0);
 
-	packed = host_pack(addr, port);
-	found = htable_lookup_extended(dm->by_host, &packed, &key, &value);
+	i = dme - dm->entries;
 
-	if (!found)
-		return;
+	g_assert(i < dm->count);
 
 	if (GNET_PROPERTY(dmesh_debug) > 1) {
-		g_debug("dmesh entry removed for urn:sha1:%s at %s",
-			sha1_base32(dm->sha1), host_addr_port_to_string(addr, port));
+		g_debug("dmesh %sentry removed for urn:sha1:%s at %s",
+			dme->fw_entry ? "firewalled " : "", sha1_base32(dm->sha1),
+			dme->fw_entry ?
+				guid_hex_str(dme->e.fwh->info.guid) :
+				host_addr_port_to_string(
+					dmesh_entry_addr(dme), dmesh_entry_port(dme)));
 	}
 
-	dme = value;
-	found = list_remove(dm->entries, dme);		/* Remove from list */
+	dmesh_entry_clear(dme);
+	ARRAY_REMOVE_DEC(dm->entries, i, dm->count);
+	dm_alt_invalidate(dm);
+}
 
-	g_assert(found);
-	g_assert(!dme->fw_entry);
+/**
+ * Remove the addr:port entry from mesh bucket, if present.
+ */
+static void
+dm_remove(struct dmesh *dm, const host_addr_t addr, uint16 port)
+{
+	struct dmesh_entry *dme;
+
+	g_assert(dm);
 
-	htable_remove(dm->by_host, &packed);	/* And from hash table */
-	wfree_packed_host(deconstify_pointer(key), NULL);
+	dme = dm_lookup_host(dm, addr, port);
 
-	dmesh_entry_free(dme);
+	if (dme != NULL)
+		dm_remove_entry(dm, dme);
 }
 
 /**
@@ -745,21 +890,25 @@ dm_lifetime(const struct dmesh *dm)
 static void
 dm_expire(struct dmesh *dm)
 {
-	pslist_t *expired = NULL;
-	pslist_t *sl;
 	time_t now = tm_time();
 	long agemax;
-	list_iter_t *iter;
+	uint i, j;
 
 	agemax = dm_lifetime(dm);
 
-	iter = list_iter_before_head(dm->entries);
+	/*
+	 * Compact the array in place, keeping the order of the entries.
+	 */
 
-	while (list_iter_has_next(iter)) {
-		struct dmesh_entry *dme = list_iter_next(iter);
+	for (i = j = 0; i < dm->count; i++) {
+		struct dmesh_entry *dme = &dm->entries[i];
 
-		if (delta_time(now, dme->stamp) <= agemax)
+		if (delta_time(now, dme->stamp) <= agemax) {
+			if (i != j)
+				dm->entries[j] = *dme;
+			j++;
 			continue;
+		}
 
 		/*
 		 * Remove the entry.
@@ -768,27 +917,27 @@ dm_expire(struct dmesh *dm)
 		 * XXX to see whether the entry is still valid?
 		 */
 
-		if (GNET_PROPERTY(dmesh_debug) > 4)
+		if (GNET_PROPERTY(dmesh_debug) > 4) {
+			dmesh_urlinfo_t info;
+
+			if (!dme->fw_entry)
+				dmesh_entry_urlinfo(dm, dme, &info);
+
 			g_debug("MESH %s: EXPIRED \"%s\", age=%u",
 				sha1_base32(dm->sha1),
 				dme->fw_entry ?
-					dmesh_fwinfo_to_string(&dme->e.fwh) :
-					dmesh_urlinfo_to_string(&dme->e.url),
+					dmesh_fwinfo_to_string(&dme->e.fwh->info) :
+					dmesh_urlinfo_to_string(&info),
 				(unsigned) delta_time(now, dme->stamp));
+		}
 
-		expired = pslist_prepend(expired, dme);
-	}
-
-	list_iter_free(&iter);
-
-	PSLIST_FOREACH(expired, sl) {
-		struct dmesh_entry *dme = sl->data;
-
-		dm_remove_entry(dm, dme);
+		dmesh_entry_clear(dme);
 	}
 
-	pslist_free(expired);
+	if (j != dm->count)
+		dm_alt_invalidate(dm);
 
+	dm->count = j;
 	dm->last_update = tm_time();
 }
 
@@ -806,7 +955,7 @@ dmesh_dispose(const struct sha1 *sha1)
 
 	dm = value;
 	g_assert(found);
-	g_assert(list_length(dm->entries) == 0);
+	g_assert(dm->count == 0);
 
 	hikset_remove(mesh, sha1);
 	dm_free(dm);
@@ -847,7 +996,7 @@ dmesh_remove(const struct sha1 *sha1, const host_addr_t addr, uint16 port,
 	 * If there is nothing left, clear the mesh entry.
 	 */
 
-	if (list_length(dm->entries) == 0)
+	if (dm->count == 0)
 		dmesh_dispose(sha1);
 
     return TRUE;
@@ -876,13 +1025,13 @@ dmesh_count(const struct sha1 *sha1)
 	if (NULL != dm && delta_time(tm_time(), dm->last_update) > EXPIRE_DELAY) {
 		dm_expire(dm);
 
-		if (list_length(dm->entries) == 0) {
+		if (dm->count == 0) {
 			dmesh_dispose(sha1);
 			dm = NULL;
 		}
 	}
 
-	return dm ? list_length(dm->entries) : 0;
+	return dm ? dm->count : 0;
 }
 
 /**
@@ -935,7 +1084,7 @@ dmesh_raw_add(const struct sha1 *sha1, const dmesh_urlinfo_t *info,
 	uint16 port = info->port;
 	uint idx = info->idx;
 	const char *name = info->name;
-	struct packed_host packed;
+	const char *kept;
 	const char *reason = NULL;
 
 	g_return_val_if_fail(sha1, FALSE);
@@ -998,24 +1147,29 @@ dmesh_raw_add(const struct sha1 *sha1, const dmesh_urlinfo_t *info,
 	 * See whether we knew something about this host already.
 	 */
 
-	packed = host_pack(addr, port);
-	dme = htable_lookup(dm->by_host, &packed);
+	dme = dm_lookup_host(dm, addr, port);
 
-	if (dme) {
-		/*
-		 * Entry for this host existed.
-		 */
+	/*
+	 * The name of /uri-res/N2R? URLs is only kept when it is not the
+	 * canonical one, which the mesh bucket already holds.
+	 */
 
-		g_assert(host_addr_equiv(dme->e.url.addr, addr));
-		g_assert(dme->e.url.port == port);
+	kept = (URN_INDEX == idx && 0 == strcmp(name, dm->urn)) ? NULL : name;
 
+	if (dme) {
 		/*
+		 * Entry for this host existed.
+		 *
 		 * We favor URN_INDEX entries, if we can...
 		 */
 
 		if (dme->e.url.idx != idx && idx == URN_INDEX) {
+			dm_alt_invalidate(dm);
 			dme->e.url.idx = idx;
-			atom_str_change(&dme->e.url.name, name);
+			if (NULL == kept)
+				atom_str_free_null(&dme->e.url.name);
+			else
+				atom_str_change(&dme->e.url.name, kept);
 		}
 
 		if (stamp > dme->stamp)		/* Don't move stamp back in the past */
@@ -1026,42 +1180,28 @@ dmesh_raw_add(const struct sha1 *sha1, const dmesh_urlinfo_t *info,
 				sha1_base32(sha1), host_addr_port_to_string(addr, port));
 	} else {
 		/*
-		 * Allocate new entry.
+		 * Allocate new entry, at the tail of the bucket.
 		 */
 
-		WALLOC(dme);
+		dme = dm_append(dm);
 
 		dme->inserted = now;
 		dme->stamp = stamp;
-		dme->e.url.addr = addr;
-		dme->e.url.port = port;
+		dme->e.url.host = host_pack(addr, port);
 		dme->e.url.idx = idx;
-		dme->e.url.name = atom_str_get(name);
-		dme->bad = NULL;
-		dme->good = FALSE;
-		dme->fw_entry = FALSE;
+		dme->e.url.name = NULL == kept ? NULL : atom_str_get(kept);
 
 		entropy_harvest_many(name, strlen(name),
-			VARLEN(dme), PTRLEN(sha1), NULL);
+			VARLEN(*dme), PTRLEN(sha1), NULL);
 
 		if (GNET_PROPERTY(dmesh_debug) > 1)
 			g_debug("dmesh entry created for urn:sha1:%s at %s",
 				sha1_base32(sha1), host_addr_port_to_string(addr, port));
 
-		/*
-		 * We insert new entries at the tail of the list, and record them
-		 * into the hash table indexed by host.
-		 */
-
-		list_append(dm->entries, dme);
 		dm->last_update = now;
 
-		htable_insert(dm->by_host, walloc_packed_host(addr, port), dme);
-
-		if (list_length(dm->entries) == MAX_ENTRIES) {
-			struct dmesh_entry *oldest = list_head(dm->entries);
-			dm_remove_entry(dm, oldest);
-		}
+		if (dm->count == MAX_ENTRIES)
+			dm_remove_entry(dm, &dm->entries[0]);	/* Oldest */
 	}
 
 	/*
@@ -1133,28 +1273,20 @@ dmesh_raw_fw_add(const struct sha1 *sha1, const dmesh_fwinfo_t *info,
 	 * See whether we knew something about this host already.
 	 */
 
-	dme = htable_lookup(dm->by_guid, info->guid);
+	dme = dm_lookup_guid(dm, info->guid);
 
 	if (dme) {
 		/*
 		 * Entry for this host existed.
 		 */
 
-		g_assert(guid_eq(dme->e.fwh.guid, info->guid));
+		g_assert(guid_eq(dme->e.fwh->info.guid, info->guid));
 
 		if (stamp > dme->stamp)		/* Don't move stamp back in the past */
 			dme->stamp = stamp;
 
-		/*
-		 * If we have new proxies, the new list supersedes the old one.
-		 * Otherwise we keep the old list.
-		 */
-
-		if (info->proxies != NULL) {
-			hash_list_free_all(&dme->e.fwh.proxies, gnet_host_free);
-			dme->e.fwh.proxies = info->proxies;
+		if (info->proxies != NULL)
 			dme->inserted = now;	/* List of push-proxies changed */
-		}
 
 		if (GNET_PROPERTY(dmesh_debug) > 1)
 			g_debug("dmesh entry reused for urn:sha1:%s for %s (%s proxies)",
@@ -1162,42 +1294,43 @@ dmesh_raw_fw_add(const struct sha1 *sha1, const dmesh_fwinfo_t *info,
 				info->proxies ? "new" : "no new");
 	} else {
 		/*
-		 * Allocate new entry.
+		 * Allocate new entry, at the tail of the bucket.
 		 */
 
-		WALLOC(dme);
+		dme = dm_append(dm);
 
 		dme->inserted = now;
 		dme->stamp = stamp;
-		dme->e.fwh.guid = atom_guid_get(info->guid);
-		dme->e.fwh.proxies = info->proxies;
-		dme->bad = NULL;
-		dme->good = FALSE;
+		dme->e.fwh = dmesh_fwhost_get(info->guid);
 		dme->fw_entry = TRUE;
 
 		entropy_harvest_many(PTRLEN(info->guid),
-			VARLEN(dme), PTRLEN(sha1), NULL);
+			VARLEN(*dme), PTRLEN(sha1), NULL);
 
 		if (GNET_PROPERTY(dmesh_debug) > 1)
 			g_debug("dmesh entry created for urn:sha1:%s for %s",
 				sha1_base32(sha1), guid_hex_str(info->guid));
 
-		/*
-		 * We insert new entries at the tail of the list, and record them
-		 * into the hash table indexed by GUID.
-		 */
-
-		list_append(dm->entries, dme);
 		dm->last_update = now;
+	}
+
+	/*
+	 * If we have new proxies, the new list supersedes the old one for that
+	 * servent, whatever the SHA1.  Otherwise we keep the old list.
+	 */
 
-		htable_insert(dm->by_guid, dme->e.fwh.guid, dme);
+	if (info->proxies != NULL) {
+		struct dmesh_fwhost *fwh = dme->e.fwh;
 
-		if (list_length(dm->entries) == MAX_ENTRIES) {
-			struct dmesh_entry *oldest = list_head(dm->entries);
-			dm_remove_entry(dm, oldest);
+		if (fwh->info.proxies != info->proxies) {
+			hash_list_free_all(&fwh->info.proxies, gnet_host_free);
+			fwh->info.proxies = info->proxies;
 		}
 	}
 
+	if (dm->count == MAX_ENTRIES)
+		dm_remove_entry(dm, &dm->entries[0]);	/* Oldest */
+
 	/*
 	 * We got a new entry that could be used for swarming if we are
 	 * downloading that file.
@@ -1309,7 +1442,6 @@ dmesh_negative_alt(const struct sha1 *sha1, host_addr_t reporter,
 	host_addr_t addr, uint16 port)
 {
 	struct dmesh *dm;
-	struct packed_host packed;
 	struct dmesh_entry *dme;
 	host_addr_t net;
 
@@ -1322,15 +1454,11 @@ dmesh_negative_alt(const struct sha1 *sha1, host_addr_t reporter,
 	if (dm == NULL)				/* Nothing for this SHA1 key */
 		return;
 
-	packed = host_pack(addr, port);
-	dme = htable_lookup(dm->by_host, &packed);
+	dme = dm_lookup_host(dm, addr, port);
 
 	if (dme == NULL)
 		return;
 
-	g_assert(dme->e.url.port == port);
-	g_assert(host_addr_equiv(dme->e.url.addr, addr));
-
 	if (dme->bad == NULL)
 		dme->bad = hash_list_new(host_addr_hash_func, host_addr_eq_func);
 
@@ -1353,8 +1481,12 @@ dmesh_negative_alt(const struct sha1 *sha1, host_addr_t reporter,
 	} else {
 		/* Add entry to the banned mesh if not a firewalled source */
 
-		if (!dme->fw_entry)
-			dmesh_ban_add(sha1, &dme->e.url, 0);
+		if (!dme->fw_entry) {
+			dmesh_urlinfo_t info;
+
+			dmesh_entry_urlinfo(dm, dme, &info);
+			dmesh_ban_add(sha1, &info, 0);
+		}
 
 		dm_remove_entry(dm, dme);
 	}
@@ -1368,7 +1500,6 @@ dmesh_good_mark(const struct sha1 *sha1,
 	host_addr_t addr, uint16 port, bool good)
 {
 	struct dmesh *dm;
-	struct packed_host packed;
 	struct dmesh_entry *dme;
 	bool retried = FALSE;
 
@@ -1376,10 +1507,8 @@ dmesh_good_mark(const struct sha1 *sha1,
 	if (dm == NULL)
 		return;			/* Weird, but it doesn't matter */
 
-	packed = host_pack(addr, port);
-
 retry:
-	dme = htable_lookup(dm->by_host, &packed);
+	dme = dm_lookup_host(dm, addr, port);
 
 	if (dme == NULL) {
 		/*
@@ -1404,9 +1533,6 @@ retry:
 			return;
 	}
 
-	g_assert(dme->e.url.port == port);
-	g_assert(host_addr_equiv(dme->e.url.addr, addr));
-
 	/*
 	 * Get rid of the "bad" reporting if we're flagging it as good!
 	 */
@@ -1449,13 +1575,11 @@ dmesh_good_fw_mark(const struct sha1 *sha1,
 	if (dm == NULL)
 		return;			/* Weird, but it doesn't matter */
 
-	dme = htable_lookup(dm->by_guid, guid);
+	dme = dm_lookup_guid(dm, guid);
 
 	if (dme == NULL)
 		return;
 
-	g_assert(guid_eq(dme->e.fwh.guid, guid));
-
 /* XXX */
 #if 0
 	/*
@@ -1651,7 +1775,8 @@ dmesh_fwinfo_to_string(const dmesh_fwinfo_t *info)
 static size_t
 dmesh_entry_compact(const struct dmesh_entry *dme, char *buf, size_t size)
 {
-	const dmesh_urlinfo_t *info = &dme->e.url;
+	host_addr_t addr;
+	uint16 port;
 	const char *host;
 	size_t rw;
 
@@ -1659,17 +1784,59 @@ dmesh_entry_compact(const struct dmesh_entry *dme, char *buf, size_t size)
 	g_assert(size > 0);
 	g_assert(size <= INT_MAX);
 
-	if (info->idx != URN_INDEX)
+	if (dme->e.url.idx != URN_INDEX)
 		return (size_t) -1;
 
-	host = info->port == GTA_PORT
-		? host_addr_to_string(info->addr)
-		: host_addr_port_to_string(info->addr, info->port);
+	addr = dmesh_entry_addr(dme);
+	port = dmesh_entry_port(dme);
+	host = port == GTA_PORT
+		? host_addr_to_string(addr)
+		: host_addr_port_to_string(addr, port);
 
 	rw = g_strlcpy(buf, host, size);
 	return rw < size ? rw : (size_t) -1;
 }
 
+/**
+ * Make sure the compact X-Alt fragments of all the entries in the mesh
+ * bucket are cached, computing them if needed.
+ *
+ * The fragment of the i-th entry starts at dm->alt[dm->alt_off[i]] and is
+ * an empty string when the entry cannot be listed in X-Alt.
+ */
+static void
+dm_alt_fill(struct dmesh *dm)
+{
+	char host[HOST_ADDR_PORT_BUFLEN];
+	str_t *s;
+	uint i;
+
+	g_assert(dm->count != 0);
+
+	if (dm->alt != NULL)
+		return;
+
+	s = str_new(dm->count * 16);
+	HALLOC_ARRAY(dm->alt_off, dm->count);
+
+	for (i = 0; i < dm->count; i++) {
+		const struct dmesh_entry *dme = &dm->entries[i];
+
+		dm->alt_off[i] = str_len(s);
+
+		if (!dme->fw_entry) {
+			size_t len = dmesh_entry_compact(dme, host, sizeof host);
+			if ((size_t) -1 != len)
+				str_cat_len(s, host, len);
+		}
+		str_putc(s, '\0');
+	}
+
+	g_assert(str_len(s) <= MAX_INT_VAL(uint16));
+
+	dm->alt = str_s2c_null(&s);
+}
+
 /**
  * Format dmesh_entry in the provided buffer, as an URL with an appended
  * timestamp in ISO format, GMT time.
@@ -1678,8 +1845,10 @@ dmesh_entry_compact(const struct dmesh_entry *dme, char *buf, size_t size)
  * the buffer.
  */
 static size_t
-dmesh_entry_url_stamp(const struct dmesh_entry *dme, char *buf, size_t size)
+dmesh_entry_url_stamp(const struct dmesh *dm, const struct dmesh_entry *dme,
+	char *buf, size_t size)
 {
+	dmesh_urlinfo_t info;
 	size_t rw;
 	bool quoting;
 
@@ -1691,7 +1860,8 @@ dmesh_entry_url_stamp(const struct dmesh_entry *dme, char *buf, size_t size)
 	 * Format the URL info first.
 	 */
 
-	rw = dmesh_urlinfo_to_string_buf(&dme->e.url, buf, size, &quoting);
+	dmesh_entry_urlinfo(dm, dme, &info);
+	rw = dmesh_urlinfo_to_string_buf(&info, buf, size, &quoting);
 	if ((size_t) -1 == rw)
 		return (size_t) -1;
 
@@ -1740,7 +1910,7 @@ dmesh_entry_fw_stamp(const struct dmesh_entry *dme, char *buf, size_t size)
 	 * Format the firewalled host info first.
 	 */
 
-	rw = dmesh_fwinfo_to_string_buf(&dme->e.fwh, buf, size);
+	rw = dmesh_fwinfo_to_string_buf(&dme->e.fwh->info, buf, size);
 	if ((size_t) -1 == rw)
 		return (size_t) -1;
 
@@ -1760,14 +1930,14 @@ dmesh_entry_fw_stamp(const struct dmesh_entry *dme, char *buf, size_t size)
  * @return pointer to static string.
  */
 static const char *
-dmesh_entry_to_string(const struct dmesh_entry *dme)
+dmesh_entry_to_string(const struct dmesh *dm, const struct dmesh_entry *dme)
 {
 	static char str[1024];
 
 	if (dme->fw_entry) {
 		dmesh_entry_fw_stamp(dme, str, sizeof str);
 	} else {
-		dmesh_entry_url_stamp(dme, str, sizeof str);
+		dmesh_entry_url_stamp(dm, dme, str, sizeof str);
 	}
 
 	return str;
@@ -1787,8 +1957,8 @@ dmesh_fill_alternate(const struct sha1 *sha1, gnet_host_t *hvec, int hcnt)
 	int nselected;
 	int i;
 	int j;
+	uint k;
 	bool complete_file;
-	list_iter_t *iter;
 
 	/*
 	 * Fetch the mesh entry for this SHA1.
@@ -1804,10 +1974,11 @@ dmesh_fill_alternate(const struct sha1 *sha1, gnet_host_t *hvec, int hcnt)
 
 	i = 0;
 	complete_file = sha1_of_finished_file(sha1);
-	iter = list_iter_before_head(dm->entries);
 
-	while (list_iter_has_next(iter)) {
-		struct dmesh_entry *dme = list_iter_next(iter);
+	for (k = 0; k < dm->count; k++) {
+		struct dmesh_entry *dme = &dm->entries[k];
+		host_addr_t addr;
+		uint16 port;
 
 		if (dme->fw_entry || dme->e.url.idx != URN_INDEX)
 			continue;
@@ -1826,13 +1997,16 @@ dmesh_fill_alternate(const struct sha1 *sha1, gnet_host_t *hvec, int hcnt)
 				continue;		/* Only propagate good alt locs */
 		}
 
-		if (!host_addr_is_ipv4(dme->e.url.addr))
+		addr = dmesh_entry_addr(dme);
+		port = dmesh_entry_port(dme);
+
+		if (!host_addr_is_ipv4(addr))
 			continue;
 
-		if (g2_cache_lookup(dme->e.url.addr, dme->e.url.port))
+		if (g2_cache_lookup(addr, port))
 			continue;			/* Don't pollute with G2-only entries */
 
-		if (local_addr_cache_lookup(dme->e.url.addr, dme->e.url.port))
+		if (local_addr_cache_lookup(addr, port))
 			continue;			/* Don't pollute with our recent addresses */
 
 		g_assert(i < MAX_ENTRIES);
@@ -1840,12 +2014,11 @@ dmesh_fill_alternate(const struct sha1 *sha1, gnet_host_t *hvec, int hcnt)
 	}
 
 	nselected = i;
-	list_iter_free(&iter);
 
 	if (nselected == 0)
 		return 0;
 
-	g_assert(UNSIGNED(nselected) <= list_length(dm->entries));
+	g_assert(UNSIGNED(nselected) <= dm->count);
 
 	/*
 	 * Second pass: choose at most `hcnt' entries at random.
@@ -1860,7 +2033,7 @@ dmesh_fill_alternate(const struct sha1 *sha1, gnet_host_t *hvec, int hcnt)
 		struct dmesh_entry *dme;
 
 		dme = selected[i];
-		gnet_host_set(&hvec[j], dme->e.url.addr, dme->e.url.port);
+		gnet_host_set(&hvec[j], dmesh_entry_addr(dme), dmesh_entry_port(dme));
 	}
 
 	return j;		/* Amount we filled in vector */
@@ -1968,13 +2141,13 @@ dmesh_alternate_location(const struct sha1 *sha1,
 	size_t len = 0;
 	pslist_t *l;
 	int nselected = 0;
-	struct dmesh_entry *selected[MAX_ENTRIES];
+	uint selected[MAX_ENTRIES];
 	int i;
 	pslist_t *by_addr;
 	size_t maxlinelen = 0;
 	header_fmt_t *fmt;
 	bool added;
-	list_iter_t *iter;
+	uint k;
 	bool complete_file;
 	bool can_share_partials;
 
@@ -2101,14 +2274,13 @@ dmesh_alternate_location(const struct sha1 *sha1,
 		struct dmesh_entry ourselves;
 		time_t now = tm_time();
 
+		ZERO(&ourselves);
 		ourselves.inserted = now;
 		ourselves.stamp = now;
-		ourselves.e.url.addr = listen_addr_primary_net(net);
-		ourselves.e.url.port = GNET_PROPERTY(listen_port);
+		ourselves.e.url.host = host_pack(listen_addr_primary_net(net),
+			GNET_PROPERTY(listen_port));
 		ourselves.e.url.idx = URN_INDEX;
-		ourselves.e.url.name = NULL;
 		ourselves.good = TRUE;
-		ourselves.fw_entry = FALSE;
 
 		url_len = dmesh_entry_compact(&ourselves, url, sizeof url);
 		g_assert((size_t) -1 != url_len && url_len < sizeof url);
@@ -2140,7 +2312,7 @@ dmesh_alternate_location(const struct sha1 *sha1,
 
 	dm_expire(dm);
 
-	if (list_length(dm->entries) == 0) {
+	if (dm->count == 0) {
 		dmesh_dispose(sha1);
 		goto nomore;
 	}
@@ -2149,21 +2321,22 @@ dmesh_alternate_location(const struct sha1 *sha1,
 	 * Go through the list, selecting new entries that can fit.
 	 * We'll do two passes.  The first pass identifies the candidates.
 	 * The second pass randomly selects items until we fill the room
-	 * allocated.
+	 * allocated, using the compact form cached for each entry.
 	 */
 
-	ZERO(&selected);
+	dm_alt_fill(dm);
 
 	/*
 	 * First pass.
 	 */
 
 	i = 0;
-	iter = list_iter_before_head(dm->entries);
 	complete_file = sha1_of_finished_file(sha1);
 
-	while (list_iter_has_next(iter)) {
-		struct dmesh_entry *dme = list_iter_next(iter);
+	for (k = 0; k < dm->count; k++) {
+		struct dmesh_entry *dme = &dm->entries[k];
+		host_addr_t daddr;
+		uint16 dport;
 
 		if (dme->fw_entry)
 			continue;
@@ -2185,33 +2358,35 @@ dmesh_alternate_location(const struct sha1 *sha1,
 		if (delta_time(dme->inserted, last_sent) <= 0)
 			continue;
 
-		if (host_addr_equiv(dme->e.url.addr, addr))
-			continue;
+		daddr = dmesh_entry_addr(dme);
+		dport = dmesh_entry_port(dme);
 
-		if (!hcache_addr_within_net(dme->e.url.addr, net))
+		if (host_addr_equiv(daddr, addr))
 			continue;
 
-		if (dme->e.url.idx != URN_INDEX)
+		if (!hcache_addr_within_net(daddr, net))
 			continue;
 
-		if (g2_cache_lookup(dme->e.url.addr, dme->e.url.port))
+		if ('\0' == dm->alt[dm->alt_off[k]])
+			continue;			/* No compact form, not an URN_INDEX entry */
+
+		if (g2_cache_lookup(daddr, dport))
 			continue;			/* Don't pollute with G2-only entries */
 
-		if (local_addr_cache_lookup(dme->e.url.addr, dme->e.url.port))
+		if (local_addr_cache_lookup(daddr, dport))
 			continue;			/* Don't pollute with our recent addresses */
 
 		g_assert(i < MAX_ENTRIES);
 
-		selected[i++] = dme;
+		selected[i++] = k;
 	}
 
 	nselected = i;
-	list_iter_free(&iter);
 
 	if (nselected == 0)
 		goto nomore;
 
-	g_assert(UNSIGNED(nselected) <= list_length(dm->entries));
+	g_assert(UNSIGNED(nselected) <= dm->count);
 
 	/*
 	 * Second pass.
@@ -2220,17 +2395,11 @@ dmesh_alternate_location(const struct sha1 *sha1,
 	SHUFFLE_ARRAY_N(selected, nselected);
 
 	for (i = 0; i < nselected; i++) {
-		struct dmesh_entry *dme = selected[i];
-		size_t url_len;
+		k = selected[i];
 
-		g_assert(delta_time(dme->inserted, last_sent) > 0);
+		g_assert(delta_time(dm->entries[k].inserted, last_sent) > 0);
 
-		url_len = dmesh_entry_compact(dme, url, sizeof url);
-
-		/* Buffer was large enough */
-		g_assert((size_t) -1 != url_len && url_len < sizeof url);
-
-		if (header_fmt_append_value(fmt, url))
+		if (header_fmt_append_value(fmt, &dm->alt[dm->alt_off[k]]))
 			added = TRUE;
 	}
 
@@ -2293,10 +2462,9 @@ dmesh_alternate_location(const struct sha1 *sha1,
 	 * to have firewalled ones.
 	 */
 
-	iter = list_iter_before_head(dm->entries);
-
-	while (list_iter_has_next(iter)) {
-		struct dmesh_entry *dme = list_iter_next(iter);
+	for (k = 0; k < dm->count; k++) {
+		struct dmesh_entry *dme = &dm->entries[k];
+		const dmesh_fwinfo_t *fwinfo;
 		sequence_t *proxies;
 		host_addr_t servent_addr;
 		uint16 servent_port;
@@ -2304,6 +2472,8 @@ dmesh_alternate_location(const struct sha1 *sha1,
 		if (!dme->fw_entry)
 			continue;
 
+		fwinfo = &dme->e.fwh->info;
+
 		/*
 		 * When downloading (i.e. when the file is not complete), we have the
 		 * neceesary feedback to spot good sources.  When sharing a complete
@@ -2321,7 +2491,7 @@ dmesh_alternate_location(const struct sha1 *sha1,
 		if (delta_time(dme->inserted, last_sent) <= 0)
 			continue;
 
-		if (guid_eq(dme->e.fwh.guid, guid))
+		if (guid_eq(fwinfo->guid, guid))
 			continue;
 
 		/*
@@ -2332,12 +2502,12 @@ dmesh_alternate_location(const struct sha1 *sha1,
 		 */
 
 		if (
-			download_known_guid(dme->e.fwh.guid, &servent_addr, &servent_port,
+			download_known_guid(fwinfo->guid, &servent_addr, &servent_port,
 				&proxies)
 		) {
 			size_t url_len;
 			url_len = dmesh_fwalt_string(url, sizeof url,
-				dme->e.fwh.guid, servent_addr, servent_port, proxies, net);
+				fwinfo->guid, servent_addr, servent_port, proxies, net);
 			sequence_release(&proxies);
 
 
@@ -2351,14 +2521,14 @@ dmesh_alternate_location(const struct sha1 *sha1,
 		} else {
 			size_t url_len;
 
-			if (dme->e.fwh.proxies != NULL) {
-				proxies = sequence_create_from_hash_list(dme->e.fwh.proxies);
+			if (fwinfo->proxies != NULL) {
+				proxies = sequence_create_from_hash_list(fwinfo->proxies);
 			} else {
 				proxies = NULL;
 			}
 
 			url_len = dmesh_fwalt_string(url, sizeof url,
-				dme->e.fwh.guid, ipv4_unspecified, 0, proxies, net);
+				fwinfo->guid, ipv4_unspecified, 0, proxies, net);
 			sequence_release(&proxies);
 
 			g_assert(url_len < sizeof url);
@@ -2368,8 +2538,6 @@ dmesh_alternate_location(const struct sha1 *sha1,
 		}
 	}
 
-	list_iter_free(&iter);
-
 	/* FALL THROUGH */
 
 nomore:
@@ -2949,7 +3117,7 @@ static int
 dmesh_alt_loc_fill(const struct sha1 *sha1, dmesh_urlinfo_t *buf, int count)
 {
 	struct dmesh *dm;
-	list_iter_t *iter;
+	uint k;
 	int i;
 
 	g_assert(sha1);
@@ -2961,23 +3129,18 @@ dmesh_alt_loc_fill(const struct sha1 *sha1, dmesh_urlinfo_t *buf, int count)
 		return 0;
 
 	i = 0;
-	iter = list_iter_before_head(dm->entries);
 
-	while (list_iter_has_next(iter) && i < count) {
-		struct dmesh_entry *dme = list_iter_next(iter);
-		dmesh_urlinfo_t *from;
+	for (k = 0; k < dm->count && i < count; k++) {
+		const struct dmesh_entry *dme = &dm->entries[k];
 
 		if (dme->fw_entry)
 			continue;
 
 		g_assert(i < MAX_ENTRIES);
 
-		from = &dme->e.url;
-		buf[i++] = *from;
+		dmesh_entry_urlinfo(dm, dme, &buf[i++]);
 	}
 
-	list_iter_free(&iter);
-
 	return i;
 }
 
@@ -3271,18 +3434,12 @@ dmesh_store_kv(void *value, void *udata)
 {
 	const struct dmesh *dm = value;
 	FILE *out = udata;
-	list_iter_t *iter;
+	uint i;
 
 	fprintf(out, "%s\n", sha1_base32(dm->sha1));
 
-	iter = list_iter_before_head(dm->entries);
-
-	while (list_iter_has_next(iter)) {
-		const struct dmesh_entry *dme = list_iter_next(iter);
-		fprintf(out, "%s\n", dmesh_entry_to_string(dme));
-	}
-
-	list_iter_free(&iter);
+	for (i = 0; i < dm->count; i++)
+		fprintf(out, "%s\n", dmesh_entry_to_string(dm, &dm->entries[i]));
 
 	fputs("\n", out);
 }
@@ -3560,6 +3717,7 @@ dmesh_close(void)
 
 	hikset_foreach(mesh, dmesh_free_kv, NULL);
 	hikset_free_null(&mesh);
+	htable_free_null(&fwhosts);
 
 	/*
 	 * Construct a list of banned mesh entries to remove, then manually
@@ -91,10 +91,12 @@
 #include "lib/array.h"
 #include "lib/ascii.h"
 #include "lib/atoms.h"
+#include "lib/barrier.h"
 #include "lib/base32.h"
 #include "lib/concat.h"
 #include "lib/dbus_util.h"
 #include "lib/dualhash.h"
+#include "lib/elist.h"
 #include "lib/endian.h"
 #include "lib/entropy.h"
 #include "lib/file.h"
@@ -121,6 +123,8 @@
 #include "lib/str.h"
 #include "lib/stringify.h"
 #include "lib/strtok.h"
+#include "lib/teq.h"
+#include "lib/thread.h"
 #include "lib/tigertree.h"
 #include "lib/tm.h"
 #include "lib/url.h"
@@ -199,6 +203,12 @@ static void download_queue_hold(struct download *d, uint32 hold,
 static void download_force_stop(struct download *d, const char * reason, ...);
 static void download_reparent(struct download *d, struct dl_server *new_server);
 static void download_silent_flush(struct download *d);
+static bool download_write_data(struct download *d);
+static bool download_write_status(struct download *d, bool trimmed);
+static void download_write_detach(struct download *d);
+static void download_write_forget(struct download *d);
+static void download_writer_init(void);
+static void download_tth_free(struct dl_tth *t);
 static void change_server_addr(struct dl_server *server,
 	const host_addr_t new_addr, const uint16 new_port);
 static struct download *download_pick_another(const struct download *d);
@@ -1321,6 +1331,7 @@ download_init(void)
 	dhl_by_sha1 = htable_create(HASH_KEY_FIXED, SHA1_RAW_SIZE);
 	dl_thex = dualhash_new(guid_hash, guid_eq, guid_hash, guid_eq);
 	local_pushes = aging_make(DOWNLOAD_PUSH_FREQ, dl_key_hash, dl_key_eq, NULL);
+	download_writer_init();
 
 	header_features_add_guarded(FEATURES_DOWNLOADS, "browse",
 		BH_VERSION_MAJOR, BH_VERSION_MINOR,
@@ -1362,6 +1373,7 @@ download_restore_state(void)
 	file_info_retrieve();					/* Get all fileinfos */
 	/* Pick up orphaned files */
 	file_info_scandir(GNET_PROPERTY(save_file_path));
+	file_info_journal_replay();				/* Apply last session updates */
 	download_retrieve();					/* Restore downloads */
 	file_info_spot_completed_orphans();		/* 100% done orphans => fake dl. */
 	download_resume_bg_tasks();				/* Reschedule SHA1 and moving */
@@ -1406,9 +1418,12 @@ buffers_free(struct download *d)
 	download_check(d);
 	g_assert(d->buffers != NULL);
 	g_assert(d->buffers->held == 0);	/* No pending data */
+	g_assert(d->buffers->write == NULL);	/* No pending disk write */
 
 	b = d->buffers;
 	pmsg_slist_free_all(&b->list);
+	if (b->tth != NULL)
+		download_tth_free(b->tth);
 	WFREE(b);
 
 	d->buffers = NULL;
@@ -3607,6 +3622,7 @@ download_info_change_all(fileinfo_t *old_fi, fileinfo_t *new_fi)
 			download_stop(d, GTA_DL_TIMEOUT_WAIT, no_reason);
 		}
 		g_assert(old_fi->refcount > 0);
+		download_write_forget(d);
 		file_info_remove_source(old_fi, d, FALSE); /* Keep it around */
 		file_info_add_source(new_fi, d);
 
@@ -3896,6 +3912,9 @@ download_clone(struct download *d)
 	if (s != NULL)
 		getline_free_null(&s->getline);	/* No longer need this */
 
+	/* No pending write: we only continue once it completed */
+	g_assert(NULL == d->buffers || NULL == d->buffers->write);
+
 	if (d->flags & (DL_F_BROWSE | DL_F_THEX)) {
 		g_assert(NULL == d->buffers);
 		if (d->io_opaque != NULL) {
@@ -4610,6 +4629,7 @@ download_stop_v(struct download *d, download_status_t new_status,
 
 		if (d->buffers != NULL) {
 			if (FILE_INFO_COMPLETE(d->file_info)) {
+				download_write_detach(d);
 				buffers_discard(d);
 			} else {
 				download_silent_flush(d);
@@ -4623,6 +4643,8 @@ download_stop_v(struct download *d, download_status_t new_status,
 					 *
 					 * We need to stop this donwload first, so defer
 					 * launching verification until we've completed cleanup.
+					 * When the data are written asynchronously, this is
+					 * done by download_write_detached_done() instead.
 					 */
 					verify_sha1 = TRUE;
 					new_status = GTA_DL_COMPLETED;	/* Forced */
@@ -5305,6 +5327,7 @@ download_info_reget(struct download *d)
 
 	if (d->file_info->sha1 != NULL)
 		download_by_sha1_remove(d);
+	download_write_forget(d);
 	file_info_remove_source(fi, d, FALSE);		/* Keep it around for others */
 
 	fi = file_info_get(d->file_name, GNET_PROPERTY(save_file_path),
@@ -5478,6 +5501,7 @@ download_remove(struct download *d)
 	atom_str_free_null(&d->file_name);
 	atom_str_free_null(&d->uri);
 
+	download_write_forget(d);
 	file_info_remove_source(d->file_info, d, FALSE); /* Keep fileinfo around */
 
 	download_check(d);
@@ -9033,145 +9057,1130 @@ download_overlap_check(struct download *d)
 		goto out;
 	}
 
-	{
-		filestat_t sb;
+	{
+		filestat_t sb;
+
+		if (-1 == file_object_fstat(fo, &sb)) {
+			/* Should never happen */
+			const char *error = g_strerror(errno);
+			g_warning("cannot stat opened \"%s\": %m", fi->pathname);
+			download_stop(d, GTA_DL_ERROR, _("Can't stat opened file: %s"),
+				error);
+			goto out;
+		}
+
+		/*
+		 * Sanity check: if the file is bigger than when we started, abort
+		 * immediately.
+		 */
+
+		if (!fi->use_swarming && d->chunk.start != fi->done) {
+			g_message("file '%s' changed size (now %s, but was %s)",
+					fi->pathname, uint64_to_string(sb.st_size),
+					uint64_to_string2(d->chunk.start));
+			download_queue_delay(d, GNET_PROPERTY(download_retry_stopped_delay),
+					_("Stopped (Output file size changed)"));
+			goto out;
+		}
+	}
+
+	{
+		ssize_t r;
+
+		data = walloc(d->chunk.overlap);
+		g_assert(d->chunk.start >= d->chunk.overlap);
+		r = file_object_pread(fo, data, d->chunk.overlap,
+				d->chunk.start - d->chunk.overlap);
+
+		if ((ssize_t) -1 == r) {
+			const char *error = g_strerror(errno);
+			g_warning("cannot read resuming data for \"%s\": %m",
+					fi->pathname);
+			download_stop(d, GTA_DL_ERROR, _("Can't read resume data: %s"),
+				error);
+			goto out;
+		} else if ((size_t) r != d->chunk.overlap) {
+			g_warning(
+				"short read (got %zu instead of %u bytes at offset %zu) "
+				"on resuming data for \"%s\"",
+				r, d->chunk.overlap, (size_t) d->chunk.start - d->chunk.overlap,
+				fi->pathname);
+			download_stop(d, GTA_DL_ERROR, _("Short read on resume data"));
+			goto out;
+		}
+	}
+
+	if (!buffers_match(d, data, d->chunk.overlap)) {
+		/*
+		 * Resuming data mismatch.
+		 */
+
+		if (GNET_PROPERTY(download_debug) > 1) {
+			g_debug("%u overlapping bytes UNMATCHED at offset %s for \"%s\"",
+				(uint) d->chunk.overlap,
+				uint64_to_string(d->chunk.start - d->chunk.overlap),
+				download_basename(d));
+        }
+
+		d->pos += d->buffers->held;	/* Keep track of what we read so far */
+		d->pos -= d->chunk.overlap;	/* Overlap did not count as chunk data */
+		d->mismatches++;
+		buffers_discard(d);			/* Discard everything we read so far */
+
+		if (GNET_PROPERTY(dl_remove_file_on_mismatch)) {
+			download_bad_source(d);	/* Until proven otherwise if we resume it */
+			download_queue(d, _("Resuming data mismatch @ %s"),
+				uint64_to_string(d->chunk.start - d->chunk.overlap));
+			download_remove_file(d, TRUE);
+			goto out;
+		}
+
+		/*
+		 * If we have not seen too many resuming mismatches from this source,
+		 * maybe we got fooled earlier and downloaded some bad data.  Give
+		 * this source a chance: if we don't have too much data requested,
+		 * simply ignore them and get a chance to issue a new request later.
+		 *		--RAM, 2007-05-05
+		 */
+
+		download_backout(d);	/* Forget some bytes at mismatch point */
+
+		if (
+			d->mismatches <= DOWNLOAD_MAX_IGN_REQS &&
+			d->keep_alive &&
+			download_can_ignore(d)
+		) {
+			success = TRUE;			/* Act as if overlapping was OK */
+			gnet_stats_inc_general(GNR_IGNORING_AFTER_MISMATCH);
+			goto out;
+		}
+
+		download_bad_source(d);	/* Until proven otherwise if we resume it */
+
+		/*
+		 * Don't always keep this source, and since there is doubt,
+		 * leave it to randomness.
+		 */
+
+		if (random_value(99) >= 50)
+			download_stop(d, GTA_DL_ERROR,
+				_("Resuming data mismatch @ %s"),
+				uint64_to_string(d->chunk.start - d->chunk.overlap));
+		else
+			download_queue_delay(d, GNET_PROPERTY(download_retry_busy_delay),
+				_("Resuming data mismatch @ %s"),
+				uint64_to_string(d->chunk.start - d->chunk.overlap));
+		goto out;
+	}
+
+	/*
+	 * Great, resuming data matched!
+	 * Remove the overlapping data from the read buffers.
+	 */
+
+	buffers_check_held(d);
+	buffers_strip_leading(d, d->chunk.overlap);
+	buffers_check_held(d);
+
+	if (GNET_PROPERTY(download_debug) > 3)
+		g_debug("%u overlapping bytes MATCHED "
+			"at offset %s for \"%s\"",
+			(uint) d->chunk.overlap,
+			uint64_to_string(d->chunk.start - d->chunk.overlap),
+			download_basename(d));
+
+	success = TRUE;
+
+out:
+	WFREE_NULL(data, d->chunk.overlap);
+	file_object_release(&fo);
+
+	return success;
+}
+
+/*
+ * Streaming tigertree verification.
+ *
+ * When the tigertree of the file is known, the data of a request are hashed
+ * slice by slice as they are handed over for writing, so that corrupted
+ * slices are detected as soon as their last byte is written and can be
+ * downloaded again immediately.
+ *
+ * A slice is only verified when the same request supplies all its data,
+ * starting at the slice boundary.  Slices straddling requests are left to
+ * the final TTH pass, which can be skipped when all slices were verified.
+ */
+
+/**
+ * Slice hashing state, kept in the download buffers.
+ */
+struct dl_tth {
+	TTH_CONTEXT *ctx;			/**< Hashing context for current slice */
+	pslist_t *bad;				/**< Indices of corrupted slices to reset */
+	filesize_t slice_size;		/**< Slice size when hashing started */
+	filesize_t next;			/**< File offset of next byte to hash */
+	filesize_t end;				/**< End of the slice being hashed */
+	size_t slice;				/**< Index of the slice being hashed */
+	bool active;				/**< Whether a slice is being hashed */
+	bool tainted;				/**< Slice partially written by others */
+};
+
+/**
+ * Free slice hashing state.
+ */
+static void
+download_tth_free(struct dl_tth *t)
+{
+	HFREE_NULL(t->ctx);
+	pslist_free_null(&t->bad);
+	WFREE(t);
+}
+
+/**
+ * Flag slices being hashed by other sources as tainted when they overlap
+ * with the range we are about to write.
+ */
+static void
+download_tth_taint(const struct download *d, filesize_t from, filesize_t to)
+{
+	const fileinfo_t *fi = d->file_info;
+	pslist_t *sl;
+
+	PSLIST_FOREACH(fi->sources, sl) {
+		const struct download *sd = sl->data;
+		struct dl_tth *t;
+
+		download_check(sd);
+
+		if (sd == d || NULL == sd->buffers || NULL == sd->buffers->tth)
+			continue;
+
+		t = sd->buffers->tth;
+
+		if (t->active && from < t->end && to > t->end - t->slice_size)
+			t->tainted = TRUE;
+	}
+}
+
+/**
+ * Complete the hashing of the current slice and check it against the
+ * tigertree leaf.
+ */
+static void
+download_tth_slice_done(struct download *d, struct dl_tth *t)
+{
+	fileinfo_t *fi = d->file_info;
+	struct tth leaf;
+
+	g_assert(t->active);
+	g_assert(t->next == t->end);
+
+	t->active = FALSE;
+	tt_digest(t->ctx, &leaf);
+
+	if G_UNLIKELY(t->slice_size != fi->tigertree.slice_size)
+		return;		/* Tigertree changed whilst hashing */
+
+	if (tth_eq(&leaf, &fi->tigertree.leaves[t->slice])) {
+		if (!t->tainted) {
+			file_info_tigertree_verified(fi, t->slice);
+			gnet_stats_inc_general(GNR_TTH_SLICES_VERIFIED);
+		}
+	} else {
+		/*
+		 * The last bytes of the slice are not marked as written yet,
+		 * hence defer the reset until download_tth_reset_bad().
+		 */
+
+		t->bad = pslist_prepend(t->bad, ulong_to_pointer(t->slice));
+		gnet_stats_inc_general(GNR_TTH_SLICES_BAD);
+	}
+}
+
+/**
+ * Hash the data held in the download buffers, which are about to be
+ * written at d->pos.
+ */
+static void
+download_tth_feed(struct download *d)
+{
+	struct dl_buffers *b = d->buffers;
+	fileinfo_t *fi = d->file_info;
+	filesize_t offset, slice_size;
+	slist_iter_t *iter;
+	struct dl_tth *t;
+
+	/*
+	 * Whatever was known about the slices we are rewriting is now moot.
+	 */
+
+	file_info_tigertree_unverify(fi, d->pos, d->pos + b->held);
+
+	if (0 == fi->tigertree.num_leaves || !fi->file_size_known)
+		return;
+
+	download_tth_taint(d, d->pos, d->pos + b->held);
+
+	slice_size = fi->tigertree.slice_size;
+	t = b->tth;
+
+	if (NULL == t) {
+		WALLOC0(t);
+		b->tth = t;
+	}
+
+	if (t->active && (t->next != d->pos || t->slice_size != slice_size))
+		t->active = FALSE;		/* Discontinuity, cannot verify this slice */
+
+	offset = d->pos;
+	iter = slist_iter_before_head(b->list);
+
+	while (slist_iter_has_next(iter)) {
+		const pmsg_t *mb = slist_iter_next(iter);
+		const char *p = pmsg_read_base(mb);
+		size_t n = pmsg_size(mb);
+
+		while (n != 0) {
+			size_t len;
+
+			if (!t->active) {
+				filesize_t start, skip;
+
+				start = (offset + slice_size - 1) / slice_size * slice_size;
+				if (start >= offset + n || start >= fi->size) {
+					offset += n;
+					break;
+				}
+
+				skip = start - offset;
+				p += skip;
+				n -= skip;
+				offset = start;
+
+				if (NULL == t->ctx)
+					t->ctx = halloc(tt_size());
+
+				t->slice = start / slice_size;
+				t->slice_size = slice_size;
+				t->end = MIN(start + slice_size, fi->size);
+				t->next = start;
+				t->active = TRUE;
+				t->tainted = FALSE;
+				tt_init(t->ctx, t->end - start);
+
+				g_assert(t->slice < fi->tigertree.num_leaves);
+			}
+
+			len = MIN(n, t->end - offset);
+			tt_update(t->ctx, p, len);
+			p += len;
+			n -= len;
+			offset += len;
+			t->next = offset;
+
+			if (t->next == t->end)
+				download_tth_slice_done(d, t);
+		}
+	}
+
+	slist_iter_free(&iter);
+}
+
+/**
+ * Mark the listed corrupted slices as empty so that they are downloaded again.
+ *
+ * @param d				the download which received the slices
+ * @param slice_size	the slice size used when hashing the slices
+ * @param bad_ptr		the list of corrupted slice indices, freed on return
+ */
+static void
+download_tth_reset_slices(struct download *d, filesize_t slice_size,
+	pslist_t **bad_ptr)
+{
+	fileinfo_t *fi = d->file_info;
+	pslist_t *sl;
+
+	PSLIST_FOREACH(*bad_ptr, sl) {
+		size_t i = pointer_to_ulong(sl->data);
+		filesize_t from, to;
+
+		if G_UNLIKELY(slice_size != fi->tigertree.slice_size)
+			break;		/* Tigertree changed, ignore results */
+
+		from = i * slice_size;
+		to = MIN(from + slice_size, fi->size);
+
+		g_warning("TTH slice #%zu (%s-%s) of \"%s\" from %s is corrupted",
+			i, filesize_to_string(from), filesize_to_string2(to - 1),
+			download_basename(d), download_host_info(d));
+
+		file_info_update(d, from, to, DL_CHUNK_EMPTY);
+	}
+
+	pslist_free_null(bad_ptr);
+}
+
+/**
+ * Once the data of the corrupted slices we detected were accounted as
+ * written, mark these slices as empty so that they are downloaded again.
+ */
+static void
+download_tth_reset_bad(struct download *d)
+{
+	struct dl_tth *t;
+
+	if (NULL == d->buffers || NULL == (t = d->buffers->tth) || NULL == t->bad)
+		return;
+
+	download_tth_reset_slices(d, t->slice_size, &t->bad);
+}
+
+/**
+ * Report a failed write of buffered data.
+ *
+ * @param d			the download for which the write failed
+ * @param size		amount of data we attempted to write
+ * @param error		the errno value describing the failure
+ * @param may_stop	whether we can stop the download on errors
+ */
+static void
+download_write_error(struct download *d, size_t size, int error,
+	bool may_stop)
+{
+	const char *msg;
+
+	errno = error;
+
+	switch (errno) {
+	case ENOSPC:	/* No space left */
+		queue_frozen_on_write_error = TRUE;
+		/* FALL THROUGH */
+	case EDQUOT:	/* quota exceeded */
+	case EROFS:		/* read-only filesystem */
+	case EIO:		/* I/O error */
+		if (!download_queue_is_frozen()) {
+			download_freeze_queue();
+			g_warning("freezing download queue due to write error: %m");
+		}
+		break;
+	}
+
+	msg = g_strerror(errno);
+	g_warning("write of %zu bytes to file \"%s\" failed: %m",
+		size, download_basename(d));
+
+	/* FIXME: We should never discard downloaded data! This
+	 * causes a re-download of the same data. Instead we should
+	 * keep the buffered data around and periodically try to
+	 * flush the buffers. At least in the case of ENOSPC or
+	 * EDQUOT when the disk filled up and the condition can
+	 * be solved by the user but may hold for a long duration.
+	 */
+
+	if (may_stop)
+		download_queue_delay(d, GNET_PROPERTY(download_retry_busy_delay),
+			_("Can't save data: %s"), msg);
+}
+
+/**
+ * Report a partial write of buffered data.
+ *
+ * @param d			the download for which the write was partial
+ * @param written	amount of data written
+ * @param held		amount of data that could not be written
+ * @param may_stop	whether we can stop the download on errors
+ */
+static void
+download_write_partial(struct download *d, size_t written, size_t held,
+	bool may_stop)
+{
+	g_warning("partial write (written=%zu, still held=%zu) to file \"%s\"",
+		written, held, download_basename(d));
+
+	if (may_stop)
+		download_queue_delay(d, GNET_PROPERTY(download_retry_busy_delay),
+			_("Partial write to file"));
+}
+
+/*
+ * Asynchronous disk writes.
+ *
+ * Buffered data reaching the flushing threshold are handed to a dedicated
+ * I/O thread, so that the main thread does not stall on a slow disk whilst
+ * the RX stack keeps filling new buffers.
+ *
+ * Only one write can be pending per download.  Should the buffers fill up
+ * again before the previous write completes, we stop reading from the source
+ * until it does: this is the back-pressure that keeps memory usage bounded
+ * by the configured buffer size (plus what the RX stack delivers from the
+ * last read).  We also stop reading as soon as the write reaches the end of
+ * the requested chunk, since what comes next depends on its outcome.
+ *
+ * Completion is reported through a TEQ event to the main thread, which
+ * updates d->pos and the fileinfo chunk list, then performs the checks that
+ * used to follow a synchronous flush: reaching the end of the chunk or of
+ * the file, bumping into a competing download, processing an EOF seen whilst
+ * the data were being written.
+ *
+ * The main thread never waits for the disk: when the download is stopped or
+ * starts ignoring data with a write still pending, that write is detached
+ * from the download and accounted for in the fileinfo on its own when it
+ * completes.
+ */
+
+enum dl_write_magic { DL_WRITE_MAGIC = 0x3c1e07a5 };
+
+/**
+ * A disk write request, handed to the I/O thread.
+ *
+ * The I/O thread only updates the `written' and `error' fields.
+ */
+struct dl_write {
+	enum dl_write_magic magic;
+	struct download *d;			/**< Download, NULL once accounted for */
+	fileinfo_t *fi;				/**< Fileinfo of the download when issued */
+	file_object_t *fo;			/**< File where data are written */
+	slist_t *list;				/**< List of pmsg_t items being written */
+	iovec_t *iov;				/**< I/O vector over the data */
+	pslist_t *bad;				/**< Corrupted TTH slices to reset */
+	link_t lk;					/**< Link in the list of detached writes */
+	filesize_t slice_size;		/**< TTH slice size of corrupted slices */
+	filesize_t offset;			/**< File offset where data are written */
+	size_t size;				/**< Amount of data to write */
+	size_t written;				/**< Amount of data written */
+	int iovcnt;					/**< Amount of entries in the I/O vector */
+	int error;					/**< The errno value on failure */
+	bool trimmed;				/**< Whether data past chunk end were trimmed */
+	bool detached;				/**< Whether write was detached from download */
+};
+
+static inline void
+dl_write_check(const struct dl_write * const wr)
+{
+	g_assert(wr != NULL);
+	g_assert(DL_WRITE_MAGIC == wr->magic);
+}
+
+static uint download_writer_id = THREAD_INVALID_ID;
+static elist_t download_detached = ELIST_INIT(offsetof(struct dl_write, lk));
+
+/**
+ * Free write request.
+ */
+static void
+dl_write_free(struct dl_write *wr)
+{
+	dl_write_check(wr);
+	g_assert(NULL == wr->d);
+
+	pmsg_slist_free_all(&wr->list);
+	HFREE_NULL(wr->iov);
+	pslist_free_null(&wr->bad);
+	wr->magic = 0;
+	WFREE(wr);
+}
+
+/**
+ * Suspend reading from the source whilst the I/O thread is still writing
+ * the previous buffers of the download.
+ *
+ * This is our back-pressure: the main thread never waits for the disk, we
+ * simply stop reading until the pending write completes, which bounds the
+ * amount of data we hold in memory.  It also holds back any data following
+ * the end of the requested chunk, or an EOF, until we know what to do next.
+ */
+static void
+download_rx_pause(struct download *d)
+{
+	struct dl_buffers *b = d->buffers;
+
+	if (b->rx_paused || NULL == d->rx)
+		return;
+
+	if (GNET_PROPERTY(download_debug) > 5) {
+		g_debug("%s: pausing reading for \"%s\", %zu bytes being written",
+			download_host_info(d), download_basename(d), b->pending);
+	}
+
+	rx_link_pause(rx_bottom(d->rx));
+	b->rx_paused = TRUE;
+}
+
+/**
+ * Resume reading from the source, if it was paused by download_rx_pause().
+ */
+static void
+download_rx_resume(struct download *d)
+{
+	struct dl_buffers *b = d->buffers;
+
+	if (!b->rx_paused)
+		return;
+
+	b->rx_paused = FALSE;
+
+	if (d->rx != NULL) {
+		rx_link_resume(rx_bottom(d->rx));
+		d->last_update = tm_time();		/* Do not count the wait as a stall */
+	}
+}
+
+/**
+ * Release the buffering accounted in the fileinfo for a write request.
+ */
+static void
+download_write_unbuffer(fileinfo_t *fi, const struct dl_write *wr)
+{
+	if (fi->buffered >= wr->size)
+		fi->buffered -= wr->size;
+	else
+		fi->buffered = 0;		/* Be fault-tolerant, this is not critical */
+}
+
+/**
+ * Account for the data written by the I/O thread on behalf of a download.
+ *
+ * Nothing is accounted for if the download was attached to another fileinfo
+ * since the write was issued: the data went to a file it no longer uses.
+ *
+ * @param d		the download for which data were written
+ * @param wr	the completed write request
+ */
+static void
+download_write_account(struct download *d, struct dl_write *wr)
+{
+	fileinfo_t *fi = d->file_info;
+
+	if G_UNLIKELY(fi != wr->fi)
+		return;
+
+	download_write_unbuffer(fi, wr);
+
+	if (wr->written != 0) {
+		file_info_update(d, wr->offset, wr->offset + wr->written,
+			DL_CHUNK_DONE);
+		gnet_prop_set_guint64_val(PROP_DL_BYTE_COUNT,
+			GNET_PROPERTY(dl_byte_count) + wr->written);
+	}
+
+	download_tth_reset_slices(d, wr->slice_size, &wr->bad);
+}
+
+/**
+ * Report a failed or partial write request.
+ *
+ * @param d			the download for which data were written
+ * @param wr		the completed write request
+ * @param may_stop	whether we can stop the download on errors
+ */
+static void
+download_write_failed(struct download *d, const struct dl_write *wr,
+	bool may_stop)
+{
+	if (0 == wr->written && wr->error != 0)
+		download_write_error(d, wr->size, wr->error, may_stop);
+	else
+		download_write_partial(d, wr->written, wr->size - wr->written, may_stop);
+}
+
+/**
+ * Process the completion of the pending write of a download.
+ *
+ * Once the data are accounted for, we perform the checks that follow a flush,
+ * then deal with what was received or noticed whilst the data were written.
+ *
+ * @param wr	the completed write request
+ */
+static void
+download_write_complete(struct dl_write *wr)
+{
+	struct download *d = wr->d;
+	struct dl_buffers *b;
+
+	dl_write_check(wr);
+	download_check(d);
+	g_assert(d->buffers != NULL);
+	g_assert(wr == d->buffers->write);
+	g_assert(GTA_DL_RECEIVING == d->status);
+	g_assert(d->pos == wr->offset);
+	g_assert(wr->written <= wr->size);
+
+	b = d->buffers;
+	b->write = NULL;
+	b->pending = 0;
+	wr->d = NULL;
+
+	download_rx_resume(d);
+	download_write_account(d, wr);
+	d->pos += wr->written;
+
+	if G_UNLIKELY(wr->written != wr->size) {
+		/*
+		 * The data buffered since the write was issued no longer start at
+		 * d->pos, hence they cannot be flushed anymore.
+		 */
+
+		if (b->held > 0)
+			buffers_discard(d);
+
+		download_write_failed(d, wr, TRUE);
+		return;
+	}
+
+	/*
+	 * The upper RX layers may have delivered data after we paused reading
+	 * at the end of the chunk: these lie past our range, and are dropped as
+	 * they would have been if we had moved on to the next request at once.
+	 */
+
+	if (b->held > 0 && d->pos >= d->chunk.end)
+		buffers_discard(d);
+
+	(void) download_write_status(d, wr->trimmed);
+
+	if (!DOWNLOAD_IS_ACTIVE(d))
+		return;
+
+	if (b->got_eof) {
+		b->got_eof = FALSE;
+		download_got_eof(d);
+	} else if (GTA_DL_RECEIVING == d->status && b->held != 0) {
+		(void) download_write_data(d);
+	}
+}
+
+/**
+ * Process the completion of a write request detached from its download.
+ *
+ * @param wr	the completed write request
+ */
+static void
+download_write_detached_done(struct dl_write *wr)
+{
+	struct download *d = wr->d;
+	fileinfo_t *fi;
+
+	dl_write_check(wr);
+	download_check(d);
+
+	elist_remove(&download_detached, wr);
+	wr->d = NULL;
+
+	download_write_account(d, wr);
+
+	if G_UNLIKELY(wr->written != wr->size)
+		download_write_failed(d, wr, FALSE);
+
+	/*
+	 * If these data completed the file after the download was stopped,
+	 * launch the verification as download_stop_v() would have done.
+	 */
+
+	fi = d->file_info;
+
+	if (
+		fi == wr->fi && FILE_INFO_COMPLETE(fi) && !FILE_INFO_FINISHED(fi) &&
+		DOWNLOAD_IS_STOPPED(d) && !DOWNLOAD_IS_VERIFYING(d) &&
+		d->list_idx == DL_LIST_STOPPED &&
+		!(FI_F_VERIFYING & fi->flags) &&
+		!(d->flags & DL_F_SUSPENDED)
+	)
+		download_verify_sha1(d);
+}
+
+/**
+ * TEQ event delivered to the main thread when a write request was processed.
+ */
+static void
+download_write_done(void *data)
+{
+	struct dl_write *wr = data;
+
+	dl_write_check(wr);
+	g_assert(thread_is_main());
+
+	if (wr->d != NULL) {
+		if (wr->detached)
+			download_write_detached_done(wr);
+		else
+			download_write_complete(wr);
+	}
+
+	dl_write_free(wr);
+}
+
+/**
+ * Write the data of the request, in the context of the I/O thread.
+ */
+static void
+download_writer_write(void *data)
+{
+	struct dl_write *wr = data;
+	iovec_t *iov;
+	int n;
+
+	dl_write_check(wr);
+
+	iov = wr->iov;
+	n = wr->iovcnt;
+
+	/*
+	 * We loop until everything is written, adjusting the I/O vector after
+	 * partial writes: as in download_flush(), writev() may not be able to
+	 * write all the data at once.
+	 */
+
+	while (wr->written < wr->size) {
+		ssize_t ret;
+		size_t len;
+
+		ret = file_object_pwritev(wr->fo, iov, n, wr->offset + wr->written);
+
+		if ((ssize_t) -1 == ret || 0 == ret) {
+			wr->error = 0 == ret ? 0 : errno;
+			break;
+		}
+
+		len = (size_t) ret;
+		wr->written += len;
+
+		while (n > 0 && len >= iovec_len(iov)) {
+			len -= iovec_len(iov);
+			iov++;
+			n--;
+		}
+
+		if (len != 0) {
+			g_assert(n > 0);
+			iovec_set_base(iov, (char *) iovec_base(iov) + len);
+			iovec_set_len(iov, iovec_len(iov) - len);
+		}
+	}
+
+	/*
+	 * Close our file reference here, so that the file is closed as soon as
+	 * the data are written even when the main thread is gone already.
+	 */
+
+	file_object_release(&wr->fo);
+	teq_safe_post(THREAD_MAIN_ID, download_write_done, wr);
+}
+
+/**
+ * Hand all the buffered data to the I/O thread, to be written at d->pos.
+ *
+ * @return the write request, NULL if the write must be done synchronously.
+ */
+static struct dl_write *
+download_write_issue(struct download *d)
+{
+	struct dl_buffers *b;
+	struct dl_write *wr;
+	file_object_t *fo;
+
+	download_check(d);
+
+	if G_UNLIKELY(THREAD_INVALID_ID == download_writer_id)
+		return NULL;
+
+	b = d->buffers;
+	g_assert(b != NULL);
+	g_assert(NULL == b->write);
+	g_assert(b->held > 0);
+	g_assert(b->held <= d->chunk.end - d->pos);
+
+	/*
+	 * The request holds its own reference on the file, since the download
+	 * can close its file before the data are written.
+	 */
+
+	fo = file_object_open(file_object_pathname(d->out_file), O_WRONLY);
+	if G_UNLIKELY(NULL == fo)
+		return NULL;
+
+	buffers_check_held(d);
+	download_tth_feed(d);
+
+	WALLOC0(wr);
+	wr->magic = DL_WRITE_MAGIC;
+	wr->d = d;
+	wr->fi = d->file_info;
+	wr->fo = fo;
+	wr->offset = d->pos;
+	wr->size = b->held;
+	wr->iov = buffers_to_iovec(d, &wr->iovcnt);
+	wr->list = b->list;
+
+	/*
+	 * The corrupted slices we detected can only be reset once the data
+	 * completing them are accounted for.
+	 */
+
+	if (b->tth != NULL) {
+		wr->bad = b->tth->bad;
+		wr->slice_size = b->tth->slice_size;
+		b->tth->bad = NULL;
+	}
+
+	/*
+	 * The pmsg_t items now belong to the request, further data are read
+	 * in a new list.
+	 */
+
+	b->list = slist_new();
+	b->mode = DL_BUF_READING;
+	b->held = 0;
+
+	if (GNET_PROPERTY(download_debug) > 10)
+		g_debug("writing %zu bytes (%d buffers) for \"%s\" asynchronously",
+			wr->size, wr->iovcnt, download_basename(d));
+
+	entropy_harvest_small(VARLEN(d), VARLEN(wr->size), VARLEN(d->pos), NULL);
+
+	teq_post(download_writer_id, download_writer_write, wr);
+
+	return wr;
+}
+
+/**
+ * Write all the buffered data asynchronously, the completion of the write
+ * being processed by download_write_complete().
+ *
+ * @param d			the download
+ * @param trimmed	whether we trimmed data going past the chunk end
+ *
+ * @return TRUE if the write was issued, FALSE if it must be done synchronously.
+ */
+static bool
+download_write_async(struct download *d, bool trimmed)
+{
+	struct dl_buffers *b;
+	struct dl_write *wr;
+
+	download_check(d);
+	g_assert(d->status == GTA_DL_RECEIVING);
+
+	wr = download_write_issue(d);
+	if (NULL == wr)
+		return FALSE;
+
+	b = d->buffers;
+	b->pending = wr->size;
+	b->write = wr;
+	wr->trimmed = trimmed;
+
+	/*
+	 * Once the data reach the end of the requested chunk, nothing else can
+	 * be read until we know how to continue, which we will upon completion.
+	 */
+
+	if (d->pos + wr->size >= d->chunk.end)
+		download_rx_pause(d);
+
+	return TRUE;
+}
+
+/**
+ * Record a detached write request, to be accounted for on completion
+ * regardless of what happens to the download meanwhile.
+ *
+ * The data being handed over, d->pos is moved past them.
+ */
+static void
+download_write_detached(struct download *d, struct dl_write *wr)
+{
+	g_assert(d->pos == wr->offset);
+	g_assert(!wr->detached);
+
+	wr->detached = TRUE;
+	elist_append(&download_detached, wr);
+	d->pos += wr->size;
+}
+
+/**
+ * Detach the pending write of a download, if any.
+ */
+static void
+download_write_detach(struct download *d)
+{
+	struct dl_buffers *b = d->buffers;
+	struct dl_write *wr = b->write;
+
+	if (NULL == wr)
+		return;
+
+	dl_write_check(wr);
+
+	b->write = NULL;
+	b->pending = 0;
+	download_write_detached(d, wr);
+	download_rx_resume(d);
+}
+
+/**
+ * Forget about the detached writes of a download which is going to lose its
+ * fileinfo: their data will not be accounted for.
+ */
+static void
+download_write_forget(struct download *d)
+{
+	struct dl_write *wr, *next;
+
+	download_check(d);
+
+	for (wr = elist_head(&download_detached); wr != NULL; wr = next) {
+		next = elist_next_data(&download_detached, wr);
+
+		if (wr->d != d)
+			continue;
+
+		if (d->file_info == wr->fi)
+			download_write_unbuffer(wr->fi, wr);
+
+		elist_remove(&download_detached, wr);
+		wr->d = NULL;		/* Completion event will just free it */
+	}
+}
+
+/**
+ * Signal handler to terminate the download I/O thread.
+ */
+static void
+download_writer_terminate(int sig)
+{
+	g_assert(TSIG_TERM == sig);
+
+	if (GNET_PROPERTY(download_debug))
+		g_debug("terminating download I/O thread");
+
+	download_writer_id = THREAD_INVALID_ID;
+}
+
+/**
+ * Has the download I/O thread been terminated?
+ *
+ * Write requests are processed as TEQ events whilst the thread waits.
+ */
+static bool
+download_writer_exiting(void *unused_arg)
+{
+	(void) unused_arg;
+
+	return THREAD_INVALID_ID == download_writer_id;
+}
 
-		if (-1 == file_object_fstat(fo, &sb)) {
-			/* Should never happen */
-			const char *error = g_strerror(errno);
-			g_warning("cannot stat opened \"%s\": %m", fi->pathname);
-			download_stop(d, GTA_DL_ERROR, _("Can't stat opened file: %s"),
-				error);
-			goto out;
-		}
+/**
+ * RPC run by the I/O thread once all the previously queued writes are done.
+ */
+static void *
+download_writer_drain(void *unused_arg)
+{
+	(void) unused_arg;
 
-		/*
-		 * Sanity check: if the file is bigger than when we started, abort
-		 * immediately.
-		 */
+	return NULL;
+}
 
-		if (!fi->use_swarming && d->chunk.start != fi->done) {
-			g_message("file '%s' changed size (now %s, but was %s)",
-					fi->pathname, uint64_to_string(sb.st_size),
-					uint64_to_string2(d->chunk.start));
-			download_queue_delay(d, GNET_PROPERTY(download_retry_stopped_delay),
-					_("Stopped (Output file size changed)"));
-			goto out;
-		}
-	}
+/**
+ * Download I/O thread main loop.
+ */
+static void *
+download_writer_main(void *arg)
+{
+	barrier_t *b = arg;
 
-	{
-		ssize_t r;
+	thread_set_name("download I/O");
+	teq_create();				/* Queue to receive TEQ events */
+	thread_signal(TSIG_TERM, download_writer_terminate);
 
-		data = walloc(d->chunk.overlap);
-		g_assert(d->chunk.start >= d->chunk.overlap);
-		r = file_object_pread(fo, data, d->chunk.overlap,
-				d->chunk.start - d->chunk.overlap);
+	barrier_wait(b);			/* Thread has initialized */
+	barrier_free_null(&b);
 
-		if ((ssize_t) -1 == r) {
-			const char *error = g_strerror(errno);
-			g_warning("cannot read resuming data for \"%s\": %m",
-					fi->pathname);
-			download_stop(d, GTA_DL_ERROR, _("Can't read resume data: %s"),
-				error);
-			goto out;
-		} else if ((size_t) r != d->chunk.overlap) {
-			g_warning(
-				"short read (got %zu instead of %u bytes at offset %zu) "
-				"on resuming data for \"%s\"",
-				r, d->chunk.overlap, (size_t) d->chunk.start - d->chunk.overlap,
-				fi->pathname);
-			download_stop(d, GTA_DL_ERROR, _("Short read on resume data"));
-			goto out;
-		}
-	}
+	if (GNET_PROPERTY(download_debug))
+		g_debug("download I/O thread started");
 
-	if (!buffers_match(d, data, d->chunk.overlap)) {
-		/*
-		 * Resuming data mismatch.
-		 */
+	while (download_writer_id != THREAD_INVALID_ID)
+		teq_wait(download_writer_exiting, NULL);
 
-		if (GNET_PROPERTY(download_debug) > 1) {
-			g_debug("%u overlapping bytes UNMATCHED at offset %s for \"%s\"",
-				(uint) d->chunk.overlap,
-				uint64_to_string(d->chunk.start - d->chunk.overlap),
-				download_basename(d));
-        }
+	g_debug("download I/O thread exiting");
+	return NULL;
+}
 
-		d->pos += d->buffers->held;	/* Keep track of what we read so far */
-		d->pos -= d->chunk.overlap;	/* Overlap did not count as chunk data */
-		d->mismatches++;
-		buffers_discard(d);			/* Discard everything we read so far */
+/**
+ * Create the download I/O thread.
+ */
+static void G_COLD
+download_writer_init(void)
+{
+	barrier_t *b;
+	int r;
 
-		if (GNET_PROPERTY(dl_remove_file_on_mismatch)) {
-			download_bad_source(d);	/* Until proven otherwise if we resume it */
-			download_queue(d, _("Resuming data mismatch @ %s"),
-				uint64_to_string(d->chunk.start - d->chunk.overlap));
-			download_remove_file(d, TRUE);
-			goto out;
-		}
+	b = barrier_new(2);
 
-		/*
-		 * If we have not seen too many resuming mismatches from this source,
-		 * maybe we got fooled earlier and downloaded some bad data.  Give
-		 * this source a chance: if we don't have too much data requested,
-		 * simply ignore them and get a chance to issue a new request later.
-		 *		--RAM, 2007-05-05
-		 */
+	/*
+	 * The thread is created as non-cancelable: to end it, we send it
+	 * a TSIG_TERM.
+	 */
 
-		download_backout(d);	/* Forget some bytes at mismatch point */
+	r = thread_create(download_writer_main, barrier_refcnt_inc(b),
+			THREAD_F_DETACH | THREAD_F_NO_CANCEL |
+				THREAD_F_NO_POOL | THREAD_F_PANIC,
+			THREAD_STACK_MIN);
 
-		if (
-			d->mismatches <= DOWNLOAD_MAX_IGN_REQS &&
-			d->keep_alive &&
-			download_can_ignore(d)
-		) {
-			success = TRUE;			/* Act as if overlapping was OK */
-			gnet_stats_inc_general(GNR_IGNORING_AFTER_MISMATCH);
-			goto out;
-		}
+	download_writer_id = r;
 
-		download_bad_source(d);	/* Until proven otherwise if we resume it */
+	barrier_wait(b);			/* Wait for thread to initialize */
+	barrier_free_null(&b);
+}
 
+/**
+ * Terminate the download I/O thread.
+ */
+static void G_COLD
+download_writer_close(void)
+{
+	if (download_writer_id != THREAD_INVALID_ID) {
 		/*
-		 * Don't always keep this source, and since there is doubt,
-		 * leave it to randomness.
+		 * Requests are processed in order: once this RPC returns, all the
+		 * writes still pending have reached the disk.
 		 */
 
-		if (random_value(99) >= 50)
-			download_stop(d, GTA_DL_ERROR,
-				_("Resuming data mismatch @ %s"),
-				uint64_to_string(d->chunk.start - d->chunk.overlap));
-		else
-			download_queue_delay(d, GNET_PROPERTY(download_retry_busy_delay),
-				_("Resuming data mismatch @ %s"),
-				uint64_to_string(d->chunk.start - d->chunk.overlap));
-		goto out;
+		teq_rpc(download_writer_id, download_writer_drain, NULL);
+		thread_kill(download_writer_id, TSIG_TERM);
 	}
+}
 
-	/*
-	 * Great, resuming data matched!
-	 * Remove the overlapping data from the read buffers.
-	 */
+/**
+ * Trim buffered data going past the end of the requested chunk.
+ *
+ * We can't have data going farther than what we requested from the
+ * server.  But if we do, trim and warn.  And mark the server as not
+ * being capable of handling keep-alive connections correctly!
+ *
+ * @return whether data were trimmed.
+ */
+static bool
+download_trim_excess(struct download *d)
+{
+	struct dl_buffers *b = d->buffers;
+	filesize_t extra;
 
-	buffers_check_held(d);
-	buffers_strip_leading(d, d->chunk.overlap);
-	buffers_check_held(d);
+	g_assert(NULL == b->write);
 
-	if (GNET_PROPERTY(download_debug) > 3)
-		g_debug("%u overlapping bytes MATCHED "
-			"at offset %s for \"%s\"",
-			(uint) d->chunk.overlap,
-			uint64_to_string(d->chunk.start - d->chunk.overlap),
-			download_basename(d));
+	if (b->held <= d->chunk.end - d->pos)
+		return FALSE;
 
-	success = TRUE;
+	extra = b->held - (d->chunk.end - d->pos);
 
-out:
-	WFREE_NULL(data, d->chunk.overlap);
-	file_object_release(&fo);
+	if (GNET_PROPERTY(download_debug)) g_debug(
+		"server %s gave us %s more byte%s than requested for \"%s\"",
+		download_host_info(d), uint64_to_string(extra),
+		plural(extra), download_basename(d));
 
-	return success;
+	buffers_check_held(d);
+	buffers_strip_trailing(d, extra);
+	buffers_check_held(d);
+
+	return TRUE;
 }
 
 /**
@@ -9194,6 +10203,7 @@ download_flush(struct download *d, bool *trimmed, bool may_stop)
 	download_check(d);
 	b = d->buffers;
 	g_assert(b != NULL);
+	g_assert(NULL == b->write);
 	g_assert(d->status == GTA_DL_RECEIVING);
 
 	if (GNET_PROPERTY(download_debug) > 10)
@@ -9201,24 +10211,7 @@ download_flush(struct download *d, bool *trimmed, bool may_stop)
 			(ulong) b->held, slist_length(b->list),
 			download_basename(d), may_stop ? "" : " on stop");
 
-	/*
-	 * We can't have data going farther than what we requested from the
-	 * server.  But if we do, trim and warn.  And mark the server as not
-	 * being capable of handling keep-alive connections correctly!
-	 */
-
-	if (b->held > d->chunk.end - d->pos) {
-		filesize_t extra = b->held - (d->chunk.end - d->pos);
-
-		if (GNET_PROPERTY(download_debug)) g_debug(
-			"server %s gave us %s more byte%s than requested for \"%s\"",
-			download_host_info(d), uint64_to_string(extra),
-			plural(extra), download_basename(d));
-
-		buffers_check_held(d);
-		buffers_strip_trailing(d, extra);
-		buffers_check_held(d);
-
+	if (download_trim_excess(d)) {
 		if (trimmed)
 			*trimmed = TRUE;
 
@@ -9242,6 +10235,8 @@ download_flush(struct download *d, bool *trimmed, bool may_stop)
 	old_held = download_buffered(d);
 	old_pos = d->pos;
 
+	download_tth_feed(d);
+
 	entropy_harvest_small(VARLEN(d), VARLEN(old_held), VARLEN(old_pos), NULL);
 
 	do {
@@ -9283,49 +10278,17 @@ download_flush(struct download *d, bool *trimmed, bool may_stop)
 	} while (b->held > 0);
 
 	if ((ssize_t) -1 == written) {
-		const char *error;
-
-		switch (errno) {
-		case ENOSPC:	/* No space left */
-			queue_frozen_on_write_error = TRUE;
-			/* FALL THROUGH */
-		case EDQUOT:	/* quota exceeded */
-		case EROFS:		/* read-only filesystem */
-		case EIO:		/* I/O error */
-			if (!download_queue_is_frozen()) {
-				download_freeze_queue();
-				g_warning("freezing download queue due to write error: %m");
-			}
-			break;
-		}
-
-	   	error = g_strerror(errno);
-		g_warning("write of %lu bytes to file \"%s\" failed: %m",
-			(ulong) b->held, download_basename(d));
-
-		/* FIXME: We should never discard downloaded data! This
-		 * causes a re-download of the same data. Instead we should
-		 * keep the buffered data around and periodically try to
-		 * flush the buffers. At least in the case of ENOSPC or
-		 * EDQUOT when the disk filled up and the condition can
-		 * be solved by the user but may hold for a long duration.
-		 */
-
-		if (may_stop)
-			download_queue_delay(d, GNET_PROPERTY(download_retry_busy_delay),
-				_("Can't save data: %s"), error);
+		int error = errno;
 
+		download_tth_reset_bad(d);
+		download_write_error(d, b->held, error, may_stop);
 		return FALSE;
 	}
 
-	if (b->held > 0) {
-		g_warning("partial write (written=%lu, still held=%lu) to file \"%s\"",
-			(ulong) written, (ulong) b->held, download_basename(d));
-
-		if (may_stop)
-			download_queue_delay(d, GNET_PROPERTY(download_retry_busy_delay),
-				_("Partial write to file"));
+	download_tth_reset_bad(d);
 
+	if (b->held > 0) {
+		download_write_partial(d, written, b->held, may_stop);
 		return FALSE;
 	}
 
@@ -9339,20 +10302,36 @@ download_flush(struct download *d, bool *trimmed, bool may_stop)
 }
 
 /**
- * Issue download_flush() if needed, discarding silently anything we cannot
- * commit to disk.
+ * Hand the buffered data to disk without any further checks, detaching any
+ * pending write, and discard silently anything we cannot commit to disk.
+ *
+ * The data are written asynchronously if possible, in which case d->pos is
+ * moved past them right away.
  */
 static void
 download_silent_flush(struct download *d)
 {
+	struct dl_buffers *b;
+	struct dl_write *wr;
+
 	download_check(d);
-	g_assert(d->buffers != NULL);
-	g_assert(d->status != GTA_DL_IGNORING || 0 == d->buffers->held);
+	b = d->buffers;
+	g_assert(b != NULL);
+	g_assert(d->status != GTA_DL_IGNORING || 0 == b->held);
 	g_assert(d->status == GTA_DL_IGNORING || d->status == GTA_DL_RECEIVING);
 
-	if (d->buffers->held > 0) {
-		download_flush(d, NULL, FALSE);
-		if (d->buffers->held > 0) {
+	download_write_detach(d);
+
+	if (b->held > 0)
+		(void) download_trim_excess(d);
+
+	if (b->held > 0) {
+		wr = download_write_issue(d);
+		if (wr != NULL)
+			download_write_detached(d, wr);
+		else
+			download_flush(d, NULL, FALSE);
+		if (b->held > 0) {
 			buffers_discard(d);
 		}
 	}
@@ -9519,9 +10498,9 @@ download_write_data(struct download *d)
 {
 	struct dl_buffers *b;
 	fileinfo_t *fi;
-	bool trimmed = FALSE;
-	enum dl_chunk_status status = DL_CHUNK_BUSY;
-	bool should_flush;
+	bool trimmed;
+	bool should_flush, in_chunk;
+	filesize_t pos;
 
 	download_check(d);
 
@@ -9558,9 +10537,11 @@ download_write_data(struct download *d)
 
 	g_assert(b->held > 0);
 
+	pos = d->pos + b->pending;		/* Where buffered data will be written */
 	should_flush = buffers_should_flush(d);		/* Enough buffered data? */
+	in_chunk = b->held < d->chunk.end - pos;
 
-	if (!should_flush && b->held >= d->chunk.end - d->pos)
+	if (!should_flush && !in_chunk)
 		should_flush = TRUE;		/* Moving past our range */
 
 	/*
@@ -9587,16 +10568,61 @@ download_write_data(struct download *d)
 			download_host_info(d),
 			should_flush ? "" : "NOT ",
 			(ulong) b->held, download_basename(d),
-			uint64_to_string(d->pos),
+			uint64_to_string(pos),
 			uint64_to_string2(d->chunk.end));
 	}
 
 	if (!should_flush)
 		return TRUE;
 
-	if (!download_flush(d, &trimmed, TRUE))
+	/*
+	 * If the I/O thread is still writing our previous buffers, stop reading
+	 * until it is done: we must not buffer more than configured, and we need
+	 * an accurate d->pos to write the data we hold.  The completion of the
+	 * pending write will resume reading and flush what we have.
+	 */
+
+	if (b->write != NULL) {
+		download_rx_pause(d);
+		return TRUE;
+	}
+
+	/*
+	 * Let the I/O thread write the data, the checks that follow a flush
+	 * being performed by download_write_complete() once they are written.
+	 */
+
+	trimmed = download_trim_excess(d);
+
+	if (download_write_async(d, trimmed))
+		return TRUE;
+
+	if (!download_flush(d, NULL, TRUE))
 		return FALSE;
 
+	return download_write_status(d, trimmed);
+}
+
+/**
+ * Check where we stand after the buffered data were written to disk.
+ *
+ * @param d			the download
+ * @param trimmed	whether we had to trim data going past the chunk end
+ *
+ * @return FALSE if the download is no longer running and no data should be
+ * read from the RX stack.
+ */
+static bool
+download_write_status(struct download *d, bool trimmed)
+{
+	fileinfo_t *fi;
+	enum dl_chunk_status status;
+
+	download_check(d);
+	g_assert(GTA_DL_RECEIVING == d->status);
+
+	fi = d->file_info;
+
 	/*
 	 * End download if we have completed it.
 	 */
@@ -9696,6 +10722,13 @@ done:
 
 		g_assert(FILE_INFO_COMPLETE(fi));
 
+		/*
+		 * Data received whilst our last write was pending are useless now.
+		 */
+
+		if (d->buffers->held > 0)
+			buffers_discard(d);
+
 		download_continue(d, trimmed);
 		download_verify_sha1(d);
 
@@ -15739,6 +16772,32 @@ download_tigertree_sweep(struct download *d,
 	HFREE_NULL(nodes);
 }
 
+/**
+ * Called when the TTH of the completed file was found to match.
+ */
+static void
+download_verify_tigertree_matched(struct download *d)
+{
+	fileinfo_t *fi = d->file_info;
+
+	download_set_status(d, GTA_DL_VERIFIED);
+	fi->tth_check = TRUE;
+
+	if (!has_good_sha1(d)) {
+		/*
+		 * FIXME:
+		 * This is far from perfect: if we come here, the SHA1 checking
+		 * was a mismatch, yet the TTH was good. We ought to flag this
+		 * bitprint (combination of SHA1 and TTH) as invalid before retrying.
+		 * But currently, what we do is move the download to the "bad" dir
+		 * and we leave it there, stopping the download.
+		 *		--RAM, 2007-08-25
+		 */
+		fi_mark_bad_bitprint(fi);
+	}
+	download_verifying_done(d);
+}
+
 /**
  * Called when download verification is finished and digest is known.
  */
@@ -15764,8 +16823,6 @@ download_verify_tigertree_done(struct download *d,
 	if (tth_eq(tth, fi->tth)) {
 		g_message("TTH matches (file=\"%s\")", download_basename(d));
 
-		download_set_status(d, GTA_DL_VERIFIED);
-
 		if (
 			GNET_PROPERTY(tigertree_debug) > 1 &&
 			fi->tigertree.num_leaves > 0
@@ -15774,19 +16831,7 @@ download_verify_tigertree_done(struct download *d,
 			download_tigertree_sweep(d, leaves, num_leaves);
 		}
 
-		if (!has_good_sha1(d)) {
-			/*
-			 * FIXME:
-			 * This is far from perfect: if we come here, the SHA1 checking
-			 * was a mismatch, yet the TTH was good. We ought to flag this
-			 * bitprint (combination of SHA1 and TTH) as invalid before retrying.
-			 * But currently, what we do is move the download to the "bad" dir
-			 * and we leave it there, stopping the download.
-			 *		--RAM, 2007-08-25
-			 */
-			fi_mark_bad_bitprint(fi);
-		}
-		download_verifying_done(d);
+		download_verify_tigertree_matched(d);
 	} else {
 		download_set_status(d, GTA_DL_COMPLETED);
 
@@ -15874,6 +16919,21 @@ download_verify_tigertree(struct download *d)
 	g_return_if_fail(!(d->flags & DL_F_TRANSIENT));
 	g_assert(!(fi->flags & FI_F_VERIFYING));
 
+	/*
+	 * When all the slices were verified against the tigertree leaves as
+	 * they were written, the file matches the TTH: no need to read it again.
+	 */
+
+	if (file_info_tigertree_all_verified(fi)) {
+		g_message("TTH matches (file=\"%s\", all slices verified on the fly)",
+			download_basename(d));
+
+		fi->vrfy_elapsed = 0;
+		fi->vrfy_hashed = fi->size;
+		download_verify_tigertree_matched(d);
+		return;
+	}
+
 	if (GNET_PROPERTY(verify_debug) > 1) {
 		g_debug("will be verifying TTH of completed %s",
 			download_pathname(d));
@@ -16080,6 +17140,7 @@ download_close(void)
 	download_clear_stopped(TRUE, TRUE, TRUE, TRUE, TRUE);
 	download_remove_all();
 	download_free_removed();
+	download_writer_close();
 
 	hash_list_free(&sl_downloads);
 	hash_list_free(&sl_unqueued);
@@ -16517,15 +17578,39 @@ download_got_eof(struct download *d)
 	fi = d->file_info;
 	file_info_check(fi);
 
+	/*
+	 * If data are still being written by the I/O thread, we need to account
+	 * for them before checking whether the file is complete: we will come
+	 * back here when the write completes.
+	 */
+
+	if (d->buffers != NULL && d->buffers->write != NULL) {
+		d->buffers->got_eof = TRUE;
+		download_rx_pause(d);
+		return;
+	}
+
 	/*
 	 * If we don't know the file size, then consider EOF as an indication
 	 * we got everything.  Flush buffers in that case because we're probably
-	 * not swarming a file whose size is unknown...
+	 * not swarming a file whose size is unknown...  The data we hold must
+	 * be accounted for before we can declare the size, hence we also come
+	 * back here once they are written.
 	 */
 
-	if (!fi->file_size_known) {
-		if (d->buffers)
-			download_silent_flush(d);
+	if (!fi->file_size_known && d->buffers != NULL) {
+		struct dl_buffers *b = d->buffers;
+
+		if (GTA_DL_RECEIVING == d->status && b->held > 0) {
+			bool trimmed = download_trim_excess(d);
+
+			if (b->held > 0 && download_write_async(d, trimmed)) {
+				b->got_eof = TRUE;
+				download_rx_pause(d);
+				return;
+			}
+		}
+		download_silent_flush(d);
 	}
 
 	if (!fi->file_size_known || FILE_INFO_COMPLETE(fi)) {
@@ -591,6 +591,22 @@ dq_pmsg_by_ttl(dquery_t *dq, int ttl)
 	if (mb != NULL)
 		return mb;
 
+	t = dq->mb;					/* Our "template" */
+
+	/*
+	 * If the template already bears the requested TTL, there is nothing
+	 * to patch: share its data buffer instead of copying the payload.
+	 * We need a plain clone since the template may be an extended message
+	 * whose free routine must only be invoked once.
+	 */
+
+	if (gnutella_header_get_ttl(pmsg_start(t)) == ttl) {
+		mb = pmsg_clone_plain(t);
+		dq->by_ttl[ttl - 1] = mb;
+		gmsg_install_presend(mb);
+		return mb;
+	}
+
 	/*
 	 * Copy does not exist for this TTL.
 	 *
@@ -599,7 +615,6 @@ dq_pmsg_by_ttl(dquery_t *dq, int ttl)
 	 * is made of one data buffer only (no data block chaining yet).
 	 */
 
-	t = dq->mb;					/* Our "template" */
 	len = pmsg_size(t);
 	db = pdata_new(len);
 	memcpy(pdata_start(db), pmsg_start(t), len);
@@ -67,7 +67,6 @@
 #include "lib/atoms.h"
 #include "lib/base32.h"
 #include "lib/concat.h"
-#include "lib/eclist.h"
 #include "lib/endian.h"
 #include "lib/entropy.h"
 #include "lib/fd.h"
@@ -131,6 +130,11 @@ enum dl_file_chunk_magic { DL_FILE_CHUNK_MAGIC = 0x563b483d };
  * These are linked to form the chunklist, the list of all the chunks defined
  * for the file and which are either completed, reserved, or empty (not yet
  * downloaded).
+ *
+ * Since chunks never overlap, they are also indexed by range in the chunkmap
+ * tree, and the empty ones in the holes tree, so that looking up the chunk
+ * holding a given offset, or the next hole to download, does not require a
+ * linear scan of the whole chunklist.
  */
 struct dl_file_chunk {
 	enum dl_file_chunk_magic magic;
@@ -139,6 +143,8 @@ struct dl_file_chunk {
 	filesize_t to;					/**< Range offset end (byte EXCLUDED) */
 	const download_t *download;		/**< Download which "reserved" range */
 	slink_t lk;						/**< Embedded one-way link */
+	rbnode_t node;					/**< Embedded node in fi->chunkmap */
+	rbnode_t hnode;					/**< Embedded node in fi->holes */
 };
 
 static inline void
@@ -205,7 +211,11 @@ static hikset_t *fi_by_guid;
 
 static const char file_info_file[] = "fileinfo";
 static const char file_info_what[] = "fileinfo database";
+static const char file_info_journal_file[] = "fileinfo.journal";
 static bool fileinfo_dirty = FALSE;
+static str_t *fi_journal_buf;		/**< Journal records not yet written */
+static filesize_t fi_journal_size;	/**< Current journal size, in bytes */
+static bool fi_journal_pending;		/**< Whether some ranges are pending */
 static bool can_swarm = FALSE;		/**< Set by file_info_retrieve() */
 static bool can_publish_partial_sha1;
 
@@ -232,6 +242,7 @@ enum dl_file_info_field {
 };
 
 #define FI_STORE_DELAY		60	/**< Max delay (secs) for flushing fileinfo */
+#define FI_JOURNAL_MAX		(256 * 1024)	/**< Journal compaction threshold */
 #define FI_TRAILER_INT		6	/**< Amount of uint32 in the trailer */
 
 /**
@@ -641,6 +652,175 @@ dl_file_chunk_free(struct dl_file_chunk **fc_ptr)
 	}
 }
 
+/**
+ * Compares two offered ranges so that two ranges are equal when they overlap.
+ */
+static int
+fi_chunk_overlap_cmp(const void *a, const void *b)
+{
+	const struct dl_file_chunk *ca = a, *cb = b;
+
+	if (ca->to <= cb->from)			/* `to' is NOT part of the chunk range */
+		return -1;
+
+	if (cb->to <= ca->from)
+		return +1;
+
+	return 0;		/* Overlapping chunks are equal */
+}
+
+/**
+ * Index chunk, which has just been linked to the chunklist.
+ */
+static void
+fi_chunk_index(fileinfo_t *fi, struct dl_file_chunk *fc)
+{
+	void *old;
+
+	dl_file_chunk_check(fc);
+
+	old = erbtree_insert(&fi->chunkmap, &fc->node);
+	g_assert(NULL == old);		/* Chunks never overlap */
+
+	if (DL_CHUNK_EMPTY == fc->status) {
+		old = erbtree_insert(&fi->holes, &fc->hnode);
+		g_assert(NULL == old);
+	}
+}
+
+/**
+ * Remove chunk from the indices, prior to unlinking it from the chunklist.
+ */
+static void
+fi_chunk_unindex(fileinfo_t *fi, struct dl_file_chunk *fc)
+{
+	dl_file_chunk_check(fc);
+
+	erbtree_remove(&fi->chunkmap, &fc->node);
+
+	if (DL_CHUNK_EMPTY == fc->status)
+		erbtree_remove(&fi->holes, &fc->hnode);
+}
+
+/**
+ * Index all the chunks of a freshly loaded (and checked) chunklist.
+ */
+static void
+fi_chunkmap_build(fileinfo_t *fi)
+{
+	struct dl_file_chunk *fc;
+
+	g_assert(0 == erbtree_count(&fi->chunkmap));
+	g_assert(0 == erbtree_count(&fi->holes));
+
+	ESLIST_FOREACH_DATA(&fi->chunklist, fc) {
+		fi_chunk_index(fi, fc);
+	}
+}
+
+/**
+ * Append new chunk at the end of the chunklist.
+ */
+static void
+fi_chunk_append(fileinfo_t *fi, struct dl_file_chunk *fc)
+{
+	eslist_append(&fi->chunklist, fc);
+	fi_chunk_index(fi, fc);
+}
+
+/**
+ * Insert new chunk `nfc' right after `fc' in the chunklist.
+ *
+ * The range of `fc' must have been shrunk beforehand so that both chunks
+ * do not overlap.
+ */
+static void
+fi_chunk_insert_after(fileinfo_t *fi,
+	struct dl_file_chunk *fc, struct dl_file_chunk *nfc)
+{
+	eslist_insert_after(&fi->chunklist, fc, nfc);
+	fi_chunk_index(fi, nfc);
+}
+
+/**
+ * Remove the chunk following `fc' in the chunklist.
+ *
+ * @return the removed chunk, which the caller must free.
+ */
+static struct dl_file_chunk *
+fi_chunk_remove_after(fileinfo_t *fi, struct dl_file_chunk *fc)
+{
+	struct dl_file_chunk *nfc;
+
+	nfc = eslist_remove_after(&fi->chunklist, fc);
+	fi_chunk_unindex(fi, nfc);
+
+	return nfc;
+}
+
+/**
+ * Change the status of a chunk, keeping track of holes.
+ */
+static void
+fi_chunk_set_status(fileinfo_t *fi,
+	struct dl_file_chunk *fc, enum dl_chunk_status status)
+{
+	dl_file_chunk_check(fc);
+
+	if (DL_CHUNK_EMPTY == fc->status && DL_CHUNK_EMPTY != status) {
+		erbtree_remove(&fi->holes, &fc->hnode);
+	} else if (DL_CHUNK_EMPTY != fc->status && DL_CHUNK_EMPTY == status) {
+		void *old = erbtree_insert(&fi->holes, &fc->hnode);
+		g_assert(NULL == old);
+	}
+
+	fc->status = status;
+}
+
+/**
+ * Look up the chunk holding the byte at offset `pos'.
+ *
+ * @return the chunk, NULL if `pos' lies past the last chunk.
+ */
+static struct dl_file_chunk *
+fi_chunk_at(const fileinfo_t *fi, filesize_t pos)
+{
+	struct dl_file_chunk key;
+
+	key.from = pos;
+	key.to = pos + 1;
+
+	return erbtree_lookup(&fi->chunkmap, &key);
+}
+
+/**
+ * Look up the first hole (EMPTY chunk) holding or following offset `pos'.
+ *
+ * @return the hole, NULL if there are no holes past `pos'.
+ */
+static struct dl_file_chunk *
+fi_hole_from(const fileinfo_t *fi, filesize_t pos)
+{
+	struct dl_file_chunk key;
+
+	key.from = pos;
+	key.to = pos + 1;
+
+	return erbtree_lookup_ceil(&fi->holes, &key);
+}
+
+/**
+ * @return the hole following `fc' in the file, wrapping around to the first
+ * hole when `fc' is the last one.
+ */
+static struct dl_file_chunk *
+fi_hole_next_circular(const fileinfo_t *fi, const struct dl_file_chunk *fc)
+{
+	rbnode_t *rn = erbtree_next(&fc->hnode);
+
+	return NULL == rn ? erbtree_head(&fi->holes) : erbtree_data(&fi->holes, rn);
+}
+
 static struct dl_avail_chunk *
 dl_avail_chunk_alloc(void)
 {
@@ -897,6 +1077,10 @@ fi_tigertree_free(fileinfo_t *fi)
 
 	if (fi->tigertree.leaves) {
 		WFREE_ARRAY(fi->tigertree.leaves, fi->tigertree.num_leaves);
+		wfree(fi->tigertree.verified,
+			BIT_ARRAY_BYTE_SIZE(fi->tigertree.num_leaves));
+		fi->tigertree.verified = NULL;
+		fi->tigertree.num_verified = 0;
 		fi->tigertree.slice_size = 0;
 		fi->tigertree.num_leaves = 0;
 		fi->tigertree.leaves = NULL;
@@ -919,6 +1103,7 @@ file_info_got_tigertree(fileinfo_t *fi,
 	fi_tigertree_free(fi);
 	fi->tigertree.leaves = WCOPY_ARRAY(leaves, num_leaves);
 	fi->tigertree.num_leaves = num_leaves;
+	fi->tigertree.verified = walloc0(BIT_ARRAY_BYTE_SIZE(num_leaves));
 
 	fi->tigertree.slice_size = TTH_BLOCKSIZE;
 	num_blocks = tt_block_count(fi->size);
@@ -930,6 +1115,69 @@ file_info_got_tigertree(fileinfo_t *fi,
 		fi->dirty = TRUE;
 }
 
+/**
+ * Record that the data of the given tigertree slice were verified against
+ * the tigertree leaves as they were written to the file.
+ *
+ * This information is not persisted: after a restart, slices will only be
+ * verified again if they are fully downloaded anew.
+ */
+void
+file_info_tigertree_verified(fileinfo_t *fi, size_t slice)
+{
+	file_info_check(fi);
+	g_return_if_fail(slice < fi->tigertree.num_leaves);
+
+	if (!bit_array_get(fi->tigertree.verified, slice)) {
+		bit_array_set(fi->tigertree.verified, slice);
+		fi->tigertree.num_verified++;
+	}
+}
+
+/**
+ * Forget about the verification of all the tigertree slices overlapping
+ * the given range, whose data are being rewritten or discarded.
+ *
+ * @param fi		the fileinfo
+ * @param from		first byte of the range
+ * @param to		first byte after the range
+ */
+void
+file_info_tigertree_unverify(fileinfo_t *fi, filesize_t from, filesize_t to)
+{
+	size_t i, last;
+
+	file_info_check(fi);
+	g_assert(from <= to);
+
+	if (0 == fi->tigertree.num_verified || from == to)
+		return;
+
+	i = from / fi->tigertree.slice_size;
+	last = (to - 1) / fi->tigertree.slice_size;
+	last = MIN(last, fi->tigertree.num_leaves - 1);
+
+	for (/* empty */; i <= last; i++) {
+		if (bit_array_get(fi->tigertree.verified, i)) {
+			bit_array_clear(fi->tigertree.verified, i);
+			g_assert(fi->tigertree.num_verified != 0);
+			fi->tigertree.num_verified--;
+		}
+	}
+}
+
+/**
+ * @return whether all the tigertree slices were verified whilst downloading.
+ */
+bool
+file_info_tigertree_all_verified(const fileinfo_t *fi)
+{
+	file_info_check(fi);
+
+	return fi->tigertree.num_leaves != 0 &&
+		fi->tigertree.num_verified == fi->tigertree.num_leaves;
+}
+
 /**
  * Record that the fileinfo trailer has been stripped.
  */
@@ -1022,6 +1270,8 @@ file_info_chunklist_free(fileinfo_t *fi)
 {
 	file_info_check(fi);
 
+	erbtree_clear(&fi->chunkmap);
+	erbtree_clear(&fi->holes);
 	eslist_wfree(&fi->chunklist, sizeof(struct dl_file_chunk));
 }
 
@@ -1182,7 +1432,7 @@ fi_extend_chunklist(fileinfo_t *fi, filesize_t size)
 	fc->from = fi->size;
 	fc->to = size;
 	fc->status = DL_CHUNK_EMPTY;
-	eslist_append(&fi->chunklist, fc);
+	fi_chunk_append(fi, fc);
 
 	/*
 	 * Don't remove/re-insert `fi' from hash tables: when this routine is
@@ -1766,6 +2016,10 @@ file_info_allocate(void)
 	WALLOC0(fi);
 	fi->magic = FI_MAGIC;
 	eslist_init(&fi->chunklist, offsetof(struct dl_file_chunk, lk));
+	erbtree_init(&fi->chunkmap, fi_chunk_overlap_cmp,
+		offsetof(struct dl_file_chunk, node));
+	erbtree_init(&fi->holes, fi_chunk_overlap_cmp,
+		offsetof(struct dl_file_chunk, hnode));
 	eslist_init(&fi->available, offsetof(struct dl_avail_chunk, lk));
 
 	return fi;
@@ -2043,6 +2297,8 @@ G_STMT_START {				\
 		/* NOT REACHED */
 	}
 
+	fi_chunkmap_build(fi);
+
 	/*
 	 * Pre-v4 (32-bit) trailers lacked the created and ntime fields.
 	 * Pre-v5 (32-bit) trailers lacked the fskn (file size known) indication.
@@ -2112,6 +2368,315 @@ eof:
 #undef BAILOUT
 }
 
+/*
+ * Fileinfo journal.
+ *
+ * Instead of rewriting the whole trailer of the file and the whole fileinfo
+ * database each time some data is written, chunk updates are appended to a
+ * journal.  Each record states that a range of the file bearing a given GUID
+ * was set to a new status, so replaying the records in order over a state
+ * saved after the journal was started yields the latest state.
+ *
+ * Contiguous updates of the same file are coalesced in memory until the
+ * journal is flushed.  The journal is discarded each time the database is
+ * rewritten, which we request once it grows beyond FI_JOURNAL_MAX bytes.
+ */
+
+/**
+ * Format the pending journal range of fileinfo into the journal buffer.
+ */
+static void
+fi_journal_emit(fileinfo_t *fi)
+{
+	if (0 == fi->journal_to)
+		return;
+
+	if (NULL == fi_journal_buf)
+		fi_journal_buf = str_new(1024);
+
+	str_catf(fi_journal_buf, "%s %s %s %u\n",
+		guid_hex_str(fi->guid), filesize_to_string(fi->journal_from),
+		filesize_to_string2(fi->journal_to), (uint) fi->journal_status);
+
+	fi->journal_to = 0;
+}
+
+/**
+ * Record that the range [from, to[ of the file was given a new status.
+ */
+static void
+fi_journal_record(fileinfo_t *fi,
+	filesize_t from, filesize_t to, enum dl_chunk_status status)
+{
+	file_info_check(fi);
+	g_assert(from < to);
+	g_assert(DL_CHUNK_BUSY != status);	/* Reloaded as EMPTY anyway */
+
+	/*
+	 * Chunk updates no longer rewrite the trailer, which is where the SHA1
+	 * was periodically given back to the DHT publisher: since there is
+	 * activity on the file, do it here, at the same pace.
+	 * See file_info_store_binary() for the rationale.
+	 */
+
+	if (fi->sha1 != NULL && can_publish_partial_sha1) {
+		time_t now = tm_time();
+
+		if (delta_time(now, fi->last_publish) >= FI_STORE_DELAY) {
+			fi->last_publish = now;
+			publisher_add(fi->sha1);
+		}
+	}
+
+	if (fi->journal_to != 0 && fi->journal_status == status) {
+		if (from == fi->journal_to) {
+			fi->journal_to = to;
+			return;
+		} else if (to == fi->journal_from) {
+			fi->journal_from = from;
+			return;
+		}
+	}
+
+	fi_journal_emit(fi);
+
+	fi->journal_from = from;
+	fi->journal_to = to;
+	fi->journal_status = status;
+	fi_journal_pending = TRUE;
+}
+
+/**
+ * Hash table iterator to emit pending journal ranges.
+ */
+static void
+fi_journal_emit_kv(void *value, void *unused_udata)
+{
+	fileinfo_t *fi = value;
+
+	(void) unused_udata;
+
+	file_info_check(fi);
+	fi_journal_emit(fi);
+}
+
+/**
+ * Append pending chunk updates to the fileinfo journal.
+ */
+void
+file_info_journal_flush(void)
+{
+	char *path;
+	FILE *f;
+	size_t len;
+
+	if (fi_journal_pending) {
+		hikset_foreach(fi_by_outname, fi_journal_emit_kv, NULL);
+		fi_journal_pending = FALSE;
+	}
+
+	if (NULL == fi_journal_buf || 0 == (len = str_len(fi_journal_buf)))
+		return;
+
+	path = make_pathname(settings_config_dir(), file_info_journal_file);
+	f = file_fopen(path, "a");
+
+	/*
+	 * Should the append fail, the records are lost, and the journal may
+	 * end with a partial record: request a full rewrite of the database,
+	 * which will discard the journal.
+	 */
+
+	if (NULL == f) {
+		fileinfo_dirty = TRUE;
+	} else {
+		if (
+			len != fwrite(str_2c(fi_journal_buf), 1, len, f) ||
+			0 != fclose(f)
+		) {
+			g_warning("%s(): could not append to \"%s\": %m",
+				G_STRFUNC, path);
+			fileinfo_dirty = TRUE;
+		}
+		fi_journal_size += len;
+	}
+
+	str_reset(fi_journal_buf);
+	HFREE_NULL(path);
+
+	if (fi_journal_size > FI_JOURNAL_MAX)
+		fileinfo_dirty = TRUE;		/* Compact at next store */
+}
+
+/**
+ * Discard the journal, once the whole database has been saved.
+ */
+static void
+fi_journal_discard(void)
+{
+	char *path;
+
+	path = make_pathname(settings_config_dir(), file_info_journal_file);
+
+	if (-1 == unlink(path) && ENOENT != errno)
+		g_warning("%s(): could not remove \"%s\": %m", G_STRFUNC, path);
+
+	HFREE_NULL(path);
+	fi_journal_size = 0;
+}
+
+/**
+ * Force the status of the range [from, to[ in the chunklist.
+ */
+static void
+fi_chunks_set_range(fileinfo_t *fi,
+	filesize_t from, filesize_t to, enum dl_chunk_status status)
+{
+	struct dl_file_chunk *fc;
+	filesize_t bound[2];
+	uint i;
+
+	/*
+	 * Split the chunks holding the range boundaries so that the range is
+	 * exactly covered by a set of chunks.
+	 */
+
+	bound[0] = from;
+	bound[1] = to;
+
+	for (i = 0; i < N_ITEMS(bound); i++) {
+		fc = fi_chunk_at(fi, bound[i]);
+
+		if (fc != NULL && fc->from != bound[i]) {
+			struct dl_file_chunk *nfc;
+
+			nfc = dl_file_chunk_alloc();
+			nfc->from = bound[i];
+			nfc->to = fc->to;
+			nfc->status = fc->status;
+			nfc->download = fc->download;
+			fc->to = bound[i];
+			fi_chunk_insert_after(fi, fc, nfc);
+		}
+	}
+
+	for (
+		fc = fi_chunk_at(fi, from);
+		fc != NULL && fc->from < to;
+		fc = eslist_next_data(&fi->chunklist, fc)
+	) {
+		fi_chunk_set_status(fi, fc, status);
+		fc->download = NULL;
+	}
+
+	file_info_merge_adjacent(fi);		/* Also updates fi->done */
+}
+
+/**
+ * Replay the fileinfo journal left by a previous session, if any.
+ *
+ * This must be called once all the known fileinfo have been loaded, before
+ * any download starts.
+ */
+void
+file_info_journal_replay(void)
+{
+	char *path;
+	FILE *f;
+	char line[1024];
+	uint replayed = 0, corrupted = 0;
+
+	path = make_pathname(settings_config_dir(), file_info_journal_file);
+	f = file_fopen_missing(path, "r");
+
+	if (NULL == f)
+		goto done;
+
+	while (fgets(line, sizeof line, f)) {
+		fileinfo_t *fi;
+		struct guid guid;
+		filesize_t from, to;
+		uint64 v;
+		const char *ep;
+		int error;
+
+		fi_journal_size += strlen(line);
+
+		if (!file_line_chomp_tail(line, sizeof line, NULL)) {
+			corrupted++;		/* Truncated record */
+			continue;
+		}
+
+		if (file_line_is_skipable(line))
+			continue;
+
+		if (
+			strlen(line) <= GUID_HEX_SIZE ||
+			' ' != line[GUID_HEX_SIZE] ||
+			!hex_to_guid(line, &guid)
+		) {
+			corrupted++;
+			continue;
+		}
+
+		from = v = parse_uint64(&line[GUID_HEX_SIZE + 1], &ep, 10, &error);
+		if (error || ' ' != *ep) {
+			corrupted++;
+			continue;
+		}
+
+		to = v = parse_uint64(&ep[1], &ep, 10, &error);
+		if (error || ' ' != *ep || to <= from) {
+			corrupted++;
+			continue;
+		}
+
+		v = parse_uint64(&ep[1], &ep, 10, &error);
+		if (
+			error || '\0' != *ep ||
+			(DL_CHUNK_EMPTY != v && DL_CHUNK_DONE != v)
+		) {
+			corrupted++;
+			continue;
+		}
+
+		/*
+		 * Skip records for files we no longer know about, or which were
+		 * completed already.
+		 */
+
+		fi = file_info_by_guid(&guid);
+
+		if (
+			NULL == fi ||
+			(fi->flags & (FI_F_TRANSIENT | FI_F_SEEDING | FI_F_STRIPPED)) ||
+			0 == eslist_count(&fi->chunklist) ||
+			to > fi->size
+		)
+			continue;
+
+		fi_chunks_set_range(fi, from, to, v);
+		fi->dirty = TRUE;
+		replayed++;
+	}
+
+	fclose(f);
+
+	if (corrupted != 0) {
+		g_warning("ignored %u corrupted record%s in \"%s\"",
+			corrupted, plural(corrupted), path);
+	}
+
+	if (replayed != 0) {
+		g_message("replayed %u fileinfo journal record%s",
+			replayed, plural(replayed));
+		fileinfo_dirty = TRUE;
+	}
+
+done:
+	HFREE_NULL(path);
+}
+
 /**
  * Stores a file info record to the config_dir/fileinfo file, and
  * appends it to the output file in question if needed.
@@ -2222,6 +2787,13 @@ file_info_store(void)
 	FILE *f;
 	file_path_t fp;
 
+	/*
+	 * Make sure pending updates reach the journal first, so that it can be
+	 * relied upon should we fail to save the database.
+	 */
+
+	file_info_journal_flush();
+
 	file_path_set(&fp, settings_config_dir(), file_info_file);
 	f = file_config_open_write(file_info_what, &fp);
 
@@ -2257,7 +2829,9 @@ file_info_store(void)
 
 	hikset_foreach(fi_by_outname, file_info_store_list, f);
 
-	file_config_close(f, &fp);
+	if (file_config_close(f, &fp))
+		fi_journal_discard();
+
 	fileinfo_dirty = FALSE;
 }
 
@@ -2471,6 +3045,7 @@ file_info_close(void)
 	hikset_free_null(&fi_by_outname);
 
 	HFREE_NULL(tbuf.arena);
+	str_destroy_null(&fi_journal_buf);
 }
 
 /**
@@ -2938,7 +3513,7 @@ fi_reset_chunks(fileinfo_t *fi)
 		fc->from = 0;
 		fc->to = fi->size;
 		fc->status = DL_CHUNK_EMPTY;
-		eslist_append(&fi->chunklist, fc);
+		fi_chunk_append(fi, fc);
 	}
 
 	fi->generation = 0;		/* Restarting from scratch... */
@@ -2964,10 +3539,17 @@ fi_copy_chunks(fileinfo_t *fi, fileinfo_t *trailer)
 		fi->cha1 = atom_sha1_get(trailer->cha1);
 
 	ESLIST_FOREACH_DATA(&trailer->chunklist, fc) {
+		struct dl_file_chunk *nfc;
+
 		dl_file_chunk_check(fc);
 		g_assert(fc->from <= fc->to);
 
-		eslist_append(&fi->chunklist, WCOPY(fc));
+		nfc = dl_file_chunk_alloc();
+		nfc->from = fc->from;
+		nfc->to = fc->to;
+		nfc->status = fc->status;
+		nfc->download = fc->download;
+		fi_chunk_append(fi, nfc);
 	}
 
 	file_info_merge_adjacent(fi); /* Recalculates also fi->done */
@@ -3497,7 +4079,7 @@ file_info_retrieve(void)
 							filesize_to_string(fi->size));
 						damaged = TRUE;
 					} else {
-						eslist_append(&fi->chunklist, fc);
+						fi_chunk_append(fi, fc);
 					}
 				}
 			}
@@ -3648,7 +4230,7 @@ file_info_create(const char *file, const char *path, filesize_t size,
 		fi->size = fc->to = st.st_size;
 		fc->status = DL_CHUNK_DONE;
 		fi->modified = st.st_mtime;
-		eslist_append(&fi->chunklist, fc);
+		fi_chunk_append(fi, fc);
 		fi->dirty = TRUE;
 	}
 
@@ -4042,7 +4624,7 @@ file_info_merge_adjacent(fileinfo_t *fi)
 			void *removed;
 
 			fc1->to = fc2->to;
-			removed = eslist_remove_after(&fi->chunklist, fc1);
+			removed = fi_chunk_remove_after(fi, fc1);
 			g_assert(removed == fc2);
 			dl_file_chunk_free(&fc2);
 			fc2 = fc1;					/* new current chunk */
@@ -4113,7 +4695,7 @@ file_info_size_known(struct download *d, filesize_t size)
 			fc->to = fi->done;			/* Byte at that offset is excluded */
 			fc->status = DL_CHUNK_DONE;
 
-			eslist_append(&fi->chunklist, fc);
+			fi_chunk_append(fi, fc);
 		} else {
 			fc->to = fi->done;
 
@@ -4124,7 +4706,7 @@ file_info_size_known(struct download *d, filesize_t size)
 			while (NULL != eslist_next(&fc->lk)) {
 				struct dl_file_chunk *fcn;
 
-				fcn = eslist_remove_after(&fi->chunklist, fc);
+				fcn = fi_chunk_remove_after(fi, fc);
 				dl_file_chunk_free(&fcn);
 			}
 		}
@@ -4143,7 +4725,7 @@ file_info_size_known(struct download *d, filesize_t size)
 		fc->to = size;				/* Byte at that offset is excluded */
 		fc->status = DL_CHUNK_BUSY;
 		fc->download = d;
-		eslist_append(&fi->chunklist, fc);
+		fi_chunk_append(fi, fc);
 	}
 
 	fi->file_size_known = TRUE;
@@ -4176,7 +4758,7 @@ file_info_update(const struct download *d, filesize_t from, filesize_t to,
 	slink_t *sl;
 	fileinfo_t *fi;
 	bool found = FALSE;
-	int n, againcount = 0;
+	int againcount = 0;
 	bool need_merging;
 	const struct download *newval;
 
@@ -4199,6 +4781,7 @@ file_info_update(const struct download *d, filesize_t from, filesize_t to,
 	case DL_CHUNK_EMPTY:
 		need_merging = TRUE;
 		newval = NULL;
+		file_info_tigertree_unverify(fi, from, to);
 		goto status_ok;
 	}
 	g_assert_not_reached();
@@ -4230,6 +4813,15 @@ status_ok:
 		fi->dirty = TRUE;
 	}
 
+	/*
+	 * The change is persisted through the journal, unless the entry is
+	 * transient.  Busy chunks are never persisted, since they are reloaded
+	 * as empty chunks anyway.
+	 */
+
+	if (DL_CHUNK_BUSY != status && !(fi->flags & FI_F_TRANSIENT))
+		fi_journal_record(fi, from, to, status);
+
 again:
 
 	/* I think the algorithm is safe now, but hey... */
@@ -4247,12 +4839,19 @@ again:
 	 * because we may be writing data to an already "done" chunk, when a
 	 * previous chunk bumps into a done one.
 	 *		--RAM, 04/11/2002
+	 *
+	 * The chunkmap gives us the first chunk to consider directly, without
+	 * having to skip all the leading chunks of the list.
 	 */
 
+	fc = fi_chunk_at(fi, from);
+	prevfc = NULL == fc ? NULL :
+		erbtree_data(&fi->chunkmap, erbtree_prev(&fc->node));
+
 	for (
-		n = 0, prevfc = NULL, sl = eslist_first(&fi->chunklist);
+		sl = NULL == fc ? NULL : &fc->lk;
 		sl != NULL;
-		n++, prevfc = fc, sl = eslist_next(sl)
+		prevfc = fc, sl = eslist_next(sl)
 	) {
 		fc = eslist_data(&fi->chunklist, sl);
 
@@ -4270,7 +4869,7 @@ again:
 
 			if (DL_CHUNK_DONE == status)
 				fi->done += to - from;
-			fc->status = status;
+			fi_chunk_set_status(fi, fc, status);
 			fc->download = newval;
 			found = TRUE;
 			g_assert(file_info_check_chunklist(fi, TRUE));
@@ -4285,7 +4884,7 @@ again:
 
 			if (DL_CHUNK_DONE == status)
 				fi->done += fc->to - from;
-			fc->status = status;
+			fi_chunk_set_status(fi, fc, status);
 			fc->download = newval;
 			from = fc->to;
 			g_assert(file_info_check_chunklist(fi, TRUE));
@@ -4316,9 +4915,9 @@ again:
 				nfc->download = fc->download;
 
 				fc->to = to;
-				fc->status = status;
+				fi_chunk_set_status(fi, fc, status);
 				fc->download = newval;
-				eslist_insert_after(&fi->chunklist, fc, nfc);
+				fi_chunk_insert_after(fi, fc, nfc);
 				g_assert(file_info_check_chunklist(fi, TRUE));
 			}
 
@@ -4326,6 +4925,7 @@ again:
 			break;
 
 		} else if (fc->from < from && fc->to >= to) {
+			filesize_t end;
 
 			/*
 			 * New chunk [from, to] lies within ]fc->from, fc->to].
@@ -4337,13 +4937,15 @@ again:
 			if (DL_CHUNK_DONE == status)
 				fi->done += to - from;
 
-			if (fc->to > to) {
+			end = fc->to;
+			fc->to = from;
+
+			if (end > to) {
 				nfc = dl_file_chunk_alloc();
 				nfc->from = to;
-				nfc->to = fc->to;
+				nfc->to = end;
 				nfc->status = fc->status;
 				nfc->download = fc->download;
-				eslist_insert_after(&fi->chunklist, fc, nfc);
 
 				if (DL_CHUNK_BUSY == nfc->status) {
 					/*
@@ -4355,6 +4957,8 @@ again:
 					nfc->status = DL_CHUNK_EMPTY;
 					nfc->download = NULL;
 				}
+
+				fi_chunk_insert_after(fi, fc, nfc);
 			}
 
 			nfc = dl_file_chunk_alloc();
@@ -4362,9 +4966,7 @@ again:
 			nfc->to = to;
 			nfc->status = status;
 			nfc->download = newval;
-			eslist_insert_after(&fi->chunklist, fc, nfc);
-
-			fc->to = from;
+			fi_chunk_insert_after(fi, fc, nfc);
 
 			found = TRUE;
 			g_assert(file_info_check_chunklist(fi, TRUE));
@@ -4380,15 +4982,16 @@ again:
 			if (DL_CHUNK_DONE == status)
 				fi->done += fc->to - from;
 
+			tmp = fc->to;
+			fc->to = from;
+
 			nfc = dl_file_chunk_alloc();
 			nfc->from = from;
-			nfc->to = fc->to;
+			nfc->to = tmp;
 			nfc->status = status;
 			nfc->download = newval;
-			eslist_insert_after(&fi->chunklist, fc, nfc);
+			fi_chunk_insert_after(fi, fc, nfc);
 
-			tmp = fc->to;
-			fc->to = from;
 			from = tmp;
 			g_assert(file_info_check_chunklist(fi, TRUE));
 			goto again;
@@ -4416,18 +5019,6 @@ again:
 
 	g_assert(file_info_check_chunklist(fi, TRUE));
 
-	/*
-	 * When status is DL_CHUNK_DONE, we're coming from an "active" download,
-	 * i.e. we are writing to it, therefore we can reuse its file descriptor.
-	 */
-
-	if (fi->flags & FI_F_TRANSIENT)
-		goto done;
-
-	if (fi->dirty) {
-		file_info_store_binary(d->file_info, FALSE);
-	}
-
 done:
 	file_info_changed(fi);
 }
@@ -4465,7 +5056,7 @@ file_info_clear_download(struct download *d, bool lifecount)
 		if (fc->download == d) {
 		    fc->download = NULL;
 		    if (DL_CHUNK_BUSY == fc->status)
-				fc->status = DL_CHUNK_EMPTY;
+				fi_chunk_set_status(fi, fc, DL_CHUNK_EMPTY);
 		}
 	}
 	file_info_merge_adjacent(fi);
@@ -4520,11 +5111,15 @@ restart:
 	ESLIST_FOREACH_DATA(&fi->chunklist, fc) {
 		dl_file_chunk_check(fc);
 		g_assert(NULL == fc->download);
-		fc->status = DL_CHUNK_EMPTY;
+		fi_chunk_set_status(fi, fc, DL_CHUNK_EMPTY);
 	}
 
+	file_info_tigertree_unverify(fi, 0, fi->size);
 	file_info_merge_adjacent(fi);
 	fileinfo_dirty = TRUE;
+
+	if (fi->size != 0 && !(fi->flags & FI_F_TRANSIENT))
+		fi_journal_record(fi, 0, fi->size, DL_CHUNK_EMPTY);
 }
 
 /**
@@ -4540,11 +5135,16 @@ file_info_chunk_status(fileinfo_t *fi, filesize_t from, filesize_t to)
 	file_info_check(fi);
 	g_assert(file_info_check_chunklist(fi, TRUE));
 
-	ESLIST_FOREACH_DATA(&fi->chunklist, fc) {
-		dl_file_chunk_check(fc);
+	/*
+	 * Chunks do not overlap, so only the one holding `from' can possibly
+	 * hold the whole range.
+	 */
 
-		if (from >= fc->from && to <= fc->to)
-			return fc->status;
+	fc = fi_chunk_at(fi, from);
+
+	if (fc != NULL && to <= fc->to) {
+		dl_file_chunk_check(fc);
+		return fc->status;
 	}
 
 	/*
@@ -4572,6 +5172,7 @@ file_info_new_chunk_owner(const struct download *d,
 {
 	fileinfo_t *fi;
 	const struct download *old = NULL;
+	struct dl_file_chunk *fc;
 	const slink_t *sl;
 
 	download_check(d);
@@ -4579,42 +5180,35 @@ file_info_new_chunk_owner(const struct download *d,
 	file_info_check(fi);
 	g_assert(file_info_check_chunklist(fi, TRUE));
 
-	ESLIST_FOREACH(&fi->chunklist, sl) {
-		struct dl_file_chunk *fc = eslist_data(&fi->chunklist, sl);
+	/*
+	 * We're looking for the first busy chunk intersecting with [from, to],
+	 * which happens when one of the segment bounds lies within the chunk.
+	 * Chunks being sorted, the one holding `from' comes first.
+	 */
 
-		dl_file_chunk_check(fc);
+	fc = fi_chunk_at(fi, from);
 
-		/*
-		 * We're looking for the first busy chunk intersecting with [from, to],
-		 * which happens when one of the segment bounds lies within the chunk.
-		 */
+	if (NULL == fc || DL_CHUNK_BUSY != fc->status)
+		fc = fi_chunk_at(fi, to);
 
-		if (DL_CHUNK_BUSY != fc->status)
-			continue;
-
-		if (
-			(from >= fc->from && from < fc->to) ||
-			(to >= fc->from && to < fc->to)
-		) {
-			g_assert(fc->download != NULL);
-			download_check(fc->download);
-			g_assert(fc->download != d);
+	if (fc != NULL && DL_CHUNK_BUSY == fc->status) {
+		g_assert(fc->download != NULL);
+		download_check(fc->download);
+		g_assert(fc->download != d);
 
-			old = fc->download;
-			fc->download = d;
-			break;
-		}
+		old = fc->download;
+		fc->download = d;
 	}
 
 	if (old != NULL) {
-		for (sl = eslist_next(sl); sl != NULL; sl = eslist_next(sl)) {
-			struct dl_file_chunk *fc = eslist_data(&fi->chunklist, sl);
+		for (sl = eslist_next(&fc->lk); sl != NULL; sl = eslist_next(sl)) {
+			struct dl_file_chunk *nfc = eslist_data(&fi->chunklist, sl);
 
-			dl_file_chunk_check(fc);
+			dl_file_chunk_check(nfc);
 
-			if (DL_CHUNK_BUSY == fc->status && fc->download == old) {
-				fc->status = DL_CHUNK_EMPTY;
-				fc->download = NULL;
+			if (DL_CHUNK_BUSY == nfc->status && nfc->download == old) {
+				fi_chunk_set_status(fi, nfc, DL_CHUNK_EMPTY);
+				nfc->download = NULL;
 			}
 		}
 	}
@@ -4632,10 +5226,11 @@ file_info_pos_status(fileinfo_t *fi, filesize_t pos)
 	file_info_check(fi);
 	g_assert(file_info_check_chunklist(fi, TRUE));
 
-	ESLIST_FOREACH_DATA(&fi->chunklist, fc) {
+	fc = fi_chunk_at(fi, pos);
+
+	if (fc != NULL) {
 		dl_file_chunk_check(fc);
-		if (pos >= fc->from && pos < fc->to)
-			return fc->status;
+		return fc->status;
 	}
 
 	if (pos > fi->size) {
@@ -4710,23 +5305,6 @@ fi_busy_count(fileinfo_t *fi, const struct download *d)
 	return count;
 }
 
-/**
- * Compares two offered ranges so that two ranges are equal when they overlap.
- */
-static int
-fi_chunk_overlap_cmp(const void *a, const void *b)
-{
-	const struct dl_file_chunk *ca = a, *cb = b;
-
-	if (ca->to <= cb->from)			/* `to' is NOT part of the chunk range */
-		return -1;
-
-	if (cb->to <= ca->from)
-		return +1;
-
-	return 0;		/* Overlapping chunks are equal */
-}
-
 /**
  * Select a chunk randomly among the rarest chunks offered on the network.
  *
@@ -4746,7 +5324,6 @@ fi_chunk_overlap_cmp(const void *a, const void *b)
 static const struct dl_file_chunk *
 fi_pick_rarest_chunk(fileinfo_t *fi, const download_t *d, filesize_t size)
 {
-	rbtree_t *missing;
 	http_rangeset_t *offered;
 	const struct dl_file_chunk *fc;
 	const struct dl_file_chunk *first, *candidate = NULL;
@@ -4767,41 +5344,29 @@ fi_pick_rarest_chunk(fileinfo_t *fi, const download_t *d, filesize_t size)
 		 * See whether chunks up to ``pfsp_first_chunk'' bytes are free.
 		 */
 
-		ESLIST_FOREACH_DATA(&fi->chunklist, fc) {
-			if (fc->from >= GNET_PROPERTY(pfsp_first_chunk))
-				break;
-
-			if (DL_CHUNK_EMPTY == fc->status) {
-				if (GNET_PROPERTY(download_debug)) {
-					g_debug("%s(): less than %u bytes, using first chunk",
-						G_STRFUNC, GNET_PROPERTY(pfsp_first_chunk));
-				}
+		fc = erbtree_head(&fi->holes);
 
-				candidate = first;
-				goto done;
+		if (fc != NULL && fc->from < GNET_PROPERTY(pfsp_first_chunk)) {
+			if (GNET_PROPERTY(download_debug)) {
+				g_debug("%s(): less than %u bytes, using first chunk",
+					G_STRFUNC, GNET_PROPERTY(pfsp_first_chunk));
 			}
+
+			candidate = first;
+			goto done;
 		}
 	}
 
 	/*
-	 * The `missing' red-black tree contains the file chunks that are still
+	 * The fi->holes red-black tree contains the file chunks that are still
 	 * empty and need to be downloaded.
 	 *
 	 * The `offered' set contains the HTTP ranges offered by the source,
 	 * if any given.  If NULL, it means the source covers the whole file.
 	 */
 
-	missing = rbtree_create(fi_chunk_overlap_cmp);
 	offered = NULL == d ? NULL : d->ranges;
 
-	ESLIST_FOREACH_DATA(&fi->chunklist, fc) {
-		dl_file_chunk_check(fc);
-
-		if (DL_CHUNK_EMPTY == fc->status) {
-			rbtree_insert(missing, fc);
-		}
-	}
-
 	/*
 	 * Find the first missing chunk that is also offered, starting with the
 	 * rarest available chunk: the fi->available list is sorted by increasing
@@ -4831,7 +5396,7 @@ fi_pick_rarest_chunk(fileinfo_t *fi, const download_t *d, filesize_t size)
 		crange.from = fa->from;
 		crange.to = fa->to;
 
-		dfc = rbtree_lookup(missing, &crange);
+		dfc = erbtree_lookup(&fi->holes, &crange);
 
 		if (dfc != NULL) {
 			/* Rare range overlaps with missing range */
@@ -4943,7 +5508,7 @@ fi_pick_rarest_chunk(fileinfo_t *fi, const download_t *d, filesize_t size)
 			nfc->status = dfc->status;
 			dfc->to = start;
 
-			eslist_insert_after(&fi->chunklist, dfc, nfc);
+			fi_chunk_insert_after(fi, dfc, nfc);
 			candidate = nfc;
 
 			if (
@@ -4965,8 +5530,6 @@ fi_pick_rarest_chunk(fileinfo_t *fi, const download_t *d, filesize_t size)
 	if (NULL == candidate)
 		candidate = first;
 
-	rbtree_free_null(&missing);
-
 done:
 	if (GNET_PROPERTY(fileinfo_debug) || GNET_PROPERTY(download_debug)) {
 		g_debug("%s(): returning [%s, %s] (%u) for \"%s\"",
@@ -4992,14 +5555,12 @@ static const struct dl_file_chunk *
 fi_pick_chunk(fileinfo_t *fi)
 {
 	filesize_t offset = 0;
-	slink_t *sl;
+	struct dl_file_chunk *fc;
 
 	file_info_check(fi);
 	g_assert(file_info_check_chunklist(fi, TRUE));
 
 	if (GNET_PROPERTY(pfsp_first_chunk) > 0) {
-		const struct dl_file_chunk *fc;
-
 		/*
 		 * Check whether first chunk is at least "pfsp_first_chunk" bytes
 		 * long.  If not, return that first chunk.
@@ -5016,7 +5577,6 @@ fi_pick_chunk(fileinfo_t *fi)
 	}
 
 	if (GNET_PROPERTY(pfsp_last_chunk) > 0) {
-		const struct dl_file_chunk *fc;
 		filesize_t last_chunk_offset;
 
 		/*
@@ -5029,15 +5589,16 @@ fi_pick_chunk(fileinfo_t *fi)
 			? fi->size - GNET_PROPERTY(pfsp_last_chunk)
 			: 0;
 
-		ESLIST_FOREACH_DATA(&fi->chunklist, fc) {
+		for (
+			fc = fi_chunk_at(fi, last_chunk_offset);
+			fc != NULL;
+			fc = eslist_next_data(&fi->chunklist, fc)
+		) {
 			dl_file_chunk_check(fc);
 
 			if (DL_CHUNK_DONE == fc->status)
 				continue;
 
-			if (fc->from < last_chunk_offset && fc->to <= last_chunk_offset)
-				continue;
-
 			offset = fc->from < last_chunk_offset
 				? last_chunk_offset
 				: fc->from;
@@ -5056,41 +5617,27 @@ fi_pick_chunk(fileinfo_t *fi)
 	}
 
 	/*
-	 * Pick the first chunk whose start is after the offset.
+	 * Pick the first chunk whose start is after the offset, starting with
+	 * the chunk holding the offset.
 	 */
 
-	ESLIST_FOREACH(&fi->chunklist, sl) {
-		const struct dl_file_chunk *fc = eslist_data(&fi->chunklist, sl);
+	fc = fi_chunk_at(fi, offset);
 
+	if (fc != NULL) {
 		dl_file_chunk_check(fc);
 
 		if (fc->from >= offset)
 			return fc;
 
 		/*
-		 * If offset lies within a free chunk, it will get split below.
-		 * So exit without selecting anything yet.
+		 * If we have not picked anything, it means we have encountered a big
+		 * chunk and the selected offset lies within that chunk.  Be smarter
+		 * and break-up that chunk into two at the selected offset if free.
 		 */
 
-		if (DL_CHUNK_EMPTY == fc->status && fc->to - 1 > offset)
-			break;
-	}
-
-	/*
-	 * If we have not picked anything, it means we have encountered a big chunk
-	 * and the selected offset lies within that chunk.
-	 * Be smarter and break-up any free chunk into two at the selected offset.
-	 */
-
-	ESLIST_FOREACH(&fi->chunklist, sl) {
-		struct dl_file_chunk *fc = eslist_data(&fi->chunklist, sl);
-
-		dl_file_chunk_check(fc);
-
 		if (DL_CHUNK_EMPTY == fc->status && fc->to - 1 > offset) {
 			struct dl_file_chunk *nfc;
 
-			g_assert(fc->from < offset);	/* Or we'd have cloned above */
 			g_assert(fc->download == NULL);	/* Chunk is empty */
 
 			/*
@@ -5104,9 +5651,13 @@ fi_pick_chunk(fileinfo_t *fi)
 			nfc->status = DL_CHUNK_EMPTY;
 			fc->to = nfc->from;
 
-			eslist_insert_after(&fi->chunklist, fc, nfc);
+			fi_chunk_insert_after(fi, fc, nfc);
 			return nfc;
 		}
+
+		fc = eslist_next_data(&fi->chunklist, fc);
+		if (fc != NULL)
+			return fc;
 	}
 
 	g_assert(file_info_check_chunklist(fi, TRUE));
@@ -5182,7 +5733,7 @@ fi_missing_coverage(const struct download *d)
 	fileinfo_t *fi;
 	filesize_t missing_size = 0;
 	filesize_t covered_size = 0;
-	const struct dl_file_chunk *fc;
+	rbnode_t *rn;
 
 	download_check(d);
 	fi = d->file_info;
@@ -5206,11 +5757,11 @@ fi_missing_coverage(const struct download *d)
 		return available ? (available * 1.0) / (fi->size * 1.0) : 1.0;
 	}
 
-	ESLIST_FOREACH_DATA(&fi->chunklist, fc) {
+	ERBTREE_FOREACH(&fi->holes, rn) {
+		const struct dl_file_chunk *fc = erbtree_data(&fi->holes, rn);
 		const http_range_t *r;
 
-		if (DL_CHUNK_EMPTY != fc->status)
-			continue;
+		g_assert(DL_CHUNK_EMPTY == fc->status);
 
 		missing_size += fc->to - fc->from;
 
@@ -5553,13 +6104,12 @@ file_info_reserve(const struct download *d,
 enum dl_chunk_status
 file_info_find_hole(const struct download *d, filesize_t *from, filesize_t *to)
 {
-	slink_t *sl;
 	fileinfo_t *fi = d->file_info;
 	filesize_t chunksize;
 	unsigned busy = 0;
 	unsigned pipelined = 0;
 	int reserved;
-	eclist_t cklist;
+	const struct dl_file_chunk *fc, *hole;
 	const struct dl_file_chunk *chunk = NULL;
 
 	file_info_check(fi);
@@ -5654,33 +6204,39 @@ file_info_find_hole(const struct download *d, filesize_t *from, filesize_t *to)
 	}
 
 	/*
-	 * Iteration is done using a "circular" list illusion, to be able to
-	 * nicely iterate even if we don't start from the head.
+	 * Pick the first hole starting from the selected chunk, wrapping around
+	 * to the beginning of the file as if the chunklist were circular.
 	 */
 
-	eclist_init(&cklist, &fi->chunklist, chunk);
+	hole = fi_hole_from(fi, NULL == chunk ? 0 : chunk->from);
+	if (NULL == hole)
+		hole = erbtree_head(&fi->holes);
+
 	chunk = NULL;		/* Will be set if we pick a chunk aggressively */
 
-	ECLIST_FOREACH(&cklist, sl) {
-		const struct dl_file_chunk *fc = eclist_data(&cklist, sl);
+	if (hole != NULL) {
+		dl_file_chunk_check(hole);
 
+		*from = hole->from;
+		*to = hole->to;
+		if ((hole->to - hole->from) > chunksize)
+			*to = hole->from + chunksize;
+		goto selected;
+	}
+
+	/*
+	 * No hole left, account for the pipelined requests of other sources.
+	 */
+
+	ESLIST_FOREACH_DATA(&fi->chunklist, fc) {
 		dl_file_chunk_check(fc);
 
-		if (DL_CHUNK_EMPTY != fc->status) {
-			if (DL_CHUNK_BUSY == fc->status) {
-				g_assert(fc->download != NULL);
-				download_check(fc->download);
-				if (fc->download != d && download_pipelining(fc->download))
-					pipelined++;
-			}
-			continue;
+		if (DL_CHUNK_BUSY == fc->status) {
+			g_assert(fc->download != NULL);
+			download_check(fc->download);
+			if (fc->download != d && download_pipelining(fc->download))
+				pipelined++;
 		}
-
-		*from = fc->from;
-		*to = fc->to;
-		if ((fc->to - fc->from) > chunksize)
-			*to = fc->from + chunksize;
-		goto selected;
 	}
 
 	busy -= pipelined;
@@ -5722,12 +6278,11 @@ file_info_find_available_hole(
 	const struct download *d, http_rangeset_t *ranges,
 	filesize_t *from, filesize_t *to)
 {
-	slink_t *sl;
 	fileinfo_t *fi;
 	filesize_t chunksize = 0;
-	eclist_t cklist;
 	uint busy = 0;
 	uint pipelined = 0;
+	const struct dl_file_chunk *fc, *first;
 	const struct dl_file_chunk *chunk = NULL;
 
 	download_check(d);
@@ -5770,27 +6325,20 @@ file_info_find_available_hole(
 	}
 
 	/*
-	 * Iteration is done using a "circular" list illusion, to be able to
-	 * nicely iterate even if we don't start from the head.
+	 * Iterate over the holes starting from the selected chunk, wrapping
+	 * around to the beginning of the file as if the chunklist were circular.
 	 */
 
-	eclist_init(&cklist, &fi->chunklist, chunk);
+	first = fi_hole_from(fi, NULL == chunk ? 0 : chunk->from);
+	if (NULL == first)
+		first = erbtree_head(&fi->holes);
+
 	chunk = NULL;		/* Will be set if we pick a chunk aggressively */
 
-	ECLIST_FOREACH(&cklist, sl) {
-		const struct dl_file_chunk *fc = eclist_data(&cklist, sl);
+	for (fc = first; fc != NULL; /* empty */) {
 		const http_range_t *r;
 
-		if (DL_CHUNK_EMPTY != fc->status) {
-			if (DL_CHUNK_BUSY == fc->status) {
-				busy++;		/* Will be used by aggresive code below */
-				g_assert(fc->download != NULL);
-				download_check(fc->download);
-				if (download_pipelining(fc->download))
-					pipelined++;
-			}
-			continue;
-		}
+		dl_file_chunk_check(fc);
 
 		/*
 		 * Look whether this empty chunk intersects with one of the
@@ -5819,6 +6367,24 @@ file_info_find_available_hole(
 			*to = end;
 			goto found;
 		}
+
+		fc = fi_hole_next_circular(fi, fc);
+		if (fc == first)
+			break;
+	}
+
+	/*
+	 * Nothing suitable, count the busy chunks for the aggressive code below.
+	 */
+
+	ESLIST_FOREACH_DATA(&fi->chunklist, fc) {
+		if (DL_CHUNK_BUSY == fc->status) {
+			busy++;
+			g_assert(fc->download != NULL);
+			download_check(fc->download);
+			if (download_pipelining(fc->download))
+				pipelined++;
+		}
 	}
 
 	busy -= pipelined;
@@ -7052,28 +7618,23 @@ file_info_restrict_range(fileinfo_t *fi, filesize_t start, filesize_t *end)
 	file_info_check(fi);
 	g_assert(file_info_check_chunklist(fi, TRUE));
 
-	ESLIST_FOREACH_DATA(&fi->chunklist, fc) {
-		dl_file_chunk_check(fc);
-
-		if (DL_CHUNK_DONE != fc->status)
-			continue;
+	fc = fi_chunk_at(fi, start);
 
-		if (start < fc->from || start >= fc->to)
-			continue;		/* `start' is not in the range */
+	if (NULL == fc || DL_CHUNK_DONE != fc->status)
+		return FALSE;	/* Sorry, cannot satisfy this request */
 
-		/*
-		 * We found an available chunk within which `start' falls.
-		 * Look whether we can serve their whole request, otherwise
-		 * shrink the end.
-		 */
+	dl_file_chunk_check(fc);
 
-		if (*end >= fc->to)
-			*end = fc->to - 1;
+	/*
+	 * We found an available chunk within which `start' falls.
+	 * Look whether we can serve their whole request, otherwise
+	 * shrink the end.
+	 */
 
-		return TRUE;
-	}
+	if (*end >= fc->to)
+		*end = fc->to - 1;
 
-	return FALSE;	/* Sorry, cannot satisfy this request */
+	return TRUE;
 }
 
 /**
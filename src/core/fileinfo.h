@@ -58,6 +58,8 @@ void file_info_retrieve(void);
 void file_info_store(void);
 void file_info_store_binary(fileinfo_t *fi, bool force);
 void file_info_store_if_dirty(void);
+void file_info_journal_flush(void);
+void file_info_journal_replay(void);
 void file_info_set_discard(fileinfo_t *fi, bool state);
 enum dl_chunk_status file_info_find_hole(
 	const struct download *d, filesize_t *from, filesize_t *to);
@@ -78,6 +80,10 @@ bool file_info_got_sha1(fileinfo_t *fi, const struct sha1 *sha1);
 void file_info_got_tth(fileinfo_t *fi, const struct tth *tth);
 void file_info_got_tigertree(fileinfo_t *fi,
 		const struct tth *leaves, size_t num_leaves, bool mark_dirty);
+void file_info_tigertree_verified(fileinfo_t *fi, size_t slice);
+void file_info_tigertree_unverify(fileinfo_t *fi,
+		filesize_t from, filesize_t to);
+bool file_info_tigertree_all_verified(const fileinfo_t *fi);
 void file_info_size_known(struct download *d, filesize_t size);
 void file_info_size_unknown(fileinfo_t *fi);
 void file_info_update(const struct download *d, filesize_t from, filesize_t to,
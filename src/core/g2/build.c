@@ -67,6 +67,7 @@
 #include "lib/pslist.h"
 #include "lib/sha1.h"
 #include "lib/stacktrace.h"
+#include "lib/str.h"
 #include "lib/stringify.h"
 #include "lib/walloc.h"
 
@@ -74,6 +75,7 @@
 
 #define G2_BUILD_QH2_THRESH		8192	/**< Flush /QH2 larger than this */
 #define G2_BUILD_QH2_MAX_ALT	16		/**< Max amount of alt-locs we send */
+#define G2_BUILD_QH2_SLACK		1024	/**< Extra room for last hit in /QH2 */
 
 enum g2_qht_type {
 	G2_QHT_RESET = 0,
@@ -162,21 +164,6 @@ g2_build_pmsg(const g2_tree_t *t)
 	return g2_build_pmsg_prio(t, PMSG_P_DATA, NULL, NULL);
 }
 
-/**
- * Create new message holding serialized tree, with associated free routine.
- *
- * @param t			the tree to serialize
- * @param freecb	the freeing callback to invoke
- * @param arg		additional argument for the freeing callback
- *
- * @return a message containing the serialized tree.
- */
-static inline pmsg_t *
-g2_build_pmsg_extended(const g2_tree_t *t, pmsg_free_t freecb, void *arg)
-{
-	return g2_build_pmsg_prio(t, PMSG_P_DATA, freecb, arg);
-}
-
 /**
  * Create a pong message, once.
  */
@@ -754,12 +741,13 @@ struct g2_qh2_builder {
 	const gnutella_node_t *hub;	/**< The hub that gave us the query */
 	const gnutella_node_t *n;	/**< The node to which results are sent */
 	hset_t *hs;					/**< Records SHA1 atoms we sent */
-	g2_tree_t *t;				/**< Current message */
+	g2_frame_writer_t w;		/**< Current message, being serialized */
+	void *common;				/**< Serialized common children of /QH2 */
+	size_t common_len;			/**< Length of the common children */
 	g2_build_qh2_cb_t cb;		/**< (optional) Processing callback */
 	void *arg;					/**< Processing callback argument */
 	size_t max_size;			/**< Max query hit size we want */
-	size_t common_size;			/**< Serialized size with common fields only */
-	size_t current_size;		/**< Estimated current size */
+	size_t current_size;		/**< Current serialized size */
 	int messages;				/**< Counts flushed messages, for logging */
 	uint flags;					/**< Flags for optional entries in hit */
 	uint from_gtkg:1;			/**< Whether query comes from GTKG */
@@ -778,15 +766,17 @@ g2_build_qh2_flush(struct g2_qh2_builder *ctx)
 	pmsg_t *mb;
 
 	g_assert(ctx != NULL);
-	g_assert(ctx->t != NULL);
+	g_assert(g2_frame_writer_active(&ctx->w));
 	g_assert((ctx->n != NULL) ^ (ctx->cb != NULL));
 
 	/*
-	 * Restore the order of children in the root packet to be the order we
-	 * used when we added the nodes, since we prepend new children.
+	 * The payload of the /QH2 message is one byte hop count + the MUID.
+	 * It comes after all the children, and closes the root packet.
 	 */
 
-	g2_tree_reverse_children(ctx->t);
+	g2_frame_writer_payload(&ctx->w, &ctx->payload[0], sizeof ctx->payload);
+	g2_frame_writer_close(&ctx->w);
+	mb = g2_frame_writer_pmsg(&ctx->w, PMSG_P_DATA);
 
 	/*
 	 * If sending over UDP, ask for reliable delivery of the query hit.
@@ -796,24 +786,31 @@ g2_build_qh2_flush(struct g2_qh2_builder *ctx)
 
 	if (ctx->to_udp) {
 		struct g2_qh2_pmsg_info *pmi;
+		pmsg_t *emb;
 
 		WALLOC0(pmi);
 		pmi->magic = G2_QH2_PMI_MAGIC;
 		pmi->hub_id = nid_ref(NODE_ID(ctx->hub));
-		mb = g2_build_pmsg_extended(ctx->t, g2_qh2_pmsg_free, pmi);
+		emb = pmsg_clone_extend(mb, g2_qh2_pmsg_free, pmi);
+		pmsg_free(mb);
+		mb = emb;
 		pmsg_mark_reliable(mb);
-	} else {
-		mb = g2_build_pmsg(ctx->t);
 	}
 
 	if (GNET_PROPERTY(g2_debug) > 3) {
+		g2_tree_t *t;
+
 		g_debug("%s(): flushing the following hit for "
 			"Q2 #%s to %s%s (%d bytes):",
 			G_STRFUNC, guid_hex_str(ctx->muid),
 			NULL == ctx->n ?
 				stacktrace_function_name(ctx->cb) : node_infostr(ctx->n),
 			NULL == ctx->n ? "()" : "", pmsg_size(mb));
-		g2_tfmt_tree_dump(ctx->t, stderr, G2FMT_O_PAYLOAD | G2FMT_O_PAYLEN);
+
+		t = g2_frame_deserialize(pmsg_start(mb), pmsg_size(mb), NULL, FALSE);
+		if (t != NULL)
+			g2_tfmt_tree_dump(t, stderr, G2FMT_O_PAYLOAD | G2FMT_O_PAYLEN);
+		g2_tree_free_null(&t);
 	}
 
 	if (ctx->n != NULL)
@@ -823,33 +820,37 @@ g2_build_qh2_flush(struct g2_qh2_builder *ctx)
 
 	ctx->messages++;
 	ctx->current_size = 0;
-	g2_tree_free_null(&ctx->t);
 }
 
 /**
- * Create new /QH2 and fill it with fields that do not depend on the hits
- * themselves, i.e. all the common fields we have to send in every /QH2 anyway.
+ * Serialize the fields that do not depend on the hits themselves, i.e. all
+ * the common fields we have to send in every /QH2 anyway.
+ *
+ * This is done once per query hit series, and the serialized children are
+ * then copied at the start of each /QH2.
  */
 static void
-g2_build_qh2_start(struct g2_qh2_builder *ctx)
+g2_build_qh2_common(struct g2_qh2_builder *ctx)
 {
-	g_assert(NULL == ctx->t);
+	g2_tree_t *t;
+	g2_frame_view_t v;
+	size_t len;
+	void *buf;
+	bool ok;
 
-	/*
-	 * The payload of the /QH2 message is one byte hop count + the MUID.
-	 */
+	g_assert(NULL == ctx->common);
 
-	ctx->t = g2_tree_alloc(G2_NAME(QH2), &ctx->payload[0], sizeof ctx->payload);
+	t = g2_tree_alloc_empty(G2_NAME(QH2));
 
-	g2_build_add_node_address(ctx->t);	/* NA -- the IP:port of this node */
-	g2_build_add_guid(ctx->t);			/* GU -- the GUID of this node */
-	g2_build_add_vendor(ctx->t);		/* V  -- vendor code */
-	g2_build_add_firewalled(ctx->t);	/* FW -- when servent is firewalled */
-	g2_build_add_browsable(ctx->t);		/* BH -- when browsing is allowed */
-	g2_build_add_tls(ctx->t);			/* TLS -- whether TLS is supported */
-	g2_build_add_uptime(ctx->t);		/* UP -- servent uptime */
-	g2_build_add_neighbours(ctx->t);	/* NH -- neighbouring hubs, if FW */
-	g2_build_add_hostname(ctx->t);		/* HN -- DNS hostname, if defined */
+	g2_build_add_node_address(t);	/* NA -- the IP:port of this node */
+	g2_build_add_guid(t);			/* GU -- the GUID of this node */
+	g2_build_add_vendor(t);			/* V  -- vendor code */
+	g2_build_add_firewalled(t);		/* FW -- when servent is firewalled */
+	g2_build_add_browsable(t);		/* BH -- when browsing is allowed */
+	g2_build_add_tls(t);			/* TLS -- whether TLS is supported */
+	g2_build_add_uptime(t);			/* UP -- servent uptime */
+	g2_build_add_neighbours(t);		/* NH -- neighbouring hubs, if FW */
+	g2_build_add_hostname(t);		/* HN -- DNS hostname, if defined */
 
 	/*
 	 * If the query comes from a GTKG node (not 100% safe, there can be some
@@ -858,16 +859,43 @@ g2_build_qh2_start(struct g2_qh2_builder *ctx)
 	 */
 
 	if (ctx->from_gtkg)
-		g2_build_add_gtkgv(ctx->t);		/* gtkgV -- GTKG version info */
+		g2_build_add_gtkgv(t);		/* gtkgV -- GTKG version info */
 
 	/*
-	 * Compute size we have so far, once per query hit series.
+	 * Restore the order of children in the root packet to be the order we
+	 * used when we added the nodes, since we prepend new children.
 	 */
 
-	if G_UNLIKELY(0 == ctx->common_size)
-		ctx->common_size = g2_frame_serialize(ctx->t, NULL, 0);
+	g2_tree_reverse_children(t);
+
+	len = g2_frame_serialize(t, NULL, 0);
+	buf = halloc(len);
+	g2_frame_serialize(t, buf, len);
+	g2_tree_free_null(&t);
+
+	ok = g2_frame_view(&v, buf, len, NULL);
+	g_assert(ok);
+	g_assert(v.child != NULL);
+
+	ctx->common_len = ptr_diff(v.child_end, v.child);
+	ctx->common = hcopy(v.child, ctx->common_len);
+	hfree(buf);
+}
+
+/**
+ * Create new /QH2 and fill it with the common fields.
+ */
+static void
+g2_build_qh2_start(struct g2_qh2_builder *ctx)
+{
+	g_assert(!g2_frame_writer_active(&ctx->w));
+
+	if G_UNLIKELY(NULL == ctx->common)
+		g2_build_qh2_common(ctx);
 
-	ctx->current_size = ctx->common_size;
+	g2_frame_writer_init(&ctx->w, ctx->max_size + G2_BUILD_QH2_SLACK);
+	g2_frame_writer_open(&ctx->w, G2_NAME(QH2));
+	g2_frame_writer_children(&ctx->w, ctx->common, ctx->common_len);
 }
 
 /**
@@ -878,8 +906,8 @@ g2_build_qh2_start(struct g2_qh2_builder *ctx)
 static bool
 g2_build_qh2_add(struct g2_qh2_builder *ctx, const shared_file_t *sf)
 {
+	g2_frame_writer_t *w = &ctx->w;
 	const sha1_t *sha1;
-	g2_tree_t *h, *c;
 
 	shared_file_check(sf);
 
@@ -917,71 +945,115 @@ g2_build_qh2_add(struct g2_qh2_builder *ctx, const shared_file_t *sf)
 	}
 
 	/*
-	 * Create the "H" child and attach it to the current tree.
+	 * Open the "H" child in the current message.
+	 *
+	 * Its children are serialized in the order hits have always been
+	 * laid out on the wire, which is the reverse of their logical order:
+	 * the "URN" child comes last.
 	 */
 
-	if (NULL == ctx->t)
+	if (!g2_frame_writer_active(w))
 		g2_build_qh2_start(ctx);
 
-	h = g2_tree_alloc_empty("H");
-	g2_tree_add_child(ctx->t, h);
+	g2_frame_writer_open(w, "H");
 
 	/*
-	 * URN -- Universal Resource Name
+	 * GTKG extension: if they requested alt-locs in the /Q2/I with "A", then
+	 * send them some known alt-locs in an "ALT" child.
 	 *
-	 * If there is a known TTH, then we can generate a bitprint, otherwise
-	 * we just convey the SHA1.
+	 * Note that these alt-locs can be for Gnutella hosts: since both Gnutella
+	 * and G2 share a common HTTP-based file transfer mechanism with compatible
+	 * extra headers, there is no need to handle them separately.
 	 */
 
-	{
-		const tth_t * const tth = shared_file_tth(sf);
-		char payload[SHA1_RAW_SIZE + TTH_RAW_SIZE + sizeof G2_URN_BITPRINT];
+	if (ctx->flags & QHIT_F_G2_ALT) {
+		gnet_host_t hvec[G2_BUILD_QH2_MAX_ALT];
+		char payload[6 * G2_BUILD_QH2_MAX_ALT];
+		int hcnt, i;
 		char *p = payload;
 
-		if (NULL == tth) {
-			p = mempcpy(p, G2_URN_SHA1, sizeof G2_URN_SHA1);
-			p += clamp_memcpy(p, sizeof payload - ptr_diff(p, payload),
-				sha1, SHA1_RAW_SIZE);
-		} else {
-			p = mempcpy(p, G2_URN_BITPRINT, sizeof G2_URN_BITPRINT);
-			p += clamp_memcpy(p, sizeof payload - ptr_diff(p, payload),
-				sha1, SHA1_RAW_SIZE);
-			p += clamp_memcpy(p, sizeof payload - ptr_diff(p, payload),
-				tth, TTH_RAW_SIZE);
+		hcnt = dmesh_fill_alternate(sha1, hvec, N_ITEMS(hvec));
+
+		for (i = 0; i < hcnt; i++) {
+			host_addr_t addr;
+			uint16 port;
+
+			addr = gnet_host_get_addr(&hvec[i]);
+			port = gnet_host_get_port(&hvec[i]);
+
+			if (host_addr_is_ipv4(addr))
+				p = host_ip_port_poke(p, addr, port, NULL);
 		}
 
-		g_assert(ptr_diff(p, payload) <= sizeof payload);
+		/*
+		 * If the payload is empty, then we do not emit any "ALT" child.
+		 */
 
-		c = g2_tree_alloc_copy("URN", payload, ptr_diff(p, payload));
-		g2_tree_add_child(h, c);
+		if (p != payload)
+			g2_frame_writer_add(w, "ALT", payload, ptr_diff(p, payload));
 	}
 
 	/*
-	 * URL -- empty to indicate that we share the file via uri-res.
+	 * DN -- distinguished name.
+	 *
+	 * Note that the presence of DN also governs the presence of SZ if the
+	 * file length does not fit a 32-bit unsigned quantity.
 	 */
 
+	if (ctx->flags & QHIT_F_G2_DN) {
+		char payload[8];		/* If we have to encode file size as 64-bit */
+		uint32 fs32;
+		filesize_t fs = shared_file_size(sf);
+		const char *rp;
+
+		g2_frame_writer_open(w, "DN");
+
+		/*
+		 * GTKG extension: if there is a file path, expose it as a "P" child
+		 * under the DN node.
+		 */
+
+		rp = shared_file_relative_path(sf);
+		if (rp != NULL)
+			g2_frame_writer_add(w, "P", rp, strlen(rp));
+
+		fs32 = fs;
+		if (fs32 == fs) {
+			/* Fits within a 32-bit quantity */
+			poke_le32(payload, fs32);
+			g2_frame_writer_payload(w, payload, sizeof fs32);
+		}
+
+		g2_frame_writer_payload(w,
+			shared_file_name_nfc(sf), shared_file_name_nfc_len(sf));
+		g2_frame_writer_close(w);
+
+		if (fs32 != fs) {
+			/* Does not fit a 32-bit quantity, emit a SZ child */
+			poke_le64(payload, fs);
+			g2_frame_writer_add(w, "SZ", payload, sizeof payload);
+		}
+	}
+
 	if (ctx->flags & QHIT_F_G2_URL) {
 		uint known;
 		uint16 csc;
 
-		c = g2_tree_alloc_empty("URL");
-		g2_tree_add_child(h, c);
-
 		/*
-		 * CSC -- if we know alternate sources, indicate how many in "CSC".
-		 *
-		 * This child is only emitted when they requested "URL".
+		 * CT -- creation time of the resource (GTKG extension).
 		 */
 
-		known = dmesh_count(sha1);
-		csc = MIN(known, MAX_INT_VAL(uint16));
+		{
+			time_t create_time = shared_file_creation_time(sf);
 
-		if (csc != 0) {
-			char payload[2];
+			if ((time_t) -1 != create_time) {
+				char payload[8];
+				int n;
 
-			poke_le16(payload, csc);
-			c = g2_tree_alloc_copy("CSC", payload, sizeof payload);
-			g2_tree_add_child(h, c);
+				create_time = MAX(0, create_time);
+				n = vlint_encode(create_time, payload);
+				g2_frame_writer_add(w, "CT", payload, n);	/* No trailing 0s */
+			}
 		}
 
 		/*
@@ -996,147 +1068,92 @@ g2_build_qh2_add(struct g2_qh2_builder *ctx, const shared_file_t *sf)
 			uint32 av32;
 			time_t mtime = shared_file_modification_time(sf);
 
-			c = g2_tree_alloc_empty("PART");
-			g2_tree_add_child(h, c);
+			g2_frame_writer_open(w, "PART");
+
+			/*
+			 * GTKG extension: encode the last modification time of the
+			 * partial file in an "MT" child.  This lets the other party
+			 * determine whether the host is still able to actively complete
+			 * the file.
+			 */
+
+			poke_le32(payload, (uint32) mtime);
+			g2_frame_writer_add(w, "MT", payload, sizeof(uint32));
 
 			av32 = available;
 			if (av32 == available) {
 				/* Fits within a 32-bit quantity */
 				poke_le32(payload, av32);
-				g2_tree_set_payload(c, payload, sizeof av32, TRUE);
+				g2_frame_writer_payload(w, payload, sizeof av32);
 			} else {
 				/* Encode as a 64-bit quantity then */
 				poke_le64(payload, available);
-				g2_tree_set_payload(c, payload, sizeof payload, TRUE);
+				g2_frame_writer_payload(w, payload, sizeof payload);
 			}
 
-			/*
-			 * GTKG extension: encode the last modification time of the
-			 * partial file in an "MT" child.  This lets the other party
-			 * determine whether the host is still able to actively complete
-			 * the file.
-			 */
-
-			poke_le32(payload, (uint32) mtime);
-			g2_tree_add_child(c,
-				g2_tree_alloc_copy("MT", payload, sizeof(uint32)));
+			g2_frame_writer_close(w);
 		}
 
 		/*
-		 * CT -- creation time of the resource (GTKG extension).
+		 * CSC -- if we know alternate sources, indicate how many in "CSC".
+		 *
+		 * This child is only emitted when they requested "URL".
 		 */
 
-		{
-			time_t create_time = shared_file_creation_time(sf);
-
-			if ((time_t) -1 != create_time) {
-				char payload[8];
-				int n;
-
-				create_time = MAX(0, create_time);
-				n = vlint_encode(create_time, payload);
-				g2_tree_add_child(h,
-					g2_tree_alloc_copy("CT", payload, n));	/* No trailing 0s */
-			}
-		}
-	}
-
-	/*
-	 * DN -- distinguished name.
-	 *
-	 * Note that the presence of DN also governs the presence of SZ if the
-	 * file length does not fit a 32-bit unsigned quantity.
-	 */
-
-	if (ctx->flags & QHIT_F_G2_DN) {
-		char payload[8];		/* If we have to encode file size as 64-bit */
-		uint32 fs32;
-		filesize_t fs = shared_file_size(sf);
-		const char *name;
-		const char *rp;
+		known = dmesh_count(sha1);
+		csc = MIN(known, MAX_INT_VAL(uint16));
 
-		c = g2_tree_alloc_empty("DN");
+		if (csc != 0) {
+			char payload[2];
 
-		fs32 = fs;
-		if (fs32 == fs) {
-			/* Fits within a 32-bit quantity */
-			poke_le32(payload, fs32);
-			g2_tree_set_payload(c, payload, sizeof fs32, TRUE);
-		} else {
-			/* Does not fit a 32-bit quantity, emit a SZ child */
-			poke_le64(payload, fs);
-			g2_tree_add_child(h,
-				g2_tree_alloc_copy("SZ", payload, sizeof payload));
+			poke_le16(payload, csc);
+			g2_frame_writer_add(w, "CSC", payload, sizeof payload);
 		}
 
-		name = shared_file_name_nfc(sf);
-		g2_tree_append_payload(c, name, shared_file_name_nfc_len(sf));
-		g2_tree_add_child(h, c);
-
 		/*
-		 * GTKG extension: if there is a file path, expose it as a "P" child
-		 * under the DN node.
+		 * URL -- empty to indicate that we share the file via uri-res.
 		 */
 
-		rp = shared_file_relative_path(sf);
-		if (rp != NULL) {
-			g2_tree_add_child(c, g2_tree_alloc_copy("P", rp, strlen(rp)));
-		}
+		g2_frame_writer_add(w, "URL", NULL, 0);
 	}
 
 	/*
-	 * GTKG extension: if they requested alt-locs in the /Q2/I with "A", then
-	 * send them some known alt-locs in an "ALT" child.
+	 * URN -- Universal Resource Name
 	 *
-	 * Note that these alt-locs can be for Gnutella hosts: since both Gnutella
-	 * and G2 share a common HTTP-based file transfer mechanism with compatible
-	 * extra headers, there is no need to handle them separately.
+	 * If there is a known TTH, then we can generate a bitprint, otherwise
+	 * we just convey the SHA1.
 	 */
 
-	if (ctx->flags & QHIT_F_G2_ALT) {
-		gnet_host_t hvec[G2_BUILD_QH2_MAX_ALT];
-		int hcnt = 0;
-
-		hcnt = dmesh_fill_alternate(sha1, hvec, N_ITEMS(hvec));
-
-		if (hcnt > 0) {
-			int i;
-
-			c = g2_tree_alloc_empty("ALT");
-
-			for (i = 0; i < hcnt; i++) {
-				host_addr_t addr;
-				uint16 port;
-
-				addr = gnet_host_get_addr(&hvec[i]);
-				port = gnet_host_get_port(&hvec[i]);
-
-				if (host_addr_is_ipv4(addr)) {
-					char payload[6];
+	{
+		const tth_t * const tth = shared_file_tth(sf);
+		char payload[SHA1_RAW_SIZE + TTH_RAW_SIZE + sizeof G2_URN_BITPRINT];
+		char *p = payload;
 
-					host_ip_port_poke(payload, addr, port, NULL);
-					g2_tree_append_payload(c, payload, sizeof payload);
-				}
-			}
+		if (NULL == tth) {
+			p = mempcpy(p, G2_URN_SHA1, sizeof G2_URN_SHA1);
+			p += clamp_memcpy(p, sizeof payload - ptr_diff(p, payload),
+				sha1, SHA1_RAW_SIZE);
+		} else {
+			p = mempcpy(p, G2_URN_BITPRINT, sizeof G2_URN_BITPRINT);
+			p += clamp_memcpy(p, sizeof payload - ptr_diff(p, payload),
+				sha1, SHA1_RAW_SIZE);
+			p += clamp_memcpy(p, sizeof payload - ptr_diff(p, payload),
+				tth, TTH_RAW_SIZE);
+		}
 
-			/*
-			 * If the payload is still empty, then drop the "ALT" child.
-			 * Otherwise, attach it to the "H" node.
-			 */
+		g_assert(ptr_diff(p, payload) <= sizeof payload);
 
-			if (NULL == g2_tree_node_payload(c, NULL)) {
-				g2_tree_free_null(&c);
-			} else {
-				g2_tree_add_child(h, c);
-			}
-		}
+		g2_frame_writer_add(w, "URN", payload, ptr_diff(p, payload));
 	}
 
+	g2_frame_writer_close(w);
+
 	/*
-	 * Update the size of the query hit we're generating.
+	 * Update the size of the query hit we're generating, accounting for
+	 * the end of the child stream and the root payload still to come.
 	 */
 
-	ctx->current_size += g2_frame_serialize(h, NULL, 0);
+	ctx->current_size = g2_frame_writer_length(w) + 1 + sizeof ctx->payload;
 
 	return TRUE;
 }
@@ -1164,10 +1181,11 @@ g2_build_qh2_process(const pslist_t *files, struct g2_qh2_builder *ctx)
 		shared_file_unref(&sf);
 	}
 
-	if (ctx->t != NULL)					/* Still some unflushed results */
-		g2_build_qh2_flush(ctx);		/* Send last packet */
+	if (g2_frame_writer_active(&ctx->w))	/* Still some unflushed results */
+		g2_build_qh2_flush(ctx);			/* Send last packet */
 
 	hset_free_null(&ctx->hs);
+	HFREE_NULL(ctx->common);
 
 	return sent;
 }
@@ -1284,6 +1302,305 @@ g2_build_qh2_results(const pslist_t *files, int count, size_t max_msgsize,
 	}
 }
 
+/**
+ * Add an "H" child describing the file to the /QH2 tree, as done before
+ * hits were streamed into the message buffer.
+ *
+ * This is the reference against which g2_build_qh2_add() is checked by
+ * g2_build_qh2_test(): new children are prepended, hence they are
+ * serialized in the reverse order of their addition.
+ *
+ * @return the size of the serialized "H" child.
+ */
+static size_t G_COLD
+g2_build_qh2_test_hit(g2_tree_t *t, const shared_file_t *sf, uint flags)
+{
+	const sha1_t *sha1 = shared_file_sha1(sf);
+	g2_tree_t *h, *c;
+
+	h = g2_tree_alloc_empty("H");
+	g2_tree_add_child(t, h);
+
+	{
+		const tth_t * const tth = shared_file_tth(sf);
+		char payload[SHA1_RAW_SIZE + TTH_RAW_SIZE + sizeof G2_URN_BITPRINT];
+		char *p = payload;
+
+		if (NULL == tth) {
+			p = mempcpy(p, G2_URN_SHA1, sizeof G2_URN_SHA1);
+			p = mempcpy(p, sha1, SHA1_RAW_SIZE);
+		} else {
+			p = mempcpy(p, G2_URN_BITPRINT, sizeof G2_URN_BITPRINT);
+			p = mempcpy(p, sha1, SHA1_RAW_SIZE);
+			p = mempcpy(p, tth, TTH_RAW_SIZE);
+		}
+
+		g2_tree_add_child(h,
+			g2_tree_alloc_copy("URN", payload, ptr_diff(p, payload)));
+	}
+
+	if (flags & QHIT_F_G2_URL) {
+		uint known;
+		uint16 csc;
+		time_t create_time;
+
+		g2_tree_add_child(h, g2_tree_alloc_empty("URL"));
+
+		known = dmesh_count(sha1);
+		csc = MIN(known, MAX_INT_VAL(uint16));
+
+		if (csc != 0) {
+			char payload[2];
+
+			poke_le16(payload, csc);
+			g2_tree_add_child(h, g2_tree_alloc_copy("CSC", payload, 2));
+		}
+
+		g_assert(!shared_file_is_partial(sf));	/* No "PART" child */
+
+		create_time = shared_file_creation_time(sf);
+
+		if ((time_t) -1 != create_time) {
+			char payload[8];
+			int n;
+
+			n = vlint_encode(MAX(0, create_time), payload);
+			g2_tree_add_child(h, g2_tree_alloc_copy("CT", payload, n));
+		}
+	}
+
+	if (flags & QHIT_F_G2_DN) {
+		char payload[8];
+		uint32 fs32;
+		filesize_t fs = shared_file_size(sf);
+		const char *rp;
+
+		c = g2_tree_alloc_empty("DN");
+
+		fs32 = fs;
+		if (fs32 == fs) {
+			poke_le32(payload, fs32);
+			g2_tree_set_payload(c, payload, sizeof fs32, TRUE);
+		} else {
+			poke_le64(payload, fs);
+			g2_tree_add_child(h,
+				g2_tree_alloc_copy("SZ", payload, sizeof payload));
+		}
+
+		g2_tree_append_payload(c,
+			shared_file_name_nfc(sf), shared_file_name_nfc_len(sf));
+		g2_tree_add_child(h, c);
+
+		rp = shared_file_relative_path(sf);
+		if (rp != NULL)
+			g2_tree_add_child(c, g2_tree_alloc_copy("P", rp, strlen(rp)));
+	}
+
+	if (flags & QHIT_F_G2_ALT) {
+		gnet_host_t hvec[G2_BUILD_QH2_MAX_ALT];
+		int hcnt, i;
+
+		hcnt = dmesh_fill_alternate(sha1, hvec, N_ITEMS(hvec));
+		c = g2_tree_alloc_empty("ALT");
+
+		for (i = 0; i < hcnt; i++) {
+			host_addr_t addr = gnet_host_get_addr(&hvec[i]);
+			uint16 port = gnet_host_get_port(&hvec[i]);
+
+			if (host_addr_is_ipv4(addr)) {
+				char payload[6];
+
+				host_ip_port_poke(payload, addr, port, NULL);
+				g2_tree_append_payload(c, payload, sizeof payload);
+			}
+		}
+
+		if (NULL == g2_tree_node_payload(c, NULL))
+			g2_tree_free_null(&c);
+		else
+			g2_tree_add_child(h, c);
+	}
+
+	return g2_frame_serialize(h, NULL, 0);
+}
+
+/**
+ * Build the /QH2 messages for the files by assembling a tree per message,
+ * flushing them as soon as they reach `max_size', as done before hits were
+ * streamed into the message buffer.
+ *
+ * @return the list of generated messages.
+ */
+static pslist_t * G_COLD
+g2_build_qh2_test_tree(const pslist_t *files, size_t max_size,
+	const char *payload, size_t paylen, uint flags)
+{
+	const pslist_t *sl;
+	pslist_t *msgs = NULL;
+	g2_tree_t *t = NULL;
+	size_t common_size = 0, current_size = 0;
+
+	PSLIST_FOREACH(files, sl) {
+		if (NULL == t) {
+			t = g2_tree_alloc(G2_NAME(QH2), payload, paylen);
+
+			g2_build_add_node_address(t);
+			g2_build_add_guid(t);
+			g2_build_add_vendor(t);
+			g2_build_add_firewalled(t);
+			g2_build_add_browsable(t);
+			g2_build_add_tls(t);
+			g2_build_add_uptime(t);
+			g2_build_add_neighbours(t);
+			g2_build_add_hostname(t);
+			g2_build_add_gtkgv(t);
+
+			if (0 == common_size)
+				common_size = g2_frame_serialize(t, NULL, 0);
+
+			current_size = common_size;
+		}
+
+		current_size += g2_build_qh2_test_hit(t, sl->data, flags);
+
+		if (current_size >= max_size || NULL == pslist_next(sl)) {
+			g2_tree_reverse_children(t);
+			msgs = pslist_prepend(msgs, g2_build_pmsg(t));
+			g2_tree_free_null(&t);
+		}
+	}
+
+	return pslist_reverse(msgs);
+}
+
+/**
+ * Collect messages generated by g2_build_qh2_results().
+ */
+static void G_COLD
+g2_build_qh2_test_collect(pmsg_t *mb, void *udata)
+{
+	pslist_t **msgs = udata;
+
+	*msgs = pslist_prepend(*msgs, mb);
+}
+
+/**
+ * Check that the /QH2 builder generates exactly the same messages as
+ * the tree-based construction for the files.
+ *
+ * @return the amount of messages generated.
+ */
+static size_t G_COLD
+g2_build_qh2_test_files(const pslist_t *files, size_t max_size, uint flags)
+{
+	guid_t muid;
+	char payload[1 + GUID_RAW_SIZE];
+	pslist_t *got = NULL, *want;
+	const pslist_t *sg, *sw;
+	size_t count;
+
+	guid_random_muid(&muid);
+	ZERO(&payload);
+	memcpy(&payload[1], &muid, GUID_RAW_SIZE);
+
+	want = g2_build_qh2_test_tree(files, max_size,
+		payload, sizeof payload, flags);
+
+	/*
+	 * The builder removes a reference on each file it processes.
+	 */
+
+	PSLIST_FOREACH(files, sg) {
+		shared_file_ref(sg->data);
+	}
+
+	g2_build_qh2_results(files, pslist_length(files), max_size,
+		g2_build_qh2_test_collect, &got, &muid, flags);
+	got = pslist_reverse(got);
+
+	count = pslist_length(want);
+	g_assert(pslist_length(got) == count);
+
+	for (
+		sg = got, sw = want;
+		sg != NULL;
+		sg = pslist_next(sg), sw = pslist_next(sw)
+	) {
+		const pmsg_t *mg = sg->data, *mw = sw->data;
+
+		g_assert(pmsg_size(mg) == pmsg_size(mw));
+		g_assert(0 == memcmp(pmsg_start(mg), pmsg_start(mw), pmsg_size(mw)));
+	}
+
+	pslist_free_full_null(&got, (free_fn_t) pmsg_free);
+	pslist_free_full_null(&want, (free_fn_t) pmsg_free);
+
+	return count;
+}
+
+/**
+ * Self-test: the /QH2 builder streams hits in the message buffer, after
+ * a copy of the serialized common children, and must produce the same
+ * messages as assembling and serializing a tree would.
+ */
+void G_COLD
+g2_build_qh2_test(void)
+{
+	pslist_t *files = NULL;
+	char name[1500];
+	size_t i, n;
+
+	g_debug("%s() starting...", G_STRFUNC);
+
+	/*
+	 * Mix files with and without TTH or relative path, one with a size
+	 * not fitting in 32 bits ("SZ" child), one with a name so long that its
+	 * "H" child does not fit in the slack we keep for the last hit, and
+	 * enough small ones to require several messages.
+	 */
+
+	memset(name, 'x', sizeof name - 1);
+	name[sizeof name - 1] = '\0';
+
+	for (i = 0; i < 40; i++) {
+		struct sha1 sha1;
+		struct tth tth;
+		char buf[32];
+		shared_file_t *sf;
+
+		memset(&sha1, i + 1, sizeof sha1);
+		memset(&tth, i + 1, sizeof tth);
+
+		if (5 == i) {
+			sf = shared_file_fake(name, NULL, 1000, &sha1, &tth);
+		} else {
+			str_bprintf(buf, sizeof buf, "file-%zu.txt", i);
+			sf = shared_file_fake(buf, 0 == i % 3 ? "dir/sub" : NULL,
+				7 == i ? (filesize_t) 5 << 30 : 1000 * i,
+				&sha1, 0 == i % 2 ? &tth : NULL);
+		}
+
+		g_assert(sf != NULL);
+		files = pslist_prepend(files, sf);
+	}
+
+	files = pslist_reverse(files);
+
+	n = g2_build_qh2_test_files(files, 512,
+			QHIT_F_G2_URL | QHIT_F_G2_DN | QHIT_F_G2_ALT);
+	g_assert(n > 2);
+
+	n = g2_build_qh2_test_files(files, 512, 0);
+	g_assert(n > 1);
+
+	n = g2_build_qh2_test_files(files, G2_BUILD_QH2_THRESH, QHIT_F_G2_DN);
+	g_assert(1 == n);
+
+	shared_file_slist_free_null(&files);
+
+	g_debug("%s() done.", G_STRFUNC);
+}
+
 /**
  * Free up global messages, at shutdown time.
  */
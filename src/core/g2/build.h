@@ -68,6 +68,7 @@ void g2_build_qh2_results(const struct pslist *files, int count,
 	const struct guid *muid, uint flags);
 
 void g2_build_close(void);
+void g2_build_qh2_test(void);
 
 #endif /* _core_g2_build_h_ */
 
@@ -30,6 +30,11 @@
  * A G2 packet is represented as a tree, much alike an XML tree, hence the
  * "tree" name of its interface.
  *
+ * Packets can also be inspected through a lazy view, which decodes the
+ * children on demand, directly from the serialized bytes, without building
+ * any tree.  Likewise, a streaming writer can serialize packets as they are
+ * described, without any intermediate tree.
+ *
  * Relevant documentation extracted from the g2.doxu.org website:
  *
  * FRAMING
@@ -541,6 +546,201 @@ g2_frame_deserialize(const void *buf, size_t len, size_t *packet_len, bool copy)
 	return t;
 }
 
+/**
+ * Decode the header of the G2 packet starting at the reading pointer and
+ * fill the supplied view, without decoding its children.
+ *
+ * The children stream is only walked through (using the lengths present in
+ * the headers of the children) to locate the payload, which follows it.
+ *
+ * @param dctx		the deserialization context
+ * @param v			the view to fill
+ *
+ * @return TRUE if OK, FALSE if the packet is malformed or truncated.
+ */
+static bool
+g2_frame_view_decode(struct frame_dctx *dctx, g2_frame_view_t *v)
+{
+	uint8 control;
+	size_t length, bytelen, namelen, remain;
+	const void *start;
+
+	v->start = dctx->p;
+
+	/*
+	 * Decode the header: control byte, length, name.
+	 */
+
+	if (!g2_frame_read_byte(dctx, &control))
+		return FALSE;
+
+	if (control & G2_FRAME_BE)
+		return FALSE;				/* Only handle little-endian packets */
+
+	if (0 == control)
+		return FALSE;				/* End of stream */
+
+	bytelen = G2_BYTELEN(control);
+	namelen = G2_NAMELEN(control);
+
+	if (0 != bytelen) {
+		if (!g2_frame_read_length(dctx, bytelen, &length))
+			return FALSE;
+	} else {
+		length = 0;
+	}
+
+	if (!g2_frame_read_data(dctx, v->name, namelen))
+		return FALSE;
+
+	v->name[namelen] = '\0';
+	start = dctx->p;				/* First byte after header */
+
+	/*
+	 * Make sure the whole packet fits into what we were given to decode.
+	 */
+
+	remain = ptr_diff(dctx->end, dctx->p);
+	if (remain < length)
+		return FALSE;
+
+	v->end = const_ptr_add_offset(start, length);
+	v->child = v->child_end = NULL;
+
+	/*
+	 * If it is a compound packet, skip over its children to find the
+	 * end of the children stream.
+	 */
+
+	if (length != 0 && (control & G2_FRAME_CF)) {
+		size_t children = 0;
+
+		while (ptr_cmp(dctx->p, v->end) < 0) {
+			const uint8 *cptr = dctx->p;		/* Control byte location */
+			size_t clen;
+
+			if (0 == *cptr) {		/* End of child stream */
+				v->child_end = dctx->p;
+				dctx->p++;
+				break;
+			}
+
+			children++;
+
+			clen = g2_frame_whole_length(dctx->p, ptr_diff(v->end, dctx->p));
+			if (0 == clen || clen > ptr_diff(v->end, dctx->p))
+				return FALSE;
+
+			dctx->p = const_ptr_add_offset(dctx->p, clen);
+		}
+
+		if (0 == children)
+			return FALSE;
+
+		v->child = start;
+		if (NULL == v->child_end)
+			v->child_end = dctx->p;
+	}
+
+	/*
+	 * The payload, if any, spans until the end of the packet.
+	 */
+
+	v->paylen = ptr_diff(v->end, dctx->p);
+	v->payload = 0 == v->paylen ? NULL : dctx->p;
+	dctx->p = v->end;
+
+	return TRUE;
+}
+
+/**
+ * Get a lazy view on the first G2 packet held in the supplied buffer.
+ *
+ * Only the framing of the packet and of its immediate children is checked:
+ * children are decoded on demand through g2_frame_view_children() and
+ * g2_frame_cursor_next().  The view points directly into the input buffer,
+ * which must therefore remain valid whilst the view is used.
+ *
+ * @param v				the view to fill
+ * @param buf			start of buffer where packet lies
+ * @param len			amount of data held in the buffer
+ * @param packet_len	if non-NULL, set with the amount of data consumed
+ *
+ * @return TRUE if packet was valid, FALSE if packet was malformed or
+ * incompletely held in the buffer.
+ */
+bool
+g2_frame_view(g2_frame_view_t *v,
+	const void *buf, size_t len, size_t *packet_len)
+{
+	struct frame_dctx dctx;
+	bool ok;
+
+	g_assert(v != NULL);
+	g_assert(buf != NULL);
+	g_assert(size_is_positive(len));
+
+	dctx.p = buf;
+	dctx.end = const_ptr_add_offset(buf, len);
+	dctx.copy = FALSE;
+
+	ok = g2_frame_view_decode(&dctx, v);
+
+	if (packet_len != NULL)
+		*packet_len = ptr_diff(dctx.p, buf);
+
+	return ok;
+}
+
+/**
+ * Initialize cursor to iterate over the children of a G2 packet view.
+ *
+ * @param v		the packet view
+ * @param c		the cursor to initialize
+ */
+void
+g2_frame_view_children(const g2_frame_view_t *v, g2_frame_cursor_t *c)
+{
+	g_assert(v != NULL);
+	g_assert(c != NULL);
+
+	c->p = v->child;
+	c->end = v->child_end;
+}
+
+/**
+ * Decode the next child under the cursor.
+ *
+ * @param c			the cursor
+ * @param child		the view to fill with the next child
+ *
+ * @return TRUE if we got a child, FALSE when there are no more children
+ * or when the child is malformed, which ends the iteration.
+ */
+bool
+g2_frame_cursor_next(g2_frame_cursor_t *c, g2_frame_view_t *child)
+{
+	struct frame_dctx dctx;
+
+	g_assert(c != NULL);
+	g_assert(child != NULL);
+
+	if (NULL == c->p || ptr_cmp(c->p, c->end) >= 0)
+		return FALSE;
+
+	dctx.p = c->p;
+	dctx.end = c->end;
+	dctx.copy = FALSE;
+
+	if (!g2_frame_view_decode(&dctx, child)) {
+		c->p = c->end;			/* Stop iterating */
+		return FALSE;
+	}
+
+	c->p = dctx.p;
+	return TRUE;
+}
+
 /**
  * Serialization context.
  */
@@ -782,4 +982,286 @@ g2_frame_serialize(const g2_tree_t *root, void *dest, size_t len)
 	return sctx.len;
 }
 
+/**
+ * Initialize streaming writer.
+ *
+ * @param w			the writer to initialize
+ * @param size		initial size of the serialization buffer
+ */
+void
+g2_frame_writer_init(g2_frame_writer_t *w, size_t size)
+{
+	g_assert(w != NULL);
+	g_assert(size_is_positive(size));
+	g_assert(size <= INT_MAX);
+
+	ZERO(w);
+	w->db = pdata_new(size);
+	pdata_addref(w->db);
+}
+
+/**
+ * Reserve room for `len' more bytes at the end of the serialization buffer,
+ * doubling its size as often as necessary.
+ *
+ * @return pointer to the first reserved byte.
+ */
+static void *
+g2_frame_writer_reserve(g2_frame_writer_t *w, size_t len)
+{
+	size_t size = pdata_len(w->db);
+	void *p;
+
+	if G_UNLIKELY(w->len + len > size) {
+		pdata_t *db;
+
+		while (w->len + len > size)
+			size *= 2;
+
+		g_assert(size <= INT_MAX);
+
+		db = pdata_new(size);
+		pdata_addref(db);
+		memcpy(pdata_start(db), pdata_start(w->db), w->len);
+		pdata_unref(w->db);
+		w->db = db;
+	}
+
+	p = pdata_start(w->db) + w->len;
+	w->len += len;
+
+	return p;
+}
+
+/**
+ * Flag the currently opened packet as having children, which must all come
+ * before its payload.
+ */
+static void
+g2_frame_writer_child_start(g2_frame_writer_t *w)
+{
+	struct g2_frame_wpkt *pkt = &w->pkt[w->depth - 1];
+
+	g_assert_log(!pkt->payload,
+		"%s(): children must be emitted before parent payload", G_STRFUNC);
+
+	if (!pkt->children) {
+		uint8 *cptr = (uint8 *) pdata_start(w->db) + pkt->start;
+		*cptr |= G2_FRAME_CF;
+		pkt->children = TRUE;
+	}
+}
+
+/**
+ * Open a new packet, as a child of the currently opened packet if any.
+ *
+ * The header is written right away, reserving 1 byte for the length which
+ * is fixed up by g2_frame_writer_close().
+ *
+ * @param w			the writer
+ * @param name		the packet name
+ */
+void
+g2_frame_writer_open(g2_frame_writer_t *w, const char *name)
+{
+	struct g2_frame_wpkt *pkt;
+	size_t namelen = strlen(name);
+	uint8 *p;
+
+	g_assert(g2_frame_writer_active(w));
+	g_assert(w->depth < G2_FRAME_WRITER_DEPTH);
+	g_assert(namelen != 0);
+	g_assert_log(namelen <= G2_FRAME_NAME_LEN_MAX,
+		"%s(): node name too long (%zu bytes): \"%.*s\"%s",
+		G_STRFUNC, namelen, (int) MIN(namelen, 20), name,
+		namelen > 20 ? " (truncated)" : "");
+
+	if (w->depth != 0)
+		g2_frame_writer_child_start(w);
+
+	pkt = &w->pkt[w->depth++];
+	pkt->start = w->len;
+	pkt->namelen = namelen;
+	pkt->children = pkt->payload = FALSE;
+
+	p = g2_frame_writer_reserve(w, 2 + namelen);
+	p[0] = ((namelen - 1) << 3) | (1 << 6);	/* Reserve 1 byte for length */
+	p[1] = 0;								/* The length, fixed up later */
+	memcpy(&p[2], name, namelen);
+}
+
+/**
+ * Append payload to the currently opened packet.
+ *
+ * The payload can be supplied in several pieces but once payload has been
+ * written, no more children can be added to the packet.
+ *
+ * @param w			the writer
+ * @param payload	the start of the payload data
+ * @param paylen	the length of the payload data
+ */
+void
+g2_frame_writer_payload(g2_frame_writer_t *w,
+	const void *payload, size_t paylen)
+{
+	struct g2_frame_wpkt *pkt;
+	uint8 *p;
+
+	g_assert(g2_frame_writer_active(w));
+	g_assert(w->depth > 0);
+	g_assert(size_is_non_negative(paylen));
+
+	if (0 == paylen)
+		return;
+
+	g_assert(payload != NULL);
+
+	pkt = &w->pkt[w->depth - 1];
+
+	if (pkt->children && !pkt->payload) {
+		p = g2_frame_writer_reserve(w, 1 + paylen);
+		*p++ = 0;							/* End of child stream */
+	} else {
+		p = g2_frame_writer_reserve(w, paylen);
+	}
+
+	memcpy(p, payload, paylen);
+	pkt->payload = TRUE;
+}
+
+/**
+ * Close the currently opened packet, back-patching its length.
+ *
+ * @param w			the writer
+ */
+void
+g2_frame_writer_close(g2_frame_writer_t *w)
+{
+	struct g2_frame_wpkt *pkt;
+	size_t length;
+	uint8 *start;
+
+	g_assert(g2_frame_writer_active(w));
+	g_assert(w->depth > 0);
+
+	pkt = &w->pkt[--w->depth];
+	length = w->len - pkt->start - 2 - pkt->namelen;
+	start = (uint8 *) pdata_start(w->db) + pkt->start;
+
+	g_assert(length < 256 * 256 * 256);		/* 3 bytes max for length */
+
+	/*
+	 * An empty packet carries no length: remove the byte we reserved and
+	 * set the CF flag if the control byte would otherwise be zero.
+	 *
+	 * When the length does not fit in the reserved byte, we have to fix the
+	 * control byte and move the data around to make room for it, as done
+	 * by g2_frame_recursive_serialize().
+	 */
+
+	if G_UNLIKELY(0 == length) {
+		uint8 control = (pkt->namelen - 1) << 3;
+
+		memmove(&start[1], &start[2], pkt->namelen);
+		start[0] = (0 == control) ? G2_FRAME_CF : control;
+		w->len--;
+	} else if G_LIKELY(length < 256) {
+		start[1] = length;
+	} else {
+		uint8 bytlen = (length < 65536) ? 2 : 3;
+		char lbuf[4];
+
+		g2_frame_writer_reserve(w, bytlen - 1);
+		start = (uint8 *) pdata_start(w->db) + pkt->start;	/* May have moved */
+
+		poke_le32(lbuf, length);
+		memmove(&start[1 + bytlen], &start[2], pkt->namelen + length);
+		memcpy(&start[1], lbuf, bytlen);
+		start[0] = (start[0] & 0x3f) | (bytlen << 6);
+	}
+}
+
+/**
+ * Append already serialized children to the currently opened packet.
+ *
+ * @param w			the writer
+ * @param buf		start of the serialized children stream
+ * @param len		length of the children stream
+ */
+void
+g2_frame_writer_children(g2_frame_writer_t *w, const void *buf, size_t len)
+{
+	g_assert(g2_frame_writer_active(w));
+	g_assert(w->depth > 0);
+	g_assert(buf != NULL);
+	g_assert(size_is_positive(len));
+
+	g2_frame_writer_child_start(w);
+	memcpy(g2_frame_writer_reserve(w, len), buf, len);
+}
+
+/**
+ * Emit a whole packet with no children, as a child of the opened packet.
+ *
+ * @param w			the writer
+ * @param name		the packet name
+ * @param payload	the packet payload (may be NULL if `paylen' is 0)
+ * @param paylen	the length of the payload
+ */
+void
+g2_frame_writer_add(g2_frame_writer_t *w, const char *name,
+	const void *payload, size_t paylen)
+{
+	g2_frame_writer_open(w, name);
+	g2_frame_writer_payload(w, payload, paylen);
+	g2_frame_writer_close(w);
+}
+
+/**
+ * Create a new message holding the serialized packets, handing over the
+ * serialization buffer to it.  The writer is then inactive.
+ *
+ * When most of the buffer is unused, the data are copied to a new message
+ * of the proper size instead, to avoid queued messages holding idle memory.
+ *
+ * @param w			the writer
+ * @param prio		priority of the message
+ *
+ * @return a message containing the serialized packets.
+ */
+pmsg_t *
+g2_frame_writer_pmsg(g2_frame_writer_t *w, int prio)
+{
+	pmsg_t *mb;
+
+	g_assert(g2_frame_writer_active(w));
+	g_assert(0 == w->depth);
+	g_assert(size_is_positive(w->len));
+
+	if (w->len < pdata_len(w->db) / 2)
+		mb = pmsg_new(prio, pdata_start(w->db), w->len);
+	else
+		mb = pmsg_alloc(prio, w->db, 0, w->len);
+
+	g2_frame_writer_discard(w);
+
+	return mb;
+}
+
+/**
+ * Discard writer's serialization buffer, if any.
+ */
+void
+g2_frame_writer_discard(g2_frame_writer_t *w)
+{
+	g_assert(w != NULL);
+
+	if (w->db != NULL) {
+		pdata_unref(w->db);
+		w->db = NULL;
+	}
+	w->len = 0;
+	w->depth = 0;
+}
+
 /* vi: set ts=4 sw=4 cindent: */
@@ -34,10 +34,65 @@
 #ifndef _core_g2_frame_h_
 #define _core_g2_frame_h_
 
+#include "lib/pmsg.h"
+
 #define G2_FRAME_NAME_LEN_MAX	8			/**< Maximum length of a packet */
 #define G2_FRAME_CF				(1U << 2)	/**< The CF flag */
 #define G2_FRAME_BE				(1U << 1)	/**< The BE flag */
 
+#define G2_FRAME_WRITER_DEPTH	8			/**< Max nesting when writing */
+
+/**
+ * A lazy view on a serialized G2 packet.
+ *
+ * The view refers to the raw packet bytes: it knows the name of the packet,
+ * where its payload lies and where its children are, but children are only
+ * decoded on demand, through a cursor.  Nothing is allocated.
+ */
+typedef struct g2_frame_view {
+	const void *start;			/**< Start of packet (control byte) */
+	const void *end;			/**< First byte past the packet */
+	const void *child;			/**< First child, NULL if none */
+	const void *child_end;		/**< End of the children stream */
+	const void *payload;		/**< Payload, NULL if none */
+	size_t paylen;				/**< Length of payload */
+	char name[G2_FRAME_NAME_LEN_MAX + 1];	/**< NUL-terminated name */
+} g2_frame_view_t;
+
+/**
+ * A cursor iterating over the children of a G2 packet view.
+ */
+typedef struct g2_frame_cursor {
+	const void *p;				/**< Next child to decode */
+	const void *end;			/**< End of the children stream */
+} g2_frame_cursor_t;
+
+/**
+ * A packet opened by the streaming writer.
+ */
+struct g2_frame_wpkt {
+	size_t start;				/**< Offset of the control byte */
+	uint8 namelen;				/**< Length of the packet name */
+	uint8 children:1;			/**< Whether children were emitted */
+	uint8 payload:1;			/**< Whether payload was emitted */
+};
+
+/**
+ * A streaming G2 packet writer.
+ *
+ * Packets are serialized directly into a data buffer as they are described,
+ * without building any tree: children must be emitted before the payload of
+ * their parent, and the packet lengths are back-patched when packets are
+ * closed.  The serialized form is identical to what g2_frame_serialize()
+ * would produce for the equivalent tree.
+ */
+typedef struct g2_frame_writer {
+	pdata_t *db;				/**< Data buffer we serialize into */
+	size_t len;					/**< Amount of bytes written so far */
+	int depth;					/**< Amount of opened packets */
+	struct g2_frame_wpkt pkt[G2_FRAME_WRITER_DEPTH];	/**< Opened packets */
+} g2_frame_writer_t;
+
 /*
  * Public interface.
  */
@@ -50,5 +105,50 @@ struct g2_tree *g2_frame_deserialize(const void *buf,
 size_t g2_frame_whole_length(const void *buf, size_t len);
 const char *g2_frame_name(const void *buf, size_t len, size_t *namelen);
 
+bool g2_frame_view(g2_frame_view_t *v,
+	const void *buf, size_t len, size_t *packet_len);
+void g2_frame_view_children(const g2_frame_view_t *v, g2_frame_cursor_t *c);
+bool g2_frame_cursor_next(g2_frame_cursor_t *c, g2_frame_view_t *child);
+
+static inline const char *
+g2_frame_view_name(const g2_frame_view_t *v)
+{
+	return v->name;
+}
+
+static inline const void *
+g2_frame_view_payload(const g2_frame_view_t *v, size_t *paylen)
+{
+	*paylen = v->paylen;
+	return v->payload;
+}
+
+void g2_frame_writer_init(g2_frame_writer_t *w, size_t size);
+void g2_frame_writer_open(g2_frame_writer_t *w, const char *name);
+void g2_frame_writer_payload(g2_frame_writer_t *w,
+	const void *payload, size_t paylen);
+void g2_frame_writer_close(g2_frame_writer_t *w);
+void g2_frame_writer_children(g2_frame_writer_t *w,
+	const void *buf, size_t len);
+void g2_frame_writer_add(g2_frame_writer_t *w, const char *name,
+	const void *payload, size_t paylen);
+pmsg_t *g2_frame_writer_pmsg(g2_frame_writer_t *w, int prio);
+void g2_frame_writer_discard(g2_frame_writer_t *w);
+
+static inline bool
+g2_frame_writer_active(const g2_frame_writer_t *w)
+{
+	return w->db != NULL;
+}
+
+static inline size_t
+g2_frame_writer_length(const g2_frame_writer_t *w)
+{
+	return w->len;
+}
+
+#define G2_FRAME_VIEW_CHILD_FOREACH(v, cur, c) \
+	for (g2_frame_view_children((v), (cur)); g2_frame_cursor_next((cur), (c));)
+
 #endif /* _core_g2_frame_h_ */
 
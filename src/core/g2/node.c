@@ -269,34 +269,49 @@ g2_node_send_lni(gnutella_node_t *n)
 }
 
 /**
- * Drop message received from given node.
+ * Log dropping of message received from given node.
  *
  * @param routine		routine where we're coming from (the one dropping)
  * @param n				source node of message
- * @param t				the message tree
- * @param reason		optional reason
+ * @param name			the message name
+ * @param fmt			optional reason format, NULL if none
+ * @param args			arguments for the format string
  */
-static void G_PRINTF(4, 5)
-g2_node_drop(const char *routine, gnutella_node_t *n, const g2_tree_t *t,
-	const char *fmt, ...)
+static void
+g2_node_drop_log(const char *routine, const gnutella_node_t *n,
+	const char *name, const char *fmt, va_list args)
 {
 	if (GNET_PROPERTY(g2_debug) || GNET_PROPERTY(log_dropped_g2)) {
-		va_list args;
 		char buf[256];
 
-		va_start(args, fmt);
-
 		if (fmt != NULL)
 			str_vbprintf(buf, sizeof buf, fmt, args);
 		else
 			buf[0] = '\0';
 
 		g_debug("%s(): dropping /%s from %s%s%s",
-			routine, g2_tree_name(t), node_infostr(n),
+			routine, name, node_infostr(n),
 			NULL == fmt ? "" : ": ", buf);
-
-		va_end(args);
 	}
+}
+
+/**
+ * Drop message received from given node.
+ *
+ * @param routine		routine where we're coming from (the one dropping)
+ * @param n				source node of message
+ * @param t				the message tree
+ * @param reason		optional reason
+ */
+static void G_PRINTF(4, 5)
+g2_node_drop(const char *routine, gnutella_node_t *n, const g2_tree_t *t,
+	const char *fmt, ...)
+{
+	va_list args;
+
+	va_start(args, fmt);
+	g2_node_drop_log(routine, n, g2_tree_name(t), fmt, args);
+	va_end(args);
 
 	gnet_stats_count_dropped(n, MSG_DROP_G2_UNEXPECTED);
 
@@ -305,6 +320,42 @@ g2_node_drop(const char *routine, gnutella_node_t *n, const g2_tree_t *t,
 	}
 }
 
+/**
+ * Drop message received from given node, which we only had a view of.
+ *
+ * @param routine		routine where we're coming from (the one dropping)
+ * @param n				source node of message
+ * @param v				the message view
+ * @param reason		optional reason
+ */
+static void G_PRINTF(4, 5)
+g2_node_drop_view(const char *routine, gnutella_node_t *n,
+	const g2_frame_view_t *v, const char *fmt, ...)
+{
+	va_list args;
+
+	va_start(args, fmt);
+	g2_node_drop_log(routine, n, g2_frame_view_name(v), fmt, args);
+	va_end(args);
+
+	gnet_stats_count_dropped(n, MSG_DROP_G2_UNEXPECTED);
+
+	/*
+	 * Only build the whole tree when we need to dump it.
+	 */
+
+	if (GNET_PROPERTY(log_dropped_g2)) {
+		g2_tree_t *t;
+
+		t = g2_frame_deserialize(v->start, ptr_diff(v->end, v->start),
+				NULL, FALSE);
+
+		if (t != NULL)
+			g2_tfmt_tree_dump(t, stderr, G2FMT_O_PAYLEN);
+		g2_tree_free_null(&t);
+	}
+}
+
 /**
  * Handle reception of a /PI
  */
@@ -432,22 +483,19 @@ g2_node_handle_rpc_answer(gnutella_node_t *n,
 }
 
 /**
- * Parse the payload of given node to extract a node address + port.
+ * Parse a payload to extract a node address + port.
  *
- * @param t		the tree node whose payload we wish to parse
- * @param addr	where to write the address part
- * @param port	where to write the port part
+ * @param payload	the payload to parse
+ * @param paylen	the payload length
+ * @param addr		where to write the address part
+ * @param port		where to write the port part
  *
  * @return TRUE if OK, FALSE if we could not extract anything.
  */
-bool
-g2_node_parse_address(const g2_tree_t *t, host_addr_t *addr, uint16 *port)
+static bool
+g2_node_parse_address_payload(const char *payload, size_t paylen,
+	host_addr_t *addr, uint16 *port)
 {
-	const char *payload;
-	size_t paylen;
-
-	payload = g2_tree_node_payload(t, &paylen);
-
 	/*
 	 * Only handle if we have an IP:port entry.
 	 * We only handle IPv4 because G2 does not support IPv6.
@@ -462,26 +510,49 @@ g2_node_parse_address(const g2_tree_t *t, host_addr_t *addr, uint16 *port)
 	return FALSE;		/* Unrecognized payload length */
 }
 
+/**
+ * Parse the payload of given node to extract a node address + port.
+ *
+ * @param t		the tree node whose payload we wish to parse
+ * @param addr	where to write the address part
+ * @param port	where to write the port part
+ *
+ * @return TRUE if OK, FALSE if we could not extract anything.
+ */
+bool
+g2_node_parse_address(const g2_tree_t *t, host_addr_t *addr, uint16 *port)
+{
+	const char *payload;
+	size_t paylen;
+
+	payload = g2_tree_node_payload(t, &paylen);
+
+	return g2_node_parse_address_payload(payload, paylen, addr, port);
+}
+
 /**
  * Handle reception of a /LNI
  */
 static void
-g2_node_handle_lni(gnutella_node_t *n, const g2_tree_t *t)
+g2_node_handle_lni(gnutella_node_t *n, const g2_frame_view_t *v)
 {
-	g2_tree_t *c;
+	g2_frame_cursor_t cur;
+	g2_frame_view_t c;
 
 	/*
 	 * Handle the children of /LNI.
 	 */
 
-	G2_TREE_CHILD_FOREACH(t, c) {
-		enum g2_lni_child ct = TOKENIZE(g2_tree_name(c), g2_lni_children);
+	G2_FRAME_VIEW_CHILD_FOREACH(v, &cur, &c) {
+		enum g2_lni_child ct;
 		const char *payload;
 		size_t paylen;
 
+		ct = TOKENIZE(g2_frame_view_name(&c), g2_lni_children);
+		payload = g2_frame_view_payload(&c, &paylen);
+
 		switch (ct) {
 		case G2_LNI_GU:			/* the node's GUID */
-			payload = g2_tree_node_payload(c, &paylen);
 			if (GUID_RAW_SIZE == paylen)
 				node_set_guid(n, (guid_t *) payload, TRUE);
 			break;
@@ -491,7 +562,10 @@ g2_node_handle_lni(gnutella_node_t *n, const g2_tree_t *t)
 				host_addr_t addr;
 				uint16 port;
 
-				if (g2_node_parse_address(c, &addr, &port)) {
+				if (
+					g2_node_parse_address_payload(payload, paylen,
+						&addr, &port)
+				) {
 					if (host_address_is_usable(addr))
 						n->gnet_addr = addr;
 					n->gnet_port = port;
@@ -500,7 +574,6 @@ g2_node_handle_lni(gnutella_node_t *n, const g2_tree_t *t)
 			break;
 
 		case G2_LNI_LS:			/* library statistics */
-			payload = g2_tree_node_payload(c, &paylen);
 			if (paylen >= 8) {
 				uint32 files = peek_le32(payload);
 				uint32 kbytes = peek_le32(&payload[4]);
@@ -512,13 +585,11 @@ g2_node_handle_lni(gnutella_node_t *n, const g2_tree_t *t)
 			break;
 
 		case G2_LNI_V:			/* vendor code */
-			payload = g2_tree_node_payload(c, &paylen);
 			if (paylen >= 4)
 				n->vcode.u32 = peek_be32(payload);
 			break;
 
 		case G2_LNI_UP:			/* uptime */
-			payload = g2_tree_node_payload(c, &paylen);
 			if (paylen <= 4)
 				n->up_date = tm_time() - vlint_decode(payload, paylen);
 			break;
@@ -527,51 +598,34 @@ g2_node_handle_lni(gnutella_node_t *n, const g2_tree_t *t)
 }
 
 /**
- * Tree message iterator to handle "NH" nodes and extract their IP:port.
+ * Handle a /KHL/NH child and extract its IP:port.
  */
 static void
-g2_node_extract_nh(void *data, void *udata)
+g2_node_extract_nh(const char *payload, size_t paylen)
 {
-	const g2_tree_t *t = data;
-
-	(void) udata;
-
-	if (0 == strcmp("NH", g2_tree_name(t))) {
-		host_addr_t addr;
-		uint16 port;
-
-		if (
-			g2_node_parse_address(t, &addr, &port) &&
-			host_is_valid(addr, port)
-		) {
-			hcache_add_caught(HOST_G2HUB, addr, port, "/KHL/NH");
-		}
+	host_addr_t addr;
+	uint16 port;
+
+	if (
+		g2_node_parse_address_payload(payload, paylen, &addr, &port) &&
+		host_is_valid(addr, port)
+	) {
+		hcache_add_caught(HOST_G2HUB, addr, port, "/KHL/NH");
 	}
 }
 
 /**
- * Tree message iterator to handle "CH" nodes and extract their IP:port.
+ * Handle a /KHL/CH child and extract its IP:port.
  */
 static void
-g2_node_extract_ch(void *data, void *udata)
+g2_node_extract_ch(const char *payload, size_t paylen)
 {
-	const g2_tree_t *t = data;
-
-	(void) udata;
-
-	if (0 == strcmp("CH", g2_tree_name(t))) {
-		const char *payload;
-		size_t paylen;
-
-		payload = g2_tree_node_payload(t, &paylen);
+	if (10 == paylen) {		/* IPv4:port + 32-bit timestamp */
+		host_addr_t addr = host_addr_peek_ipv4(payload);
+		uint16 port = peek_le16(&payload[4]);
 
-		if (10 == paylen) {		/* IPv4:port + 32-bit timestamp */
-			host_addr_t addr = host_addr_peek_ipv4(payload);
-			uint16 port = peek_le16(&payload[4]);
-
-			if (host_is_valid(addr, port) && !hostiles_is_bad(addr))
-				guess_add_hub(addr, port);
-		}
+		if (host_is_valid(addr, port) && !hostiles_is_bad(addr))
+			guess_add_hub(addr, port);
 	}
 }
 
@@ -579,39 +633,45 @@ g2_node_extract_ch(void *data, void *udata)
  * Handle reception of a /KHL
  */
 static void
-g2_node_handle_khl(const g2_tree_t *t)
+g2_node_handle_khl(const g2_frame_view_t *v)
 {
-	/*
-	 * Extract the neighbouring node info and insert them into our cache.
-	 */
-
-	g2_tree_child_foreach(t, g2_node_extract_nh, NULL);
+	g2_frame_cursor_t cur;
+	g2_frame_view_t c;
 
 	/*
+	 * Extract the neighbouring node info and insert them into our cache.
+	 *
 	 * Extract cached hubs (necessarily not in the cluster of the hub sending
 	 * us the /KHL) and add them to the GUESS host cache.
 	 */
 
-	g2_tree_child_foreach(t, g2_node_extract_ch, NULL);
+	G2_FRAME_VIEW_CHILD_FOREACH(v, &cur, &c) {
+		const char *name = g2_frame_view_name(&c);
+		const char *payload;
+		size_t paylen;
+
+		payload = g2_frame_view_payload(&c, &paylen);
+
+		if (0 == strcmp("NH", name))
+			g2_node_extract_nh(payload, paylen);
+		else if (0 == strcmp("CH", name))
+			g2_node_extract_ch(payload, paylen);
+	}
 }
 
 /**
- * Extract min/max sizes from the payload of a /Q2/SZR tree node.
+ * Extract min/max sizes from the payload of a /Q2/SZR child.
  *
  * @return TRUE if we successfully extracted the information.
  */
-static bool NON_NULL_PARAM((2, 3))
-g2_node_extract_size_request(const g2_tree_t *t, uint64 *min, uint64 *max)
+static bool NON_NULL_PARAM((3, 4))
+g2_node_extract_size_request(const char *p, size_t paylen,
+	uint64 *min, uint64 *max)
 {
-	const char *p;
-	size_t paylen;
-
 	/*
 	 * The payload can be 2 32-bit or 2 64-bit values.
 	 */
 
-	p = g2_tree_node_payload(t, &paylen);
-
 	if (8 == paylen) {
 		*min = (uint64) peek_le32(p);
 		*max = (uint64) peek_le32(&p[4]);
@@ -626,18 +686,17 @@ g2_node_extract_size_request(const g2_tree_t *t, uint64 *min, uint64 *max)
 }
 
 /**
- * Extract interest flags from the payload of a /Q2/I tree node.
+ * Extract interest flags from the payload of a /Q2/I child.
  *
  * @return the consolidated flags G2_Q2_F_* requested by the payload.
  */
 static uint32
-g2_node_extract_interest(const g2_tree_t *t)
+g2_node_extract_interest(const char *payload, size_t paylen)
 {
 	const char *p, *q, *end;
-	size_t paylen;
 	uint32 flags = 0;
 
-	p = q = g2_tree_node_payload(t, &paylen);
+	p = q = payload;
 
 	if (NULL == p)
 		return 0;
@@ -665,10 +724,8 @@ g2_node_extract_interest(const g2_tree_t *t)
  * if it is a SHA1 (or bitprint, which contains a SHA1).
  */
 static void
-g2_node_extract_urn(const g2_tree_t *t, search_request_info_t *sri)
+g2_node_extract_urn(const char *p, size_t paylen, search_request_info_t *sri)
 {
-	const char *p;
-	size_t paylen;
 	uint i;
 
 	/*
@@ -678,8 +735,6 @@ g2_node_extract_urn(const g2_tree_t *t, search_request_info_t *sri)
 	if (sri->exv_sha1cnt == N_ITEMS(sri->exv_sha1))
 		return;
 
-	p = g2_tree_node_payload(t, &paylen);
-
 	if (NULL == p)
 		return;
 
@@ -723,14 +778,9 @@ g2_node_extract_urn(const g2_tree_t *t, search_request_info_t *sri)
  * if we have a valid address.
  */
 static void
-g2_node_extract_udp(const g2_tree_t *t, search_request_info_t *sri,
+g2_node_extract_udp(const char *p, size_t paylen, search_request_info_t *sri,
 	const gnutella_node_t *n)
 {
-	const char *p;
-	size_t paylen;
-
-	p = g2_tree_node_payload(t, &paylen);
-
 	/*
 	 * Only handle if we have an IP:port entry.
 	 * We only handle IPv4 because G2 does not support IPv6.
@@ -810,11 +860,12 @@ g2_node_intuit_media_type(const char *md)
  * Handle reception of a /Q2
  */
 static void
-g2_node_handle_q2(gnutella_node_t *n, const g2_tree_t *t)
+g2_node_handle_q2(gnutella_node_t *n, const g2_frame_view_t *v)
 {
 	const guid_t *muid;
 	size_t paylen;
-	const g2_tree_t *c;
+	g2_frame_cursor_t cur;
+	g2_frame_view_t c;
 	char *dn = NULL;
 	char *md = NULL;
 	uint32 iflags = 0;
@@ -829,7 +880,7 @@ g2_node_handle_q2(gnutella_node_t *n, const g2_tree_t *t)
 	 */
 
 	if (NODE_IS_UDP(n)) {
-		g2_node_drop(G_STRFUNC, n, t, "coming from UDP");
+		g2_node_drop_view(G_STRFUNC, n, v, "coming from UDP");
 		return;
 	}
 
@@ -837,10 +888,10 @@ g2_node_handle_q2(gnutella_node_t *n, const g2_tree_t *t)
 	 * The MUID of the query is the payload of the root node.
 	 */
 
-	muid = g2_tree_node_payload(t, &paylen);
+	muid = g2_frame_view_payload(v, &paylen);
 
 	if (paylen != GUID_RAW_SIZE) {
-		g2_node_drop(G_STRFUNC, n, t, "missing MUID");
+		g2_node_drop_view(G_STRFUNC, n, v, "missing MUID");
 		return;
 	}
 
@@ -883,13 +934,14 @@ g2_node_handle_q2(gnutella_node_t *n, const g2_tree_t *t)
 	 * Handle the children of /Q2.
 	 */
 
-	G2_TREE_CHILD_FOREACH(t, c) {
-		enum g2_q2_child ct = TOKENIZE(g2_tree_name(c), g2_q2_children);
+	G2_FRAME_VIEW_CHILD_FOREACH(v, &cur, &c) {
+		enum g2_q2_child ct = TOKENIZE(g2_frame_view_name(&c), g2_q2_children);
 		const char *payload;
 
+		payload = g2_frame_view_payload(&c, &paylen);
+
 		switch (ct) {
 		case G2_Q2_DN:
-			payload = g2_tree_node_payload(c, &paylen);
 			if (payload != NULL && NULL == dn) {
 				uint off = 0;
 				/* Not NUL-terminated, need to h_strndup() it */
@@ -905,12 +957,11 @@ g2_node_handle_q2(gnutella_node_t *n, const g2_tree_t *t)
 
 		case G2_Q2_I:
 			if (!has_interest)
-				iflags = g2_node_extract_interest(c);
+				iflags = g2_node_extract_interest(payload, paylen);
 			has_interest = TRUE;
 			break;
 
 		case G2_Q2_MD:
-			payload = g2_tree_node_payload(c, &paylen);
 			if (payload != NULL && NULL == md) {
 				/* Not NUL-terminated, need to h_strndup() it */
 				md = h_strndup(payload, paylen);
@@ -922,17 +973,20 @@ g2_node_handle_q2(gnutella_node_t *n, const g2_tree_t *t)
 			break;
 
 		case G2_Q2_SZR:			/* Size limits */
-			if (g2_node_extract_size_request(c, &sri.minsize, &sri.maxsize))
+			if (
+				g2_node_extract_size_request(payload, paylen,
+					&sri.minsize, &sri.maxsize)
+			)
 				sri.size_restrictions = TRUE;
 			break;
 
 		case G2_Q2_UDP:
 			if (!sri.oob)
-				g2_node_extract_udp(c, &sri, n);
+				g2_node_extract_udp(payload, paylen, &sri, n);
 			break;
 
 		case G2_Q2_URN:
-			g2_node_extract_urn(c, &sri);
+			g2_node_extract_urn(payload, paylen, &sri);
 			break;
 		}
 	}
@@ -1012,27 +1066,41 @@ done:
 	HFREE_NULL(md);
 }
 
+/**
+ * Log message from G2 node that we cannot parse.
+ */
+static void
+g2_node_bad_packet(const char *routine, const gnutella_node_t *n)
+{
+	if (GNET_PROPERTY(g2_debug) > 0 || GNET_PROPERTY(log_bad_g2)) {
+		g_warning("%s(): cannot deserialize /%s from %s",
+			routine, g2_msg_raw_name(n->data, n->size), node_infostr(n));
+	}
+	if (GNET_PROPERTY(log_bad_g2))
+		dump_hex(stderr, "G2 Packet", n->data, n->size);
+}
+
 /**
  * Handle message coming from G2 node.
  */
 void
 g2_node_handle(gnutella_node_t *n)
 {
-	g2_tree_t *t;
+	g2_frame_view_t v;
+	g2_tree_t *t = NULL;
 	size_t plen;
 	enum g2_msg type;
 
 	node_check(n);
 	g_assert(NODE_TALKS_G2(n));
 
-	t = g2_frame_deserialize(n->data, n->size, &plen, FALSE);
-	if (NULL == t) {
-		if (GNET_PROPERTY(g2_debug) > 0 || GNET_PROPERTY(log_bad_g2)) {
-			g_warning("%s(): cannot deserialize /%s from %s",
-				G_STRFUNC, g2_msg_raw_name(n->data, n->size), node_infostr(n));
-		}
-		if (GNET_PROPERTY(log_bad_g2))
-			dump_hex(stderr, "G2 Packet", n->data, n->size);
+	/*
+	 * Start with a lazy view of the packet, which validates its framing
+	 * without allocating anything.
+	 */
+
+	if (!g2_frame_view(&v, n->data, n->size, &plen)) {
+		g2_node_bad_packet(G_STRFUNC, n);
 		return;
 	} else if (plen != n->size) {
 		if (GNET_PROPERTY(g2_debug) > 0 || GNET_PROPERTY(log_bad_g2)) {
@@ -1044,13 +1112,46 @@ g2_node_handle(gnutella_node_t *n)
 			dump_hex(stderr, "G2 Packet", n->data, n->size);
 		hostiles_dynamic_add(n->addr,
 			"cannot parse incoming messages", HSTL_GIBBERISH);
-		goto done;
+		return;
 	} else if (GNET_PROPERTY(g2_debug) > 19) {
 		g_debug("%s(): received packet from %s", G_STRFUNC, node_infostr(n));
-		g2_tfmt_tree_dump(t, stderr, G2FMT_O_PAYLEN);
+		t = g2_frame_deserialize(n->data, n->size, &plen, FALSE);
+		if (t != NULL)
+			g2_tfmt_tree_dump(t, stderr, G2FMT_O_PAYLEN);
+	}
+
+	type = g2_msg_name_type(g2_frame_view_name(&v));
+
+	/*
+	 * The most frequent messages are handled directly from the view,
+	 * their children being decoded on demand as the handlers look at them.
+	 */
+
+	switch (type) {
+	case G2_MSG_LNI:
+		g2_node_handle_lni(n, &v);
+		goto done;
+	case G2_MSG_KHL:
+		g2_node_handle_khl(&v);
+		goto done;
+	case G2_MSG_Q2:
+		g2_node_handle_q2(n, &v);
+		goto done;
+	default:
+		break;
 	}
 
-	type = g2_msg_name_type(g2_tree_name(t));
+	/*
+	 * Other messages are handled from the whole tree.
+	 */
+
+	if (NULL == t) {
+		t = g2_frame_deserialize(n->data, n->size, &plen, FALSE);
+		if (NULL == t) {
+			g2_node_bad_packet(G_STRFUNC, n);
+			return;
+		}
+	}
 
 	switch (type) {
 	case G2_MSG_PI:
@@ -1059,18 +1160,9 @@ g2_node_handle(gnutella_node_t *n)
 	case G2_MSG_PO:
 		g2_node_handle_pong(n, t);
 		break;
-	case G2_MSG_LNI:
-		g2_node_handle_lni(n, t);
-		break;
-	case G2_MSG_KHL:
-		g2_node_handle_khl(t);
-		break;
 	case G2_MSG_PUSH:
 		handle_push_request(n, t);
 		break;
-	case G2_MSG_Q2:
-		g2_node_handle_q2(n, t);
-		break;
 	case G2_MSG_QA:
 	case G2_MSG_QKA:
 		g2_node_handle_rpc_answer(n, t, type);
@@ -107,6 +107,7 @@
 #include "lib/walloc.h"
 
 #ifdef TREE_TESTING
+#include "build.h"
 #include "tfmt.h"
 #include "frame.h"
 #endif
@@ -672,14 +673,107 @@ g2_tree_enter_leave(g2_tree_t *root,
 
 #define LARGE_PAYLOAD	258		/* Force 2-byte payload length */
 
+/**
+ * Recursively check that a lazy frame view matches the tree.
+ */
+static void
+g2_tree_test_view(const g2_tree_t *t, const g2_frame_view_t *v)
+{
+	g2_frame_cursor_t cur;
+	g2_frame_view_t c;
+	const g2_tree_t *tc;
+	const void *p, *q;
+	size_t plen, qlen;
+
+	g_assert(0 == strcmp(g2_tree_name(t), g2_frame_view_name(v)));
+
+	p = g2_tree_node_payload(t, &plen);
+	q = g2_frame_view_payload(v, &qlen);
+	g_assert(plen == qlen);
+	g_assert(0 == plen || 0 == memcmp(p, q, plen));
+
+	tc = g2_tree_first_child(t);
+
+	G2_FRAME_VIEW_CHILD_FOREACH(v, &cur, &c) {
+		g_assert(tc != NULL);
+		g2_tree_test_view(tc, &c);
+		tc = g2_tree_next_sibling(tc);
+	}
+
+	g_assert(NULL == tc);
+}
+
+/**
+ * Recursively emit the tree through the streaming writer.
+ */
+static void
+g2_tree_test_writer(const g2_tree_t *t, g2_frame_writer_t *w)
+{
+	const g2_tree_t *tc;
+	const void *p;
+	size_t plen;
+
+	g2_frame_writer_open(w, g2_tree_name(t));
+
+	tc = g2_tree_first_child(t);
+
+	while (tc != NULL) {
+		g2_tree_test_writer(tc, w);
+		tc = g2_tree_next_sibling(tc);
+	}
+
+	p = g2_tree_node_payload(t, &plen);
+	g2_frame_writer_payload(w, p, plen);
+	g2_frame_writer_close(w);
+}
+
+/**
+ * Check the lazy view and the streaming writer against the serialized tree.
+ */
+static void
+g2_tree_test_stream(const g2_tree_t *t, const void *buffer, size_t length)
+{
+	g2_frame_writer_t writer;
+	g2_frame_view_t view;
+	pmsg_t *mb;
+	size_t rlen;
+	bool ok;
+
+	/*
+	 * Lazy view testing.
+	 */
+
+	ok = g2_frame_view(&view, buffer, length, &rlen);
+	g_assert(ok);
+	g_assert(length == rlen);
+
+	g2_tree_test_view(t, &view);
+
+	ok = g2_frame_view(&view, buffer, length - 1, &rlen);
+	g_assert(!ok);			/* Truncated packet */
+
+	/*
+	 * Streaming writer testing: must be identical to tree serialization.
+	 * Start with a small buffer to exercise its resizing.
+	 */
+
+	g2_frame_writer_init(&writer, 16);
+	g2_tree_test_writer(t, &writer);
+	mb = g2_frame_writer_pmsg(&writer, PMSG_P_DATA);
+	g_assert(!g2_frame_writer_active(&writer));
+	g_assert(UNSIGNED(pmsg_size(mb)) == length);
+	g_assert(0 == memcmp(pmsg_start(mb), buffer, length));
+	pmsg_free(mb);
+}
+
 void G_COLD
 g2_tree_test(void)
 {
-	g2_tree_t *root, *first, *node, *c2, *retrieved;
+	g2_tree_t *root, *first, *node, *c2, *retrieved, *cf;
 	const char root_payload[] = "root payload";
 	const char second[] = "second payload";
-	size_t needed, length, rlen;
-	void *buffer, *large;
+	size_t needed, length, rlen, cflen;
+	void *buffer, *large, *cfbuf;
 	bool ok;
 
 	g_debug("%s() starting...", G_STRFUNC);
@@ -751,6 +845,32 @@ g2_tree_test(void)
 	g_assert(node != c2);
 	g_assert(0 == strcmp("c2", g2_tree_name(node)));
 
+	g2_tree_test_stream(root, buffer, length);
+
+	/*
+	 * An empty child with a 1-letter name has a control byte with the CF
+	 * flag set, to make it non-zero.
+	 */
+
+	cf = g2_tree_alloc_empty("cf");
+	g2_tree_add_child(cf, g2_tree_alloc_empty("e"));
+
+	cflen = g2_frame_serialize(cf, NULL, 0);
+	cfbuf = halloc(cflen);
+	length = g2_frame_serialize(cf, cfbuf, cflen);
+	g_assert(length == cflen);
+
+	g2_tree_test_stream(cf, cfbuf, cflen);
+
+	HFREE_NULL(cfbuf);
+	g2_tree_free_null(&cf);
+
+	/*
+	 * The /QH2 builder must produce the same messages as trees.
+	 */
+
+	g2_build_qh2_test();
+
 	HFREE_NULL(buffer);
 	HFREE_NULL(large);
 	g2_tree_free_null(&root);
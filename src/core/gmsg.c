@@ -475,6 +475,9 @@ gmsg_split_to_pmsg_extend(const void *head, const void *data,
  *
  * The supplied mb is cloned for each node to which it is sent. It is up
  * to the caller to free that mb, if needed, upon return.
+ *
+ * Clones are shallow: all the destination queues reference the same data
+ * buffer, so the message is never copied, however many nodes we send it to.
  */
 void
 gmsg_mb_sendto_all(const pslist_t *sl, pmsg_t *mb)
@@ -673,7 +676,7 @@ gmsg_split_routeto_one(gnutella_node_t *from, gnutella_node_t *to,
 void
 gmsg_sendto_all(const pslist_t *sl, const void *msg, uint32 size)
 {
-	pmsg_t *mb = gmsg_to_pmsg(msg, size);
+	pmsg_t *mb = NULL;
 
 	gmsg_header_check(msg, size);
 
@@ -684,10 +687,13 @@ gmsg_sendto_all(const pslist_t *sl, const void *msg, uint32 size)
 		gnutella_node_t *dn = sl->data;
 		if (!NODE_IS_ESTABLISHED(dn))
 			continue;
+		if (NULL == mb)
+			mb = gmsg_to_pmsg(msg, size);
 		mq_tcp_putq(dn->outq, pmsg_clone(mb), NULL);
 	}
 
-	pmsg_free(mb);
+	if (mb != NULL)
+		pmsg_free(mb);
 }
 
 /**
@@ -697,7 +703,7 @@ void
 gmsg_search_sendto_all(
 	const pslist_t *sl, gnet_search_t sh, const void *msg, uint32 size)
 {
-	pmsg_t *mb = gmsg_to_pmsg(msg, size);
+	pmsg_t *mb = NULL;
 
 	gmsg_header_check(msg, size);
 	g_assert(gnutella_header_get_hops(msg)<= GNET_PROPERTY(hops_random_factor));
@@ -716,10 +722,13 @@ gmsg_search_sendto_all(
 
 		if (!NODE_IS_ESTABLISHED(dn) || dn->searchq == NULL)
 			continue;
+		if (NULL == mb)
+			mb = gmsg_to_pmsg(msg, size);
 		sq_putq(dn->searchq, sh, pmsg_clone(mb));
 	}
 
-	pmsg_free(mb);
+	if (mb != NULL)
+		pmsg_free(mb);
 }
 
 /**
@@ -727,13 +736,16 @@ gmsg_search_sendto_all(
  * the list but one node ``n''.
  *
  * We never broadcast anything to a leaf node.  Those are handled specially.
+ *
+ * The message is only materialized once we know at least one node will
+ * get it, and its data buffer is then shared by all the destinations.
  */
 static void
 gmsg_split_routeto_all_but_one(const gnutella_node_t *from,
 	const pslist_t *sl, const gnutella_node_t *n,
 	const void *head, const void *data, uint32 size)
 {
-	pmsg_t *mb = gmsg_split_to_pmsg(head, data, size);
+	pmsg_t *mb = NULL;
 	bool skip_up_with_qrp = FALSE;
 
 	/*
@@ -761,14 +773,20 @@ gmsg_split_routeto_all_but_one(const gnutella_node_t *from,
 			continue;
 		if (n->header_flags && !NODE_CAN_SFLAG(dn))
 			continue;
+		if (NULL == mb)
+			mb = gmsg_split_to_pmsg(head, data, size);
 		mq_tcp_putq(dn->outq, pmsg_clone(mb), from);
 	}
 
-	pmsg_free(mb);
+	if (mb != NULL)
+		pmsg_free(mb);
 }
 
 /**
  * Route message consisting of header and data to all the nodes in the list.
+ *
+ * The message is only materialized once we know at least one node will
+ * get it, and its data buffer is then shared by all the destinations.
  */
 void
 gmsg_split_routeto_all(
@@ -776,7 +794,7 @@ gmsg_split_routeto_all(
 	const gnutella_node_t *from,
 	const void *head, const void *data, uint32 size)
 {
-	pmsg_t *mb = gmsg_split_to_pmsg(head, data, size);
+	pmsg_t *mb = NULL;
 
 	gmsg_header_check(head, size);
 
@@ -792,10 +810,13 @@ gmsg_split_routeto_all(
 		 * We have already tested that the node was being writable.
 		 */
 
+		if (NULL == mb)
+			mb = gmsg_split_to_pmsg(head, data, size);
 		mq_tcp_putq(dn->outq, pmsg_clone(mb), from);
 	}
 
-	pmsg_free(mb);
+	if (mb != NULL)
+		pmsg_free(mb);
 }
 
 /**
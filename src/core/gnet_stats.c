@@ -44,6 +44,7 @@
 #include "if/dht/kademlia.h"
 #include "if/gnet_property_priv.h"
 
+#include "lib/atomic.h"
 #include "lib/entropy.h"
 #include "lib/event.h"
 #include "lib/random.h"
@@ -75,6 +76,53 @@ static spinlock_t gnet_stats_slk = SPINLOCK_INIT;
 #define GNET_STATS_LOCK		spinlock_hidden(&gnet_stats_slk)
 #define GNET_STATS_UNLOCK	spinunlock_hidden(&gnet_stats_slk)
 
+/*
+ * Sharded general counters.
+ *
+ * The general counters are updated from many threads, on hot paths.  To avoid
+ * contention on the lock and false sharing of cache lines between threads,
+ * each thread adds to its own shard, indexed by its small thread ID.  Since
+ * only the owning thread writes to a shard, no locking is required.
+ *
+ * The value of a general counter is the sum of the base value held in
+ * gnet_stats.general[] and of all the shards, computed on read.  The base
+ * value is only changed under the lock, when a counter is set to a given
+ * value or when a new maximum is recorded, which are rarer operations.
+ */
+#define GNET_STATS_CACHELINE	64	/* Amount of bytes in a CPU cacheline */
+
+struct gnet_stats_shard {
+	uint64 general[GNR_TYPE_COUNT];
+} G_ALIGNED(GNET_STATS_CACHELINE);
+
+static struct gnet_stats_shard gnet_stats_shard[THREAD_MAX];
+
+/**
+ * Add delta to the general counter in the shard of the current thread.
+ */
+static inline void
+gnet_stats_general_add(size_t i, uint64 delta)
+{
+	gnet_stats_shard[thread_small_id()].general[i] += delta;
+}
+
+/**
+ * Compute the sum of all the shards for given general counter.
+ */
+static uint64
+gnet_stats_general_shards(size_t i)
+{
+	uint64 sum = 0;
+	uint t;
+
+	atomic_mb();
+
+	for (t = 0; t < N_ITEMS(gnet_stats_shard); t++)
+		sum += gnet_stats_shard[t].general[i];
+
+	return sum;
+}
+
 /***
  *** Public functions
  ***/
@@ -219,8 +267,11 @@ gnet_stats_udp_digest(sha1_t *digest)
 void
 gnet_stats_general_digest(sha1_t *digest)
 {
+	uint64 general[GNR_TYPE_COUNT];
+
 	gnet_stats_inc_general(GNR_STATS_DIGEST);
-	SHA1_COMPUTE(gnet_stats.general, digest);
+	gnet_stats_general_get(general);
+	SHA1_COMPUTE(general, digest);
 }
 
 /**
@@ -618,7 +669,7 @@ gnet_stats_count_expired(const gnutella_node_t *n)
         (reason == MSG_DROP_ROUTE_LOST) ||				\
         (reason == MSG_DROP_NO_ROUTE)					\
     )													\
-        gnet_stats.general[GNR_ROUTING_ERRORS]++;		\
+        gnet_stats_general_add(GNR_ROUTING_ERRORS, 1);		\
 														\
     gnet_stats.drop_reason[reason][MSG_TOTAL]++;		\
     gnet_stats.drop_reason[reason][t]++;				\
@@ -727,9 +778,7 @@ gnet_stats_count_general(gnr_stats_t type, int delta)
 
 	g_assert(i < GNR_TYPE_COUNT);
 
-	GNET_STATS_LOCK;
-    gnet_stats.general[i] += delta;
-	GNET_STATS_UNLOCK;
+	gnet_stats_general_add(i, delta);
 }
 
 /**
@@ -742,9 +791,7 @@ gnet_stats_inc_general(gnr_stats_t type)
 
 	g_assert(i < GNR_TYPE_COUNT);
 
-	GNET_STATS_LOCK;
-    gnet_stats.general[i]++;
-	GNET_STATS_UNLOCK;
+	gnet_stats_general_add(i, 1);
 }
 
 /**
@@ -757,9 +804,7 @@ gnet_stats_dec_general(gnr_stats_t type)
 
 	g_assert(i < GNR_TYPE_COUNT);
 
-	GNET_STATS_LOCK;
-    gnet_stats.general[i]--;
-	GNET_STATS_UNLOCK;
+	gnet_stats_general_add(i, -1);
 }
 
 /**
@@ -769,12 +814,22 @@ void
 gnet_stats_max_general(gnr_stats_t type, uint64 value)
 {
 	size_t i = type;
+	uint64 current;
 
 	g_assert(i < GNR_TYPE_COUNT);
 
+	/*
+	 * Counters recording a maximum are normally never incremented, hence
+	 * their shards are zero: avoid summing them unless we have a candidate.
+	 */
+
+	if G_LIKELY(value <= gnet_stats.general[i])
+		return;
+
 	GNET_STATS_LOCK;
-	if (value > gnet_stats.general[i])
-		gnet_stats.general[i] = value;
+	current = gnet_stats.general[i] + gnet_stats_general_shards(i);
+	if (value > current)
+		gnet_stats.general[i] += value - current;
 	GNET_STATS_UNLOCK;
 }
 
@@ -789,7 +844,7 @@ gnet_stats_set_general(gnr_stats_t type, uint64 value)
 	g_assert(i < GNR_TYPE_COUNT);
 
 	GNET_STATS_LOCK;
-    gnet_stats.general[i] = value;
+	gnet_stats.general[i] = value - gnet_stats_general_shards(i);
 	GNET_STATS_UNLOCK;
 }
 
@@ -808,7 +863,36 @@ gnet_stats_get_general(gnr_stats_t type)
 	value = gnet_stats.general[i];
 	GNET_STATS_UNLOCK;
 
-	return value;
+	return value + gnet_stats_general_shards(i);
+}
+
+/**
+ * Get a snapshot of all the general stats counters.
+ *
+ * This is cheaper than gnet_stats_get() when only the general counters
+ * are needed, and can be called from any thread.
+ *
+ * @param general	array of GNR_TYPE_COUNT items, filled with the counters
+ */
+void
+gnet_stats_general_get(uint64 *general)
+{
+	uint t, i;
+
+	g_assert(general != NULL);
+
+	GNET_STATS_LOCK;
+	memcpy(general, gnet_stats.general, sizeof gnet_stats.general);
+	GNET_STATS_UNLOCK;
+
+	atomic_mb();
+
+	for (t = 0; t < N_ITEMS(gnet_stats_shard); t++) {
+		const struct gnet_stats_shard *gs = &gnet_stats_shard[t];
+
+		for (i = 0; i < GNR_TYPE_COUNT; i++)
+			general[i] += gs->general[i];
+	}
 }
 
 void
@@ -938,6 +1022,8 @@ gnet_stats_get(gnet_stats_t *s)
 	GNET_STATS_LOCK;
     *s = gnet_stats;
 	GNET_STATS_UNLOCK;
+
+	gnet_stats_general_get(s->general);
 }
 
 void
@@ -51,6 +51,7 @@ void gnet_stats_dec_general(gnr_stats_t);
 void gnet_stats_max_general(gnr_stats_t type, uint64 value);
 void gnet_stats_set_general(gnr_stats_t type, uint64 value);
 uint64 gnet_stats_get_general(gnr_stats_t type);
+void gnet_stats_general_get(uint64 *general);
 void gnet_stats_count_flowc(const void *, bool head_only);
 
 void gnet_stats_g2_count_flowc(const gnutella_node_t *n,
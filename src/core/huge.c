@@ -45,7 +45,8 @@
 #include "settings.h"
 #include "share.h"
 #include "spam.h"
-#include "verify_sha1.h"
+#include "tth_cache.h"
+#include "verify_sha1_tth.h"
 #include "verify_tth.h"
 #include "version.h"
 
@@ -556,8 +557,13 @@ huge_verify_callback(const struct verify *ctx, enum verify_status status,
 	case VERIFY_PROGRESS:
 		return 0 != (SHARE_F_INDEXED & shared_file_flags(sf));
 	case VERIFY_DONE:
-		huge_update_hashes(sf, verify_sha1_digest(ctx), NULL);
-		request_tigertree(sf, TRUE);
+		{
+			const struct tth *tth = verify_sha1_tth_tth(ctx);
+
+			huge_update_hashes(sf, verify_sha1_tth_sha1(ctx), tth);
+			tth_cache_insert(tth, verify_sha1_tth_leaves(ctx),
+				verify_sha1_tth_leave_count(ctx));
+		}
 		/* FALL THROUGH */
 	case VERIFY_ERROR:
 	case VERIFY_SHUTDOWN:
@@ -574,8 +580,7 @@ huge_verify_callback(const struct verify *ctx, enum verify_status status,
 /**
  * Put the shared file on the stack of the things to do.
  *
- * We first begin with the computation of the SHA1, and when completed we
- * will continue with the TTH computation.
+ * Both the SHA1 and the TTH are computed in a single pass over the file.
  */
 static void
 queue_shared_file_for_sha1_computation(shared_file_t *sf)
@@ -584,7 +589,7 @@ queue_shared_file_for_sha1_computation(shared_file_t *sf)
 
  	shared_file_check(sf);
 
-	inserted = verify_sha1_enqueue(FALSE, shared_file_path(sf),
+	inserted = verify_sha1_tth_enqueue(FALSE, shared_file_path(sf),
 					shared_file_size(sf), huge_verify_callback,
 					shared_file_ref(sf));
 
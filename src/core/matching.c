@@ -36,12 +36,17 @@
 #include "lib/ascii.h"
 #include "lib/atomic.h"
 #include "lib/atoms.h"
+#include "lib/getcpucount.h"
 #include "lib/halloc.h"
 #include "lib/hset.h"
+#include "lib/hstrfn.h"
+#include "lib/htable.h"
 #include "lib/pattern.h"
 #include "lib/pslist.h"
 #include "lib/stringify.h"	/* For hex_escape() */
+#include "lib/thread.h"
 #include "lib/utf8.h"
+#include "lib/vsort.h"
 #include "lib/walloc.h"
 #include "lib/wordvec.h"
 
@@ -51,6 +56,16 @@
 
 #define WOVEC_DFLT	10			/**< Default size of word-vectors */
 
+/*
+ * Splitting of large bins among threads.
+ *
+ * Each thread must get at least ST_THREAD_SLICE entries to scan, otherwise
+ * the cost of launching threads offsets what we gain through concurrency.
+ */
+#define ST_THREAD_SLICE		4096	/**< Minimum amount of entries per thread */
+#define ST_THREAD_MAX		16		/**< Maximum amount of scanning threads */
+#define ST_THREAD_STACK		THREAD_STACK_MIN
+
 typedef uint64 st_mask_t;
 
 /*
@@ -84,9 +99,18 @@ typedef uint64 st_mask_t;
  *    bin["rc"] has 1
  *
  * Therefore we'll look for "arc" in the bin["rc"] list.
+ *
+ * On top of the bins, each set keeps an inverted word index: every word of
+ * the indexed names (separated by spaces, as in the query hash vector built
+ * for QRP) points to the sorted list of the entries holding that word.
+ * Since query words must match at the beginning of words, a query word can
+ * only match entries listed under words it is a prefix of.  Intersecting
+ * these lists for all the query words yields a set of candidates that is
+ * often much smaller than the smallest bin, which we scan instead.
  */
 
 #define ST_MIN_BIN_SIZE		4
+#define ST_MIN_POSTINGS		2
 
 struct st_entry {
 	const char *string;				/* atom */
@@ -99,10 +123,24 @@ struct st_bin {
 	struct st_entry **vals;
 };
 
+/*
+ * An indexed word, with the sorted list of the entries holding it.
+ *
+ * Entries are identified by their index in the "all_entries" bin.
+ */
+struct st_word {
+	const char *word;				/* atom */
+	uint32 *ids;
+	uint count, size;
+};
+
 struct st_set {
 	uint nentries, nchars, nbins;
 	struct st_bin **bins;
 	struct st_bin all_entries;
+	htable_t *word_table;			/* Word index whilst being built */
+	struct st_word **words;			/* Word index, sorted, once compacted */
+	uint nwords;
 	uchar index_map[MAX_INT_VAL(uchar)];
 	uchar fold_map[MAX_INT_VAL(uchar)];
 };
@@ -262,6 +300,9 @@ st_set_initialize(struct st_set *set)
 	set->nbins = set->nchars * set->nchars;
 	set->bins = NULL;
 	set->all_entries.vals = 0;
+	set->word_table = NULL;
+	set->words = NULL;
+	set->nwords = 0;
 
 	if (GNET_PROPERTY(matching_debug)) {
 		static bool done;
@@ -303,6 +344,11 @@ st_set_recreate(struct st_set *set)
 		set->bins[i] = NULL;
 
     bin_initialize(&set->all_entries, ST_MIN_BIN_SIZE);
+
+	g_assert(NULL == set->word_table);
+	g_assert(NULL == set->words);
+
+	set->word_table = htable_create(HASH_KEY_STRING, 0);
 }
 
 /**
@@ -317,6 +363,29 @@ st_recreate(search_table_t *table)
 	st_set_recreate(&table->alias);
 }
 
+/**
+ * Free an indexed word.
+ */
+static void
+st_word_free(struct st_word *w)
+{
+	atom_str_free_null(&w->word);
+	HFREE_NULL(w->ids);
+	WFREE(w);
+}
+
+/**
+ * htable_foreach() callback to free indexed words.
+ */
+static void
+st_word_free_kv(const void *unused_key, void *value, void *unused_data)
+{
+	(void) unused_key;
+	(void) unused_data;
+
+	st_word_free(value);
+}
+
 /**
  * Destroy a set.
  */
@@ -325,6 +394,18 @@ st_set_destroy(struct st_set *set)
 {
 	uint i;
 
+	if (set->word_table != NULL) {
+		htable_foreach(set->word_table, st_word_free_kv, NULL);
+		htable_free_null(&set->word_table);
+	}
+
+	if (set->words != NULL) {
+		for (i = 0; i < set->nwords; i++)
+			st_word_free(set->words[i]);
+		HFREE_NULL(set->words);
+		set->nwords = 0;
+	}
+
 	if (set->bins) {
 		for (i = 0; i < set->nbins; i++) {
 			struct st_bin *bin = set->bins[i];
@@ -477,6 +558,72 @@ st_key(struct st_set *set, const char k[2])
 		set->index_map[(uchar) k[1]];
 }
 
+/**
+ * Record that entry ``id'' holds the given word in the word index.
+ */
+static void
+st_index_word(struct st_set *set, const char *word, uint32 id)
+{
+	struct st_word *w;
+
+	w = htable_lookup(set->word_table, word);
+
+	if (NULL == w) {
+		WALLOC0(w);
+		w->word = atom_str_get(word);
+		w->size = ST_MIN_POSTINGS;
+		HALLOC_ARRAY(w->ids, w->size);
+		htable_insert(set->word_table, w->word, w);
+	} else if (w->ids[w->count - 1] == id) {
+		return;				/* Word repeated in the name */
+	}
+
+	if (w->count == w->size) {
+		w->size *= 2;
+		HREALLOC_ARRAY(w->ids, w->size);
+	}
+
+	/*
+	 * Entries are inserted with increasing identifiers, hence the list
+	 * remains sorted as we append to it.
+	 */
+
+	w->ids[w->count++] = id;
+}
+
+/**
+ * Index all the words of the entry string.
+ */
+static void
+st_index_entry(struct st_set *set, const struct st_entry *entry, uint32 id)
+{
+	char *str, *p, *word = NULL;
+
+	str = h_strdup(entry->string);
+
+	/*
+	 * Pattern matching with qs_begin considers that any ASCII space starts
+	 * a new word, so we split on all of them.
+	 */
+
+	for (p = str; /* empty */; p++) {
+		uchar c = *p;
+
+		if ('\0' == c || is_ascii_space(c)) {
+			*p = '\0';
+			if (word != NULL)
+				st_index_word(set, word, id);
+			word = NULL;
+			if ('\0' == c)
+				break;
+		} else if (NULL == word) {
+			word = p;
+		}
+	}
+
+	hfree(str);
+}
+
 /**
  * Insert an item into the search_table
  * one-char strings are silently ignored.
@@ -528,6 +675,9 @@ st_insert_item(search_table_t *table,
 
 		bin_insert_item(set->bins[key], entry);
 	}
+	if (set->word_table != NULL)
+		st_index_entry(set, entry, set->all_entries.nvals);
+
 	bin_insert_item(&set->all_entries, entry);
 	set->nentries++;
 
@@ -535,6 +685,57 @@ st_insert_item(search_table_t *table,
 	return TRUE;
 }
 
+/**
+ * vsort() callback to sort indexed words alphabetically.
+ */
+static int
+st_word_cmp(const void *a, const void *b)
+{
+	const struct st_word * const *wa = a, * const *wb = b;
+
+	return strcmp((*wa)->word, (*wb)->word);
+}
+
+/**
+ * htable_foreach() callback to compact an indexed word and move it to
+ * the sorted array.
+ */
+static void
+st_word_freeze(const void *unused_key, void *value, void *data)
+{
+	struct st_set *set = data;
+	struct st_word *w = value;
+
+	(void) unused_key;
+
+	HREALLOC_ARRAY(w->ids, w->count);
+	w->size = w->count;
+	set->words[set->nwords++] = w;
+}
+
+/**
+ * Turn the word table into a sorted array, so that we can look up all the
+ * words starting with a given prefix.
+ */
+static void
+st_set_index_compact(struct st_set *set)
+{
+	g_assert(NULL == set->words);
+
+	HALLOC_ARRAY(set->words, MAX(1, htable_count(set->word_table)));
+	set->nwords = 0;
+	htable_foreach(set->word_table, st_word_freeze, set);
+	htable_free_null(&set->word_table);
+
+	vsort(set->words, set->nwords, sizeof set->words[0], st_word_cmp);
+
+	if (GNET_PROPERTY(matching_debug)) {
+		g_debug("MATCH indexed %u word%s from %u entr%s",
+			set->nwords, plural(set->nwords),
+			set->all_entries.nvals, plural_y(set->all_entries.nvals));
+	}
+}
+
 /**
  * Minimize space consumption in the set.
  */
@@ -552,6 +753,9 @@ st_set_compact(struct st_set *set)
 		if (set->bins[i])
 			bin_compact(set->bins[i]);
 	}
+
+	if (set->word_table != NULL)
+		st_set_index_compact(set);
 }
 
 /**
@@ -663,6 +867,485 @@ enum search_mode {
 
 typedef size_t (*st_filename_len_fn_t)(const shared_file_t *sf);
 
+/**
+ * Scanning of a slice of the selected bin.
+ *
+ * All the fields above "pattern" are read-only and shared among all the
+ * slices of a given search.  The others are private to the slice, so that
+ * slices can be scanned concurrently by different threads.
+ *
+ * Because hash table lookups can re-organize the table, "already_matched"
+ * is only set when the whole bin is scanned by the calling thread.
+ */
+struct st_slice {
+	struct st_entry * const *vals;		/**< First entry to scan */
+	uint vcnt;							/**< Amount of entries to scan */
+	st_mask_t search_mask;				/**< Mask of the query */
+	size_t minlen;						/**< Minimum filename length */
+	const char *search;					/**< The query string (canonized) */
+	const search_request_info_t *sri;	/**< Search meta-information */
+	const hset_t *already_matched;		/**< Entries already listed, or NULL */
+	st_filename_len_fn_t flen;			/**< Filename length routine */
+	word_vec_t *wovec;					/**< Query words */
+	uint wocnt;							/**< Amount of query words */
+	cpattern_t **pattern;				/**< Lazily compiled patterns */
+	pslist_t *result;					/**< Matching entries */
+	uint nres;							/**< Amount of matches */
+	uint scanned;						/**< Amount of entries pattern-matched */
+	uint tid;							/**< Scanning thread, if any */
+};
+
+/**
+ * Scan the entries of a bin slice, collecting matches in the slice result.
+ *
+ * This is used as a thread entry point when the bin is split among threads.
+ *
+ * @return its argument.
+ */
+static void * G_HOT
+st_scan_slice(void *arg)
+{
+	struct st_slice *ctx = arg;
+	pslist_t *local = ctx->result;
+	uint i, nres = 0, scanned = 0;
+
+	for (i = 0; i < ctx->vcnt; i++) {
+		const struct st_entry *e = ctx->vals[i];
+		const shared_file_t *sf;
+		size_t filename_len;
+
+		/*
+		 * As we only return a limited amount of results, we insert all the
+		 * matching entries in a list, which will then be randomly shuffled.
+		 * Only its leading items will be extracted.
+		 *
+		 * That strategy allows us to possibly return all the matching entries
+		 * when they repeat the search over time.
+		 */
+
+		if ((e->mask & ctx->search_mask) != ctx->search_mask)
+			continue;		/* Can't match */
+
+		sf = e->sf;
+
+		if (
+			ctx->already_matched != NULL &&
+			hset_contains(ctx->already_matched, sf)
+		)
+			continue;
+
+		if (!shared_file_is_shareable(sf))
+			continue;		/* Cannot be shared */
+
+		filename_len = (*ctx->flen)(sf);
+
+		if (filename_len < ctx->minlen)
+			continue;		/* Can't match */
+
+		if (!search_apply_limits(sf, ctx->sri))
+			continue;		/* Does not pass limits the queryier has set */
+
+		scanned++;
+
+		if (entry_match(e->string, filename_len,
+				ctx->pattern, ctx->wovec, ctx->wocnt)
+		) {
+			if (GNET_PROPERTY(matching_debug) > 3) {
+				g_debug("MATCH \"%s\" matches %s",
+					ctx->search, shared_file_name_nfc(sf));
+			}
+
+			local = pslist_prepend_const(local, sf);
+			nres++;
+		}
+	}
+
+	ctx->result = local;
+	ctx->nres = nres;
+	ctx->scanned = scanned;
+
+	return ctx;
+}
+
+/**
+ * Compute the amount of threads among which a bin of ``vcnt'' entries
+ * should be split.
+ *
+ * @return 1 when the bin is to be scanned by the calling thread only.
+ */
+static uint
+st_thread_count(uint vcnt)
+{
+	static uint cpus;
+	uint n = GNET_PROPERTY(matching_threads);
+
+	if (vcnt < 2 * ST_THREAD_SLICE)
+		return 1;
+
+	if (0 == n) {
+		if G_UNLIKELY(0 == cpus)
+			cpus = getcpucount();
+		n = cpus;
+	}
+
+	n = MIN(n, vcnt / ST_THREAD_SLICE);
+
+	return MAX(1, MIN(n, ST_THREAD_MAX));
+}
+
+/**
+ * Scan the selected bin, splitting it among several threads when it is
+ * large enough, each thread scanning a contiguous slice of the bin.
+ *
+ * The calling thread scans the first slice itself and then waits for the
+ * other threads, so that the shared file entries cannot change whilst they
+ * are being looked at.  Matching entries are prepended to the list.
+ *
+ * @param tmpl		template for slices, holding the shared search parameters
+ * @param bin		the bin to scan
+ * @param result	list where matching entries are prepended
+ * @param scanned	where the amount of pattern-matched entries is returned
+ * @param compiled	where the maximum amount of compiled patterns is returned
+ *
+ * @return amount of matching entries added to the list.
+ */
+static uint
+st_scan_bin(const struct st_slice *tmpl, const struct st_bin *bin,
+	pslist_t **result, uint *scanned, uint *compiled)
+{
+	struct st_slice slices[ST_THREAD_MAX];
+	const hset_t *dups = NULL;
+	uint i, j, n, nres = 0, chunk;
+
+	n = st_thread_count(bin->nvals);
+	chunk = bin->nvals / n;
+
+	if (n > 1)
+		dups = tmpl->already_matched;	/* Checked when gathering results */
+
+	for (i = 0; i < n; i++) {
+		struct st_slice *ctx = &slices[i];
+
+		*ctx = *tmpl;		/* Struct copy */
+		ctx->vals = &bin->vals[i * chunk];
+		ctx->vcnt = (i == n - 1) ? bin->nvals - i * chunk : chunk;
+		ctx->tid = THREAD_INVALID_ID;
+		ctx->result = NULL;
+		if (dups != NULL)
+			ctx->already_matched = NULL;
+		WALLOC0_ARRAY(ctx->pattern, ctx->wocnt);
+	}
+
+	/*
+	 * Launch threads for all the slices but the first one, which is handled
+	 * by the calling thread.  If we cannot create a thread, the slice will
+	 * be scanned by the calling thread as well.
+	 */
+
+	for (i = 1; i < n; i++) {
+		slices[i].tid = thread_create(st_scan_slice, &slices[i],
+			THREAD_F_NO_CANCEL, ST_THREAD_STACK);
+		if G_UNLIKELY(THREAD_INVALID_ID == slices[i].tid) {
+			s_warning_once_per(LOG_PERIOD_SECOND,
+				"%s(): cannot create new thread: %m", G_STRFUNC);
+		}
+	}
+
+	for (i = 0; i < n; i++) {
+		struct st_slice *ctx = &slices[i];
+
+		if (THREAD_INVALID_ID == ctx->tid) {
+			st_scan_slice(ctx);
+		} else if (-1 == thread_join(ctx->tid, NULL)) {
+			s_error("%s(): cannot join with %s: %m",
+				G_STRFUNC, thread_id_name(ctx->tid));
+		}
+	}
+
+	/*
+	 * Gather results, discarding entries already listed when the threads
+	 * could not check for them.
+	 *
+	 * Matching patterns are lazily compiled by entry_match(), as they are
+	 * needed, but in order.  Therefore we can stop as soon as we hit a NULL
+	 * entry in the array.
+	 */
+
+	*scanned = *compiled = 0;
+
+	for (i = 0; i < n; i++) {
+		struct st_slice *ctx = &slices[i];
+
+		if (dups != NULL) {
+			const shared_file_t *sf;
+
+			while (NULL != (sf = pslist_shift(&ctx->result))) {
+				if (hset_contains(dups, sf))
+					ctx->nres--;
+				else
+					*result = pslist_prepend_const(*result, sf);
+			}
+		} else {
+			*result = pslist_concat(ctx->result, *result);
+		}
+
+		nres += ctx->nres;
+		*scanned += ctx->scanned;
+
+		for (j = 0; j < ctx->wocnt; j++) {
+			if (NULL == ctx->pattern[j])
+				break;
+			pattern_free(ctx->pattern[j]);
+		}
+		*compiled = MAX(*compiled, j);
+
+		WFREE_ARRAY(ctx->pattern, ctx->wocnt);
+	}
+
+	if (n > 1 && GNET_PROPERTY(matching_debug) > 2) {
+		g_debug("MATCH %s(): scanned %u-entry bin with %u threads",
+			G_STRFUNC, bin->nvals, n);
+	}
+
+	return nres;
+}
+
+/*
+ * Range of indexed words starting with a query word.
+ */
+struct st_range {
+	uint lo, hi;			/* Words in [lo, hi[ start with the query word */
+	uint total;				/* Amount of postings in the range */
+};
+
+/**
+ * vsort() callback to sort ranges by increasing amount of postings.
+ */
+static int
+st_range_cmp(const void *a, const void *b)
+{
+	const struct st_range *ra = a, *rb = b;
+
+	return CMP(ra->total, rb->total);
+}
+
+/**
+ * vsort() callback to sort entry identifiers.
+ */
+static int
+st_id_cmp(const void *a, const void *b)
+{
+	const uint32 *ia = a, *ib = b;
+
+	return CMP(*ia, *ib);
+}
+
+/**
+ * Look for the indexed words starting with the query word.
+ *
+ * @param set		the set whose word index we're looking at
+ * @param wv		the query word
+ * @param limit		stop counting postings when reaching this amount
+ * @param range		filled with the range of words found
+ *
+ * @return TRUE if the range holds less than ``limit'' postings.
+ */
+static bool
+st_index_range(const struct st_set *set, const word_vec_t *wv,
+	uint limit, struct st_range *range)
+{
+	uint lo = 0, hi = set->nwords, i;
+	size_t total = 0;
+
+	/*
+	 * Find the first word not sorting before the query word.
+	 */
+
+	while (lo < hi) {
+		uint mid = lo + (hi - lo) / 2;
+
+		if (strcmp(set->words[mid]->word, wv->word) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	for (i = lo; i < set->nwords; i++) {
+		const struct st_word *w = set->words[i];
+
+		if (0 != strncmp(w->word, wv->word, wv->len))
+			break;
+
+		total += w->count;
+		if (total >= limit)
+			return FALSE;
+	}
+
+	range->lo = lo;
+	range->hi = i;
+	range->total = total;
+
+	return TRUE;
+}
+
+/**
+ * Merge the posting lists of the words in the range.
+ *
+ * @return sorted array of distinct identifiers, its length in ``count''.
+ */
+static uint32 *
+st_index_union(const struct st_set *set, const struct st_range *range,
+	uint *count)
+{
+	uint32 *ids;
+	uint i, n = 0;
+
+	HALLOC_ARRAY(ids, MAX(1, range->total));
+
+	for (i = range->lo; i < range->hi; i++) {
+		const struct st_word *w = set->words[i];
+
+		memcpy(&ids[n], w->ids, w->count * sizeof ids[0]);
+		n += w->count;
+	}
+
+	g_assert(n == range->total);
+
+	/*
+	 * A single posting list is already sorted and without duplicates.
+	 */
+
+	if (range->hi - range->lo > 1 && n > 1) {
+		uint j;
+
+		vsort(ids, n, sizeof ids[0], st_id_cmp);
+
+		for (i = 1, j = 0; i < n; i++) {
+			if (ids[i] != ids[j])
+				ids[++j] = ids[i];
+		}
+		n = j + 1;
+	}
+
+	*count = n;
+	return ids;
+}
+
+/**
+ * Intersect two sorted lists, the result replacing the first one.
+ *
+ * @return the amount of identifiers left in the first list.
+ */
+static uint
+st_index_intersect(uint32 *a, uint na, const uint32 *b, uint nb)
+{
+	uint i = 0, j = 0, n = 0;
+
+	while (i < na && j < nb) {
+		if (a[i] < b[j])
+			i++;
+		else if (a[i] > b[j])
+			j++;
+		else {
+			a[n++] = a[i];
+			i++;
+			j++;
+		}
+	}
+
+	return n;
+}
+
+/**
+ * Use the word index to compute the entries which can match the query.
+ *
+ * Each query word can only match entries listed under the indexed words it
+ * is a prefix of.  The resulting candidates must still be pattern-matched
+ * since query words may need to appear several times.
+ *
+ * @param set		the set whose word index we're using
+ * @param wovec		the query words
+ * @param wocnt		amount of query words
+ * @param limit		amount of entries we would otherwise scan
+ * @param vals		where the allocated array of candidates is returned
+ *
+ * @return the amount of candidates, -1 if the index cannot do better than
+ * scanning ``limit'' entries.
+ */
+static int
+st_index_candidates(const struct st_set *set,
+	const word_vec_t *wovec, uint wocnt, uint limit, struct st_entry ***vals)
+{
+	struct st_range *ranges;
+	uint32 *ids = NULL;
+	uint i, j, n = 0, usable = 0;
+	int result = -1;
+
+	if (NULL == set->words)
+		return -1;
+
+	/*
+	 * Query words holding other spaces than plain ones cannot be found in
+	 * the index, which splits indexed names on all spaces.
+	 */
+
+	for (i = 0; i < wocnt; i++) {
+		for (j = 0; j < wovec[i].len; j++) {
+			if (is_ascii_space(wovec[i].word[j]))
+				return -1;
+		}
+	}
+
+	WALLOC_ARRAY(ranges, wocnt);
+
+	for (i = 0; i < wocnt; i++) {
+		if (st_index_range(set, &wovec[i], limit, &ranges[usable])) {
+			if (0 == ranges[usable].total) {
+				result = 0;			/* Word not indexed, nothing can match */
+				goto done;
+			}
+			usable++;
+		}
+	}
+
+	if (0 == usable)
+		goto done;
+
+	/*
+	 * Start with the smallest range, then intersect with the others.
+	 */
+
+	vsort(ranges, usable, sizeof ranges[0], st_range_cmp);
+
+	ids = st_index_union(set, &ranges[0], &n);
+
+	for (i = 1; i < usable && n != 0; i++) {
+		uint32 *other;
+		uint count;
+
+		other = st_index_union(set, &ranges[i], &count);
+		n = st_index_intersect(ids, n, other, count);
+		HFREE_NULL(other);
+	}
+
+	HALLOC_ARRAY(*vals, MAX(1, n));
+
+	for (i = 0; i < n; i++) {
+		g_assert(ids[i] < set->all_entries.nvals);
+		(*vals)[i] = set->all_entries.vals[ids[i]];
+	}
+
+	result = n;
+
+	/* FALL THROUGH */
+
+done:
+	HFREE_NULL(ids);
+	WFREE_ARRAY(ranges, wocnt);
+
+	return result;
+}
+
 /**
  * Perform search.
  *
@@ -693,15 +1376,14 @@ st_run_search(
 	uint best_bin_size = UINT_MAX;
 	word_vec_t *wovec;
 	uint wocnt;
-	cpattern_t **pattern;
-	struct st_entry **vals;
-	uint vcnt;
-	int scanned = 0;		/* measure search mask efficiency */
-	pslist_t *local;
+	uint scanned;			/* measure search mask efficiency */
+	uint compiled;
 	st_mask_t search_mask;
 	size_t minlen;
 	hset_t *already_matched = NULL;	/* entries that are already in the list */
-	st_filename_len_fn_t flen;
+	struct st_slice tmpl;
+	struct st_entry **candidates = NULL;
+	int ncand;
 
 	g_assert(implies(SEARCH_ALIAS == mode, NULL == qhv));
 
@@ -804,8 +1486,6 @@ st_run_search(
 
 	g_assert(best_bin_size > 0);	/* Allocated bin, it must hold something */
 
-	WALLOC0_ARRAY(pattern, wocnt);
-
 	/*
 	 * Prepare matching optimization, an idea from Mike Green.
 	 *
@@ -836,95 +1516,51 @@ st_run_search(
 	minlen--;
 	g_assert(minlen <= INT_MAX);		/* No overflows */
 
-	flen = SEARCH_NORMAL == mode ?
-		shared_file_name_canonic_len : shared_file_name_normalized_len;
-
 	/*
-	 * Search through the smallest bin
+	 * Search through the smallest bin, or through the candidates supplied
+	 * by the word index when they are fewer, possibly splitting the scan
+	 * among threads when there are many entries to look at.
 	 */
 
-	vcnt = best_bin->nvals;
-	vals = best_bin->vals;
-
-	nres = 0;
-	local = *result;
-	for (i = 0; i < vcnt; i++) {
-		const struct st_entry *e = vals[i];
-		const shared_file_t *sf;
-		size_t filename_len;
-
-		/*
-		 * As we only return a limited amount of results, we insert all the
-		 * matching entries in a list, which will then be randomly shuffled.
-		 * Only its leading items will be extracted.
-		 *
-		 * That strategy allows us to possibly return all the matching entries
-		 * when they repeat the search over time.
-		 */
-
-		if ((e->mask & search_mask) != search_mask)
-			continue;		/* Can't match */
-
-		sf = e->sf;
-
-		if (already_matched != NULL && hset_contains(already_matched, sf))
-			continue;
-
-		if (!shared_file_is_shareable(sf))
-			continue;		/* Cannot be shared */
-
-		filename_len = (*flen)(sf);
-
-		if (filename_len < minlen)
-			continue;		/* Can't match */
+	ZERO(&tmpl);
+	tmpl.search_mask = search_mask;
+	tmpl.minlen = minlen;
+	tmpl.search = search;
+	tmpl.sri = sri;
+	tmpl.already_matched = already_matched;
+	tmpl.flen = SEARCH_NORMAL == mode ?
+		shared_file_name_canonic_len : shared_file_name_normalized_len;
+	tmpl.wovec = wovec;
+	tmpl.wocnt = wocnt;
 
-		if (!search_apply_limits(sf, sri))
-			continue;		/* Does not pass limits the queryier has set */
+	ncand = st_index_candidates(set, wovec, wocnt, best_bin_size, &candidates);
 
-		scanned++;
-
-		if (entry_match(e->string, filename_len, pattern, wovec, wocnt)) {
-			if (GNET_PROPERTY(matching_debug) > 3) {
-				g_debug("MATCH \"%s\" matches %s",
-					search, shared_file_name_nfc(sf));
-			}
+	if (ncand >= 0) {
+		struct st_bin cbin;
 
-			local = pslist_prepend_const(local, sf);
-			nres++;
+		if (GNET_PROPERTY(matching_debug) > 1) {
+			g_debug("MATCH %s(): word index yields %d candidate%s "
+				"instead of %u bin entr%s",
+				G_STRFUNC, ncand, plural(ncand),
+				best_bin_size, plural_y(best_bin_size));
 		}
-	}
 
-	*result = local;
+		cbin.nvals = cbin.nslots = ncand;
+		cbin.vals = candidates;
+		nres = st_scan_bin(&tmpl, &cbin, result, &scanned, &compiled);
+		HFREE_NULL(candidates);
+	} else {
+		nres = st_scan_bin(&tmpl, best_bin, result, &scanned, &compiled);
+	}
 
 	if (GNET_PROPERTY(matching_debug) > 2) {
-		uint compiled = 0;
-
-		for (i = 0; i < wocnt; i++) {
-			if (NULL == pattern[i])
-				break;
-			compiled++;
-		}
-
 		g_debug("MATCH %s(): "
-			"scanned %d/%d bin entr%s, "
-			"compiled %u/%u pattern%s, got %d match%s",
+			"scanned %u/%u bin entr%s, "
+			"compiled %u/%u pattern%s, got %u match%s",
 			G_STRFUNC, scanned, best_bin_size, plural_y(scanned),
 			compiled, wocnt, plural(compiled), nres, plural_es(nres));
 	}
 
-	/*
-	 * Matching patterns are lazily compiled by entry_match(), as they are
-	 * needed, but in order.  Therefore we can stop as soon as we hit a NULL
-	 * entry in the array.
-	 */
-
-	for (i = 0; i < wocnt; i++) {
-		if (NULL == pattern[i])
-			break;
-		pattern_free(pattern[i]);
-	}
-
-	WFREE_ARRAY(pattern, wocnt);
 	word_vec_free(wovec, wocnt);
 
 	/* FALL THROUGH */
@@ -60,6 +60,11 @@
 #include "if/gnet_property.h"
 #include "if/gnet_property_priv.h"
 
+#ifdef HAS_FICLONE
+#include <sys/ioctl.h>
+#include <linux/fs.h>		/* For FICLONE */
+#endif
+
 #include "lib/override.h"	/* Must be the last header included */
 
 #define COPY_BLOCK_FRAGMENT	4096		/**< Power of two of copy unit credit */
@@ -87,6 +92,7 @@ struct moved {
 	time_delta_t elapsed;	/**< Elapsed time, set when move is completed */
 	int wd;					/**< File descriptor for write, -1 if none */
 	int error;				/**< Error code */
+	bool kernel_copy;		/**< Whether to attempt copy_file_range() */
 };
 
 /**
@@ -221,6 +227,46 @@ move_starting(void *ctx)
 	return NULL;
 }
 
+#ifdef HAS_FICLONE
+/**
+ * Attempt to clone the source file into the target, on filesystems
+ * supporting reflinks: the target then shares the data blocks of the
+ * source and no data need to be copied at all.
+ *
+ * @return TRUE if the file was cloned, FALSE if it must be copied.
+ */
+static bool
+move_clone(struct moved *md)
+{
+	/*
+	 * Calling file_object_fd() is safe here, see move_d_step_copy().
+	 */
+
+	if (-1 == ioctl(md->wd, FICLONE, file_object_fd(md->rd))) {
+		if (GNET_PROPERTY(move_debug) > 1) {
+			g_debug("MOVE cannot clone \"%s\" to \"%s\": %m",
+				file_object_pathname(md->rd), md->target);
+		}
+		return FALSE;
+	}
+
+	/*
+	 * The whole file was cloned, including the fileinfo trailer which
+	 * we must now strip, as we would have done by copying only the
+	 * first md->size bytes.
+	 */
+
+	if (-1 == ftruncate(md->wd, md->size)) {
+		g_warning("cannot truncate clone \"%s\": %m", md->target);
+		if (-1 == ftruncate(md->wd, 0))
+			md->error = errno;
+		return FALSE;
+	}
+
+	return TRUE;
+}
+#endif	/* HAS_FICLONE */
+
 /**
  * Daemon's notification: starting to work on item.
  */
@@ -280,6 +326,18 @@ move_d_start(struct bgtask *h, void *ctx, void *item)
 	md->copied = 0;
 	md->last_notify = md->start;
 	md->error = 0;
+	md->kernel_copy = TRUE;
+
+#ifdef HAS_FICLONE
+	if (md->size != 0 && move_clone(md)) {
+		md->copied = md->size;
+		if (GNET_PROPERTY(move_debug) > 1) {
+			g_debug("MOVE cloned \"%s\" to \"%s\"",
+				file_object_pathname(md->rd), md->target);
+		}
+		return;
+	}
+#endif
 
 	file_object_fadvise_sequential(md->rd);
 
@@ -432,6 +490,63 @@ move_progress(void *ctx)
 	return NULL;
 }
 
+#ifdef HAS_COPY_FILE_RANGE
+/**
+ * Copy data from the source file to the target within the kernel, which
+ * can also let the filesystem (or the NFS server) perform the copy itself.
+ *
+ * @param md		the moving context
+ * @param amount	the maximum amount of bytes to copy
+ *
+ * @return the amount of bytes copied, 0 if copy_file_range() cannot be used
+ * and we must fall back to regular copying, -1 on error with md->error set.
+ */
+static ssize_t
+move_copy_range(struct moved *md, size_t amount)
+{
+	off_t off = md->copied;
+	ssize_t r;
+
+	/*
+	 * The target offset is left to the kernel, so that the file position
+	 * remains correct should we need to fall back to regular copying.
+	 */
+
+	r = copy_file_range(file_object_fd(md->rd), &off, md->wd, NULL, amount, 0);
+
+	if ((ssize_t) -1 == r) {
+		switch (errno) {
+		case EXDEV:			/* Cross-filesystem copy unsupported (pre 5.3) */
+		case ENOSYS:		/* Not supported by the kernel */
+		case EOPNOTSUPP:	/* Not supported by the filesystem */
+		case EINVAL:		/* Idem, or special files */
+		case EBADF:			/* Some FUSE filesystems */
+			if (GNET_PROPERTY(move_debug) > 1) {
+				g_debug("MOVE no copy_file_range() for \"%s\": %m",
+					download_basename(md->d));
+			}
+			md->kernel_copy = FALSE;
+			return 0;
+		default:
+			break;
+		}
+		md->error = errno;
+		g_warning("error while copying \"%s\" for moving \"%s\": %m",
+			file_object_pathname(md->rd), download_basename(md->d));
+		return -1;
+	} else if (0 == r) {
+		g_warning("EOF while copying \"%s\" for moving!",
+			file_object_pathname(md->rd));
+		md->error = -1;
+		return -1;
+	}
+
+	g_assert((size_t) r <= amount);
+
+	return r;
+}
+#endif	/* HAS_COPY_FILE_RANGE */
+
 /**
  * Copy file around, incrementally.
  */
@@ -453,25 +568,26 @@ move_d_step_copy(struct bgtask *h, void *u, int ticks)
 	if (md->size == 0)			/* Empty file */
 		return BGR_DONE;
 
+	if (md->error != 0)			/* Failed whilst starting */
+		return BGR_DONE;
+
+	if (md->copied == md->size) {	/* File was cloned */
+		teq_safe_rpc(THREAD_MAIN_ID, move_progress, md);
+		return BGR_DONE;
+	}
+
 again:		/* Avoids indenting all this code */
 
 	g_assert(md->size > md->copied);
 	remain = md->size - md->copied;
 
 	/*
-	 * When we use sendfile(), we have no use for the internal buffer,
-	 * hence there is no need to limit the amount of data to transfer.
-	 */
-
-#ifndef HAS_SENDFILE
-	remain = MIN(remain, COPY_BUF_SIZE);
-#endif
-
-	/*
-	 * Each tick we have can buy us COPY_BLOCK_FRAGMENT bytes.
+	 * Each tick we have can buy us COPY_BLOCK_FRAGMENT bytes, and we copy
+	 * at most md->size bytes total, to stop before the fileinfo trailer.
 	 *
-	 * We read into a COPY_BUF_SIZE bytes buffer, and at most md->size
-	 * bytes total, to stop before the fileinfo trailer.
+	 * When we use sendfile() or copy_file_range(), we have no use for the
+	 * internal buffer, hence there is no need to limit the amount of data
+	 * to transfer any further.
 	 */
 
 	amount = MAX(0, ticks);
@@ -480,6 +596,22 @@ again:		/* Avoids indenting all this code */
 
 	g_assert(amount > 0);
 
+#ifdef HAS_COPY_FILE_RANGE
+	if (md->kernel_copy) {
+		r = move_copy_range(md, amount);
+		if ((ssize_t) -1 == r)
+			return BGR_DONE;
+		else if (r > 0)
+			goto copied;
+
+		/* Fall back to regular copying */
+	}
+#endif	/* HAS_COPY_FILE_RANGE */
+
+#ifndef HAS_SENDFILE
+	amount = MIN(amount, COPY_BUF_SIZE);	/* We read into md->buffer */
+#endif
+
 #ifdef HAS_SENDFILE
 	{
 		off_t off = md->copied;
@@ -530,6 +662,9 @@ again:		/* Avoids indenting all this code */
 
 	g_assert((size_t) r == amount);
 
+#ifdef HAS_COPY_FILE_RANGE
+copied:
+#endif
 	md->copied += r;
 
 	/*
@@ -40,7 +40,6 @@
 #include "gmsg.h"
 #include "gnet_stats.h"
 
-#include "lib/array_util.h"
 #include "lib/cq.h"
 #include "lib/halloc.h"
 #include "lib/htable.h"
@@ -50,7 +49,6 @@
 #include "lib/stringify.h"		/* For plural() */
 #include "lib/unsigned.h"		/* For size_saturate_add() */
 #include "lib/walloc.h"
-#include "lib/xsort_data.h"
 
 #include "if/gnet_property_priv.h"
 
@@ -59,9 +57,10 @@
 #define MQ_DEBUG_LVL(q)	(*q->debug)
 
 static void qlink_free(mqueue_t *q);
+static int qlink_cmp(const mqueue_t *q, const plist_t *l1, const plist_t *l2);
 static void mq_update_flowc(mqueue_t *q);
 static bool make_room_header(
-	mqueue_t *q, const char *header, uint prio, int needed, int *offset);
+	mqueue_t *q, const char *header, uint prio, int needed);
 static void mq_swift_timer(cqueue_t *cq, void *obj);
 
 /**
@@ -306,13 +305,15 @@ mq_check_track(mqueue_t *q, int offset, const char *where, int line)
 	for (n = 0; n < q->qlink_count; n++) {
 		plist_t *item = q->qlink[n];
 		mqueue_t *owner;
+		void *pos;
 
 		if (item == NULL)
-			continue;
+			g_error("BUG: linkable #%d/%d from %s is NULL at %s:%d",
+				n, q->qlink_count, mq_info(q), where, line);
 
 		qlink_alive++;
 		if (item->data == NULL)
-			g_error("BUG: linkable #%d/%d from %s is NULL at %s:%d",
+			g_error("BUG: linkable #%d/%d from %s has no data at %s:%d",
 				n, q->qlink_count, mq_info(q), where, line);
 
 		g_assert(qown);		/* If we have a qlink, we have added items */
@@ -326,8 +327,24 @@ mq_check_track(mqueue_t *q, int offset, const char *where, int line)
 					"does not belong to any queue" :
 					"belongs to foreign queue",
 				where, line);
+
+		if (
+			!htable_lookup_extended(q->qpos, item, NULL, &pos) ||
+			pointer_to_int(pos) != n
+		)
+			g_error("BUG: linkable #%d/%d from %s has wrong position at %s:%d",
+				n, q->qlink_count, mq_info(q), where, line);
+
+		if (n > 0 && qlink_cmp(q, q->qlink[(n - 1) / 2], item) > 0)
+			g_error("BUG: linkable #%d/%d from %s breaks heap order at %s:%d",
+				n, q->qlink_count, mq_info(q), where, line);
 	}
 
+	if (htable_count(q->qpos) != UNSIGNED(q->qlink_count))
+		g_error("BUG: qlink position table for %s has %zu entries, "
+			"expected %d at %s:%d",
+			mq_info(q), htable_count(q->qpos), q->qlink_count, where, line);
+
 	if (qlink_alive != qcount + offset)
 		g_error("BUG: qlink discrepancy for %s "
 		"(counted %d alive linkable, expected %d, queue has %d items) at %s:%d",
@@ -512,7 +529,7 @@ mq_swift_checkpoint(mqueue_t *q, bool initial)
 			int old_size = q->size;
 			const void *base = iovec_base(&templates[i]);
 
-			if (make_room_header(q, base, PMSG_P_DATA, needed, NULL))
+			if (make_room_header(q, base, PMSG_P_DATA, needed))
 				break;
 
 			needed -= old_size - q->size;		/* Amount we removed */
@@ -737,25 +754,93 @@ mq_flush(mqueue_t *q)
 }
 
 /**
- * Compare two pointers to links based on their relative priorities, then
- * based on their held Gnutella messages.
- * -- qsort() callback but with an extra data parameter
+ * Compare two links based on their relative priorities, then based on
+ * their held Gnutella messages.
+ *
+ * @return negative value if `l1' is less valuable than `l2', 0 if they are
+ * equivalent and a positive value otherwise.
  */
 static int
-qlink_cmp(const void *a, const void *b, void *data)
+qlink_cmp(const mqueue_t *q, const plist_t *l1, const plist_t *l2)
 {
-	const plist_t * const *l1 = a, * const *l2 = b;
-	const pmsg_t *m1 = (*l1)->data, *m2 = (*l2)->data;
+	const pmsg_t *m1 = l1->data, *m2 = l2->data;
 
-	if (pmsg_prio(m1) == pmsg_prio(m2)) {
-		const mqueue_t *q = data;
+	if (pmsg_prio(m1) == pmsg_prio(m2))
 		return q->uops->msg_cmp(pmsg_start(m1), pmsg_start(m2));
-	} else
+	else
 		return pmsg_prio(m1) < pmsg_prio(m2) ? -1 : +1;
 }
 
 /**
- * Create the `qlink' sorted array of queued items.
+ * Store linkable `l' at index `i' in the qlink heap, recording its position.
+ */
+static inline void
+qlink_set(mqueue_t *q, int i, plist_t *l)
+{
+	q->qlink[i] = l;
+	htable_insert(q->qpos, l, int_to_pointer(i));
+}
+
+/**
+ * Move the entry at index `i' in the qlink heap up towards the root until
+ * its parent is no longer more valuable than itself.
+ */
+static void
+qlink_sift_up(mqueue_t *q, int i)
+{
+	plist_t *l = q->qlink[i];
+
+	while (i > 0) {
+		int parent = (i - 1) / 2;
+		plist_t *p = q->qlink[parent];
+
+		if (qlink_cmp(q, p, l) <= 0)
+			break;
+
+		qlink_set(q, i, p);
+		i = parent;
+	}
+
+	qlink_set(q, i, l);
+}
+
+/**
+ * Move the entry at index `i' in the qlink heap down towards the leaves
+ * until none of its children are less valuable than itself.
+ */
+static void
+qlink_sift_down(mqueue_t *q, int i)
+{
+	plist_t *l = q->qlink[i];
+	int n = q->qlink_count;
+
+	for (;;) {
+		int c = 2 * i + 1;
+		plist_t *child;
+
+		if (c >= n)
+			break;
+
+		if (c + 1 < n && qlink_cmp(q, q->qlink[c + 1], q->qlink[c]) < 0)
+			c++;
+
+		child = q->qlink[c];
+
+		if (qlink_cmp(q, l, child) <= 0)
+			break;
+
+		qlink_set(q, i, child);
+		i = c;
+	}
+
+	qlink_set(q, i, l);
+}
+
+/**
+ * Create the `qlink' heap of queued items.
+ *
+ * The least valuable message, i.e. the first one we would drop to make
+ * room in the queue, is always at the root of the heap.
  */
 static void
 qlink_create(mqueue_t *q)
@@ -764,20 +849,21 @@ qlink_create(mqueue_t *q)
 	int n;
 
 	g_assert(q->qlink == NULL);
+	g_assert(q->qpos == NULL);
 
-	HALLOC_ARRAY(q->qlink, q->count);
+	q->qlink_size = MAX(q->count, 1);
+	HALLOC_ARRAY(q->qlink, q->qlink_size);
+	q->qpos = htable_create(HASH_KEY_SELF, 0);
 
 	/*
-	 * Prepare sorting of queued messages.
-	 *
-	 * What's sorted is queue links, but the sorting criteria is the
+	 * What's ordered is queue links, but the ordering criteria is the
 	 * user-supplied msg_cmp routine to compare the messages, when they
 	 * have the same priority.
 	 */
 
 	for (l = q->qhead, n = 0; l && n < q->count; l = plist_next(l), n++) {
 		g_assert(l->data != NULL);
-		q->qlink[n] = l;
+		qlink_set(q, n, l);
 	}
 
 	if (l || n != q->count)
@@ -787,16 +873,20 @@ qlink_create(mqueue_t *q)
 	/*
 	 * We use `n' and not `q->count' in case the warning above is emitted,
 	 * in which case we have garbage after the `n' first items.
+	 *
+	 * Build the heap bottom-up, which is linear in the amount of items.
 	 */
 
 	q->qlink_count = n;
-	xsort_with_data(q->qlink, n, sizeof q->qlink[0], qlink_cmp, q);
+
+	while (n-- > 0)
+		qlink_sift_down(q, n);
 
 	mq_check(q, 0);
 }
 
 /**
- * Free the `qlink' sorted array of queued items.
+ * Free the `qlink' heap of queued items.
  */
 static void
 qlink_free(mqueue_t *q)
@@ -804,202 +894,60 @@ qlink_free(mqueue_t *q)
 	g_assert(q->qlink);
 
 	HFREE_NULL(q->qlink);
-	q->qlink_count = 0;
+	htable_free_null(&q->qpos);
+	q->qlink_count = q->qlink_size = 0;
 }
 
 /**
- * Insert linkable `l' within the sorted qlink array of linkables for the queue,
- * before the position indicated by `hint'.
+ * Insert linkable `l' within the qlink heap of linkables.
  */
 static void
-qlink_insert_before(mqueue_t *q, int hint, plist_t *l)
+qlink_insert(mqueue_t *q, plist_t *l)
 {
-	g_assert(hint >= 0 && hint < q->qlink_count);
-	g_assert(qlink_cmp(&q->qlink[hint], &l, q) >= 0);	/* `hint' >= `l' */
 	g_assert(l->data != NULL);
 
 	mq_check(q, -1);
 
-	/*
-	 * Lookup before the message for a NULL entry that we could fill.
-	 */
-
-	if (hint > 0 && q->qlink[hint - 1] == NULL) {
-		q->qlink[hint - 1] = l;
-		return;
+	if (q->qlink_count >= q->qlink_size) {
+		q->qlink_size = MAX(q->qlink_size * 2, 8);
+		HREALLOC_ARRAY(q->qlink, q->qlink_size);
 	}
 
-	/*
-	 * Extend the array then, and insert right at `hint' in the new array.
-	 */
-
-	q->qlink_count++;
-	HREALLOC_ARRAY(q->qlink, q->qlink_count);
-
-	ARRAY_INSERT(q->qlink, hint, q->qlink_count, l);
+	q->qlink[q->qlink_count++] = l;
+	qlink_sift_up(q, q->qlink_count - 1);
 }
 
 /**
- * Insert linkable `l' within the sorted qlink array of linkables.
+ * Delete the entry at index `i' in the qlink heap.
  */
 static void
-qlink_insert(mqueue_t *q, plist_t *l)
+qlink_delete(mqueue_t *q, int i)
 {
-	int low = 0;
-	int high = q->qlink_count - 1;
-	plist_t **qlink = q->qlink;
+	int last;
 
-	g_assert(l->data != NULL);
-
-	mq_check(q, -1);
+	g_assert(i >= 0 && i < q->qlink_count);
 
-	/*
-	 * If `qlink' is empty, create a slot for the new entry.
-	 */
+	htable_remove(q->qpos, q->qlink[i]);
+	last = --q->qlink_count;
 
-	if (high < 0) {
-		g_assert(q->count == 1);		/* `l' is already part of the queue */
-		q->qlink_count++;
-		HREALLOC_ARRAY(q->qlink, q->qlink_count);
-		q->qlink[0] = l;
+	if (i == last)
 		return;
-	}
 
 	/*
-	 * If lower than the beginning, insert at the head.
+	 * Move the last entry in the freed slot and restore the heap ordering,
+	 * which can require moving it either way.
 	 */
 
-	if (qlink[low] != NULL && qlink_cmp(&l, &qlink[low], q) <= 0) {
-		qlink_insert_before(q, low, l);
-		return;
-	}
+	q->qlink[i] = q->qlink[last];
 
-	/*
-	 * If higher than the tail, insert at the tail.
-	 */
-
-	if (qlink[high] != NULL && qlink_cmp(&l, &qlink[high], q) >= 0) {
-		q->qlink_count++;
-		HREALLOC_ARRAY(q->qlink, q->qlink_count);
-		q->qlink[q->qlink_count - 1] = l;
-		return;
-	}
-
-	/*
-	 * The array is sorted, so we're going to use a dichotomic search
-	 * to find the right insertion point.  However, there can be NULLified
-	 * entries in the array, so this is not a plain dichotomic search.
-	 */
-
-	while (low <= high) {
-		int mid = low + (high - low) / 2;
-		int c;
-
-		/*
-		 * If we end up in a NULL spot, inspect the [low, high] range.
-		 */
-
-		if (qlink[mid] == NULL) {
-			int n;
-			int lowest_non_null = -1;
-			int highest_non_null = -1;
-
-			/*
-			 * Go back towards `low' to find a non-NULL entry.
-			 */
-
-			for (n = mid - 1; n >= low; n--) {
-				if (qlink[n] != NULL) {
-					lowest_non_null = n;
-					break;
-				}
-			}
-
-			/*
-			 * Go forward towards `high' to find a non-NULL entry.
-			 */
-
-			for (n = mid + 1; n <= high; n++) {
-				if (qlink[n] != NULL) {
-					highest_non_null = n;
-					break;
-				}
-			}
-
-			/*
-			 * If both `lowest_non_null' and `highest_non_null' are -1, we
-			 * have only NULLs, and the boundaries are NULL as well.
-			 */
-
-			if (lowest_non_null == -1) {
-				if (highest_non_null == -1) {
-					qlink[mid] = l;
-					return;
-				}
-				low = mid + 1;
-				continue;
-			} else if (highest_non_null == -1) {
-				high = mid - 1;
-				continue;
-			}
-
-			/*
-			 * We know that the final insertion point will be after `low'
-			 * and before `high'.  If there are only NULL entries between
-			 * the two, we're done...
-			 */
-
-			if (lowest_non_null <= low + 1 && highest_non_null >= high - 1) {
-				qlink[mid] = l;			/* Insert at the middle of the range */
-				return;
-			}
-
-			if (qlink_cmp(&l, &qlink[lowest_non_null], q) < 0) {
-				high = lowest_non_null - 1;
-				continue;
-			}
-
-			if (qlink_cmp(&l, &qlink[highest_non_null], q) > 0) {
-				low = highest_non_null + 1;
-				continue;
-			}
-
-			/*
-			 * `lowest_non_null' <= `l' <= `highest_non_null'
-			 */
-
-			low = lowest_non_null + 1;
-			high = highest_non_null - 1;
-
-			continue;
-		}
-
-		/*
-		 * Regular dichotomic case.
-		 */
-
-		c = qlink_cmp(&qlink[mid], &l, q);
-
-		if (c == 0) {
-			qlink_insert_before(q, mid, l);
-			return;
-		} else if (c < 0)
-			low = mid + 1;
-		else
-			high = mid - 1;
-	}
-
-	if (qlink[low] == NULL) {
-		qlink[low] = l;
-		return;
-	}
-
-	qlink_insert_before(q, low, l);
+	if (i > 0 && qlink_cmp(q, q->qlink[i], q->qlink[(i - 1) / 2]) < 0)
+		qlink_sift_up(q, i);
+	else
+		qlink_sift_down(q, i);
 }
 
 /**
- * Remove the entry in the `qlink' linkable array, allowing compaction
- * when there are too many holes.
+ * Remove the entry in the `qlink' heap of linkables.
  *
  * @param q			the message queue
  * @param l			the linkable to remove from the qlink indexer
@@ -1007,84 +955,46 @@ qlink_insert(mqueue_t *q, plist_t *l)
 static void
 qlink_remove(mqueue_t *q, plist_t *l)
 {
-	plist_t **qlink = q->qlink;
-	int n = q->qlink_count;
+	void *pos;
 
-	g_assert(qlink);
-	g_assert(n > 0);
+	g_assert(q->qlink);
+	g_assert(q->qlink_count > 0);
 	g_assert(l->data != NULL);
 
 	mq_check(q, 0);
 
-	/*
-	 * If more entries in `qlink' than 3 times the amount of queued messages,
-	 * we have too many NULL in the array.
-	 */
-
-	if (n > q->count * 3) {
-		plist_t **dest = qlink;
-		int copied = 0;
-		bool found = FALSE;
-
-		while (n-- > 0) {
-			plist_t *entry = *qlink++;
-			if (entry == NULL)
-				continue;
-			else if (l == entry) {
-				found = TRUE;
-				continue;
-			}
-			*dest++ = entry;
-			copied++;
-		}
-
-		q->qlink_count = copied;
-
-		if (found)
-			return;
-	} else {
-		while (n-- > 0) {
-			if (l == *qlink) {
-				*qlink = NULL;
-				return;
-			}
-			qlink++;
-		}
-
-		/* Should have been found -- FALL THROUGH */
+	if (!htable_lookup_extended(q->qpos, l, NULL, &pos)) {
+		g_error("BUG: linkable %p for %s not found "
+			"(qlink has %d slots, queue has %d counted items, really %zd) "
+			"at %s:%d",
+			(void *) l, mq_info(q),
+			q->qlink_count, q->count, plist_length(q->qhead),
+			_WHERE_, __LINE__);
 	}
 
-	g_error("BUG: linkable %p for %s not found "
-		"(qlink has %d slots, queue has %d counted items, really %zd) at %s:%d",
-		(void *) l, mq_info(q),
-		q->qlink_count, q->count, plist_length(q->qhead),
-		_WHERE_, __LINE__);
+	g_assert(q->qlink[pointer_to_int(pos)] == l);
+
+	qlink_delete(q, pointer_to_int(pos));
 }
 
 /**
  * Attempt to make room in the queue to be able to enqueue the new message
  * whose header is specified.
  *
- * If `offset' is not null, it may be set with the offset within qlink where
- * the message immediately more prioritary than the new one can be found.
- * It is up to the caller to initialize it with -1 and check whether it has
- * been set.
- *
  * @param q			the queue
  * @param header	pointer to the header of the new message
  * @param msglen	if non-zero, header points to a full PDU of msglen bytes
  * @param prio		the priority of the new message we want to enqueue
  * @param needed	the amount of room we want to make in the queue
- * @param offset	see above description
  *
  * @returns TRUE if we were able to make enough room.
  */
 static bool
 make_room_internal(mqueue_t *q,
-	const char *header, size_t msglen, uint prio, int needed, int *offset)
+	const char *header, size_t msglen, uint prio, int needed)
 {
-	int n;
 	int dropped = 0;				/* Amount of messages dropped */
+	plist_t *partial = NULL;		/* Partially written message, set aside */
 
 	g_assert(needed > 0);
 	mq_check(q, 0);
@@ -1097,54 +1007,47 @@ make_room_internal(mqueue_t *q,
 	if (q->qhead == NULL)			/* Queue is empty */
 		return FALSE;
 
-	if (q->qlink == NULL)			/* No cached sorted queue links */
+	if (q->qlink == NULL)			/* No cached heap of queue links */
 		qlink_create(q);
 
 	g_assert(q->qlink);
 
 	/*
-	 * Traverse the sorted links and prune as many messages as necessary.
-	 * Note that we try to prune at least one byte more than needed, hence
-	 * we stay in the loop even when needed reaches 0.
-	 *
-	 * To avoid freeing the qlink array every time we drop something, we
-	 * write NULLs at the entries we drop (which are then ignored
-	 * in the loop below).  When we break out because we found a more
-	 * prioritary message, we remember the index in the array and return it
-	 * to the caller.  If the message is finally inserted in the queue,
-	 * we can insert its plist_t link right before that index.
+	 * Repeatedly look at the least valuable message, at the root of the
+	 * heap, and prune as many messages as necessary.  Note that we try to
+	 * prune at least one byte more than needed, hence we stay in the loop
+	 * even when needed reaches 0.
 	 *
-	 * This adds some complexity but it will avoid millions of calls to
-	 * qlink_cmp(), which is costly.
+	 * Each message dropped costs O(log n) to restore the heap, and looking
+	 * at the next candidate is O(1), so we only pay for what we drop.
 	 *
-	 * The qlink array is freed when we leave flow control.  During FC, we
+	 * The qlink heap is freed when we leave flow control.  During FC, we
 	 * need to find the messages we're removing after writing them to the
-	 * network, so we can NULLify the corresponding slot in the qlink array.
+	 * network, so we can retract them from the heap.
 	 */
 
-	for (n = 0; needed >= 0 && n < q->qlink_count; n++) {
-		plist_t *item = q->qlink[n];
+	while (needed >= 0 && q->qlink_count > 0) {
+		plist_t *item = q->qlink[0];
 		pmsg_t *cmb;
 		char *cmb_start;
 		int cmb_size;
 
-		/*
-		 * If slot was NULLified, skip it.
-		 */
-
-		if (item == NULL)
-			continue;
-
 		cmb = item->data;
 		cmb_start = pmsg_start(cmb);
 
 		/*
 		 * Any partially written message, however unimportant, cannot be
-		 * removed or we'd break the flow of messages.
+		 * removed or we'd break the flow of messages.  There can only be
+		 * one such message, at the tail of the queue: set it aside so that
+		 * we can look at the next candidate, and put it back afterwards.
 		 */
 
-		if (pmsg_read_base(cmb) != cmb_start)	/* Started to write it  */
+		if (pmsg_read_base(cmb) != cmb_start) {	/* Started to write it  */
+			g_assert(NULL == partial);
+			partial = item;
+			qlink_delete(q, 0);
 			continue;
+		}
 
 		/*
 		 * If we reach a message equally or more important than the message
@@ -1156,17 +1059,11 @@ make_room_internal(mqueue_t *q,
 		 */
 
 		if (0 == msglen) {
-			if (q->uops->msg_headcmp(cmb_start, header) >= 0) {
-				if (offset != NULL)
-					*offset = n;
+			if (q->uops->msg_headcmp(cmb_start, header) >= 0)
 				break;
-			}
 		} else {
-			if (q->uops->msg_cmp(cmb_start, header) >= 0) {
-				if (offset != NULL)
-					*offset = n;
+			if (q->uops->msg_cmp(cmb_start, header) >= 0)
 				break;
-			}
 		}
 
 		/*
@@ -1175,11 +1072,8 @@ make_room_internal(mqueue_t *q,
 		 * even if its embedded Gnet message is deemed less important.
 		 */
 
-		if (pmsg_prio(cmb) > prio) {
-			if (offset != NULL)
-				*offset = n;
+		if (pmsg_prio(cmb) > prio)
 			break;
-		}
 
 		/*
 		 * Drop message.
@@ -1198,17 +1092,20 @@ make_room_internal(mqueue_t *q,
 
 		cmb_size = pmsg_size(cmb);
 
-		g_assert(q->qlink[n] == item);
+		g_assert(q->qlink[0] == item);
 
 		needed -= cmb_size;
-		q->qlink[n] = NULL;
+		qlink_delete(q, 0);
 		(void) mq_rmlink_prev(q, item, cmb_size);
 
 		dropped++;
 
-		mq_check(q, 0);
+		mq_check(q, NULL == partial ? 0 : -1);
 	}
 
+	if (partial != NULL)
+		qlink_insert(q, partial);
+
 	if (dropped)
 		node_add_txdrop(q->node, dropped);	/* Dropped during TX */
 
@@ -1248,21 +1145,16 @@ make_room_internal(mqueue_t *q,
  * Remove from the queue enough messages that are less prioritary than
  * the current one, so as to make sure we can enqueue it.
  *
- * If `offset' is not null, it may be set with the offset within qlink where
- * the message immediately more prioritary than `mb' can be found.  It is
- * up to the caller to initialize it with -1 and check whether it has been
- * set.
- *
  * @returns TRUE if we were able to make enough room.
  */
 static bool
-make_room(mqueue_t *q, const pmsg_t *mb, int needed, int *offset)
+make_room(mqueue_t *q, const pmsg_t *mb, int needed)
 {
 	const char *header = pmsg_start(mb);
 	uint prio = pmsg_prio(mb);
 	size_t msglen = pmsg_written_size(mb);
 
-	return make_room_internal(q, header, msglen, prio, needed, offset);
+	return make_room_internal(q, header, msglen, prio, needed);
 }
 
 /**
@@ -1270,10 +1162,9 @@ make_room(mqueue_t *q, const pmsg_t *mb, int needed, int *offset)
  * point but a Gnutella header and a message priority explicitly.
  */
 static bool
-make_room_header(
-	mqueue_t *q, const char *header, uint prio, int needed, int *offset)
+make_room_header(mqueue_t *q, const char *header, uint prio, int needed)
 {
-	return make_room_internal(q, header, 0, prio, needed, offset);
+	return make_room_internal(q, header, 0, prio, needed);
 }
 
 /**
@@ -1283,7 +1174,6 @@ static void
 mq_puthere(mqueue_t *q, pmsg_t *mb, int msize)
 {
 	int needed;
-	int qlink_offset = -1;
 	plist_t *new = NULL;
 	bool make_room_called = FALSE;
 	bool has_normal_prio = (pmsg_prio(mb) == PMSG_P_DATA);
@@ -1301,7 +1191,7 @@ mq_puthere(mqueue_t *q, pmsg_t *mb, int msize)
 		has_normal_prio &&
 		gmsg_can_drop(pmsg_start(mb), msize) &&
 		((make_room_called = TRUE)) &&			/* Call make_room() once only */
-		!make_room(q, mb, msize, &qlink_offset)
+		!make_room(q, mb, msize)
 	) {
 		g_assert(pmsg_is_unread(mb));			/* Not partially written */
 		if (MQ_DEBUG_LVL(q) > 4 && q->uops->msg_log != NULL)
@@ -1328,7 +1218,7 @@ mq_puthere(mqueue_t *q, pmsg_t *mb, int msize)
 
 	if (
 		needed > 0 &&
-		(make_room_called || !make_room(q, mb, needed, &qlink_offset))
+		(make_room_called || !make_room(q, mb, needed))
 	) {
 		/*
 		 * Close the connection only if the message is a prioritary one
@@ -1453,23 +1343,12 @@ mq_puthere(mqueue_t *q, pmsg_t *mb, int msize)
 	q->count++;
 
 	/*
-	 * If `qlink' is not NULL, insert `new' within it.
-	 *
-	 * We have two options: we called make_room() and have `qlink_offset'
-	 * set to something other than -1.  In that case, this is the offset
-	 * of the message more prioritary that us.
-	 *
-	 * We have not called make_room() yet: we need to scan the `qlink' array
-	 * to find the proper insertion place.
+	 * If `qlink' is not NULL, insert `new' within the heap.
 	 */
 
 	if (q->qlink) {			/* Inserted something, `qlink' is stale */
 		g_assert(new != NULL);
-
-		if (qlink_offset != -1)
-			qlink_insert_before(q, qlink_offset, new);
-		else
-			qlink_insert(q, new);
+		qlink_insert(q, new);
 	}
 
 	/*
@@ -42,6 +42,7 @@
 #include "if/core/mq.h"
 
 #include "lib/cq.h"
+#include "lib/htable.h"
 #include "lib/plist.h"
 #include "lib/pmsg.h"
 #include "lib/slist.h"
@@ -139,9 +140,12 @@ enum mq_magic {
  * and remains in effect until we reach the low watermark, thereby providing
  * the necessary hysteresis.
  *
- * The `qlink' field is used during flow-control.  It contains a sorted (by
- * priority) array of all the items in the list.  It is dynamically allocated
- * and freed as needed.
+ * The `qlink' field is used during flow-control.  It contains a binary heap
+ * of all the items in the list, ordered by priority so that the least
+ * valuable message is always at the root.  The `qpos' table maps each
+ * linkable to its index within the heap, so that messages removed from the
+ * queue after being sent can be retracted from the heap without a scan.
+ * Both are dynamically allocated and freed as needed.
  *
  * The `header' is used to hold the function/hops/TTL of a reference message
  * to be used as a comparison point when speeding up dropping in flow-control.
@@ -158,7 +162,9 @@ struct mqueue {
 	cevent_t *swift_ev;		/**< Callout queue event in "swift" mode */
 	const uint32 *debug;	/**< Debug config variable for this queue */
 	int swift_elapsed;		/**< Scheduled elapsed time, in ms */
+	htable_t *qpos;			/**< Maps linkables to their `qlink' index */
 	int qlink_count;		/**< Amount of entries in `qlink' */
+	int qlink_size;			/**< Allocated entries in `qlink' */
 	int maxsize;			/**< Maximum size of this queue (total queued) */
 	int count;				/**< Amount of messages queued */
 	int hiwat;				/**< High watermark */
@@ -2267,6 +2267,17 @@ node_remove_v(gnutella_node_t *n, const char *reason, va_list ap)
 		 */
 	}
 
+	/*
+	 * We still need to retract the slots a leaf contributed from the
+	 * merged table, which is maintained incrementally, but that change
+	 * will only be propagated with the next leaf update.
+	 *
+	 * This must be done even when we no longer hold its QRT: a RESET
+	 * discards the table whilst the following patch is being received.
+	 */
+
+	qrp_leaf_removed(n);
+
 	if (n->sent_query_table) {
 		qrt_unref(n->sent_query_table);
 		n->sent_query_table = NULL;
@@ -12021,9 +12032,9 @@ node_set_hops_flow(gnutella_node_t *n, uint8 hops)
 
 		if (hops < NODE_LEAF_MIN_FLOW) {
 			if (old_hops_flow >= NODE_LEAF_MIN_FLOW)
-				qrp_leaf_changed();		/* Will be skipped from inter-UP QRP */
+				qrp_leaf_changed(n);	/* Will be skipped from inter-UP QRP */
 		} else if (old_hops_flow < NODE_LEAF_MIN_FLOW) {
-			qrp_leaf_changed();			/* Can include this leaf now */
+			qrp_leaf_changed(n);		/* Can include this leaf now */
 		}
 
 		goto fire;
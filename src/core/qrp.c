@@ -61,6 +61,7 @@
 
 #include "lib/atoms.h"
 #include "lib/bg.h"
+#include "lib/bitmap.h"
 #include "lib/cq.h"
 #include "lib/endian.h"
 #include "lib/halloc.h"
@@ -69,6 +70,7 @@
 #include "lib/hstrfn.h"
 #include "lib/htable.h"
 #include "lib/mutex.h"
+#include "lib/nid.h"
 #include "lib/pow2.h"
 #include "lib/pslist.h"
 #include "lib/random.h"
@@ -674,13 +676,8 @@ qrt_patches_clear(void)
 static struct routing_patch *
 qrt_diff_4(struct routing_table *old, struct routing_table *new)
 {
-	int bytes;
 	struct routing_patch *rp;
-	uchar *op;
-	uchar *np;
-	uchar *pp;
-	int i;
-	bool changed = FALSE;
+	bool changed;
 
 	g_assert(old == NULL || old->magic == QRP_ROUTE_MAGIC);
 	g_assert(old == NULL || old->compacted);
@@ -696,61 +693,24 @@ qrt_diff_4(struct routing_table *old, struct routing_table *new)
 	rp->len = rp->size / 2;			/* Each entry stored on 4 bits */
 	rp->entry_bits = 4;
 	rp->compressed = FALSE;
-	pp = rp->arena = halloc(rp->len);
-
-	op = old ? old->arena : NULL;
-	np = new->arena;
-
-	for (i = 0, bytes = new->slots / 8; i < bytes; i++) {
-		uint8 obyte = op ? *op++ : 0x0;	/* Nothing */
-		uint8 nbyte = *np++;
-		int j;
-		uint8 v;
-
-		/*
-		 * Optimize computation: if bytes are equal, we can immediately
-		 * generate 8 quartets of 0, i.e. 4 bytes.
-		 */
+	rp->arena = halloc(rp->len);
 
-		if G_LIKELY(obyte == nbyte) {
-			*pp++ = 0;
-			*pp++ = 0;
-			*pp++ = 0;
-			*pp++ = 0;
-			continue;
-		}
-
-		/*
-		 * In our compacted table, set bits indicate presence.
-		 * Thus, we need to build the patch quartets as:
-		 *
-		 *     old bit      new bit      patch
-		 *        0            0          0x0     (no change)
-		 *        0            1          0xf     (-1, from INFINITY=2 to 1)
-		 *        1            0          0x1     (+1, from 1 to INFINITY)
-		 *        1            1          0x0     (no change)
-		 */
-
-		for (v = 0, j = 7; j >= 0; j--) {
-			uint8 mask = 1 << j;
-
-			if ((obyte & mask) ^ (nbyte & mask)) {	/* Bit `j' changed */
-				v |= (obyte & mask) ? 0x1 : 0xf;
-				changed = TRUE;
-			}
-
-			if (j & 0x1)
-				v <<= 4;			/* We have upper half of octet (byte) */
-			else {
-				*pp++ = v;
-				v = 0;
-			}
-		}
-	}
+	/*
+	 * In our compacted table, set bits indicate presence.
+	 * Thus, we need to build the patch quartets as:
+	 *
+	 *     old bit      new bit      patch
+	 *        0            0          0x0     (no change)
+	 *        0            1          0xf     (-1, from INFINITY=2 to 1)
+	 *        1            0          0x1     (+1, from 1 to INFINITY)
+	 *        1            1          0x0     (no change)
+	 *
+	 * Equal parts of the tables generate quartets of 0 and are skipped
+	 * quickly, many bytes at a time.
+	 */
 
-	g_assert(np == (new->arena + new->slots / 8));
-	g_assert(op == NULL || op == (old->arena + old->slots / 8));
-	g_assert(pp == (rp->arena + rp->len));
+	changed = bitmap_diff4(rp->arena,
+		NULL == old ? NULL : old->arena, new->arena, new->slots / 8);
 
 	if (!changed && old != NULL) {
 		qrt_patch_free(rp);
@@ -776,13 +736,8 @@ qrt_diff_4(struct routing_table *old, struct routing_table *new)
 static struct routing_patch *
 qrt_diff_1(struct routing_table *old, struct routing_table *new, bool reverse)
 {
-	int bytes;
 	struct routing_patch *rp;
-	uchar *op;
-	uchar *np;
-	uchar *pp;
-	int i;
-	bool changed = FALSE;
+	bool changed;
 
 	g_assert(old == NULL || old->magic == QRP_ROUTE_MAGIC);
 	g_assert(old == NULL || old->compacted);
@@ -799,10 +754,7 @@ qrt_diff_1(struct routing_table *old, struct routing_table *new, bool reverse)
 	rp->entry_bits = 1;
 	rp->compressed = FALSE;
 	rp->reversed = booleanize(reverse);
-	pp = rp->arena = halloc(rp->len);
-
-	op = old ? old->arena : NULL;
-	np = new->arena;
+	rp->arena = halloc(rp->len);
 
 	/*
 	 * A 1-bit patch is really a flip of all the bytes.
@@ -810,34 +762,14 @@ qrt_diff_1(struct routing_table *old, struct routing_table *new, bool reverse)
 	 *     old bit      new bit      patch
 	 *        0            0           0     (no change)
 	 *        0            1           1     (flip to 1)
-	 *        1            0           1     (fli to 0)
+	 *        1            0           1     (flip to 0)
 	 *        1            1           0     (no change)
 	 *
 	 * This is the truth table of XOR.
 	 */
 
-	if (reverse) {
-		for (i = 0, bytes = new->slots / 8; i < bytes; i++) {
-			uint8 obyte = op ? *op++ : 0x0;	/* Nothing */
-			uint8 v = obyte ^ *np++;
-
-			if G_LIKELY(0 == v) {
-				*pp++ = v;
-			} else {
-				*pp++ = reverse_byte(v);
-			}
-		}
-	} else {
-		for (i = 0, bytes = new->slots / 8; i < bytes; i++) {
-			uint8 obyte = op ? *op++ : 0x0;	/* Nothing */
-
-			*pp++ = obyte ^ *np++;
-		}
-	}
-
-	g_assert(np == (new->arena + new->slots / 8));
-	g_assert(op == NULL || op == (old->arena + old->slots / 8));
-	g_assert(pp == (rp->arena + rp->len));
+	changed = bitmap_xor(rp->arena,
+		NULL == old ? NULL : old->arena, new->arena, new->slots / 8, reverse);
 
 	if (!changed && old != NULL) {
 		qrt_patch_free(rp);
@@ -1054,15 +986,19 @@ qrt_patch_compress(struct routing_patch *rp, bgtask_t *bt,
 /**
  * Create a new query routing table, with supplied `arena' and `slots'.
  * The value used for infinity is given as `max'.
+ *
+ * When `compacted' is TRUE, the arena is already a compacted table of
+ * slots / 8 bytes, where set bits indicate presence.
  */
 static struct routing_table *
-qrt_create(const char *name, char *arena, int slots, int max)
+qrt_make(const char *name, char *arena, int slots, int max, bool compacted)
 {
 	struct routing_table *rt;
 
 	g_assert(slots > 0);
 	g_assert(max > 0);
 	g_assert(arena != NULL);
+	g_assert(!compacted || 0 == (slots & 0x7));
 
 	WALLOC0(rt);
 
@@ -1079,7 +1015,12 @@ qrt_create(const char *name, char *arena, int slots, int max)
 	rt->can_route_urn = qrp_can_route_default;
 	rt->can_route     = qrp_can_route_default;
 
-	qrt_compact(rt);
+	if (compacted) {
+		rt->compacted = TRUE;
+		rt->set_count = bitmap_count(arena, slots / 8);
+	} else {
+		qrt_compact(rt);
+	}
 
 	gnet_prop_set_guint32_val(PROP_QRP_GENERATION, (uint32) rt->generation);
 	gnet_prop_set_guint32_val(PROP_QRP_MEMORY,
@@ -1097,6 +1038,16 @@ qrt_create(const char *name, char *arena, int slots, int max)
 	return rt;
 }
 
+/**
+ * Create a new query routing table, with supplied `arena' and `slots'.
+ * The value used for infinity is given as `max'.
+ */
+static struct routing_table *
+qrt_create(const char *name, char *arena, int slots, int max)
+{
+	return qrt_make(name, arena, slots, max, FALSE);
+}
+
 /**
  * Create small empty table.
  */
@@ -1256,13 +1207,316 @@ enum merge_magic {
 
 struct merge_context {
 	enum merge_magic magic;
-	pslist_t *tables;			/* Leaf routing tables */
-	uchar *arena;				/* Working arena (not compacted) */
-	int slots;					/* Amount of slots used for merged table */
+	pslist_t *leaves;			/* IDs of the leaves to merge */
 };
 
 static struct merge_context *merge_ctx;
 
+/*
+ * The merged table is maintained incrementally: each of its slots counts
+ * the amount of leaves having that slot present in their QRT, and the slot
+ * is present in the merged table when its count is not zero.
+ *
+ * For each leaf, we keep a copy of the table it contributed, so that when
+ * the leaf patches its QRT we only update the counts of the slots that
+ * changed, and when the leaf goes away we can retract its slots.  Hence the
+ * cost of a leaf change is proportional to the size of its patch and the
+ * full merging of all the tables is only required when we become ultrapeer.
+ */
+struct mrg_leaf {
+	const struct nid *id;		/* Node ID (reference counted) */
+	uchar *arena;				/* Compacted table contributed */
+	int slots;					/* Amount of slots in table */
+};
+
+static struct mrg_state {
+	uint16 *counts;				/* Amount of leaves having each slot present */
+	uchar *arena;				/* Merged table (compacted) */
+	uchar *delta;				/* Scratch arena for slots changed by a leaf */
+	size_t delta_len;			/* Length of the scratch arena */
+	int slots;					/* Amount of slots in merged table */
+	htable_t *leaves;			/* Node ID => struct mrg_leaf */
+} mrg;
+
+static void
+mrg_leaf_free(struct mrg_leaf *ml)
+{
+	nid_unref(ml->id);
+	HFREE_NULL(ml->arena);
+	WFREE(ml);
+}
+
+static void
+mrg_leaf_free_kv(const void *unused_key, void *value, void *unused_data)
+{
+	(void) unused_key;
+	(void) unused_data;
+
+	mrg_leaf_free(value);
+}
+
+/**
+ * Discard the merged table counts, which will need to be fully recomputed.
+ */
+static void
+mrg_clear(void)
+{
+	if (mrg.leaves != NULL) {
+		htable_foreach(mrg.leaves, mrg_leaf_free_kv, NULL);
+		htable_free_null(&mrg.leaves);
+	}
+
+	HFREE_NULL(mrg.counts);
+	HFREE_NULL(mrg.arena);
+	HFREE_NULL(mrg.delta);
+	ZERO(&mrg);
+}
+
+/**
+ * Start maintaining an empty merged table of `slots' slots.
+ */
+static void
+mrg_init(int slots)
+{
+	g_assert(NULL == mrg.counts);
+	g_assert(is_pow2(slots));
+	g_assert(slots >= 8);
+
+	HALLOC0_ARRAY(mrg.counts, slots);
+	mrg.arena = halloc0(slots / 8);
+	mrg.slots = slots;
+	mrg.leaves = htable_create_any(nid_hash, nid_hash2, nid_equal);
+}
+
+/**
+ * Grow the merged table to `slots' slots, each existing slot covering
+ * as many slots in the larger table.
+ */
+static void
+mrg_resize(int slots)
+{
+	int ratio, i;
+	uint16 *counts;
+	uchar *arena;
+
+	g_assert(is_pow2(slots));
+	g_assert(slots > mrg.slots);
+
+	ratio = highest_bit_set(slots) - highest_bit_set(mrg.slots);
+
+	HALLOC_ARRAY(counts, slots);
+	for (i = 0; i < slots; i++)
+		counts[i] = mrg.counts[i >> ratio];
+
+	arena = halloc0(slots / 8);
+	bitmap_or_expand(arena, mrg.arena, mrg.slots / 8, ratio);
+
+	HFREE_NULL(mrg.counts);
+	HFREE_NULL(mrg.arena);
+	mrg.counts = counts;
+	mrg.arena = arena;
+	mrg.slots = slots;
+
+	if (qrp_debugging(1))
+		g_debug("QRP merged table grown to %d slots", slots);
+}
+
+/**
+ * Account for a change in a compacted leaf table of `slots' slots, going
+ * from `old' to `new'.  A NULL table is considered empty.
+ *
+ * @return whether the merged table changed.
+ */
+static bool
+mrg_apply(const uchar *old, const uchar *new, int slots)
+{
+	int ratio, expand, bytes, b;
+	bool changed = FALSE;
+
+	g_assert(is_pow2(slots));
+	g_assert(slots <= mrg.slots);
+
+	ratio = highest_bit_set(mrg.slots) - highest_bit_set(slots);
+	expand = 1 << ratio;
+	bytes = slots / 8;
+
+	if (mrg.delta_len < UNSIGNED(bytes)) {
+		HFREE_NULL(mrg.delta);
+		mrg.delta = halloc(bytes);
+		mrg.delta_len = bytes;
+	}
+
+	/*
+	 * Locate the slots that changed, many bytes at a time.
+	 */
+
+	if (NULL == new) {
+		if (NULL == old || !bitmap_xor(mrg.delta, NULL, old, bytes, FALSE))
+			return FALSE;
+	} else if (!bitmap_xor(mrg.delta, old, new, bytes, FALSE)) {
+		return FALSE;
+	}
+
+	for (b = 0; b < bytes; b++) {
+		uint8 x = mrg.delta[b];
+		uint8 n = NULL == new ? 0 : new[b];
+		uint mask;
+		int i;
+
+		/* Skip unchanged parts of the table quickly */
+
+		if (0 == (b & 0x7) && b + 8 <= bytes) {
+			uint64 w;
+
+			memcpy(&w, &mrg.delta[b], 8);
+			if G_LIKELY(0 == w) {
+				b += 7;
+				continue;
+			}
+		}
+
+		if G_LIKELY(0 == x)
+			continue;
+
+		for (mask = 0x80, i = b * 8; mask != 0; mask >>= 1, i++) {
+			int j, k;
+
+			if (0 == (x & mask))
+				continue;
+
+			for (j = i << ratio, k = 0; k < expand; j++, k++) {
+				uint16 *c = &mrg.counts[j];
+
+				if (n & mask) {
+					g_assert(*c < MAX_INT_VAL(uint16));
+					if (0 == (*c)++) {
+						mrg.arena[j >> 3] |= 0x80 >> (j & 0x7);
+						changed = TRUE;
+					}
+				} else {
+					g_assert(*c != 0);
+					if (0 == --(*c)) {
+						mrg.arena[j >> 3] &= ~(0x80 >> (j & 0x7));
+						changed = TRUE;
+					}
+				}
+			}
+		}
+	}
+
+	return changed;
+}
+
+/**
+ * @return the QRT of the node that should be part of the merged table,
+ * NULL if the node does not contribute to it.
+ */
+static const struct routing_table *
+mrg_leaf_table(const gnutella_node_t *n)
+{
+	const struct routing_table *rt = n->recv_query_table;
+
+	if (rt == NULL || !NODE_IS_LEAF(n))
+		return NULL;
+
+	/*
+	 * Do not include leaves whose hops-flow is set to a value less
+	 * than NODE_LEAF_MIN_FLOW because they are not fully searcheable
+	 * by remote ultrapeers.
+	 *		--RAM, 2007-05-23
+	 */
+
+	if (n->hops_flow < NODE_LEAF_MIN_FLOW)
+		return NULL;
+
+	/*
+	 * If table is so small to be useless, don't merge it.
+	 */
+
+	if (rt->slots <= 8)
+		return NULL;
+
+	return rt;
+}
+
+/**
+ * Update the merged table with the current QRT of a leaf node, retracting
+ * the slots it contributed if it no longer has to be part of the table.
+ *
+ * @return whether the merged table changed.
+ */
+static bool
+mrg_leaf_update(const gnutella_node_t *n)
+{
+	const struct routing_table *rt;
+	struct mrg_leaf *ml;
+	bool changed = FALSE;
+
+	if (NULL == mrg.counts)
+		return FALSE;			/* Not maintaining the merged table */
+
+	rt = mrg_leaf_table(n);
+	ml = htable_lookup(mrg.leaves, NODE_ID(n));
+
+	/*
+	 * If the leaf no longer contributes, or if its table was resized,
+	 * retract what it contributed so far.
+	 */
+
+	if (ml != NULL && (NULL == rt || rt->slots != ml->slots)) {
+		changed = mrg_apply(ml->arena, NULL, ml->slots);
+
+		if (NULL == rt) {
+			htable_remove(mrg.leaves, ml->id);
+			mrg_leaf_free(ml);
+			return changed;
+		}
+
+		HFREE_NULL(ml->arena);
+	}
+
+	if (NULL == rt)
+		return changed;
+
+	g_assert(rt->compacted);
+
+	if (rt->slots > mrg.slots)
+		mrg_resize(rt->slots);
+
+	if (NULL == ml) {
+		WALLOC0(ml);
+		ml->id = nid_ref(NODE_ID(n));
+		htable_insert(mrg.leaves, ml->id, ml);
+	}
+
+	if (mrg_apply(ml->arena, rt->arena, rt->slots))
+		changed = TRUE;
+
+	if (NULL == ml->arena) {
+		ml->arena = halloc(rt->slots / 8);
+		ml->slots = rt->slots;
+	}
+
+	memcpy(ml->arena, rt->arena, rt->slots / 8);
+
+	return changed;
+}
+
+/**
+ * Install a new `merged_table' from the current merged slots.
+ */
+static void
+mrg_install(void)
+{
+	struct routing_table *mt;
+
+	g_assert(mrg.counts != NULL);
+
+	mt = qrt_make("Merged table",
+		hcopy(mrg.arena, mrg.slots / 8), mrg.slots, LOCAL_INFINITY, TRUE);
+	install_merged_table(mt);
+}
+
 /**
  * Free merge context.
  */
@@ -1281,27 +1535,24 @@ merge_context_free(void *p)
 
 	QRP_TASK_UNLOCK;
 
-	PSLIST_FOREACH(ctx->tables, sl) {
-		struct routing_table *rt = sl->data;
-
-		qrt_unref(rt);
+	PSLIST_FOREACH(ctx->leaves, sl) {
+		nid_unref(sl->data);
 	}
-	pslist_free_null(&ctx->tables);
+	pslist_free_null(&ctx->leaves);
 
-	HFREE_NULL(ctx->arena);
 	ctx->magic = 0;
 	WFREE(ctx);
 }
 
 /**
- * Fetch the list of all the QRT from our leaves.
+ * Fetch the list of all our leaves having sent us a QRT.
  */
 static bgret_t
 mrg_step_get_list(struct bgtask *unused_h, void *u, int unused_ticks)
 {
 	struct merge_context *ctx = u;
 	const pslist_t *sl;
-	int max_size = 0;			/* Max # of slots seen in all QRT */
+	int max_size = EMPTY_TABLE_SIZE;	/* Max # of slots seen in all QRT */
 
 	(void) unused_h;
 	(void) unused_ticks;
@@ -1309,172 +1560,30 @@ mrg_step_get_list(struct bgtask *unused_h, void *u, int unused_ticks)
 
 	PSLIST_FOREACH(node_all_gnet_nodes(), sl) {
 		gnutella_node_t *dn = sl->data;
-		struct routing_table *rt = dn->recv_query_table;
-
-		if (rt == NULL || !NODE_IS_LEAF(dn))
-			continue;
-
-		/*
-		 * Do not include leaves whose hops-flow is set to a value less
-		 * than NODE_LEAF_MIN_FLOW because they are not fully searcheable
-		 * by remote ultrapeers.
-		 *		--RAM, 2007-05-23
-		 */
+		const struct routing_table *rt = mrg_leaf_table(dn);
 
-		if (dn->hops_flow < NODE_LEAF_MIN_FLOW)
+		if (NULL == rt)
 			continue;
 
 		/*
-		 * If table is so small to be useless, don't merge it.
+		 * We're snapshoting the list of leaves by their ID.  Later on, the
+		 * node can be removed, but then we won't find it any more.
 		 */
 
-		if (rt->slots <= 8)
-			continue;
-
-		/*
-		 * At this point we're snapshoting the list of tables and we take
-		 * a reference on the table of the node.  Later on, the node can be
-		 * removed, but then we'll know because we'll be the only one
-		 * referencing the table!
-		 */
-
-		ctx->tables = pslist_prepend(ctx->tables, qrt_ref(rt));
+		ctx->leaves = pslist_prepend(ctx->leaves, nid_ref(NODE_ID(dn)));
 
 		if (max_size < rt->slots)
 			max_size = rt->slots;
 	}
 
-	/* No valid table can have 0 slots! */
-	g_assert(max_size > 0 || ctx->tables == NULL);
-
-	ctx->slots = max_size;
-	if (max_size > 0) {
-		ctx->arena = halloc(max_size);
-		memset(ctx->arena, LOCAL_INFINITY, max_size);
-	}
-
-	return BGR_NEXT;
-}
-
-/**
- * Merge routing table into specified arena.
- *
- * @param rt is the routing table to merge
- * @param arena is a non-compacted arena
- * @param slots is the number of slots in the arena
- */
-static void
-merge_table_into_arena(struct routing_table *rt, uchar *arena, int slots)
-{
-	int ratio;
-	int expand;
-	int i;
-	int b;
-	int bytes;
-
-	/*
-	 * By construction, the size of the arena is the max of all the sizes
-	 * of the QRT tables, so the size of the routing table to merge can only
-	 * be smaller than the arena size.
-	 */
-
-	g_assert(rt->slots <= slots);
-	g_assert(rt->compacted);
-	g_assert(is_pow2(slots));
-	g_assert(is_pow2(rt->slots));
-	g_assert(rt->slots >= 8);
-
-	ratio = highest_bit_set(slots) - highest_bit_set(rt->slots);
-
-	g_assert(ratio >= 0);
-
-	expand = 1 << ratio;
-	bytes = rt->slots / 8;
-
-	g_assert(rt->slots * expand <= slots);	/* Won't overflow */
-
 	/*
-	 * Loop over the supplied QRT, and expand each slot `expand' times into
-	 * the arena, doing an "OR" merging.
-	 *
-	 * Since this is going to be a tight loop, try to optimize the smallest
-	 * expansion factors by avoiding memset() calls.
-	 *
-	 * Furthermore, we avoid repeated RT_SLOT_READ() calls by accessing the
-	 * compacted table one byte at a time and then looping on each of its bits.
+	 * We're recomputing all the counts from scratch.
 	 */
 
-#define RT_FOR_EACH_BIT_SET(ON_CHANGE)				\
-for (b = 0, i = 0; b < bytes; b++) {				\
-	uint8 entry = rt->arena[b];						\
-	unsigned mask = 0x80;							\
-													\
-	do {											\
-		/* "0 OR x = x", hence skip unset bits */	\
-		if (entry & mask) {							\
-			ON_CHANGE								\
-		}											\
-		i++;										\
-		mask >>= 1;									\
-	} while (mask);									\
-}
-
-	switch (expand) {
-	case 1:
-		RT_FOR_EACH_BIT_SET(
-			arena[i] = 0;		/* less than "inf" => indicates presence */
-		);
-		break;
-	case 2:
-		RT_FOR_EACH_BIT_SET(
-			size_t j = i * 2;
-			arena[j++] = 0;		/* less than "inf" => indicates presence */
-			arena[j] = 0;
-		);
-		break;
-	case 4:
-		RT_FOR_EACH_BIT_SET(
-			size_t j = i * 4;
-			arena[j++] = 0;		/* less than "inf" => indicates presence */
-			arena[j++] = 0;
-			arena[j++] = 0;
-			arena[j] = 0;
-		);
-		break;
-	case 8:
-		RT_FOR_EACH_BIT_SET(
-			size_t j = i * 8;
-			arena[j++] = 0;		/* less than "inf" => indicates presence */
-			arena[j++] = 0;
-			arena[j++] = 0;
-			arena[j++] = 0;
-			arena[j++] = 0;
-			arena[j++] = 0;
-			arena[j++] = 0;
-			arena[j] = 0;
-		);
-		break;
-	case 16:
-		RT_FOR_EACH_BIT_SET(
-			/* 0 is less than "infinity" => indicates presence */
-			memset(&arena[i * 16], 0, 16);
-		);
-		break;
-	case 32:
-		RT_FOR_EACH_BIT_SET(
-			/* 0 is less than "infinity" => indicates presence */
-			memset(&arena[i * 32], 0, 32);
-		);
-		break;
-	default:
-		RT_FOR_EACH_BIT_SET(
-			/* 0 is less than "infinity" => indicates presence */
-			memset(&arena[i * expand], 0, expand);
-		);
-		break;
-	}
+	mrg_clear();
+	mrg_init(max_size);
 
-#undef RT_FOR_EACH_BIT_SET
+	return BGR_NEXT;
 }
 
 /**
@@ -1497,25 +1606,26 @@ mrg_step_merge_one(struct bgtask *unused_h, void *u, int ticks)
 	if (!settings_is_ultra())
 		return BGR_DONE;
 
-	while (ctx->tables != NULL && ticks_used < ticks) {
-		struct routing_table *rt = ctx->tables->data;
+	while (ctx->leaves != NULL && ticks_used < ticks) {
+		const struct nid *id = ctx->leaves->data;
+		const gnutella_node_t *dn = node_by_id(id);
 
-		ctx->tables = pslist_remove(ctx->tables, rt);
+		ctx->leaves = pslist_remove(ctx->leaves, id);
 
 		/*
-		 * If we're the only referer to this table, it means the node is
-		 * dead and therefore this table should be skipped.
+		 * Leaves that changed since we started have already been accounted
+		 * for, in which case the update will not find anything new.
 		 */
 
-		if (rt->refcnt > 1) {
-			merge_table_into_arena(rt, ctx->arena, ctx->slots);
+		if (dn != NULL) {
+			mrg_leaf_update(dn);
 			ticks_used++;
 		}
 
-		qrt_unref(rt);
+		nid_unref(id);
 	}
 
-	return (ctx->tables == NULL) ? BGR_NEXT : BGR_MORE;
+	return (ctx->leaves == NULL) ? BGR_NEXT : BGR_MORE;
 }
 
 /**
@@ -1535,18 +1645,8 @@ mrg_step_install_table(struct bgtask *unused_h, void *u, int unused_ticks)
 	 * not make sense.
 	 */
 
-	if (settings_is_ultra()) {
-		struct routing_table *mt;
-		if (ctx->slots != 0)
-			mt = qrt_create("Merged table",
-				cast_to_pointer(ctx->arena), ctx->slots, LOCAL_INFINITY);
-		else {
-			g_assert(ctx->arena == NULL);
-			mt = qrt_empty_table("Empty merged table");
-		}
-		ctx->arena = NULL;			/* Don't free arena when freeing context */
-		install_merged_table(mt);
-	}
+	if (settings_is_ultra())
+		mrg_install();
 
 	return BGR_DONE;
 }
@@ -2374,6 +2474,7 @@ qrp_step_install_leaf(struct bgtask *unused_h, void *u, int unused_ticks)
 	if (!settings_is_ultra()) {
 		install_routing_table(*ctx->rtp);
 		install_merged_table(NULL);			/* We're not an ultra node */
+		mrg_clear();
 		node_qrt_changed(routing_table);
 		return BGR_DONE;		/* Done! */
 	}
@@ -4929,7 +5030,7 @@ qrt_handle_patch(
 			node_qrt_patched(n, rt);
 
 		if (NODE_IS_LEAF(n))
-			qrp_leaf_changed();
+			qrp_leaf_changed(n);
 
 		if (qrp_debugging(4))
 			(void) qrt_dump(rt, GNET_PROPERTY(qrp_debug) > 19);
@@ -4993,13 +5094,50 @@ dropped:
 static bool qrt_leaf_change_notified = FALSE;
 
 /**
- * Called when we get a new QRT from a leaf node, or when we loose a leaf
- * that sent us its QRT.
+ * Called when we get a new QRT from a leaf node, or when a leaf node
+ * starts or stops being searchable by other ultrapeers.
  */
 void
-qrp_leaf_changed(void)
+qrp_leaf_changed(const gnutella_node_t *n)
 {
-	qrt_leaf_change_notified = TRUE;
+	node_check(n);
+
+	/*
+	 * When the merged table is not maintained yet, it will be fully
+	 * computed by the monitor.  Otherwise we only need to publish a
+	 * new table when the leaf change altered the merged table.
+	 */
+
+	if (NULL == mrg.counts || mrg_leaf_update(n))
+		qrt_leaf_change_notified = TRUE;
+}
+
+/**
+ * Called when we loose a node, which may be a leaf that sent us its QRT.
+ *
+ * The slots it contributed, if any, are retracted from the merged table,
+ * but this alone does not warrant sending a new table to our peers: all we
+ * could do is clear some slots to get less entries, which could be filled
+ * by the next leaf that will come to fill the free leaf slot.  The change
+ * will be propagated with the next leaf update.
+ */
+void
+qrp_leaf_removed(const gnutella_node_t *n)
+{
+	struct mrg_leaf *ml;
+
+	node_check(n);
+
+	if (NULL == mrg.counts)
+		return;			/* Not maintaining the merged table */
+
+	ml = htable_lookup(mrg.leaves, NODE_ID(n));
+	if (NULL == ml)
+		return;			/* Node was not contributing */
+
+	(void) mrg_apply(ml->arena, NULL, ml->slots);
+	htable_remove(mrg.leaves, ml->id);
+	mrg_leaf_free(ml);
 }
 
 /**
@@ -5020,13 +5158,21 @@ qrp_monitor(void *unused_obj)
 		return TRUE;
 
 	/*
-	 * If we got notified of changes, relaunch the computation of the
-	 * merge_table.
+	 * If we got notified of changes, install the new merged table, which
+	 * has been kept up-to-date as leaves changed, and recompute our routing
+	 * table.  When we're not maintaining the merged table yet, relaunch its
+	 * full computation.
 	 */
 
 	if (qrt_leaf_change_notified) {
-		if (mrg_compute(qrp_merge_routing_table))
+		if (NULL == mrg.counts) {
+			if (mrg_compute(qrp_merge_routing_table))
+				qrt_leaf_change_notified = FALSE;
+		} else {
+			mrg_install();
+			qrp_update_routing_table();
 			qrt_leaf_change_notified = FALSE;
+		}
 	}
 
 	return TRUE;		/* Keep calling */
@@ -5083,6 +5229,7 @@ qrp_close(void)
 	if (merged_table)
 		qrt_unref(merged_table);
 
+	mrg_clear();
 	HFREE_NULL(buffer.arena);
 }
 
@@ -74,7 +74,8 @@ typedef struct query_hashvec query_hashvec_t;
 void qrp_init(void);
 void qrp_close(void);
 
-void qrp_leaf_changed(void);
+void qrp_leaf_changed(const struct gnutella_node *n);
+void qrp_leaf_removed(const struct gnutella_node *n);
 void qrp_peermode_changed(void);
 
 void qrp_prepare_computation(void);
@@ -33,6 +33,10 @@
 
 #include "common.h"
 
+#if 0
+#define ROUTING_TESTING
+#endif
+
 #include "routing.h"
 
 #include "gmsg.h"
@@ -56,6 +60,7 @@
 #include "lib/host_addr.h"
 #include "lib/hset.h"
 #include "lib/htable.h"
+#include "lib/pow2.h"
 #include "lib/pslist.h"
 #include "lib/str.h"
 #include "lib/stringify.h"
@@ -107,6 +112,10 @@ routing_udp_node_check(const struct routing_udp_node * const un)
  * Query hit routes and push routes are precious, therefore they are
  * moved to the tail of the "message_array[]" when they get used to increase
  * their liftime.
+ *
+ * When the flat routing table is used, entries are records stored inline
+ * in an open-addressed table instead, and the "slot" and "chunk_idx" fields
+ * are unused.
  */
 struct message {
 	struct guid muid;			/**< Message UID */
@@ -116,6 +125,8 @@ struct message {
 	uint8 function;				/**< Type of the message */
 	uint8 ttl;					/**< Max TTL we saw for this message */
 	uint8 chunk_idx;			/**< Index of chunk holding the slot */
+	uint8 state;				/**< Flat table: record state */
+	uint32 ring_idx;			/**< Flat table: position in eviction ring */
 };
 
 /**
@@ -182,8 +193,50 @@ static struct {
 	unsigned nchunks;			 /**< Amount of allocated chunks */
 	hset_t *messages_hashed;	 /**< All messages (key = struct message) */
 	time_t last_rotation;		 /**< Last time we restarted from idx=0 */
+	bool flat;					 /**< Whether the flat table is used */
 } routing;
 
+/*
+ * Flat routing table data structures.
+ *
+ * Messages are records stored inline in an open-addressed table, using
+ * linear probing.  Removed records leave tombstones behind, so that records
+ * never move unless the table is resized, which only happens when a new
+ * message is added.
+ *
+ * The order in which records expire is kept in a ring buffer holding record
+ * indices, the next ring position to use holding the oldest record.  When
+ * a record is revitalized, its ring position is cleared and the record is
+ * re-inserted at the next ring position.
+ *
+ * Like the chunked table, the ring grows as long as we cycle over it in
+ * less than TABLE_MIN_CYCLE seconds, up to the same maximum capacity.
+ */
+
+#define FLAT_MIN_SIZE		(1 << (CHUNK_BITS + 1))	/**< Initial table size */
+#define FLAT_MAX_MESSAGES	(MAX_CHUNKS * CHUNK_MESSAGES)
+#define FLAT_NONE			((uint32) -1)	/**< Empty ring position */
+
+/* Records held by a table of ``s'' slots, and table filling threshold */
+#define FLAT_CAPACITY(s)	((s) / 4 * 3)
+#define FLAT_THRESHOLD(s)	((s) / 8 * 7)
+
+enum flat_state {
+	FLAT_EMPTY = 0,				/**< Free record, ends probing sequences */
+	FLAT_LIVE,					/**< Record holding a message */
+	FLAT_TOMB					/**< Removed record */
+};
+
+static struct {
+	struct message *records;	/**< Open-addressed table of records */
+	uint32 *ring;				/**< Expiration order, as record indices */
+	size_t size;				/**< Table size, a power of 2 */
+	size_t ring_size;			/**< Ring capacity */
+	size_t ring_next;			/**< Next ring position, oldest record */
+	size_t live;				/**< Amount of live records */
+	size_t tombs;				/**< Amount of tombstones */
+} flat;
+
 /**
  * "banned" GUIDs for push routing.
  *
@@ -247,6 +300,9 @@ static aging_table_t *at_udp_routes;
 static bool find_message(
 	const struct guid *muid, uint8 function, struct message **m);
 static void free_route_list(struct message *m);
+static struct message *flat_new_entry(const struct guid *muid, uint8 function);
+static void flat_revitalize_entry(struct message *entry);
+static void flat_clear(size_t size);
 
 static inline bool
 is_banned_push(const struct guid *guid)
@@ -1091,6 +1147,16 @@ routing_clear(unsigned idx)
 void
 routing_clear_all(void)
 {
+	if (routing.flat) {
+		if (GNET_PROPERTY(routing_debug)) {
+			g_debug("RT clearing whole flat table (holds %zu / %zu)",
+				flat.live, flat.ring_size);
+		}
+		flat_clear(FLAT_MIN_SIZE);
+		routing.last_rotation = tm_time();
+		return;
+	}
+
 	if (GNET_PROPERTY(routing_debug)) {
 		g_debug("RT clearing whole table (holds %d / %d)",
 			routing.capacity, routing.count);
@@ -1262,16 +1328,27 @@ get_next_slot(bool advance, unsigned *cidx)
 }
 
 /**
- * Fetch next routing table entry to be able to store routing information.
+ * Fetch next routing table entry to be able to store routing information
+ * for the message, and make it visible to find_message().
  */
 static struct message *
-get_next_entry(void)
+get_next_entry(const struct guid *muid, uint8 function)
 {
 	struct message **slot;
+	struct message *entry;
 	unsigned chunk_idx;
 
+	if (routing.flat)
+		return flat_new_entry(muid, function);
+
 	slot = get_next_slot(TRUE, &chunk_idx);
-	return prepare_entry(slot, chunk_idx);
+	entry = prepare_entry(slot, chunk_idx);
+
+	entry->muid = *muid;
+	entry->function = function;
+	hset_insert(routing.messages_hashed, entry);
+
+	return entry;
 }
 
 /**
@@ -1297,6 +1374,11 @@ revitalize_entry(struct message *entry, bool force)
 	if (!force && settings_is_leaf())
 		return;
 
+	if (routing.flat) {
+		flat_revitalize_entry(entry);
+		return;
+	}
+
 	/*
 	 * Relocate at the end of the table, preventing early expiration.
 	 */
@@ -1435,6 +1517,15 @@ message_compare_func(const void *p, const void *q)
 	return a->function == b->function && guid_eq(&a->muid, &b->muid);
 }
 
+/**
+ * Hash message MUID and function.
+ */
+static inline uint
+message_hash(const struct guid *muid, uint8 function)
+{
+	return integer_hash_fast(function) ^ universal_hash(muid, GUID_RAW_SIZE);
+}
+
 /**
  * Hashes message structures for storage in a hash table.
  */
@@ -1443,8 +1534,7 @@ message_hash_func(const void *key)
 {
 	const struct message *msg = key;
 
-	return integer_hash_fast(msg->function) ^
-		universal_hash(&msg->muid, GUID_RAW_SIZE);
+	return message_hash(&msg->muid, msg->function);
 }
 
 /**
@@ -1458,6 +1548,292 @@ message_hash_func2(const void *key)
 	return integer_hash2(msg->function) ^ guid_hash(&msg->muid);
 }
 
+/**
+ * Update routing table statistics after a change in the flat table.
+ */
+static void
+flat_update_stats(void)
+{
+	gnet_stats_set_general(GNR_ROUTING_TABLE_CHUNKS, 0);
+	gnet_stats_set_general(GNR_ROUTING_TABLE_CAPACITY, flat.ring_size);
+	gnet_stats_set_general(GNR_ROUTING_TABLE_COUNT, flat.live);
+}
+
+/**
+ * Free route lists of all the live records in the flat table.
+ */
+static void
+flat_free_routes(void)
+{
+	size_t i;
+
+	for (i = 0; i < flat.size; i++) {
+		struct message *m = &flat.records[i];
+
+		if (FLAT_LIVE == m->state)
+			free_route_list(m);
+	}
+}
+
+/**
+ * Clear the flat table, allocating a new empty table of ``size'' records.
+ */
+static void
+flat_clear(size_t size)
+{
+	size_t i;
+
+	g_assert(is_pow2(size));
+
+	if (flat.records != NULL)
+		flat_free_routes();
+
+	HFREE_NULL(flat.records);
+	HFREE_NULL(flat.ring);
+
+	flat.size = size;
+	flat.ring_size = FLAT_CAPACITY(size);
+	flat.records = halloc0(size * sizeof flat.records[0]);
+	HALLOC_ARRAY(flat.ring, flat.ring_size);
+	for (i = 0; i < flat.ring_size; i++)
+		flat.ring[i] = FLAT_NONE;
+	flat.ring_next = flat.live = flat.tombs = 0;
+
+	flat_update_stats();
+}
+
+/**
+ * Locate the flat table record where message can be inserted.
+ *
+ * The message must not already be present in the table.
+ *
+ * @return index of the first free record in the probing sequence.
+ */
+static inline size_t
+flat_free_record(const struct message *records, size_t size,
+	const struct guid *muid, uint8 function)
+{
+	size_t mask = size - 1;
+	size_t i = message_hash(muid, function) & mask;
+
+	while (FLAT_LIVE == records[i].state)
+		i = (i + 1) & mask;
+
+	return i;
+}
+
+/**
+ * Look for message in the flat table.
+ *
+ * @return the message record, NULL if not found.
+ */
+static struct message *
+flat_find(const struct guid *muid, uint8 function)
+{
+	size_t mask = flat.size - 1;
+	size_t i = message_hash(muid, function) & mask;
+
+	for (;;) {
+		struct message *m = &flat.records[i];
+
+		if (FLAT_EMPTY == m->state)
+			return NULL;
+
+		if (
+			FLAT_LIVE == m->state && function == m->function &&
+			guid_eq(muid, &m->muid)
+		)
+			return m;
+
+		i = (i + 1) & mask;
+	}
+}
+
+/**
+ * Resize the flat table, also purging tombstones and ring holes.
+ *
+ * Records are re-inserted in their expiration order, so the oldest record
+ * remains the next one to expire.
+ *
+ * @attention
+ * This moves all the records, hence invalidates record pointers.
+ */
+static void
+flat_resize(size_t size)
+{
+	struct message *records;
+	uint32 *ring;
+	size_t i, n, ring_size = FLAT_CAPACITY(size);
+
+	g_assert(is_pow2(size));
+	g_assert(flat.live <= ring_size);
+
+	records = halloc0(size * sizeof records[0]);
+	HALLOC_ARRAY(ring, ring_size);
+
+	for (i = n = 0; i < flat.ring_size; i++) {
+		uint32 idx = flat.ring[(flat.ring_next + i) % flat.ring_size];
+		const struct message *m;
+		size_t j;
+
+		if (FLAT_NONE == idx)
+			continue;
+
+		m = &flat.records[idx];
+		g_assert(FLAT_LIVE == m->state);
+
+		j = flat_free_record(records, size, &m->muid, m->function);
+		records[j] = *m;		/* Struct copy */
+		records[j].ring_idx = n;
+		ring[n++] = j;
+	}
+
+	g_assert(n == flat.live);
+
+	for (i = n; i < ring_size; i++)
+		ring[i] = FLAT_NONE;
+
+	if (GNET_PROPERTY(routing_debug)) {
+		g_debug("RT resizing flat table from %zu to %zu records, holds %zu",
+			flat.size, size, n);
+	}
+
+	HFREE_NULL(flat.records);
+	HFREE_NULL(flat.ring);
+
+	flat.records = records;
+	flat.ring = ring;
+	flat.size = size;
+	flat.ring_size = ring_size;
+	flat.ring_next = n % ring_size;
+	flat.tombs = 0;
+
+	flat_update_stats();
+}
+
+/**
+ * Insert record at the next ring position, expiring the oldest record there.
+ */
+static void
+flat_ring_push(size_t idx)
+{
+	size_t pos = flat.ring_next;
+	uint32 old = flat.ring[pos];
+
+	if (old != FLAT_NONE) {
+		struct message *m = &flat.records[old];
+
+		g_assert(FLAT_LIVE == m->state);
+		g_assert(pos == m->ring_idx);
+
+		free_route_list(m);
+		m->state = FLAT_TOMB;
+		flat.live--;
+		flat.tombs++;
+		gnet_stats_dec_general(GNR_ROUTING_TABLE_COUNT);
+	}
+
+	flat.ring[pos] = idx;
+	flat.records[idx].ring_idx = pos;
+
+	if (++flat.ring_next == flat.ring_size)
+		flat.ring_next = 0;
+}
+
+/**
+ * Create new flat table entry for the message, which must not be present.
+ *
+ * @return the new record.
+ */
+static struct message *
+flat_new_entry(const struct guid *muid, uint8 function)
+{
+	time_delta_t elapsed = delta_time(tm_time(), routing.last_rotation);
+	struct message *m;
+	size_t idx;
+
+	/*
+	 * When we are about to cycle over the ring, see whether we should rather
+	 * expand the table because we are cycling too fast.  Conversely, when
+	 * we cycle slowly over a mostly empty table, shrink it.
+	 *
+	 * As with the chunked table, this is only decided once per cycle, hence
+	 * the time of the last rotation is only updated here.
+	 */
+
+	if (0 == flat.ring_next && flat.live != 0) {
+		if (
+			elapsed < TABLE_MIN_CYCLE &&
+			FLAT_CAPACITY(2 * flat.size) <= FLAT_MAX_MESSAGES
+		) {
+			flat_resize(2 * flat.size);
+		} else {
+			if (GNET_PROPERTY(routing_debug)) {
+				g_debug("RT cycled over flat table, elapsed=%u, holds %zu / %zu",
+					(unsigned) elapsed, flat.live, flat.ring_size);
+			}
+
+			if (
+				elapsed > TABLE_MIN_CYCLE &&
+				flat.size > FLAT_MIN_SIZE && flat.live < flat.ring_size / 4
+			)
+				flat_resize(flat.size / 2);
+
+			routing.last_rotation = tm_time();
+		}
+	}
+
+	if G_UNLIKELY(flat.live + flat.tombs >= FLAT_THRESHOLD(flat.size))
+		flat_resize(flat.size);		/* Purge tombstones */
+
+	idx = flat_free_record(flat.records, flat.size, muid, function);
+	m = &flat.records[idx];
+
+	if (FLAT_TOMB == m->state)
+		flat.tombs--;
+
+	g_assert(NULL == m->routes);
+	g_assert(NULL == m->ttls);
+
+	m->muid = *muid;
+	m->function = function;
+	m->ttl = 0;
+	m->state = FLAT_LIVE;
+	flat.live++;
+	gnet_stats_inc_general(GNR_ROUTING_TABLE_COUNT);
+
+	flat_ring_push(idx);
+
+	return m;
+}
+
+/**
+ * Move flat table entry to the tail of the expiration ring.
+ *
+ * Records are not moved, hence the entry remains valid.
+ */
+static void
+flat_revitalize_entry(struct message *entry)
+{
+	size_t age;
+
+	g_assert(FLAT_LIVE == entry->state);
+	g_assert(entry->ring_idx < flat.ring_size);
+
+	/*
+	 * Like the chunked table does for entries within the same chunk,
+	 * do not bother moving recent entries.
+	 */
+
+	age = (flat.ring_next + flat.ring_size - entry->ring_idx) % flat.ring_size;
+
+	if (age <= CHUNK_MESSAGES)
+		return;
+
+	flat.ring[entry->ring_idx] = FLAT_NONE;
+	flat_ring_push(entry - flat.records);
+}
+
 /**
  * Reset this node's GUID.
  */
@@ -1557,8 +1933,14 @@ routing_init(void)
 	 * need to be deallocated
 	 */
 
-	routing.messages_hashed = hset_create_any(message_hash_func,
-		message_hash_func2, message_compare_func);
+	routing.flat = GNET_PROPERTY(routing_flat_table);
+
+	if (routing.flat)
+		flat_clear(FLAT_MIN_SIZE);
+	else {
+		routing.messages_hashed = hset_create_any(message_hash_func,
+			message_hash_func2, message_compare_func);
+	}
 	routing.last_rotation = tm_time();
 
 	/*
@@ -1745,12 +2127,8 @@ message_add(const struct guid *muid, uint8 function,
 	if (found)			/* Dup message forwarded due to higher TTL */
 		entry = m;		/* Reuse existing entry */
 	else {
-		entry = get_next_entry();
+		entry = get_next_entry(muid, function);
 		g_assert(entry->routes == NULL);
-
-		/* fill in that storage space */
-		entry->muid = *muid;
-		entry->function = function;
 	}
 
 	g_assert(route != NULL);
@@ -1798,9 +2176,6 @@ message_add(const struct guid *muid, uint8 function,
 		entry->ttl = gnutella_header_get_ttl(&node->header);
 	else
 		entry->ttl = GNET_PROPERTY(my_ttl);
-
-	/* insert the new message into the hash table */
-	hset_insert(routing.messages_hashed, entry);
 }
 
 /**
@@ -1894,6 +2269,16 @@ find_message(const struct guid *muid, uint8 function, struct message **m)
 	struct message dummy;
 	const void *orig_key;
 
+	if (routing.flat) {
+		struct message *msg = flat_find(muid, function);
+
+		if (msg != NULL)
+			purge_dangling_references(msg);
+
+		*m = msg;
+		return msg != NULL;
+	}
+
 	dummy.muid = *muid;
 	dummy.function = function;
 
@@ -3192,7 +3577,13 @@ routing_close(void)
 {
 	uint cnt;
 
-	g_assert(routing.messages_hashed != NULL);
+	if (routing.flat) {
+		flat_free_routes();
+		HFREE_NULL(flat.records);
+		HFREE_NULL(flat.ring);
+	} else {
+		g_assert(routing.messages_hashed != NULL);
+	}
 
 	hset_free_null(&routing.messages_hashed);
 
@@ -3233,4 +3624,248 @@ routing_close(void)
 	aging_destroy(&at_udp_routes);
 }
 
+#ifdef ROUTING_TESTING
+
+#define ROUTING_TEST_NODES	6	/**< Amount of fake nodes sending messages */
+#define ROUTING_TEST_FIRST	(2 * CHUNK_MESSAGES + 100)	/**< First batch */
+#define ROUTING_TEST_SECOND	(3 * CHUNK_MESSAGES / 2)	/**< Second batch */
+#define ROUTING_TEST_TOTAL	(ROUTING_TEST_FIRST + ROUTING_TEST_SECOND)
+
+/**
+ * What the routing table knows about a message.
+ */
+struct routing_test_msg {
+	uint8 found;				/**< Whether message was found */
+	uint8 routes;				/**< Amount of routes */
+	uint8 ttls;					/**< Amount of TTLs */
+	uint8 ttl;					/**< Max TTL seen */
+};
+
+/**
+ * Compute the MUID of the i-th test message.
+ */
+static void
+routing_test_muid(struct guid *muid, size_t i)
+{
+	ZERO(muid);
+	poke_be32(&muid->v[0], i);
+	poke_be32(&muid->v[12], ~i);
+}
+
+/**
+ * Compute the function of the i-th test message.
+ */
+static uint8
+routing_test_function(size_t i)
+{
+	static const uint8 functions[] = {
+		GTA_MSG_SEARCH, GTA_MSG_PUSH_REQUEST, QUERY_HIT_ROUTE_SAVE,
+	};
+
+	return functions[i % N_ITEMS(functions)];
+}
+
+/**
+ * Record what the routing table knows about the first ``n'' test messages.
+ */
+static void
+routing_test_snapshot(struct routing_test_msg *msgs, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		struct guid muid;
+		struct message *m;
+
+		routing_test_muid(&muid, i);
+		ZERO(&msgs[i]);
+
+		if (find_message(&muid, routing_test_function(i), &m)) {
+			msgs[i].found = TRUE;
+			msgs[i].routes = pslist_length(m->routes);
+			msgs[i].ttls = pslist_length(m->ttls);
+			msgs[i].ttl = m->ttl;
+		}
+	}
+}
+
+/**
+ * Dispose of the current routing table and start with an empty one,
+ * using the flat or the chunked store.
+ */
+static void
+routing_test_store(bool use_flat)
+{
+	if (routing.flat) {
+		flat_free_routes();
+		HFREE_NULL(flat.records);
+		HFREE_NULL(flat.ring);
+	} else {
+		routing_clear_all();
+	}
+
+	routing.flat = use_flat;
+
+	if (use_flat) {
+		flat_clear(FLAT_MIN_SIZE);
+	} else if (NULL == routing.messages_hashed) {
+		routing.messages_hashed = hset_create_any(message_hash_func,
+			message_hash_func2, message_compare_func);
+	}
+
+	routing.last_rotation = tm_time();
+}
+
+/**
+ * Run the test scenario on an empty store, recording the state of the test
+ * messages after each batch.
+ *
+ * The first batch is added whilst cycling fast, forcing the table to grow.
+ * The second batch is added whilst cycling slowly, forcing the eviction of
+ * the oldest messages.
+ */
+static void
+routing_test_run(struct routing_test_msg *first, struct routing_test_msg *second)
+{
+	gnutella_node_t *nodes[ROUTING_TEST_NODES];
+	struct guid muid;
+	struct message *m;
+	size_t i;
+
+	for (i = 0; i < N_ITEMS(nodes); i++) {
+		WALLOC0(nodes[i]);
+		nodes[i]->magic = NODE_MAGIC;
+		nodes[i]->peermode = NODE_P_NORMAL;
+		gnutella_header_set_ttl(&nodes[i]->header, i + 1);
+	}
+
+	for (i = 0; i < ROUTING_TEST_FIRST; i++) {
+		routing_test_muid(&muid, i);
+		message_add(&muid, routing_test_function(i), nodes[i % N_ITEMS(nodes)]);
+	}
+
+	/*
+	 * Duplicates coming from another node add a route, those coming from
+	 * the same node do not.
+	 */
+
+	for (i = 0; i < ROUTING_TEST_FIRST; i += 7) {
+		gnutella_node_t *n = nodes[(i + 1) % N_ITEMS(nodes)];
+		uint8 function = routing_test_function(i);
+
+		routing_test_muid(&muid, i);
+		message_add(&muid, function, n);
+		message_add(&muid, function, n);
+
+		g_assert(!find_message(&muid, GTA_MSG_BYE, &m));
+		g_assert(NULL == m);
+	}
+
+	/*
+	 * Many routes for the same query, including ourselves.
+	 */
+
+	routing_test_muid(&muid, 3);
+	g_assert(GTA_MSG_SEARCH == routing_test_function(3));
+
+	for (i = 0; i < N_ITEMS(nodes); i++)
+		message_add(&muid, GTA_MSG_SEARCH, nodes[i]);
+	message_add(&muid, GTA_MSG_SEARCH, NULL);
+
+	g_assert(find_message(&muid, GTA_MSG_SEARCH, &m));
+	g_assert(N_ITEMS(nodes) + 1 == pslist_length(m->routes));
+	g_assert(N_ITEMS(nodes) + 1 == pslist_length(m->ttls));
+	g_assert(GPOINTER_TO_UINT(pslist_nth_data(m->ttls, 0)) == 3 % 6 + 1);
+	g_assert(GPOINTER_TO_UINT(pslist_nth_data(m->ttls, N_ITEMS(nodes))) ==
+		GNET_PROPERTY(my_ttl));
+
+	/*
+	 * Revitalize the oldest message, so that it survives the next batch.
+	 */
+
+	routing_test_muid(&muid, 0);
+	g_assert(find_message(&muid, routing_test_function(0), &m));
+	revitalize_entry(m, TRUE);
+
+	routing_test_snapshot(first, ROUTING_TEST_FIRST);
+
+	for (i = 0; i < ROUTING_TEST_FIRST; i++) {
+		g_assert(first[i].found);
+		g_assert(first[i].ttl == i % N_ITEMS(nodes) + 1);
+		g_assert(first[i].routes ==
+			(3 == i ? N_ITEMS(nodes) + 1 : 0 == i % 7 ? 2 : 1));
+		g_assert(first[i].ttls ==
+			(QUERY_HIT_ROUTE_SAVE == routing_test_function(i) ?
+				0 : first[i].routes));
+	}
+
+	/*
+	 * Cycle slowly now.
+	 */
+
+	routing.last_rotation = tm_time() - TABLE_MIN_CYCLE - 1;
+
+	for (i = ROUTING_TEST_FIRST; i < ROUTING_TEST_TOTAL; i++) {
+		routing_test_muid(&muid, i);
+		message_add(&muid, routing_test_function(i), nodes[i % N_ITEMS(nodes)]);
+	}
+
+	routing_test_snapshot(second, ROUTING_TEST_TOTAL);
+
+	g_assert(second[0].found);			/* Revitalized */
+	g_assert(!second[1].found);			/* Oldest message, expired */
+	g_assert(second[ROUTING_TEST_FIRST - 1].found);
+
+	for (i = ROUTING_TEST_FIRST; i < ROUTING_TEST_TOTAL; i++)
+		g_assert(second[i].found);
+
+	for (i = 0; i < N_ITEMS(nodes); i++) {
+		routing_node_remove(nodes[i]);
+		WFREE(nodes[i]);
+	}
+}
+
+/**
+ * Check that the flat routing table behaves as the chunked one.
+ */
+void G_COLD
+routing_test(void)
+{
+	struct routing_test_msg *first[2], *second[2];
+	bool use_flat = routing.flat;
+	uint i;
+
+	g_debug("%s() starting...", G_STRFUNC);
+
+	for (i = 0; i < N_ITEMS(first); i++) {
+		HALLOC_ARRAY(first[i], ROUTING_TEST_FIRST);
+		HALLOC_ARRAY(second[i], ROUTING_TEST_TOTAL);
+
+		routing_test_store(1 == i);
+		routing_test_run(first[i], second[i]);
+	}
+
+	g_assert(0 == memcmp(first[0], first[1],
+		ROUTING_TEST_FIRST * sizeof first[0][0]));
+	g_assert(0 == memcmp(second[0], second[1],
+		ROUTING_TEST_TOTAL * sizeof second[0][0]));
+
+	routing_test_store(use_flat);
+
+	for (i = 0; i < N_ITEMS(first); i++) {
+		HFREE_NULL(first[i]);
+		HFREE_NULL(second[i]);
+	}
+
+	g_debug("%s() done.", G_STRFUNC);
+}
+
+#else	/* !ROUTING_TESTING */
+void G_COLD
+routing_test(void)
+{
+	/* Nothing */
+}
+#endif	/* ROUTING_TESTING */
+
 /* vi: set ts=4 sw=4 cindent: */
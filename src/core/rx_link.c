@@ -42,7 +42,9 @@
 #include "rxbuf.h"
 #include "bsched.h"
 
+#include "lib/cq.h"
 #include "lib/pmsg.h"
+#include "lib/slist.h"
 #include "lib/walloc.h"
 #include "lib/override.h"		/* Must be the last header included */
 
@@ -54,9 +56,56 @@ struct attr {
 	bio_source_t *bio;			/**< Bandwidth-limited I/O source */
 	bsched_bws_t bws;			/**< Scheduler to attach I/O source to */
 	const struct rx_link_cb *cb;/**< Layer-specific callbacks */
+	slist_t *held;				/**< Messages read but not delivered yet */
+	cevent_t *resume_ev;		/**< Delivery of held messages on resume */
 	unsigned delivering:1;		/**< Currently delivery payloads */
+	unsigned paused:1;			/**< Reading suspended by owner */
 };
 
+/**
+ * Deliver the messages held since the owner paused us, in order.
+ *
+ * @return TRUE if all the held messages were delivered.
+ */
+static bool
+rx_link_deliver_held(rxdrv_t *rx)
+{
+	struct attr *attr = rx->opaque;
+
+	g_assert(!attr->delivering);	/* No recursion: would mess up order */
+
+	attr->delivering = TRUE;
+
+	while (!attr->paused && 0 != slist_length(attr->held)) {
+		pmsg_t *mb = slist_shift(attr->held);
+
+		if (!(*rx->data.ind)(rx, mb)) {
+			pmsg_slist_discard_all(attr->held);		/* Receiver is done */
+			break;
+		}
+	}
+
+	attr->delivering = FALSE;
+
+	return 0 == slist_length(attr->held);
+}
+
+/**
+ * Callout queue callback to deliver held messages after a resume.
+ */
+static void
+rx_link_resume_deliver(cqueue_t *cq, void *obj)
+{
+	rxdrv_t *rx = obj;
+	struct attr *attr = rx->opaque;
+
+	rx_check(rx);
+	cq_zero(cq, &attr->resume_ev);
+
+	if (!attr->paused)
+		(void) rx_link_deliver_held(rx);
+}
+
 /**
  * Invoked when the input file descriptor has more data available.
  */
@@ -75,6 +124,16 @@ is_readable(void *data, int unused_source, inputevt_cond_t cond)
 	(void) unused_source;
 	g_assert(attr->bio);			/* Input enabled */
 
+	/*
+	 * Data held whilst we were paused must be delivered before anything
+	 * we could read now.
+	 */
+
+	if G_UNLIKELY(0 != slist_length(attr->held)) {
+		if (!rx_link_deliver_held(rx))
+			return;
+	}
+
 	if (cond & INPUT_EVENT_EXCEPTION) {
 		errno = EIO;
 		attr->cb->read_error(rx->owner, _("Read failed (Input Exception)"));
@@ -148,7 +207,15 @@ is_readable(void *data, int unused_source, inputevt_cond_t cond)
 			}
 			mb = pmsg_alloc(PMSG_P_DATA, db[i], 0, n);
 			i++;
-			if (!(*rx->data.ind)(rx, mb))
+
+			/*
+			 * If the owner paused us during delivery, keep the remaining
+			 * data around: they will be delivered when we are resumed.
+			 */
+
+			if G_UNLIKELY(attr->paused || 0 != slist_length(attr->held))
+				slist_append(attr->held, mb);
+			else if (!(*rx->data.ind)(rx, mb))
 				break;
 		}
 
@@ -188,6 +255,7 @@ rx_link_init(rxdrv_t *rx, const void *args)
 	attr->wio = rargs->wio;
 	attr->bws = rargs->bws;
 	attr->bio = NULL;
+	attr->held = slist_new();
 
 	rx->opaque = attr;
 
@@ -207,6 +275,8 @@ rx_link_destroy(rxdrv_t *rx)
 		attr->bio = NULL;					/* Paranoid */
 	}
 
+	cq_cancel(&attr->resume_ev);
+	pmsg_slist_free_all(&attr->held);
 	WFREE(attr);
 	rx->opaque = NULL;
 }
@@ -281,6 +351,9 @@ rx_link_disable(rxdrv_t *rx)
 
 	bsched_source_remove(attr->bio);
 	attr->bio = NULL;
+	attr->paused = FALSE;
+	cq_cancel(&attr->resume_ev);
+	pmsg_slist_discard_all(attr->held);
 }
 
 /**
@@ -294,6 +367,62 @@ bio_source *rx_link_bio_source(rxdrv_t *rx)
 	return attr->bio;
 }
 
+/**
+ * Suspend reading from the network, keeping the I/O source (and therefore
+ * its bandwidth accounting) around.
+ *
+ * Contrary to rx_disable(), the upper layers remain enabled and nothing is
+ * lost in the middle of a message.  The owner stops getting data, even when
+ * pausing from its data indication callback: what was already read from the
+ * network is held back until rx_link_resume().
+ *
+ * @param rx	the link layer, at the bottom of the RX stack
+ */
+void
+rx_link_pause(rxdrv_t *rx)
+{
+	struct attr *attr = rx->opaque;
+
+	rx_check(rx);
+	g_assert(rx->ops == rx_link_get_ops());
+
+	if (NULL == attr->bio || attr->paused)
+		return;
+
+	bio_remove_callback(attr->bio);
+	attr->paused = TRUE;
+}
+
+/**
+ * Resume reading from the network after rx_link_pause().
+ *
+ * @param rx	the link layer, at the bottom of the RX stack
+ */
+void
+rx_link_resume(rxdrv_t *rx)
+{
+	struct attr *attr = rx->opaque;
+
+	rx_check(rx);
+	g_assert(rx->ops == rx_link_get_ops());
+
+	if (!attr->paused)
+		return;
+
+	g_assert(attr->bio != NULL);
+
+	bio_add_callback(attr->bio, is_readable, rx);
+	attr->paused = FALSE;
+
+	/*
+	 * Held data are delivered asynchronously, so that the owner can safely
+	 * resume from anywhere, including before changing the RX stack owner.
+	 */
+
+	if (0 != slist_length(attr->held) && NULL == attr->resume_ev)
+		attr->resume_ev = cq_main_insert(1, rx_link_resume_deliver, rx);
+}
+
 static const struct rxdrv_ops rx_link_ops = {
 	rx_link_init,		/**< init */
 	rx_link_destroy,	/**< destroy */
@@ -40,6 +40,8 @@
 #include "if/core/bsched.h"
 
 const struct rxdrv_ops *rx_link_get_ops(void);
+void rx_link_pause(rxdrv_t *rx);
+void rx_link_resume(rxdrv_t *rx);
 
 /**
  * Callbacks used by the link layer.
@@ -684,6 +684,7 @@ shared_file_set_names(shared_file_t *sf, const char *filename)
 static const uint FILENAME_CLASH = -1;		/**< Indicates basename clashes */
 static const uint PARTIAL_FILE = -2;		/**< Indicates partial file */
 static const uint SPECIAL_FILE = -3;		/**< Special served files */
+static const uint FAKE_FILE = -4;			/**< Fake file, for self-tests */
 
 /**
  * Initialize special file entry, returning shared_file_t structure if
@@ -3748,6 +3749,53 @@ shared_file_from_fileinfo(fileinfo_t *fi)
 	fi->sf = shared_file_ref(sf);
 }
 
+/**
+ * Create a fake shared file, which is not part of the library.
+ *
+ * This is meant for self-tests that need to generate query hits: the file
+ * looks shared but is not recorded anywhere, and it is freed when its last
+ * reference is removed.
+ *
+ * @param filename		the name of the file
+ * @param relative_path	the relative path of the file, NULL if none
+ * @param size			the file size
+ * @param sha1			the SHA1 of the file
+ * @param tth			the TTH of the file, NULL if none
+ *
+ * @return a new shared file, with one reference, NULL on error.
+ */
+shared_file_t *
+shared_file_fake(const char *filename, const char *relative_path,
+	filesize_t size, const struct sha1 *sha1, const struct tth *tth)
+{
+	shared_file_t *sf;
+
+	g_assert(filename != NULL);
+	g_assert(sha1 != NULL);
+
+	sf = shared_file_alloc();
+	sf->flags = SHARE_F_HAS_DIGEST;
+	sf->mtime = sf->ctime = tm_time();
+	sf->sha1 = atom_sha1_get(sha1);
+	sf->tth = NULL == tth ? NULL : atom_tth_get(tth);
+	sf->file_size = size;
+	sf->file_index = FAKE_FILE;
+
+	if (relative_path != NULL)
+		sf->relative_path = atom_str_get(relative_path);
+
+	if (shared_file_set_names(sf, filename)) {
+		shared_file_free(&sf);
+		return NULL;
+	}
+
+	sf->mime_type = mime_type_from_filename(sf->name_nfc);
+	sf->media_type = shared_file_media_type(sf->mime_type);
+	sf->file_path = atom_str_get(filename);
+
+	return shared_file_ref(sf);
+}
+
 /**
  * Get shared file identified by its SHA1.
  *
@@ -146,6 +146,8 @@ fileinfo_t *shared_file_fileinfo(const shared_file_t *sf) G_PURE;
 const char *shared_file_mime_type(const shared_file_t *sf) G_PURE;
 bool shared_file_indexed(const shared_file_t *sf) G_PURE;
 void shared_file_from_fileinfo(fileinfo_t *fi);
+shared_file_t *shared_file_fake(const char *filename, const char *relative_path,
+	filesize_t size, const struct sha1 *sha1, const struct tth *tth);
 bool shared_file_has_media_type(const shared_file_t *sf, unsigned m)
 	G_PURE;
 
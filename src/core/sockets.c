@@ -112,6 +112,7 @@
 #define MAX_UDP_LOOP_MS		37		/**< Amount of CPU time we can spend */
 #define UDP_QUEUED_GUESS	65536	/**< Guess amount of pending RX input */
 #define UDP_QUEUE_DELAY_MS	250		/**< RX queue processing delay */
+#define UDP_BATCH_MAX		16		/**< Max datagrams read per system call */
 #define TLS_BAN_FREQ		300		/**< Avoid TLS for 5 minutes */
 
 enum {
@@ -128,6 +129,38 @@ struct gnutella_socket *s_udp_listen6 = NULL;
 struct gnutella_socket *s_local_listen = NULL;
 
 static aging_table_t *tls_ban;
+
+#ifdef HAS_RECVMMSG
+/**
+ * Batch of datagrams read from an UDP socket through a single recvmmsg().
+ *
+ * The buffers are allocated once, the first time we read from the socket,
+ * and then reused: datagrams are handed over to the application (or copied
+ * to the read-ahead queue) straight from the arena.
+ */
+struct udp_batch {
+	struct mmsghdr msg[UDP_BATCH_MAX];	/**< Message headers for recvmmsg() */
+	iovec_t iov[UDP_BATCH_MAX];			/**< One I/O vector per datagram */
+	socket_addr_t from[UDP_BATCH_MAX];	/**< Origin of each datagram */
+#if defined(CMSG_LEN) && defined(CMSG_SPACE)
+	union {
+		struct cmsghdr hdr;
+		size_t align;
+		char bytes[CMSG_SPACE(128)];
+	} cmsg[UDP_BATCH_MAX];				/**< Ancillary data, for dst address */
+#endif	/* CMSG_LEN && CMSG_SPACE */
+	char *arena;						/**< Datagram buffers */
+	size_t bufsize;						/**< Size of each datagram buffer */
+	unsigned count;						/**< Amount of datagrams in batch */
+	unsigned next;						/**< Index of next datagram to deliver */
+};
+
+static bool socket_udp_no_recvmmsg;		/**< Set when kernel lacks recvmmsg() */
+#endif	/* HAS_RECVMMSG */
+
+#ifdef HAS_SENDMMSG
+static bool socket_udp_no_sendmmsg;	/**< Set when kernel lacks sendmmsg() */
+#endif
 static once_flag_t tls_ban_inited;
 
 static bool socket_is_shutdowning;	/**< Layer shutdown has started */
@@ -1537,6 +1570,42 @@ socket_udp_qfree(void *item, void *unused_data)
 	socket_udpq_free(item);
 }
 
+#ifdef HAS_RECVMMSG
+/**
+ * Allocate the datagram batch for the UDP socket.
+ */
+static struct udp_batch *
+socket_udp_batch_alloc(gnutella_socket_t *s)
+{
+	struct udp_batch *b;
+
+	g_assert(s->flags & SOCK_F_UDP);
+	g_assert(NULL == s->resource.udp->batch);
+
+	WALLOC0(b);
+	b->bufsize = s->buf_size;
+	b->arena = halloc(UDP_BATCH_MAX * b->bufsize);
+
+	return s->resource.udp->batch = b;
+}
+
+/**
+ * Free the datagram batch of the UDP socket, if any.
+ */
+static void
+socket_udp_batch_free(gnutella_socket_t *s)
+{
+	struct udp_batch *b = s->resource.udp->batch;
+
+	if (b != NULL) {
+		HFREE_NULL(b->arena);
+		WFREE(b);
+		s->resource.udp->batch = NULL;
+	}
+}
+
+#endif	/* HAS_RECVMMSG */
+
 /**
  * Dispose of socket, closing connection, removing input callback, and
  * reclaiming attached getline buffer.
@@ -1557,6 +1626,9 @@ socket_free(struct gnutella_socket *s)
 		struct udpctx *uctx = s->resource.udp;
 		if (uctx != NULL) {
 			WFREE_NULL(uctx->socket_addr, sizeof(socket_addr_t));
+#ifdef HAS_RECVMMSG
+			socket_udp_batch_free(s);
+#endif
 			eslist_foreach(&uctx->queue, socket_udp_qfree, NULL);
 			cq_cancel(&uctx->queue_ev);
 			WFREE(s->resource.udp);
@@ -2721,9 +2793,10 @@ socket_udp_extract_dst_addr(const struct msghdr *msg, host_addr_t *dst_addr)
  * Note: for the Gnutella datagram socket this is udp_received().
  */
 static inline void
-socket_udp_process(gnutella_socket_t *s, bool truncated)
+socket_udp_process(gnutella_socket_t *s,
+	const void *data, size_t len, bool truncated)
 {
-	(*s->resource.udp->data_ind)(s, s->buf, s->pos, truncated);
+	(*s->resource.udp->data_ind)(s, data, len, truncated);
 }
 
 /**
@@ -2789,6 +2862,59 @@ socket_udp_is_old(const gnutella_socket_t *s)
 	return booleanize(s->flags & SOCK_F_OLD);
 }
 
+/**
+ * Record the origin of a datagram we just read from an UDP socket.
+ *
+ * @param s				the socket which received the datagram
+ * @param from_addr		the address of the sender
+ * @param len			the length of the datagram
+ * @param has_dst_addr	whether we know the destination address
+ * @param dst_addr		the destination address, if known
+ *
+ * @return TRUE if the datagram can be processed, FALSE if it must be ignored.
+ */
+static bool
+socket_udp_got_datagram(gnutella_socket_t *s, const socket_addr_t *from_addr,
+	size_t len, bool has_dst_addr, host_addr_t dst_addr)
+{
+	/*
+	 * Record remote address.
+	 */
+
+	s->addr = socket_addr_get_addr(from_addr);
+	s->port = socket_addr_get_port(from_addr);
+
+	if (!is_host_addr(s->addr)) {
+		gnet_stats_inc_general(GNR_UDP_BOGUS_SOURCE_IP);
+		bws_udp_count_read(len, FALSE);	/* Assume not from DHT */
+		return FALSE;
+	}
+
+	if (has_dst_addr) {
+		static host_addr_t last_addr;
+
+		settings_addr_changed(dst_addr, s->addr);
+
+		/*
+		 * Show the destination address only when it differs from
+		 * the last seen or if the debug level is higher than 1.
+		 */
+
+		if (
+			GNET_PROPERTY(socket_debug) > 1 ||
+			!host_addr_equiv(last_addr, dst_addr)
+		) {
+			last_addr = dst_addr;
+			if (GNET_PROPERTY(socket_debug)) {
+				g_debug("%s(): dst_addr=%s",
+					G_STRFUNC, host_addr_to_string(dst_addr));
+			}
+		}
+	}
+
+	return TRUE;
+}
+
 /**
  * Someone is sending us a datagram.  Read it into the socket's buffer.
  *
@@ -2893,46 +3019,210 @@ socket_udp_accept(struct gnutella_socket *s, bool *truncation)
 
 	s->pos = r;
 
-	/*
-	 * Record remote address.
-	 */
-
-	s->addr = socket_addr_get_addr(from_addr);
-	s->port = socket_addr_get_port(from_addr);
-
-	if (!is_host_addr(s->addr)) {
-		gnet_stats_inc_general(GNR_UDP_BOGUS_SOURCE_IP);
-		bws_udp_count_read(r, FALSE);	/* Assume not from DHT */
+	if (!socket_udp_got_datagram(s, from_addr, r, has_dst_addr, dst_addr)) {
 		errno = EINVAL;
 		return (ssize_t) -1;
 	}
 
-	if (has_dst_addr) {
-		static host_addr_t last_addr;
+	if (truncated)
+		gnet_stats_inc_general(GNR_UDP_RX_TRUNCATED);
 
-		settings_addr_changed(dst_addr, s->addr);
+	*truncation = truncated;
+	return r;
+}
+
+#ifdef HAS_RECVMMSG
+/**
+ * Refill the datagram batch of the socket with a single recvmmsg() call.
+ *
+ * @return -1 on error with errno set, the amount of datagrams read otherwise.
+ */
+static int
+socket_udp_batch_fill(gnutella_socket_t *s, struct udp_batch *b)
+{
+	unsigned i;
+	int r;
+
+	g_assert(b->next == b->count);
+
+	for (i = 0; i < N_ITEMS(b->msg); i++) {
+		struct msghdr *msg = &b->msg[i].msg_hdr;
+		socklen_t from_len;
+
+		from_len = socket_addr_init(&b->from[i], s->net);
+		iovec_set(&b->iov[i], &b->arena[i * b->bufsize], b->bufsize);
+
+		ZERO(msg);
+		msg->msg_name = socket_addr_get_sockaddr(&b->from[i]);
+		msg->msg_namelen = from_len;
+		msg->msg_iov = &b->iov[i];
+		msg->msg_iovlen = 1;
+#if defined(CMSG_LEN) && defined(CMSG_SPACE)
+		ZERO(&b->cmsg[i].hdr);
+		msg->msg_control = b->cmsg[i].bytes;
+		msg->msg_controllen = sizeof b->cmsg[i].bytes;
+#endif	/* CMSG_LEN && CMSG_SPACE */
+		b->msg[i].msg_len = 0;
+	}
+
+	b->count = b->next = 0;
+	r = recvmmsg(s->file_desc, b->msg, N_ITEMS(b->msg), MSG_DONTWAIT, NULL);
+
+	if (r > 0)
+		b->count = r;
+
+	return r;
+}
+
+/**
+ * Fetch the next valid datagram from the socket's batch.
+ *
+ * @param s				the socket which received the datagrams
+ * @param b				the datagram batch
+ * @param data			written with the start of the datagram
+ * @param truncation	written with whether datagram was truncated
+ *
+ * @return -1 when the batch is exhausted, the size of the datagram otherwise.
+ */
+static ssize_t
+socket_udp_batch_next(gnutella_socket_t *s, struct udp_batch *b,
+	const void **data, bool *truncation)
+{
+	while (b->next < b->count) {
+		unsigned i = b->next++;
+		const struct msghdr *msg = &b->msg[i].msg_hdr;
+		size_t len = b->msg[i].msg_len;
+		bool truncated = FALSE, has_dst_addr = FALSE;
+		host_addr_t dst_addr;
+
+		g_assert(len <= b->bufsize);
+
+		/* msg_flags is missing at least in some versions of IRIX. */
+#if defined(HAS_MSGHDR_MSG_FLAGS)
+		truncated = 0 != (MSG_TRUNC & msg->msg_flags);
+#endif
+
+		if (!GNET_PROPERTY(force_local_ip))
+			has_dst_addr = socket_udp_extract_dst_addr(msg, &dst_addr);
+
+		if (!socket_udp_got_datagram(s, &b->from[i], len,
+				has_dst_addr, dst_addr)
+		) {
+			if (GNET_PROPERTY(socket_debug)) {
+				g_debug("%s(): ignoring datagram #%u from bogus source",
+					G_STRFUNC, i);
+			}
+			continue;
+		}
+
+		if (truncated)
+			gnet_stats_inc_general(GNR_UDP_RX_TRUNCATED);
+
+		*data = iovec_base(&b->iov[i]);
+		*truncation = truncated;
+		return len;
+	}
+
+	return (ssize_t) -1;
+}
+
+/**
+ * @return whether the socket has datagrams pending in its batch.
+ */
+static inline bool
+socket_udp_batch_pending(const gnutella_socket_t *s)
+{
+	const struct udp_batch *b = s->resource.udp->batch;
+
+	return b != NULL && b->next < b->count;
+}
+#else	/* !HAS_RECVMMSG */
+#define socket_udp_batch_pending(s)	FALSE
+#endif	/* HAS_RECVMMSG */
+
+/**
+ * Read the next datagram from the UDP socket.
+ *
+ * When recvmmsg() is available, datagrams are read from the kernel in
+ * batches and then delivered one at a time from the socket's batch, saving
+ * one system call per datagram.  Otherwise, each datagram is read in the
+ * socket's buffer.
+ *
+ * @param s				the socket which receives a datagram
+ * @param data			written with the start of the datagram
+ * @param truncation	written with whether datagram was truncated
+ *
+ * @return -1 on error, the size of the datagram otherwise.
+ */
+static ssize_t
+socket_udp_read(gnutella_socket_t *s, const void **data, bool *truncation)
+{
+	ssize_t r;
+
+#ifdef HAS_RECVMMSG
+	{
+		struct udp_batch *b = s->resource.udp->batch;
 
 		/*
-		 * Show the destination address only when it differs from
-		 * the last seen or if the debug level is higher than 1.
+		 * Do not read ahead when the socket is configured to process one
+		 * single datagram per I/O event.
 		 */
 
 		if (
-			GNET_PROPERTY(socket_debug) > 1 ||
-			!host_addr_equiv(last_addr, dst_addr)
-		) {
-			last_addr = dst_addr;
-			if (GNET_PROPERTY(socket_debug)) {
-				g_debug("%s(): dst_addr=%s",
-					G_STRFUNC, host_addr_to_string(dst_addr));
+			NULL == b && !socket_udp_no_recvmmsg &&
+			!(s->flags & SOCK_F_SINGLE)
+		)
+			b = socket_udp_batch_alloc(s);
+
+		if (b != NULL) {
+			r = socket_udp_batch_next(s, b, data, truncation);
+			if (r != (ssize_t) -1)
+				return r;
+
+			if (s->flags & SOCK_F_SINGLE)
+				goto single;
+
+			/*
+			 * Batch exhausted, refill it.  Bogus datagrams are skipped
+			 * when fetching from the batch so we may have to loop.
+			 */
+
+			for (;;) {
+				int n = socket_udp_batch_fill(s, b);
+
+				if (n <= 0) {
+					if (0 == n)
+						errno = EAGAIN;
+					break;
+				}
+
+				r = socket_udp_batch_next(s, b, data, truncation);
+				if (r != (ssize_t) -1)
+					return r;
 			}
+
+			if (ENOSYS != errno)
+				return (ssize_t) -1;
+
+			/*
+			 * Kernel does not support recvmmsg(), fallback to reading
+			 * datagrams one at a time.
+			 */
+
+			g_info("%s(): recvmmsg() not supported, reading datagrams "
+				"one at a time", G_STRFUNC);
+
+			socket_udp_no_recvmmsg = TRUE;
+			socket_udp_batch_free(s);
 		}
 	}
 
-	if (truncated)
-		gnet_stats_inc_general(GNR_UDP_RX_TRUNCATED);
+single:
+#endif	/* HAS_RECVMMSG */
+
+	r = socket_udp_accept(s, truncation);
+	*data = s->buf;
 
-	*truncation = truncated;
 	return r;
 }
 
@@ -2940,7 +3230,8 @@ socket_udp_accept(struct gnutella_socket *s, bool *truncation)
  * Enqueue UDP datagram for deferred processing.
  */
 static void
-socket_udp_queue(gnutella_socket_t *s, bool truncated)
+socket_udp_queue(gnutella_socket_t *s,
+	const void *data, size_t len, bool truncated)
 {
 	struct udpctx *uctx;
 	struct udpq *uq;
@@ -2950,8 +3241,8 @@ socket_udp_queue(gnutella_socket_t *s, bool truncated)
 	uctx = s->resource.udp;
 
 	WALLOC(uq);
-	uq->buf = wcopy(s->buf, s->pos);
-	uq->len = s->pos;
+	uq->buf = wcopy(data, len);
+	uq->len = len;
 	uq->queued = tm_time();
 	uq->truncated = booleanize(truncated);
 	uq->addr = s->addr;
@@ -3113,10 +3404,11 @@ socket_udp_event(void *data, int unused_source, inputevt_cond_t cond)
 	rd = qd = qn = 0;
 
 	for(;;) {
+		const void *data;
 		ssize_t r;
 
 		i++;
-		r = socket_udp_accept(s, &truncated);		/* Read datagram */
+		r = socket_udp_read(s, &data, &truncated);	/* Read datagram */
 
 		if ((ssize_t) -1 == r) {
 			/* ECONNRESET is meaningless with UDP but happens on Windows */
@@ -3143,15 +3435,23 @@ socket_udp_event(void *data, int unused_source, inputevt_cond_t cond)
 		 */
 
 		if (enqueue) {
-			socket_udp_queue(s, truncated);				/* Enqueue it */
+			socket_udp_queue(s, data, r, truncated);	/* Enqueue it */
 			qd += r;
 			qn++;
 		} else {
-			socket_udp_process(s, truncated);			/* Process it */
+			socket_udp_process(s, data, r, truncated);	/* Process it */
 		}
 
 		avail = size_saturate_sub(avail, r);
 
+		/*
+		 * Datagrams already read in the batch must be handled before we
+		 * can leave: they are no longer in the kernel RX queue.
+		 */
+
+		if (socket_udp_batch_pending(s))
+			goto next;
+
 		/* kevent() reports 32 more bytes than there are, maybe
 		 * it refers to header or control msg data. */
 		if (avail <= 32)
@@ -3160,7 +3460,7 @@ socket_udp_event(void *data, int unused_source, inputevt_cond_t cond)
 	next:
 
 		/* Process one event at a time if configured as such */
-		if (s->flags & SOCK_F_SINGLE)
+		if ((s->flags & SOCK_F_SINGLE) && !socket_udp_batch_pending(s))
 			break;
 
 		if (!enqueue) {
@@ -4309,8 +4609,9 @@ socket_set_single(struct gnutella_socket *s, bool on)
 /**
  * Creates a non-blocking listening UDP socket.
  *
- * Upon datagram reception, the ``data_ind'' callback is invoked. The received
- * data will be held in s->buf, being s->pos byte-long.
+ * Upon datagram reception, the ``data_ind'' callback is invoked with the
+ * received data, which is not necessarily held in s->buf since datagrams
+ * can be read in batches.
  */
 struct gnutella_socket *
 socket_udp_listen(host_addr_t bind_addr, uint16 port,
@@ -4705,6 +5006,106 @@ socket_plain_sendto(
 	return ret;
 }
 
+/**
+ * Send several datagrams, stopping at the first one that cannot be sent.
+ *
+ * When sendmmsg() is available, datagrams are sent with as few system calls
+ * as possible.  Otherwise, or if the kernel does not support sendmmsg(),
+ * they are sent one at a time through sendto().
+ *
+ * @return -1 if the first datagram could not be sent, the amount of
+ * datagrams sent otherwise.
+ */
+static int
+socket_plain_sendmmsg(struct wrap_io *wio, const wrap_dgram_t *dg, int cnt)
+{
+	struct gnutella_socket *s = wio->ctx;
+	int sent = 0;
+
+	socket_check(s);
+	g_assert(!socket_uses_tls(s));
+	g_assert(cnt >= 0);
+
+#ifdef HAS_SENDMMSG
+	while (sent < cnt && !socket_udp_no_sendmmsg) {
+		struct mmsghdr msg[UDP_BATCH_MAX];
+		socket_addr_t addr[UDP_BATCH_MAX];
+		iovec_t iov[UDP_BATCH_MAX];
+		int i, n, r;
+
+		n = MIN(cnt - sent, (int) N_ITEMS(msg));
+
+		for (i = 0; i < n; i++) {
+			const wrap_dgram_t *d = &dg[sent + i];
+			struct msghdr *h = &msg[i].msg_hdr;
+			host_addr_t ha;
+
+			/*
+			 * Stop the batch at the first datagram we cannot send: it
+			 * will be handled by sendto() below to report the error.
+			 */
+
+			if (!host_addr_convert(gnet_host_get_addr(d->to), &ha, s->net))
+				break;
+
+			iovec_set(&iov[i], d->data, d->len);
+
+			ZERO(h);
+			h->msg_namelen = socket_addr_set(&addr[i],
+				ha, gnet_host_get_port(d->to));
+			h->msg_name = socket_addr_get_sockaddr(&addr[i]);
+			h->msg_iov = &iov[i];
+			h->msg_iovlen = 1;
+			msg[i].msg_len = 0;
+		}
+
+		if (0 == i) {
+			ssize_t w = socket_plain_sendto(wio, dg[sent].to,
+				dg[sent].data, dg[sent].len);
+			if ((ssize_t) -1 == w)
+				break;
+			sent++;
+			continue;
+		}
+
+		r = sendmmsg(s->file_desc, msg, i, MSG_DONTWAIT);
+
+		if (-1 == r) {
+			if (ENOSYS == errno) {
+				g_info("%s(): sendmmsg() not supported, sending datagrams "
+					"one at a time", G_STRFUNC);
+				socket_udp_no_sendmmsg = TRUE;
+				break;
+			}
+			if (GNET_PROPERTY(udp_debug)) {
+				int e = errno;
+				g_warning("sendmmsg() failed: %m");
+				errno = e;
+			}
+			break;
+		}
+
+		sent += r;
+
+		if (r < i)
+			break;		/* Kernel could not take all the datagrams */
+	}
+
+	if (!socket_udp_no_sendmmsg)
+		return 0 == sent ? -1 : sent;
+#endif	/* HAS_SENDMMSG */
+
+	while (sent < cnt) {
+		const wrap_dgram_t *d = &dg[sent];
+
+		if ((ssize_t) -1 == socket_plain_sendto(wio, d->to, d->data, d->len))
+			break;
+		sent++;
+	}
+
+	return 0 == sent ? -1 : sent;
+}
+
 static ssize_t
 socket_no_sendto(struct wrap_io *unused_wio, const gnet_host_t *unused_to,
 	const void *unused_buf, size_t unused_size)
@@ -4717,6 +5118,17 @@ socket_no_sendto(struct wrap_io *unused_wio, const gnet_host_t *unused_to,
 	return -1;
 }
 
+static int
+socket_no_sendmmsg(struct wrap_io *unused_wio,
+	const wrap_dgram_t *unused_dg, int unused_cnt)
+{
+	(void) unused_wio;
+	(void) unused_dg;
+	(void) unused_cnt;
+	g_error("no sendmmsg() routine allowed");
+	return -1;
+}
+
 static ssize_t
 socket_no_write(struct wrap_io *unused_wio,
 		const void *unused_buf, size_t unused_size)
@@ -4785,12 +5197,14 @@ socket_wio_link(struct gnutella_socket *s)
 		s->wio.writev = socket_no_writev;
 		s->wio.readv = socket_plain_readv;
 		s->wio.sendto = socket_plain_sendto;
+		s->wio.sendmmsg = socket_plain_sendmmsg;
 	} else if (SOCK_CONN_LISTENING == s->direction) {
 		s->wio.write = socket_no_write;
 		s->wio.read = socket_no_read;
 		s->wio.writev = socket_no_writev;
 		s->wio.readv = socket_no_readv;
 		s->wio.sendto = socket_no_sendto;
+		s->wio.sendmmsg = socket_no_sendmmsg;
 	} else if (socket_uses_tls(s)) {
 		tls_wio_link(s);
 	} else {
@@ -4800,6 +5214,7 @@ socket_wio_link(struct gnutella_socket *s)
 		s->wio.writev = socket_plain_writev;
 		s->wio.readv = socket_plain_readv;
 		s->wio.sendto = socket_no_sendto;
+		s->wio.sendmmsg = socket_no_sendmmsg;
 	}
 }
 
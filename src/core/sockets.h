@@ -175,6 +175,7 @@ struct udpctx {
 	struct cevent *queue_ev;			/**< Queue processing event */
 	eslist_t queue;						/**< Queued items (read-ahead) */
 	size_t queued;						/**< Amount of bytes queued */
+	struct udp_batch *batch;			/**< Batch of datagrams (recvmmsg) */
 };
 
 static inline void
@@ -60,6 +60,13 @@
 #define USE_TLS_PUSHV
 #endif
 
+#if defined(HAS_KTLS) && HAS_TLS(3, 4)
+/* Kernel can encrypt outgoing records, needs gnutls_record_get_state() */
+#define USE_KTLS
+#include <netinet/tcp.h>
+#include <linux/tls.h>
+#endif
+
 #include "tls_common.h"
 
 #include "features.h"
@@ -105,6 +112,7 @@ struct tls_context {
 		gnutls_anon_client_credentials_t client;
 	} cred;
 	const struct gnutella_socket *s;
+	bool kernel_tx;			/**< Whether kernel encrypts outgoing records */
 };
 
 static gnutls_certificate_credentials_t cert_cred;
@@ -566,6 +574,35 @@ tls_set_errno(struct gnutella_socket *s, int errnum)
 	gnutls_transport_set_errno(tls_socket_get_session(s), errnum);
 }
 
+/**
+ * Refuse to let GnuTLS write on a socket whose outgoing records are
+ * encrypted by the kernel.
+ *
+ * Anything GnuTLS would emit on its own at that point (an alert, or the
+ * answer to a renegotiation attempt) would be sealed with stale keys and
+ * sequence numbers, corrupting the stream.  Failing the push makes the
+ * GnuTLS call report an error and the connection is then dropped.
+ *
+ * @return TRUE if the push must fail, with errno set.
+ */
+static bool
+tls_push_refused(struct gnutella_socket *s)
+{
+	if G_LIKELY(!s->tls.ctx->kernel_tx)
+		return FALSE;
+
+	if (GNET_PROPERTY(tls_debug)) {
+		g_warning("%s(): GnuTLS record to %s on fd=%d refused: "
+			"kernel encrypts outgoing records",
+			G_STRFUNC, host_addr_port_to_string(s->addr, s->port),
+			s->file_desc);
+	}
+
+	tls_set_errno(s, EIO);
+	errno = EIO;
+	return TRUE;
+}
+
 #ifdef USE_TLS_PUSHV
 static inline ssize_t
 tls_pushv(gnutls_transport_ptr_t ptr, const giovec_t *iov, int iovcnt)
@@ -578,6 +615,9 @@ tls_pushv(gnutls_transport_ptr_t ptr, const giovec_t *iov, int iovcnt)
 	socket_check(s);
 	g_assert(is_valid_fd(s->file_desc));
 
+	if (tls_push_refused(s))
+		return -1;
+
 	/*
 	 * On Windows, we need to convert the giovec_t structure into our
 	 * emulated iovec_t, which are actually WSABUF structures, so that
@@ -621,6 +661,9 @@ tls_push(gnutls_transport_ptr_t ptr, const void *buf, size_t size)
 	socket_check(s);
 	g_assert(is_valid_fd(s->file_desc));
 
+	if (tls_push_refused(s))
+		return -1;
+
 	ret = s_write(s->file_desc, buf, size);
 	saved_errno = errno;
 	tls_signal_pending(s);
@@ -809,6 +852,168 @@ tls_log_audit(gnutls_session_t session, const char *message)
 }
 #endif	/* TLS >= 3.0 */
 
+#ifdef USE_KTLS
+/**
+ * Hand the encryption of outgoing records over to the kernel.
+ *
+ * The current write key, IV and record sequence number are installed on
+ * the socket, so that anything written to the file descriptor afterwards,
+ * including through sendfile(), is sent as TLS application data.  Incoming
+ * records are still decrypted by GnuTLS.
+ *
+ * Only TLS 1.2 sessions are handed over: under TLS 1.3, GnuTLS may still
+ * need to send records of its own after the handshake (key updates, session
+ * tickets), which it could no longer do.
+ *
+ * When the kernel lacks TLS support or does not handle the negotiated
+ * cipher, the socket is left untouched and GnuTLS keeps encrypting.
+ *
+ * @return TRUE if the kernel now encrypts outgoing records.
+ */
+static bool
+tls_kernel_tx_setup(struct gnutella_socket *s)
+{
+	gnutls_session_t session = tls_socket_get_session(s);
+	gnutls_datum_t iv, key;
+	uchar seq[8];
+	union {
+		struct tls12_crypto_info_aes_gcm_128 aes128;
+		struct tls12_crypto_info_aes_gcm_256 aes256;
+#ifdef TLS_CIPHER_CHACHA20_POLY1305
+		struct tls12_crypto_info_chacha20_poly1305 chacha;
+#endif
+	} ci;
+	socklen_t len;
+	const char *what;
+
+	if (!GNET_PROPERTY(tls_kernel_offload))
+		return FALSE;
+
+	if (GNUTLS_TLS1_2 != gnutls_protocol_get_version(session))
+		return FALSE;
+
+	if (gnutls_record_get_state(session, FALSE, NULL, &iv, &key, seq))
+		return FALSE;
+
+	ZERO(&ci);
+
+	/*
+	 * With TLS 1.2, the explicit part of the GCM nonce is the record
+	 * sequence number, as generated by GnuTLS.
+	 */
+
+#define KTLS_GCM(field, type) G_STMT_START {								\
+	if (key.size != sizeof ci.field.key ||									\
+		iv.size < TLS_CIPHER_##type##_SALT_SIZE)							\
+		return FALSE;														\
+	ci.field.info.version = TLS_1_2_VERSION;								\
+	ci.field.info.cipher_type = TLS_CIPHER_##type;							\
+	memcpy(ci.field.salt, iv.data, sizeof ci.field.salt);					\
+	memcpy(ci.field.iv, seq, sizeof ci.field.iv);							\
+	memcpy(ci.field.key, key.data, sizeof ci.field.key);					\
+	memcpy(ci.field.rec_seq, seq, sizeof ci.field.rec_seq);				\
+	len = sizeof ci.field;													\
+} G_STMT_END
+
+	switch (gnutls_cipher_get(session)) {
+	case GNUTLS_CIPHER_AES_128_GCM:
+		KTLS_GCM(aes128, AES_GCM_128);
+		break;
+	case GNUTLS_CIPHER_AES_256_GCM:
+		KTLS_GCM(aes256, AES_GCM_256);
+		break;
+#ifdef TLS_CIPHER_CHACHA20_POLY1305
+	case GNUTLS_CIPHER_CHACHA20_POLY1305:
+		if (key.size != sizeof ci.chacha.key || iv.size != sizeof ci.chacha.iv)
+			return FALSE;
+		ci.chacha.info.version = TLS_1_2_VERSION;
+		ci.chacha.info.cipher_type = TLS_CIPHER_CHACHA20_POLY1305;
+		memcpy(ci.chacha.iv, iv.data, sizeof ci.chacha.iv);
+		memcpy(ci.chacha.key, key.data, sizeof ci.chacha.key);
+		memcpy(ci.chacha.rec_seq, seq, sizeof ci.chacha.rec_seq);
+		len = sizeof ci.chacha;
+		break;
+#endif	/* TLS_CIPHER_CHACHA20_POLY1305 */
+	default:
+		return FALSE;
+	}
+
+#undef KTLS_GCM
+
+	/*
+	 * Attaching the "tls" upper layer protocol alone does not change how
+	 * the socket behaves, so there is nothing to undo if TLS_TX fails.
+	 */
+
+	what = "TCP_ULP";
+	if (-1 == setsockopt(s->file_desc, IPPROTO_TCP, TCP_ULP, "tls", sizeof "tls"))
+		goto failed;
+
+	what = "TLS_TX";
+	if (-1 == setsockopt(s->file_desc, SOL_TLS, TLS_TX, &ci, len))
+		goto failed;
+
+	ZERO(&ci);		/* Do not leave key material on the stack */
+
+	if (GNET_PROPERTY(tls_debug) > 1) {
+		g_debug("%s(): kernel now encrypts %s records for %s on fd=%d",
+			G_STRFUNC, gnutls_cipher_get_name(gnutls_cipher_get(session)),
+			host_addr_port_to_string(s->addr, s->port), s->file_desc);
+	}
+
+	return TRUE;
+
+failed:
+	ZERO(&ci);
+
+	if (GNET_PROPERTY(tls_debug) > 1) {
+		g_debug("%s(): cannot set %s on fd=%d: %m",
+			G_STRFUNC, what, s->file_desc);
+	}
+
+	return FALSE;
+}
+
+/**
+ * Send a TLS close_notify alert through the kernel.
+ *
+ * Once the kernel encrypts outgoing records, GnuTLS can no longer send
+ * anything on the socket, so we have to build the alert record ourselves.
+ */
+static void
+tls_kernel_bye(struct gnutella_socket *s)
+{
+	static const uchar alert[2] = { 1, 0 };	/* Warning level, close_notify */
+	char buf[CMSG_SPACE(sizeof(uchar))];
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	struct iovec iov;
+
+	ZERO(&msg);
+	ZERO(&buf);
+	iov.iov_base = deconstify_pointer(alert);
+	iov.iov_len = sizeof alert;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = buf;
+	msg.msg_controllen = sizeof buf;
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_TLS;
+	cmsg->cmsg_type = TLS_SET_RECORD_TYPE;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(uchar));
+	*(uchar *) CMSG_DATA(cmsg) = 21;		/* Alert record type */
+
+	if (-1 == sendmsg(s->file_desc, &msg, MSG_DONTWAIT)) {
+		if (GNET_PROPERTY(tls_debug) > 1) {
+			g_debug("%s(): cannot send close_notify to %s on fd=%d: %m",
+				G_STRFUNC, host_addr_port_to_string(s->addr, s->port),
+				s->file_desc);
+		}
+	}
+}
+#endif	/* USE_KTLS */
+
 /**
  * @return	TLS_HANDSHAKE_ERROR if the TLS handshake failed.
  *			TLS_HANDSHAKE_RETRY if the handshake is incomplete; thus
@@ -854,6 +1059,9 @@ tls_handshake(struct gnutella_socket *s)
 			tls_print_session_info(s->addr, s->port, session,
 				SOCK_CONN_INCOMING == s->direction);
 		}
+#ifdef USE_KTLS
+		s->tls.ctx->kernel_tx = tls_kernel_tx_setup(s);
+#endif
 		tls_signal_pending(s);
 		return TLS_HANDSHAKE_FINISHED;
 	case GNUTLS_E_AGAIN:
@@ -1395,16 +1603,74 @@ tls_no_sendto(struct wrap_io *unused_wio, const gnet_host_t *unused_to,
 	return -1;
 }
 
+static int
+tls_no_sendmmsg(struct wrap_io *unused_wio,
+	const wrap_dgram_t *unused_dg, int unused_cnt)
+{
+	(void) unused_wio;
+	(void) unused_dg;
+	(void) unused_cnt;
+	g_error("no sendmmsg() routine allowed");
+	return -1;
+}
+
+#ifdef USE_KTLS
+static ssize_t
+tls_kernel_write(struct wrap_io *wio, const void *buf, size_t size)
+{
+	struct gnutella_socket *s = wio->ctx;
+
+	socket_check(s);
+	g_assert(socket_uses_tls(s));
+	g_assert(s->tls.ctx->kernel_tx);
+
+	return s_write(s->file_desc, buf, size);
+}
+
+static ssize_t
+tls_kernel_writev(struct wrap_io *wio, const iovec_t *iov, int iovcnt)
+{
+	struct gnutella_socket *s = wio->ctx;
+
+	socket_check(s);
+	g_assert(socket_uses_tls(s));
+	g_assert(s->tls.ctx->kernel_tx);
+
+	return s_writev(s->file_desc, iov, iovcnt);
+}
+#endif	/* USE_KTLS */
+
+/**
+ * @return whether the kernel encrypts the outgoing TLS records of the
+ * socket, in which case data can be written directly to its file descriptor.
+ */
+bool
+tls_kernel_tx(const struct gnutella_socket *s)
+{
+	socket_check(s);
+
+	return NULL != s->tls.ctx && s->tls.ctx->kernel_tx;
+}
+
 void
 tls_wio_link(struct gnutella_socket *s)
 {
 	socket_check(s);
 
-	s->wio.write = tls_write;
+#ifdef USE_KTLS
+	if (tls_kernel_tx(s)) {
+		s->wio.write = tls_kernel_write;
+		s->wio.writev = tls_kernel_writev;
+	} else
+#endif
+	{
+		s->wio.write = tls_write;
+		s->wio.writev = tls_writev;
+	}
 	s->wio.read = tls_read;
-	s->wio.writev = tls_writev;
 	s->wio.readv = tls_readv;
 	s->wio.sendto = tls_no_sendto;
+	s->wio.sendmmsg = tls_no_sendmmsg;
 	s->wio.flush = tls_flush;
 }
 
@@ -1420,6 +1686,13 @@ tls_bye(struct gnutella_socket *s)
 	if ((SOCK_F_EOF | SOCK_F_SHUTDOWN) & s->flags)
 		return;
 
+#ifdef USE_KTLS
+	if (s->tls.ctx->kernel_tx) {
+		tls_kernel_bye(s);
+		return;
+	}
+#endif
+
 	if (tls_flush(&s->wio) && GNET_PROPERTY(tls_debug)) {
 		g_warning("%s(): tls_flush(fd=%d) failed", G_STRFUNC, s->file_desc);
 	}
@@ -1603,6 +1876,13 @@ tls_wio_link(struct gnutella_socket *s)
 	g_assert_not_reached();
 }
 
+bool
+tls_kernel_tx(const struct gnutella_socket *s)
+{
+	socket_check(s);
+	return FALSE;
+}
+
 void
 tls_global_init(void)
 {
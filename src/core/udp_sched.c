@@ -54,6 +54,11 @@
  * each packet to send also remembers its TX stack origin (for callback
  * processing, which need to get at the TX owner).
  *
+ * When processing the queued datagrams at the beginning of a bandwidth
+ * scheduling period, datagrams are gathered in batches and sent with a
+ * single system call per batch whenever possible, each datagram still being
+ * charged to the bandwidth scheduler.
+ *
  * @author Raphael Manfredi
  * @date 2012
  */
@@ -78,6 +83,7 @@
 #include "lib/log.h"
 #include "lib/palloc.h"
 #include "lib/pmsg.h"
+#include "lib/stringify.h"		/* For plural() */
 #include "lib/tm.h"
 #include "lib/unsigned.h"
 #include "lib/walloc.h"
@@ -88,6 +94,7 @@
 
 #define UDP_SCHED_EXPIRE	5	/**< Seconds before expiring unsent messages */
 #define UDP_SCHED_FACTOR	3	/**< Stop when that many times the b/w queued */
+#define UDP_SCHED_BATCH		32	/**< Max datagrams sent per system call */
 
 #define udp_sched_log(lvl, fmt, ...)						\
 G_STMT_START {												\
@@ -110,6 +117,17 @@ static const enum net_type udp_sched_net_type[UDP_SCHED_NET_CNT] = {
 	NET_TYPE_IPV6,			/* UDP_SCHED_IPv6 */
 };
 
+struct udp_tx_desc;
+
+/**
+ * Datagrams gathered for sending through a single bio_sendmmsg() call.
+ */
+struct udp_sched_batch {
+	struct udp_tx_desc *txd[UDP_SCHED_BATCH];	/**< Gathered TX descriptors */
+	wrap_dgram_t dg[UDP_SCHED_BATCH];			/**< Datagrams to send */
+	unsigned count;								/**< Amount gathered */
+};
+
 /**
  * The UDP TX scheduler object.
  *
@@ -131,10 +149,12 @@ struct udp_sched {
 	udp_sched_socket_cb_t get_socket;		/**< Get the UDP socket by net */
 	eslist_t lifo[PMSG_P_COUNT];	/**< LIFO stacks of TX descriptors */
 	eslist_t tx_released;			/**< Deferred TX descriptor freeing */
+	struct udp_sched_batch batch[UDP_SCHED_NET_CNT];	/**< Datagram batches */
 	bsched_bws_t bws;				/**< Bandwidth scheduler to use */
 	hset_t *seen;					/**< Remembers destinations processed */
 	hash_list_t *stacks;			/**< TX stacks using us */
 	size_t buffered;				/**< Amount buffered (regular + urgent) */
+	eslist_t unsent;				/**< Batched datagrams left unsent */
 	unsigned used_all:1;			/**< Set when all b/w was used */
 	unsigned flow_controlled:1;		/**< Whether we flow-controlled */
 };
@@ -416,7 +436,26 @@ udp_tx_drop(const txdrv_t *tx, const struct tx_dgram_cb *cb)
 }
 
 /**
- * Send message block to IP:port.
+ * @return the index of the network to use to send traffic to given host.
+ */
+static enum udp_sched_net
+udp_sched_net_index(const gnet_host_t *to)
+{
+	switch (gnet_host_get_net(to)) {
+	case NET_TYPE_IPV4:
+		return UDP_SCHED_IPv4;
+	case NET_TYPE_IPV6:
+		return UDP_SCHED_IPv6;
+	case NET_TYPE_NONE:
+	case NET_TYPE_LOCAL:
+		break;
+	}
+
+	g_assert_not_reached();
+}
+
+/**
+ * Check whether message needs to be discarded instead of being sent.
  *
  * @param us		the UDP scheduler
  * @param mb		the message to send
@@ -424,17 +463,12 @@ udp_tx_drop(const txdrv_t *tx, const struct tx_dgram_cb *cb)
  * @param tx		the TX stack sending the message
  * @param cb		callback actions on the datagram
  *
- * @return TRUE if message was sent or dropped, FALSE if there is no more
- * bandwidth to send anything.
+ * @return TRUE if message must be discarded.
  */
 static bool
-udp_sched_mb_sendto(udp_sched_t *us, pmsg_t *mb, const gnet_host_t *to,
+udp_sched_mb_discard(udp_sched_t *us, pmsg_t *mb, const gnet_host_t *to,
 	const txdrv_t *tx, const struct tx_dgram_cb *cb)
 {
-	ssize_t r;
-	int len = pmsg_size(mb);
-	bio_source_t *bio = NULL;
-
 	if (0 == gnet_host_get_port(to))
 		return TRUE;
 
@@ -445,38 +479,69 @@ udp_sched_mb_sendto(udp_sched_t *us, pmsg_t *mb, const gnet_host_t *to,
 	if (!pmsg_hook_check(mb))
 		return TRUE;			/* Dropped */
 
-	/*
-	 * Select the proper I/O source depending on the network address type.
-	 */
-
-	switch (gnet_host_get_net(to)) {
-	case NET_TYPE_IPV4:
-		bio = us->bio[UDP_SCHED_IPv4];
-		break;
-	case NET_TYPE_IPV6:
-		bio = us->bio[UDP_SCHED_IPv6];
-		break;
-	case NET_TYPE_NONE:
-	case NET_TYPE_LOCAL:
-		g_assert_not_reached();
-	}
-
 	/*
 	 * If there is no I/O source, then the socket to send that type of traffic
 	 * was cleared, hence we simply need to discard the message.
 	 */
 
-	if (NULL == bio) {
+	if (NULL == us->bio[udp_sched_net_index(to)]) {
 		udp_sched_log(4, "%p: discarding mb=%p (%d bytes) to %s",
 			us, mb, pmsg_size(mb), gnet_host_to_string(to));
-		return udp_tx_drop(tx, cb);		/* TRUE, for "sent" */
+		return udp_tx_drop(tx, cb);		/* TRUE */
 	}
 
+	return FALSE;
+}
+
+/**
+ * Account for message that was successfully sent.
+ *
+ * @param us		the UDP scheduler
+ * @param mb		the message sent
+ * @param to		the IP:port destination of the message
+ * @param tx		the TX stack sending the message
+ * @param cb		callback actions on the datagram
+ */
+static void
+udp_sched_mb_sent(udp_sched_t *us, pmsg_t *mb, const gnet_host_t *to,
+	const txdrv_t *tx, const struct tx_dgram_cb *cb)
+{
+	udp_sched_log(5, "%p: sent mb=%p (%d bytes) prio=%u",
+		us, mb, pmsg_size(mb), pmsg_prio(mb));
+	pmsg_mark_sent(mb);
+	if (cb->msg_account != NULL)
+		(*cb->msg_account)(tx->owner, mb);
+
+	inet_udp_record_sent(gnet_host_get_addr(to));
+}
+
+/**
+ * Send message block to IP:port.
+ *
+ * @param us		the UDP scheduler
+ * @param mb		the message to send
+ * @param to		the IP:port destination of the message
+ * @param tx		the TX stack sending the message
+ * @param cb		callback actions on the datagram
+ *
+ * @return TRUE if message was sent or dropped, FALSE if there is no more
+ * bandwidth to send anything.
+ */
+static bool
+udp_sched_mb_sendto(udp_sched_t *us, pmsg_t *mb, const gnet_host_t *to,
+	const txdrv_t *tx, const struct tx_dgram_cb *cb)
+{
+	ssize_t r;
+	int len = pmsg_size(mb);
+
+	if (udp_sched_mb_discard(us, mb, to, tx, cb))
+		return TRUE;
+
 	/*
 	 * OK, proceed if we have bandwidth.
 	 */
 
-	r = bio_sendto(bio, to, pmsg_start(mb), len);
+	r = bio_sendto(us->bio[udp_sched_net_index(to)], to, pmsg_start(mb), len);
 
 	if (r < 0) {		/* Error, or no bandwidth */
 		if (udp_sched_write_error(us, to, mb, G_STRFUNC)) {
@@ -495,28 +560,106 @@ udp_sched_mb_sendto(udp_sched_t *us, pmsg_t *mb, const gnet_host_t *to,
 			"for %d-byte datagram",
 			G_STRFUNC, r, gnet_host_to_string(to), len);
 	} else {
-		udp_sched_log(5, "%p: sent mb=%p (%d bytes) prio=%u",
-			us, mb, pmsg_size(mb), pmsg_prio(mb));
-		pmsg_mark_sent(mb);
-		if (cb->msg_account != NULL)
-			(*cb->msg_account)(tx->owner, mb);
-
-		inet_udp_record_sent(gnet_host_get_addr(to));
+		udp_sched_mb_sent(us, mb, to, tx, cb);
 	}
 
 	return TRUE;		/* Message sent */
 }
 
 /**
- * Send message (eslist iterator callback).
+ * Dispose of TX descriptor whose message was sent or dropped from a batch.
+ */
+static void
+udp_sched_batch_done(udp_sched_t *us, struct udp_tx_desc *txd)
+{
+	us->buffered = size_saturate_sub(us->buffered, pmsg_size(txd->mb));
+	udp_tx_desc_flag_release(txd, us);
+}
+
+/**
+ * Send the datagrams gathered in the batch of the specified network.
+ *
+ * Datagrams that cannot be sent for lack of bandwidth are moved to the
+ * list of unsent datagrams, in their original order, to be put back at the
+ * head of their LIFO queue once we are done iterating over it.
+ */
+static void
+udp_sched_batch_flush(udp_sched_t *us, enum udp_sched_net net)
+{
+	struct udp_sched_batch *b = &us->batch[net];
+	bio_source_t *bio = us->bio[net];
+	unsigned i = 0;
+
+	g_assert(bio != NULL);
+
+	while (i < b->count && !us->used_all) {
+		int r = bio_sendmmsg(bio, &b->dg[i], b->count - i);
+
+		if (r < 0) {		/* Error on first datagram, or no bandwidth */
+			struct udp_tx_desc *txd = b->txd[i];
+
+			if (udp_sched_write_error(us, txd->to, txd->mb, G_STRFUNC)) {
+				udp_sched_log(4, "%p: dropped mb=%p (%d bytes): %m",
+					us, txd->mb, pmsg_size(txd->mb));
+				udp_tx_drop(txd->tx, txd->cb);
+				udp_sched_batch_done(us, txd);
+				i++;
+				continue;
+			}
+			udp_sched_log(3, "%p: no bandwidth for %u datagram%s",
+				us, b->count - i, plural(b->count - i));
+			us->used_all = TRUE;
+			break;
+		}
+
+		udp_sched_log(4, "%p: sent %d/%u datagram%s in batch",
+			us, r, b->count - i, plural(b->count - i));
+
+		for (/* empty */; r > 0; r--, i++) {
+			struct udp_tx_desc *txd = b->txd[i];
+
+			udp_sched_mb_sent(us, txd->mb, txd->to, txd->tx, txd->cb);
+			if (PMSG_P_DATA == pmsg_prio(txd->mb) && pmsg_was_sent(txd->mb))
+				hset_insert(us->seen, atom_host_get(txd->to));
+			udp_sched_batch_done(us, txd);
+		}
+	}
+
+	for (/* empty */; i < b->count; i++)
+		eslist_append(&us->unsent, b->txd[i]);
+
+	b->count = 0;
+}
+
+/**
+ * @return whether a datagram to the given destination is already batched.
+ */
+static bool
+udp_sched_batch_has(const struct udp_sched_batch *b, const gnet_host_t *to)
+{
+	unsigned i;
+
+	for (i = 0; i < b->count; i++) {
+		if (gnet_host_equal(b->dg[i].to, to))
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+/**
+ * Gather message for batched sending (eslist iterator callback).
  *
- * @return TRUE if message was sent and freed up.
+ * @return TRUE if message was removed from the list, being either discarded
+ * or moved to the batch of datagrams to send.
  */
 static bool
-udp_tx_desc_send(void *data, void *udata)
+udp_tx_desc_gather(void *data, void *udata)
 {
 	struct udp_tx_desc *txd = data;
 	udp_sched_t *us = udata;
+	struct udp_sched_batch *b;
+	enum udp_sched_net net;
 	unsigned prio;
 
 	udp_sched_check(us);
@@ -546,18 +689,60 @@ udp_tx_desc_send(void *data, void *udata)
 		return FALSE;
 	}
 
-	if (udp_sched_mb_sendto(us, txd->mb, txd->to, txd->tx, txd->cb)) {
-		if (PMSG_P_DATA == prio && pmsg_was_sent(txd->mb))
-			hset_insert(us->seen, atom_host_get(txd->to));
-	} else {
-		return FALSE;		/* Unsent, leave it in the queue */
+	if (udp_sched_mb_discard(us, txd->mb, txd->to, txd->tx, txd->cb)) {
+		us->buffered = size_saturate_sub(us->buffered, pmsg_size(txd->mb));
+		udp_tx_desc_flag_release(txd, us);
+		return TRUE;
 	}
 
-	us->buffered = size_saturate_sub(us->buffered, pmsg_size(txd->mb));
-	udp_tx_desc_flag_release(txd, us);
+	net = udp_sched_net_index(txd->to);
+	b = &us->batch[net];
+
+	/*
+	 * The destination is only remembered once the message is sent, so
+	 * we also need to skip messages to destinations already gathered.
+	 */
+
+	if (PMSG_P_DATA == prio && udp_sched_batch_has(b, txd->to)) {
+		udp_sched_log(2, "%p: skipping mb=%p (%d bytes) to %s (batched)",
+			us, txd->mb, pmsg_size(txd->mb), gnet_host_to_string(txd->to));
+		return FALSE;
+	}
+
+	g_assert(b->count < N_ITEMS(b->txd));
+
+	b->txd[b->count] = txd;
+	b->dg[b->count].to = txd->to;
+	b->dg[b->count].data = pmsg_start(txd->mb);
+	b->dg[b->count].len = pmsg_size(txd->mb);
+
+	/*
+	 * Flush the batch as soon as it is full, so that each queued message
+	 * is only visited once: this is safe since the eslist iterator does
+	 * not re-inspect the item after calling us, and unsent messages are
+	 * only put back into the list once the iteration is over.
+	 */
+
+	if (N_ITEMS(b->txd) == ++b->count)
+		udp_sched_batch_flush(us, net);
+
 	return TRUE;
 }
 
+/**
+ * Flush all the gathered datagrams.
+ */
+static void
+udp_sched_flush(udp_sched_t *us)
+{
+	unsigned i;
+
+	for (i = 0; i < N_ITEMS(us->batch); i++) {
+		if (0 != us->batch[i].count)
+			udp_sched_batch_flush(us, i);
+	}
+}
+
 /**
  * @return b/w per second configured for the attached b/w scheduler.
  */
@@ -668,13 +853,19 @@ udp_sched_send(udp_sched_t *us, pmsg_t *mb, const gnet_host_t *to,
 
 /**
  * Process LIFO queue, sending out messages until we have no more bandwidth.
+ *
+ * Messages are gathered in batches which are flushed each time one of them
+ * fills up or when we reach the end of the queue.  Messages left unsent are
+ * put back at the head of the queue, in their original order.
  */
 static void
 udp_sched_process(udp_sched_t *us, eslist_t *list)
 {
 	udp_sched_check(us);
 
-	eslist_foreach_remove(list, udp_tx_desc_send, us);
+	eslist_foreach_remove(list, udp_tx_desc_gather, us);
+	udp_sched_flush(us);
+	eslist_prepend_list(list, &us->unsent);
 }
 
 /**
@@ -945,6 +1136,7 @@ udp_sched_make(
 		eslist_init(&us->lifo[i], offsetof(struct udp_tx_desc, lnk));
 	}
 	eslist_init(&us->tx_released, offsetof(struct udp_tx_desc, lnk));
+	eslist_init(&us->unsent, offsetof(struct udp_tx_desc, lnk));
 	us->seen =
 		hset_create_any(gnet_host_hash, gnet_host_hash2, gnet_host_equal);
 	us->stacks = hash_list_new(udp_tx_stack_hash, udp_tx_stack_eq);
@@ -455,7 +455,8 @@ use_sendfile(struct upload *u)
 {
 	upload_check(u);
 #if defined(HAS_MMAP) || defined(HAS_SENDFILE)
-	return !sendfile_failed && !socket_uses_tls(u->socket);
+	return !sendfile_failed &&
+		(!socket_uses_tls(u->socket) || tls_kernel_tx(u->socket));
 #else
 	return FALSE;
 #endif /* USE_MMAP || HAS_SENDFILE */
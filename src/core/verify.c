@@ -47,6 +47,14 @@
  * so each thread can use almost all its processing ticks to actually compute
  * the hash value.
  *
+ * On multi-core systems, each verification context can further be handled
+ * by a pool of workers, each running in its own thread and taking files
+ * from the shared work queue independently.  The amount of workers is
+ * configured by the "verify_workers" property, or derived from the amount
+ * of CPUs, which are then shared by all the verification contexts.  Each
+ * worker is a verification context of its own, with its own hashing state,
+ * and is the one passed to the user callbacks.
+ *
  * @author Raphael Manfredi
  * @date 2002-2003, 2013
  */
@@ -83,7 +91,9 @@
 
 #define HASH_BUF_SIZE		(128 * 1024)	/**< Size of the reading buffer */
 
-#define HASH_THREAD_MAX			2			/**< At most 2 hashing threads */
+#define VERIFY_WORKERS_MAX		8			/**< Max workers per verification */
+#define VERIFY_CONTEXTS			3			/**< SHA-1, TTH, SHA-1+TTH */
+#define HASH_THREAD_MAX		(VERIFY_CONTEXTS * VERIFY_WORKERS_MAX) /**< Threads */
 #define VERIFY_DEFERRED			10			/**< ms: deferred free timeout */
 #define VERIFY_PROGRESS_NOTIFY	1			/**< s: progress notification */
 
@@ -98,6 +108,10 @@ struct verify {
 	enum verify_magic magic;	/**< Magic number. */
 	hash_list_t *files_to_hash;	/**< Work queue */
 	const struct verify_hash hash;	/**< Hash-specific processing callbacks */
+	void *hash_ctx;				/**< Hash computation state for this worker */
+	struct verify *primary;		/**< Context owning the work queue */
+	struct verify **workers;	/**< Workers sharing the queue (primary only) */
+	unsigned worker_count;		/**< Amount of workers (primary only) */
 	struct bgtask *task;		/**< Background task handling the processing */
 	bgsched_t *sched;			/**< Task scheduler for this thread */
 	unsigned verify_stid;		/**< Verification thread ID */
@@ -129,19 +143,19 @@ verify_check(const struct verify * const ctx)
 static inline void
 verify_hash_init(const struct verify * const ctx)
 {
-	ctx->hash.init(ctx->end - ctx->start);
+	ctx->hash.init(ctx->hash_ctx, ctx->end - ctx->start);
 }
 
 static inline int
 verify_hash_update(const struct verify * const ctx, const void *data, size_t n)
 {
-	return ctx->hash.update(data, n);
+	return ctx->hash.update(ctx->hash_ctx, data, n);
 }
 
 static inline int
 verify_hash_final(const struct verify * const ctx)
 {
-	return ctx->hash.final();
+	return ctx->hash.final(ctx->hash_ctx);
 }
 
 static inline const char *
@@ -294,6 +308,19 @@ verify_done(struct verify *ctx)
 	ctx->status = VERIFY_INVALID;
 }
 
+/**
+ * The callback function may call this to get at the hashing state of the
+ * worker that processed the current file, to retrieve the computed digest.
+ *
+ * @return the hash-specific context of the worker.
+ */
+void *
+verify_hash_context(const struct verify *ctx)
+{
+	verify_check(ctx);
+	return ctx->hash_ctx;
+}
+
 /**
  * @return current verification status.
  */
@@ -553,9 +580,13 @@ verify_thread_create(struct verify *v, bgsched_t *bs, const char *name)
 
 /**
  * Create a new verification thread if necessary.
+ *
+ * @param v			the verification worker for which we need a thread
+ * @param idx		the index of the worker in the pool
+ * @param count		the amount of workers in the pool
  */
 static void
-verify_thread_create_if_needed(struct verify *v)
+verify_thread_create_if_needed(struct verify *v, unsigned idx, unsigned count)
 {
 	static unsigned verify_id;
 	static bgsched_t *verify_bs;
@@ -565,11 +596,12 @@ verify_thread_create_if_needed(struct verify *v)
 
 	/*
 	 * When there are more than 2 CPUs, we are on a multi-core system and we
-	 * create one thread per verification.  If they have only 2 CPUs, then we
-	 * just create a single thread to handle all the verifications.
+	 * create one thread per verification worker.  If they have only 2 CPUs
+	 * and did not configure more workers, then we just create a single thread
+	 * to handle all the verifications.
 	 */
 
-	if (cpus <= 2) {
+	if (cpus <= 2 && 1 == count) {
 		if G_UNLIKELY(NULL == verify_bs) {
 			static const char name[] = "verify";
 
@@ -580,7 +612,9 @@ verify_thread_create_if_needed(struct verify *v)
 			v->verify_stid = verify_id;
 		}
 	} else {
-		const char *tname = str_smsg("verify %s", verify_hash_name(v));
+		const char *tname = 1 == count ?
+			str_smsg("verify %s", verify_hash_name(v)) :
+			str_smsg("verify %s #%u", verify_hash_name(v), idx + 1);
 		const char *name = constant_str(tname);
 
 		bgsched_t *bs = bg_sched_create(name, 1000000);		/* 1 sec */
@@ -588,9 +622,82 @@ verify_thread_create_if_needed(struct verify *v)
 	}
 }
 
+/**
+ * Compute the amount of workers to create for a new verification context.
+ */
+static unsigned
+verify_worker_count(void)
+{
+	static unsigned contexts;		/* Amount of contexts created so far */
+	static long cpus_left;			/* CPUs not used by these contexts */
+	unsigned n = GNET_PROPERTY(verify_workers);
+
+	g_assert(thread_is_main());
+
+	/*
+	 * By default, the CPUs are shared among the verification contexts since
+	 * they can run concurrently: library files are hashed by the combined
+	 * SHA-1+TTH context, downloaded files by the SHA-1 and TTH ones.
+	 *
+	 * Contexts are created on demand, so each new context gets its share of
+	 * the CPUs not already used by the previous ones.
+	 */
+
+	if (0 == n) {
+		if (0 == contexts)
+			cpus_left = getcpucount();
+
+		if (contexts < VERIFY_CONTEXTS)
+			n = cpus_left / (VERIFY_CONTEXTS - contexts);
+	}
+
+	n = MAX(1, MIN(n, VERIFY_WORKERS_MAX));
+	cpus_left -= MIN(cpus_left, n);
+	contexts++;
+
+	return n;
+}
+
+/**
+ * Allocate a new verification worker.
+ *
+ * @param hash		Hash-specific callbacks for this hash verification
+ * @param primary	The primary context, owning the work queue, NULL if none
+ *
+ * @return new verification context, without any thread attached yet.
+ */
+static struct verify *
+verify_worker_new(const struct verify_hash *hash, struct verify *primary)
+{
+	struct verify *ctx;
+
+	WALLOC0(ctx);
+	ctx->magic = VERIFY_MAGIC;
+	ctx->buffer_size = HASH_BUF_SIZE;
+	ctx->buffer = halloc(ctx->buffer_size);
+	STATIC_ASSERT(sizeof ctx->hash == sizeof(struct verify_hash));
+	*(struct verify_hash *) &ctx->hash = *hash;		/* Assignment to "const" */
+	ctx->hash_ctx = hash->new_context();
+
+	if (NULL == primary) {
+		ctx->primary = ctx;
+		ctx->files_to_hash = hash_list_new(verify_item_hash, verify_item_equal);
+		hash_list_thread_safe(ctx->files_to_hash);
+	} else {
+		verify_check(primary);
+		ctx->primary = primary;
+		ctx->files_to_hash = primary->files_to_hash;
+	}
+
+	return ctx;
+}
+
 /**
  * Create a new verification context.
  *
+ * The returned context is the primary worker of a pool of workers sharing
+ * the same work queue.
+ *
  * @param hash		Hash-specific callbacks for this hash verification
  *
  * @return verification context to which work can be requested via
@@ -600,19 +707,26 @@ struct verify *
 verify_new(const struct verify_hash *hash)
 {
 	struct verify *ctx;
+	unsigned i;
 
 	g_assert(hash);
 
-	WALLOC0(ctx);
-	ctx->magic = VERIFY_MAGIC;
-	ctx->buffer_size = HASH_BUF_SIZE;
-	ctx->buffer = halloc(ctx->buffer_size);
-	STATIC_ASSERT(sizeof ctx->hash == sizeof(struct verify_hash));
-	*(struct verify_hash *) &ctx->hash = *hash;		/* Assignment to "const" */
-	ctx->files_to_hash = hash_list_new(verify_item_hash, verify_item_equal);
-	hash_list_thread_safe(ctx->files_to_hash);
+	ctx = verify_worker_new(hash, NULL);
+	ctx->worker_count = verify_worker_count();
+	HALLOC_ARRAY(ctx->workers, ctx->worker_count);
+
+	for (i = 0; i < ctx->worker_count; i++) {
+		struct verify *w = 0 == i ? ctx : verify_worker_new(hash, ctx);
+
+		ctx->workers[i] = w;
+		verify_thread_create_if_needed(w, i, ctx->worker_count);
+	}
 
-	verify_thread_create_if_needed(ctx);
+	if (GNET_PROPERTY(verify_debug)) {
+		g_debug("using %u worker%s for %s verification",
+			ctx->worker_count, plural(ctx->worker_count),
+			verify_hash_name(ctx));
+	}
 
 	return ctx;
 }
@@ -627,42 +741,60 @@ verify_deferred_free(cqueue_t *cq, void *data)
 	unsigned i;
 
 	verify_check(ctx);
+	g_assert(ctx->primary == ctx);
 
 	/*
-	 * We do not free the verification context until the thread that uses it
-	 * has not marked it was about to exit by clearing its corresponding
-	 * entry in verify_threads[].
+	 * We do not free the verification context until all the threads used
+	 * by its workers have marked they were about to exit by clearing their
+	 * corresponding entry in verify_threads[].
 	 */
 
-	i = verify_thread_local_id(ctx->verify_stid, FALSE);
+	for (i = 0; i < ctx->worker_count; i++) {
+		struct verify *w = ctx->workers[i];
 
-	if (i != VERIFY_INVALID_LOCAL_ID) {
-		/*
-		 * Thread has not terminated yet, could have pending RPCs...
-		 */
+		if (
+			verify_thread_local_id(w->verify_stid, FALSE) !=
+				VERIFY_INVALID_LOCAL_ID
+		) {
+			/*
+			 * Thread has not terminated yet, could have pending RPCs...
+			 */
 
-		if (GNET_PROPERTY(verify_debug) > 1) {
-			g_debug("verification %s for %s not terminated yet",
-				thread_id_name(ctx->verify_stid), verify_hash_name(ctx));
-		}
+			if (GNET_PROPERTY(verify_debug) > 1) {
+				g_debug("verification %s for %s not terminated yet",
+					thread_id_name(w->verify_stid), verify_hash_name(w));
+			}
 
-		cq_insert(cq, VERIFY_DEFERRED, verify_deferred_free, ctx);
-	} else {
-		if (GNET_PROPERTY(verify_debug) > 1) {
-			g_debug("freeing %s verification context", verify_hash_name(ctx));
+			cq_insert(cq, VERIFY_DEFERRED, verify_deferred_free, ctx);
+			return;
 		}
+	}
 
-		hash_list_free(&ctx->files_to_hash);
-		ctx->magic = 0;
-		WFREE(ctx);
+	if (GNET_PROPERTY(verify_debug) > 1) {
+		g_debug("freeing %s verification context", verify_hash_name(ctx));
 	}
+
+	hash_list_free(&ctx->files_to_hash);
+
+	for (i = 0; i < ctx->worker_count; i++) {
+		struct verify *w = ctx->workers[i];
+
+		w->hash.free_context(w->hash_ctx);
+		HFREE_NULL(w->buffer);
+		w->magic = 0;
+		if (w != ctx)
+			WFREE(w);
+	}
+
+	HFREE_NULL(ctx->workers);
+	WFREE(ctx);
 }
 
 /**
  * Free verification context and nullify its pointer.
  *
  * The actual physical disposal of the verification context is deferred until
- * the thread responsible for handling the work has terminated.
+ * the threads responsible for handling the work have terminated.
  */
 void
 verify_free(struct verify **ptr)
@@ -670,20 +802,28 @@ verify_free(struct verify **ptr)
 	struct verify *ctx = *ptr;
 
 	if (ctx != NULL) {
+		unsigned i;
+
 		verify_check(ctx);
+		g_assert(ctx->primary == ctx);
 		g_assert(!ctx->shutdowned);
 
-		if (ctx->task != NULL) {
-			bg_task_cancel(ctx->task);
-			ctx->task = NULL;
+		for (i = 0; i < ctx->worker_count; i++) {
+			struct verify *w = ctx->workers[i];
+
+			if (w->task != NULL) {
+				bg_task_cancel(w->task);
+				w->task = NULL;
+			}
+
+			w->shutdowned = TRUE;
+			thread_kill(w->verify_stid, TSIG_TERM);
 		}
 
-		ctx->shutdowned = TRUE;
-		thread_kill(ctx->verify_stid, TSIG_TERM);
 		*ptr = NULL;
 
 		/*
-		 * Defer freeing of the context until the thread is dead
+		 * Defer freeing of the context until the threads are dead
 		 *
 		 * We leave the ctx->files_to_hash list around as well because
 		 * it could still be accessed by other threads.
@@ -1076,6 +1216,7 @@ verify_enqueue(struct verify *ctx, int high_priority,
 	int inserted;
 
 	verify_check(ctx);
+	g_assert(ctx->primary == ctx);
 	g_return_val_if_fail(pathname, FALSE);
 	g_return_val_if_fail(callback, FALSE);
 	g_return_val_if_fail(!ctx->shutdowned, FALSE);
@@ -1112,17 +1253,26 @@ verify_enqueue(struct verify *ctx, int high_priority,
 
 	/*
 	 * When work was inserted into the queue (represented by the hash list
-	 * here), we signal the thread handling the verification so that it can
-	 * be awoken if it was sleeping: the TSIG_TEQ signal will let the thread
-	 * out of the teq_wait() call in its main processing loop, and the
+	 * here), we signal the threads handling the verification so that they
+	 * can be awoken if they were sleeping: the TSIG_TEQ signal will let each
+	 * thread out of the teq_wait() call in its main processing loop, and the
 	 * verify_enqueued() event callback will make sure we have a background
 	 * task to actually process the work.
+	 *
+	 * All the workers are signalled, the ones finding the queue empty will
+	 * simply terminate their background task.
 	 */
 
-	if (inserted)
-		teq_post(ctx->verify_stid, verify_enqueued, ctx);
-	else
+	if (inserted) {
+		unsigned i;
+
+		for (i = 0; i < ctx->worker_count; i++) {
+			struct verify *w = ctx->workers[i];
+			teq_post(w->verify_stid, verify_enqueued, w);
+		}
+	} else {
 		verify_file_free(&item);
+	}
 
 	return inserted;
 }
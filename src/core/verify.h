@@ -56,9 +56,11 @@ typedef bool (*verify_callback)(const struct verify *,
 
 struct verify_hash {
 	const char *	(*name)(void);
-	void 			(*init)(filesize_t amount);
-	int  			(*update)(const void *data, size_t size);
-	int 			(*final)(void);
+	void *			(*new_context)(void);
+	void			(*free_context)(void *hctx);
+	void 			(*init)(void *hctx, filesize_t amount);
+	int  			(*update)(void *hctx, const void *data, size_t size);
+	int 			(*final)(void *hctx);
 };
 
 struct verify *verify_new(const struct verify_hash *);
@@ -69,6 +71,7 @@ bool verify_enqueue(struct verify *, int high_priority,
 	verify_callback callback, void *user_data);
 
 enum verify_status verify_status(const struct verify *);
+void *verify_hash_context(const struct verify *);
 filesize_t verify_hashed(const struct verify *);
 uint verify_elapsed(const struct verify *);
 
@@ -0,0 +1,210 @@
+/*
+ * Copyright (c) 2026, Raphael Manfredi
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup core
+ * @file
+ *
+ * Combined SHA-1 and TTH hash verification.
+ *
+ * Each buffer read from the file is fed to both the SHA-1 and the Tiger
+ * tree computations, so that both digests of a newly shared file can be
+ * obtained by reading it from disk only once.
+ *
+ * @author Raphael Manfredi
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "verify_sha1_tth.h"
+
+#include "lib/halloc.h"
+#include "lib/once.h"
+#include "lib/sha1.h"
+#include "lib/tigertree.h"
+#include "lib/walloc.h"
+
+#include "lib/override.h"	/* Must be the last header included */
+
+static struct {
+	struct verify	*verify;
+} verify_sha1_tth;
+
+/**
+ * Combined SHA-1 and TTH computation state of a verification worker.
+ */
+struct verify_sha1_tth_ctx {
+	SHA1_context	sha1_ctx;
+	TTH_CONTEXT		*tth_ctx;
+	struct sha1		sha1;
+	struct tth		tth;
+};
+
+static const char *
+verify_sha1_tth_name(void)
+{
+	return "SHA-1+TTH";
+}
+
+static void *
+verify_sha1_tth_new(void)
+{
+	struct verify_sha1_tth_ctx *vc;
+
+	WALLOC0(vc);
+	vc->tth_ctx = halloc(tt_size());
+	return vc;
+}
+
+static void
+verify_sha1_tth_free(void *hctx)
+{
+	struct verify_sha1_tth_ctx *vc = hctx;
+
+	HFREE_NULL(vc->tth_ctx);
+	WFREE(vc);
+}
+
+static void
+verify_sha1_tth_reset(void *hctx, filesize_t amount)
+{
+	struct verify_sha1_tth_ctx *vc = hctx;
+	int ret;
+
+	ret = SHA1_reset(&vc->sha1_ctx);
+	g_assert(SHA_SUCCESS == ret);
+	tt_init(vc->tth_ctx, amount);
+}
+
+static int
+verify_sha1_tth_update(void *hctx, const void *data, size_t size)
+{
+	struct verify_sha1_tth_ctx *vc = hctx;
+	int ret;
+
+	ret = SHA1_input(&vc->sha1_ctx, data, size);
+	if (SHA_SUCCESS != ret)
+		return -1;
+
+	tt_update(vc->tth_ctx, data, size);
+	return 0;
+}
+
+static int
+verify_sha1_tth_final(void *hctx)
+{
+	struct verify_sha1_tth_ctx *vc = hctx;
+	int ret;
+
+	ret = SHA1_result(&vc->sha1_ctx, &vc->sha1);
+	if (SHA_SUCCESS != ret)
+		return -1;
+
+	tt_digest(vc->tth_ctx, &vc->tth);
+	return 0;
+}
+
+static const struct verify_hash verify_hash_sha1_tth = {
+	verify_sha1_tth_name,
+	verify_sha1_tth_new,
+	verify_sha1_tth_free,
+	verify_sha1_tth_reset,
+	verify_sha1_tth_update,
+	verify_sha1_tth_final,
+};
+
+/**
+ * Enqueue file for combined SHA-1 and TTH computation.
+ *
+ * @return TRUE if the item was enqueued, FALSE if it was already present.
+ */
+int
+verify_sha1_tth_enqueue(int high_priority,
+	const char *pathname, filesize_t filesize,
+	verify_callback callback, void *user_data)
+{
+	return verify_enqueue(verify_sha1_tth.verify, high_priority,
+		pathname, 0, filesize, callback, user_data);
+}
+
+static const struct verify_sha1_tth_ctx *
+verify_sha1_tth_context(const struct verify *ctx)
+{
+	return verify_hash_context(ctx);
+}
+
+const struct sha1 *
+verify_sha1_tth_sha1(const struct verify *ctx)
+{
+	g_return_val_if_fail(verify_status(ctx) == VERIFY_DONE, NULL);
+	return &verify_sha1_tth_context(ctx)->sha1;
+}
+
+const struct tth *
+verify_sha1_tth_tth(const struct verify *ctx)
+{
+	g_return_val_if_fail(verify_status(ctx) == VERIFY_DONE, NULL);
+	return &verify_sha1_tth_context(ctx)->tth;
+}
+
+const struct tth *
+verify_sha1_tth_leaves(const struct verify *ctx)
+{
+	g_return_val_if_fail(verify_status(ctx) == VERIFY_DONE, NULL);
+	return tt_leaves(verify_sha1_tth_context(ctx)->tth_ctx);
+}
+
+size_t
+verify_sha1_tth_leave_count(const struct verify *ctx)
+{
+	g_return_val_if_fail(verify_status(ctx) == VERIFY_DONE, 0);
+	return tt_leave_count(verify_sha1_tth_context(ctx)->tth_ctx);
+}
+
+static void G_COLD
+verify_sha1_tth_init_once(void)
+{
+	verify_sha1_tth.verify = verify_new(&verify_hash_sha1_tth);
+}
+
+void G_COLD
+verify_sha1_tth_init(void)
+{
+	static once_flag_t initialized;
+
+	/*
+	 * Must use once_flag_runwait() since verify_new() can create threads,
+	 * see verify_sha1_init() for details.
+	 */
+
+	once_flag_runwait(&initialized, verify_sha1_tth_init_once);
+}
+
+void G_COLD
+verify_sha1_tth_close(void)
+{
+	verify_free(&verify_sha1_tth.verify);
+}
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2026, Raphael Manfredi
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup core
+ * @file
+ *
+ * Combined SHA-1 and TTH hash verification.
+ *
+ * @author Raphael Manfredi
+ * @date 2026
+ */
+
+#ifndef _core_verify_sha1_tth_h_
+#define _core_verify_sha1_tth_h_
+
+#include "common.h"
+
+#include "verify.h"
+
+int verify_sha1_tth_enqueue(int high_priority,
+	const char *pathname, filesize_t filesize,
+	verify_callback callback, void *user_data);
+
+const struct sha1 *verify_sha1_tth_sha1(const struct verify *);
+const struct tth *verify_sha1_tth_tth(const struct verify *);
+const struct tth *verify_sha1_tth_leaves(const struct verify *);
+size_t verify_sha1_tth_leave_count(const struct verify *);
+
+void verify_sha1_tth_init(void);
+void verify_sha1_tth_close(void);
+
+#endif	/* _core_verify_sha1_tth_h_ */
+
+/* vi: set ts=4: */
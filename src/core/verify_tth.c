@@ -43,18 +43,27 @@
 
 #include "lib/base32.h"
 #include "lib/halloc.h"
+#include "lib/hset.h"
 #include "lib/once.h"
 #include "lib/tiger.h"
 #include "lib/tigertree.h"
 #include "lib/tm.h"
+#include "lib/walloc.h"
 
 #include "lib/override.h"		/* Must be the last inclusion */
 
 static struct {
 	struct verify	*verify;
+	hset_t			*rebuilding;	/* Workers computing a library file TTH */
+} verify_tth;
+
+/**
+ * TTH computation state of a verification worker.
+ */
+struct verify_tth_ctx {
 	TTH_CONTEXT		*context;
 	struct tth		digest;
-} verify_tth;
+};
 
 static const char *
 verify_tth_name(void)
@@ -62,35 +71,55 @@ verify_tth_name(void)
 	return "TTH";
 }
 
+static void *
+verify_tth_new(void)
+{
+	struct verify_tth_ctx *vt;
+
+	WALLOC0(vt);
+	vt->context = halloc(tt_size());
+	return vt;
+}
+
 static void
-verify_tth_reset(filesize_t size)
+verify_tth_free(void *hctx)
 {
-	if G_LIKELY(verify_tth.context != NULL)
-		tt_init(verify_tth.context, size);
+	struct verify_tth_ctx *vt = hctx;
+
+	HFREE_NULL(vt->context);
+	WFREE(vt);
+}
+
+static void
+verify_tth_reset(void *hctx, filesize_t size)
+{
+	struct verify_tth_ctx *vt = hctx;
+
+	tt_init(vt->context, size);
 }
 
 static int
-verify_tth_update(const void *data, size_t size)
+verify_tth_update(void *hctx, const void *data, size_t size)
 {
-	if G_UNLIKELY(NULL == verify_tth.context)
-		return -1;
+	struct verify_tth_ctx *vt = hctx;
 
-	tt_update(verify_tth.context, data, size);
+	tt_update(vt->context, data, size);
 	return 0;
 }
 
 static int
-verify_tth_final(void)
+verify_tth_final(void *hctx)
 {
-	if G_UNLIKELY(NULL == verify_tth.context)
-		return -1;
+	struct verify_tth_ctx *vt = hctx;
 
-	tt_digest(verify_tth.context, &verify_tth.digest);
+	tt_digest(vt->context, &vt->digest);
 	return 0;
 }
 
 static const struct verify_hash verify_hash_tth = {
 	verify_tth_name,
+	verify_tth_new,
+	verify_tth_free,
 	verify_tth_reset,
 	verify_tth_update,
 	verify_tth_final,
@@ -99,28 +128,39 @@ static const struct verify_hash verify_hash_tth = {
 const struct tth *
 verify_tth_digest(const struct verify *ctx)
 {
+	const struct verify_tth_ctx *vt;
+
 	g_return_val_if_fail(verify_status(ctx) == VERIFY_DONE, NULL);
-	return &verify_tth.digest;
+
+	vt = verify_hash_context(ctx);
+	return &vt->digest;
 }
 
 const struct tth *
 verify_tth_leaves(const struct verify *ctx)
 {
+	const struct verify_tth_ctx *vt;
+
 	g_return_val_if_fail(verify_status(ctx) == VERIFY_DONE, NULL);
-	return tt_leaves(verify_tth.context);
+
+	vt = verify_hash_context(ctx);
+	return tt_leaves(vt->context);
 }
 
 size_t
 verify_tth_leave_count(const struct verify *ctx)
 {
+	const struct verify_tth_ctx *vt;
+
 	g_return_val_if_fail(verify_status(ctx) == VERIFY_DONE, 0);
-	return tt_leave_count(verify_tth.context);
+
+	vt = verify_hash_context(ctx);
+	return tt_leave_count(vt->context);
 }
 
 static void G_COLD
 verify_tth_init_once(void)
 {
-	verify_tth.context = halloc(tt_size());
 	verify_tth.verify = verify_new(&verify_hash_tth);
 }
 
@@ -149,15 +189,43 @@ void G_COLD
 verify_tth_shutdown(void)
 {
 	verify_free(&verify_tth.verify);
+	hset_free_null(&verify_tth.rebuilding);
 }
 
 /**
- * Release memory resources used by tigertree verification.
+ * Record that the verification worker starts computing the TTH of a
+ * library file.
  */
-void G_COLD
-verify_tth_close(void)
+static void
+verify_tth_rebuilding_start(const struct verify *ctx)
 {
-	HFREE_NULL(verify_tth.context);
+	if G_UNLIKELY(NULL == verify_tth.rebuilding)
+		verify_tth.rebuilding = hset_create(HASH_KEY_SELF, 0);
+
+	hset_insert(verify_tth.rebuilding, ctx);
+	gnet_prop_set_boolean_val(PROP_TTH_REBUILDING, TRUE);
+}
+
+/**
+ * Record that the verification worker is done with the library file.
+ *
+ * The TTH rebuilding indication is only cleared once all the workers
+ * are done.  We can be called for files that were never started, which
+ * are simply ignored.
+ */
+static void
+verify_tth_rebuilding_end(const struct verify *ctx)
+{
+	if (NULL == verify_tth.rebuilding)
+		return;
+
+	if (!hset_contains(verify_tth.rebuilding, ctx))
+		return;
+
+	hset_remove(verify_tth.rebuilding, ctx);
+
+	if (0 == hset_count(verify_tth.rebuilding))
+		gnet_prop_set_boolean_val(PROP_TTH_REBUILDING, FALSE);
 }
 
 static bool
@@ -194,7 +262,7 @@ request_tigertree_callback(const struct verify *ctx, enum verify_status status,
 			}
 			return FALSE;
 		}
-		gnet_prop_set_boolean_val(PROP_TTH_REBUILDING, TRUE);
+		verify_tth_rebuilding_start(ctx);
 		return TRUE;
 	case VERIFY_PROGRESS:
 		return 0 != (SHARE_F_INDEXED & shared_file_flags(sf));
@@ -210,7 +278,7 @@ request_tigertree_callback(const struct verify *ctx, enum verify_status status,
 	case VERIFY_ERROR:
 	case VERIFY_SHUTDOWN:
 		shared_file_unref(&sf);
-		gnet_prop_set_boolean_val(PROP_TTH_REBUILDING, FALSE);
+		verify_tth_rebuilding_end(ctx);
 		return TRUE;
 	case VERIFY_INVALID:
 		break;
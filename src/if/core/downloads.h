@@ -149,6 +149,8 @@ typedef struct download download_t;
 
 struct bio_source;
 struct http_buffer;
+struct dl_tth;
+struct dl_write;
 
 enum dl_bufmode {
 	DL_BUF_READING,
@@ -165,6 +167,11 @@ struct dl_buffers {
 	slist_t *list;			/**< List of pmsg_t items */
 	size_t amount;			/**< Amount to buffer (extra is read-ahead) */
 	size_t held;			/**< Amount of data held in read buffers */
+	size_t pending;			/**< Amount of data being written to disk */
+	struct dl_write *write;	/**< Pending disk write, NULL if none */
+	bool rx_paused;			/**< Reading suspended until write completes */
+	bool got_eof;			/**< EOF seen whilst write was pending */
+	struct dl_tth *tth;		/**< Streaming tigertree verification */
 };
 
 /**
@@ -366,7 +373,8 @@ enum {
 #define download_filesize(d)	((d)->file_info->size)
 #define download_filedone(d)	((d)->file_info->done + (d)->file_info->buffered)
 #define download_fileremain(d)	(download_filesize(d) - download_filedone(d))
-#define download_buffered(d)	((d)->buffers == NULL ? 0 : (d)->buffers->held)
+#define download_buffered(d)	\
+	((d)->buffers == NULL ? 0 : (d)->buffers->held + (d)->buffers->pending)
 #define download_pipelining(d)	((d)->pipeline != NULL)
 
 /*
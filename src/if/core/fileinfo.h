@@ -26,6 +26,8 @@
 
 #include "common.h"
 
+#include "lib/bit_array.h"
+#include "lib/erbtree.h"
 #include "lib/eslist.h"
 #include "lib/http_range.h"
 #include "lib/path.h"
@@ -155,6 +157,8 @@ typedef struct dl_file_info {
 		struct tth *leaves;	/**< Tigertree leaves */
 		size_t num_leaves;	/**< Number of tigertree leaves */
 		filesize_t slice_size;	/* Slice size (bytes covered by a leaf) */
+		bit_array_t *verified;	/**< Slices verified whilst downloading */
+		size_t num_verified;	/**< Amount of bits set in verified[] */
 	} tigertree;
 	int32 refcount;			/**< Reference count of file (number of sources)*/
 	pslist_t *sources;		/**< list of sources (struct download *) */
@@ -164,12 +168,15 @@ typedef struct dl_file_info {
 	time_t modified;		/**< Modification time stamp */
 	time_t ntime;			/**< Last time a new source was added */
 	time_t last_flush;		/**< When last flush to disk occurred */
+	time_t last_publish;	/**< When SHA1 was last given to DHT publisher */
 	time_t last_dmesh;		/**< When last dmesh query was used */
 	time_t last_dht_query;	/**< Last time when SHA1 DHT query was made */
 	filesize_t done;		/**< Total number of bytes completed (flushed) */
 	filesize_t buffered;	/**< Amount of buffered data (unflushed) */
 	filesize_t uploaded;	/**< Amount of bytes uploaded */
 	eslist_t chunklist;		/**< List of ranges within file */
+	erbtree_t chunkmap;		/**< Same chunks, indexed by range */
+	erbtree_t holes;		/**< EMPTY chunks only, indexed by range */
 	eslist_t available;		/**< List of ranges available, with source count */
 	http_rangeset_t *seen_on_network;  /**< Ranges available on network */
 	uint32 generation;		/**< Generation number, incremented on disk update */
@@ -197,6 +204,14 @@ typedef struct dl_file_info {
 	unsigned vrfy_elapsed;	/**< Time spent to compute the hash */
 	unsigned copy_elapsed;	/**< Time spent to copy the file */
 
+	/*
+	 * Pending chunk update, not yet appended to the fileinfo journal.
+	 */
+
+	filesize_t journal_from;	/**< Start of pending journaled range */
+	filesize_t journal_to;		/**< End of pending range, 0 if none */
+	enum dl_chunk_status journal_status;	/**< Status of pending range */
+
 	/*
 	 * Booleans (bit fields used since bool uses too much space).
 	 */
@@ -1,5 +1,5 @@
 /*
- * Generated on Sun Nov  6 23:31:52 2016 by enum-msg.pl -- DO NOT EDIT
+ * Generated on Sun Oct 18 04:24:37 2026 by enum-msg.pl -- DO NOT EDIT
  *
  * Command: ../../../scripts/enum-msg.pl stats.lst
  */
@@ -209,6 +209,8 @@ static const char *stats_symbols[] = {
 	"parq_queue_follow_ups",
 	"sha1_verifications",
 	"tth_verifications",
+	"tth_slices_verified",
+	"tth_slices_bad",
 	"qhit_seeding_of_orphan",
 	"upload_seeding_of_orphan",
 	"rudp_tx_bytes",
@@ -539,6 +541,8 @@ static const char *stats_text[] = {
 	N_("PARQ QUEUE follow-up requests received"),
 	N_("Launched SHA-1 file verifications"),
 	N_("Launched TTH file verifications"),
+	N_("TTH slices verified whilst downloading"),
+	N_("Corrupted TTH slices detected whilst downloading"),
 	N_("Re-seeding of orphan downloads through query hits"),
 	N_("Re-seeding of orphan downloads through upload requests"),
 	N_("RUDP sent bytes"),
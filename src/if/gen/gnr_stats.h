@@ -1,5 +1,5 @@
 /*
- * Generated on Sun Nov  6 23:31:52 2016 by enum-msg.pl -- DO NOT EDIT
+ * Generated on Sun Oct 18 04:24:37 2026 by enum-msg.pl -- DO NOT EDIT
  *
  * Command: ../../../scripts/enum-msg.pl stats.lst
  */
@@ -8,7 +8,7 @@
 #define _if_gen_gnr_stats_h_
 
 /*
- * Enum count: 309
+ * Enum count: 311
  */
 typedef enum {
 	GNR_ROUTING_ERRORS = 0,
@@ -205,6 +205,8 @@ typedef enum {
 	GNR_PARQ_QUEUE_FOLLOW_UPS,
 	GNR_SHA1_VERIFICATIONS,
 	GNR_TTH_VERIFICATIONS,
+	GNR_TTH_SLICES_VERIFIED,
+	GNR_TTH_SLICES_BAD,
 	GNR_QHIT_SEEDING_OF_ORPHAN,
 	GNR_UPLOAD_SEEDING_OF_ORPHAN,
 	GNR_RUDP_TX_BYTES,
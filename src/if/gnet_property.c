@@ -1130,6 +1130,14 @@ gboolean gnet_property_variable_lock_contention_trace     = FALSE;
 static const gboolean gnet_property_variable_lock_contention_trace_default = FALSE;
 gboolean gnet_property_variable_lock_sleep_trace     = FALSE;
 static const gboolean gnet_property_variable_lock_sleep_trace_default = FALSE;
+guint32  gnet_property_variable_verify_workers     = 0;
+static const guint32  gnet_property_variable_verify_workers_default = 0;
+gboolean gnet_property_variable_tls_kernel_offload     = FALSE;
+static const gboolean gnet_property_variable_tls_kernel_offload_default = FALSE;
+guint32  gnet_property_variable_matching_threads     = 0;
+static const guint32  gnet_property_variable_matching_threads_default = 0;
+gboolean gnet_property_variable_routing_flat_table     = FALSE;
+static const gboolean gnet_property_variable_routing_flat_table_default = FALSE;
 
 static prop_set_t *gnet_property;
 
@@ -11376,6 +11384,88 @@ gnet_prop_init(void) {
     gnet_property->props[486].data.boolean.def   = (void *) &gnet_property_variable_lock_sleep_trace_default;
     gnet_property->props[486].data.boolean.value = (void *) &gnet_property_variable_lock_sleep_trace;
 
+
+    /*
+     * PROP_VERIFY_WORKERS:
+     *
+     * General data:
+     */
+    gnet_property->props[487].name = "verify_workers";
+    gnet_property->props[487].desc = _("Amount of hashing workers to use per hash type when computing file digests.  When 0, the amount is derived from the number of CPUs.  Changes are only taken into account at the next startup.");
+    gnet_property->props[487].ev_changed = event_new("verify_workers_changed");
+    gnet_property->props[487].save = TRUE;
+    gnet_property->props[487].internal = FALSE;
+    gnet_property->props[487].vector_size = 1;
+	mutex_init(&gnet_property->props[487].lock);
+
+    /* Type specific data: */
+    gnet_property->props[487].type               = PROP_TYPE_GUINT32;
+    gnet_property->props[487].data.guint32.def   = (void *) &gnet_property_variable_verify_workers_default;
+    gnet_property->props[487].data.guint32.value = (void *) &gnet_property_variable_verify_workers;
+    gnet_property->props[487].data.guint32.choices = NULL;
+    gnet_property->props[487].data.guint32.max   = 8;
+    gnet_property->props[487].data.guint32.min   = 0;
+
+
+    /*
+     * PROP_TLS_KERNEL_OFFLOAD:
+     *
+     * General data:
+     */
+    gnet_property->props[488].name = "tls_kernel_offload";
+    gnet_property->props[488].desc = _("Whether to let the kernel encrypt outgoing TLS 1.2 records when it can, which lets file uploads over TLS use sendfile().");
+    gnet_property->props[488].ev_changed = event_new("tls_kernel_offload_changed");
+    gnet_property->props[488].save = TRUE;
+    gnet_property->props[488].internal = FALSE;
+    gnet_property->props[488].vector_size = 1;
+	mutex_init(&gnet_property->props[488].lock);
+
+    /* Type specific data: */
+    gnet_property->props[488].type               = PROP_TYPE_BOOLEAN;
+    gnet_property->props[488].data.boolean.def   = (void *) &gnet_property_variable_tls_kernel_offload_default;
+    gnet_property->props[488].data.boolean.value = (void *) &gnet_property_variable_tls_kernel_offload;
+
+
+    /*
+     * PROP_MATCHING_THREADS:
+     *
+     * General data:
+     */
+    gnet_property->props[489].name = "matching_threads";
+    gnet_property->props[489].desc = _("Amount of threads among which the scanning of a large search bin is split when matching queries against the library.  When 0, the amount is derived from the number of CPUs.  Use 1 to always match from the main thread.");
+    gnet_property->props[489].ev_changed = event_new("matching_threads_changed");
+    gnet_property->props[489].save = TRUE;
+    gnet_property->props[489].internal = FALSE;
+    gnet_property->props[489].vector_size = 1;
+	mutex_init(&gnet_property->props[489].lock);
+
+    /* Type specific data: */
+    gnet_property->props[489].type               = PROP_TYPE_GUINT32;
+    gnet_property->props[489].data.guint32.def   = (void *) &gnet_property_variable_matching_threads_default;
+    gnet_property->props[489].data.guint32.value = (void *) &gnet_property_variable_matching_threads;
+    gnet_property->props[489].data.guint32.choices = NULL;
+    gnet_property->props[489].data.guint32.max   = 16;
+    gnet_property->props[489].data.guint32.min   = 0;
+
+
+    /*
+     * PROP_ROUTING_FLAT_TABLE:
+     *
+     * General data:
+     */
+    gnet_property->props[490].name = "routing_flat_table";
+    gnet_property->props[490].desc = _("Whether to keep the Gnutella routing table as a flat open-addressed table of inline records, instead of individually allocated entries.  Changes are only taken into account at the next startup.");
+    gnet_property->props[490].ev_changed = event_new("routing_flat_table_changed");
+    gnet_property->props[490].save = TRUE;
+    gnet_property->props[490].internal = FALSE;
+    gnet_property->props[490].vector_size = 1;
+	mutex_init(&gnet_property->props[490].lock);
+
+    /* Type specific data: */
+    gnet_property->props[490].type               = PROP_TYPE_BOOLEAN;
+    gnet_property->props[490].data.boolean.def   = (void *) &gnet_property_variable_routing_flat_table_default;
+    gnet_property->props[490].data.boolean.value = (void *) &gnet_property_variable_routing_flat_table;
+
     gnet_property->by_name = htable_create(HASH_KEY_STRING, 0);
     for (n = 0; n < GNET_PROPERTY_NUM; n ++) {
         htable_insert(gnet_property->by_name,
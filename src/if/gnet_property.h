@@ -523,6 +523,10 @@ typedef enum {
     PROP_INPUTEVT_TRACE,
     PROP_LOCK_CONTENTION_TRACE,
     PROP_LOCK_SLEEP_TRACE,
+    PROP_VERIFY_WORKERS,
+    PROP_TLS_KERNEL_OFFLOAD,
+    PROP_MATCHING_THREADS,
+    PROP_ROUTING_FLAT_TABLE,
     GNET_PROPERTY_END
 } gnet_property_t;
 
@@ -537,6 +537,10 @@ extern const gboolean gnet_property_variable_query_trace;
 extern const gboolean gnet_property_variable_inputevt_trace;
 extern const gboolean gnet_property_variable_lock_contention_trace;
 extern const gboolean gnet_property_variable_lock_sleep_trace;
+extern const guint32  gnet_property_variable_verify_workers;
+extern const gboolean gnet_property_variable_tls_kernel_offload;
+extern const guint32  gnet_property_variable_matching_threads;
+extern const gboolean gnet_property_variable_routing_flat_table;
 
 
 prop_set_t *gnet_prop_init(void);
@@ -0,0 +1,437 @@
+/*
+ * bitmap-test -- bitmap kernel tests and QRP merging benchmark.
+ *
+ * Copyright (c) 2026 Raphael Manfredi <Raphael_Manfredi@pobox.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the authors nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "common.h"
+
+#include "lib/bitmap.h"
+#include "lib/misc.h"
+#include "lib/pow2.h"
+#include "lib/progname.h"
+#include "lib/rand31.h"
+#include "lib/tm.h"
+#include "lib/xmalloc.h"
+
+#define TEST_LOOPS		256
+#define TEST_MAXLEN		4096
+#define TEST_MAXRATIO	6
+
+#define BENCH_LEAVES	400			/* Default amount of leaf tables */
+#define BENCH_MIN_BITS	16			/* Smallest leaf table: 64K slots */
+#define BENCH_MAX_BITS	20			/* Largest leaf table: 1M slots */
+#define BENCH_LOOPS		4			/* Amount of merges timed */
+
+static bool silent_mode, verbose_mode;
+
+static void G_NORETURN
+usage(void)
+{
+	fprintf(stderr,
+		"Usage: %s [-hbSV] [-l leaves] [-n loops] [-R seed]\n"
+		"  -b : benchmark merging of leaf tables with each backend\n"
+		"  -h : prints this help message\n"
+		"  -l : sets amount of leaf tables to merge in benchmark\n"
+		"  -n : sets amount of random loops\n"
+		"  -R : seed for repeatable random data\n"
+		"  -S : silent mode -- do not print anything for successful tests\n"
+		"  -V : verbose mode -- print status after each successful test\n"
+		, getprogname());
+	exit(EXIT_FAILURE);
+}
+
+static void G_NORETURN
+failed(const char *name, const char *what, size_t len, uint arg)
+{
+	printf("%s: %s on %zu bytes (%u) FAILED\n", name, what, len, arg);
+	printf("use '-R %u' to reproduce problem.\n", rand31_initial_seed());
+	exit(EXIT_FAILURE);
+}
+
+/*
+ * Fill bitmap with random bits, with a random density so that we get
+ * both sparse and dense bitmaps.
+ */
+static void
+random_bitmap(uint8 *p, size_t len)
+{
+	uint density = rand31_value(8);
+	size_t i;
+
+	rand31_bytes(p, len);
+
+	for (i = 0; i < len; i++) {
+		if (rand31_value(8) >= density)
+			p[i] = 0;
+	}
+}
+
+static bool
+bit_get(const uint8 *p, size_t i)
+{
+	return 0 != (p[i >> 3] & (0x80 >> (i & 0x7)));
+}
+
+static void
+bit_set(uint8 *p, size_t i)
+{
+	p[i >> 3] |= 0x80 >> (i & 0x7);
+}
+
+static void
+ref_or_expand(uint8 *d, const uint8 *s, size_t len, uint ratio)
+{
+	size_t i, j, n = (size_t) 1 << ratio;
+
+	for (i = 0; i < 8 * len; i++) {
+		if (bit_get(s, i)) {
+			for (j = 0; j < n; j++)
+				bit_set(d, i * n + j);
+		}
+	}
+}
+
+static bool
+ref_xor(uint8 *d, const uint8 *a, const uint8 *b, size_t len, bool reverse)
+{
+	bool changed = FALSE;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		uint8 x = (NULL == a ? 0 : a[i]) ^ b[i];
+
+		if (x != 0)
+			changed = TRUE;
+		d[i] = reverse ? reverse_byte(x) : x;
+	}
+
+	return changed;
+}
+
+static bool
+ref_diff4(uint8 *d, const uint8 *o, const uint8 *n, size_t len)
+{
+	bool changed = FALSE;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		uint8 obyte = NULL == o ? 0 : o[i];
+		uint8 nbyte = n[i];
+		uint8 v;
+		int j;
+
+		for (v = 0, j = 7; j >= 0; j--) {
+			uint8 mask = 1 << j;
+
+			if ((obyte & mask) ^ (nbyte & mask)) {
+				v |= (obyte & mask) ? 0x1 : 0xf;
+				changed = TRUE;
+			}
+
+			if (j & 0x1)
+				v <<= 4;
+			else {
+				*d++ = v;
+				v = 0;
+			}
+		}
+	}
+
+	return changed;
+}
+
+static void
+test_or_expand(const char *name, size_t loops)
+{
+	uint8 *src, *dst, *ref;
+	size_t i;
+
+	src = xmalloc(TEST_MAXLEN + 1);
+	dst = xmalloc((TEST_MAXLEN << TEST_MAXRATIO) + 1);
+	ref = xmalloc((TEST_MAXLEN << TEST_MAXRATIO) + 1);
+
+	for (i = 0; i < loops; i++) {
+		uint ratio = rand31_value(TEST_MAXRATIO);
+		size_t len = rand31_value(TEST_MAXLEN >> (ratio / 2));
+		size_t offset = rand31_value(1);		/* Unaligned data */
+		size_t dlen = len << ratio;
+
+		random_bitmap(src + offset, len);
+		random_bitmap(dst + offset, dlen);
+		memcpy(ref, dst + offset, dlen);
+
+		ref_or_expand(ref, src + offset, len, ratio);
+		bitmap_or_expand(dst + offset, src + offset, len, ratio);
+
+		if (0 != memcmp(ref, dst + offset, dlen))
+			failed(name, "OR with expansion", len, ratio);
+	}
+
+	if (verbose_mode)
+		printf("%s: %zu random OR expansions OK\n", name, loops);
+
+	xfree(src);
+	xfree(dst);
+	xfree(ref);
+}
+
+static void
+test_diff(const char *name, size_t loops)
+{
+	uint8 *old, *new, *dst, *ref;
+	size_t i;
+
+	old = xmalloc(TEST_MAXLEN + 1);
+	new = xmalloc(TEST_MAXLEN + 1);
+	dst = xmalloc(4 * TEST_MAXLEN + 1);
+	ref = xmalloc(4 * TEST_MAXLEN + 1);
+
+	for (i = 0; i < loops; i++) {
+		size_t len = rand31_value(TEST_MAXLEN);
+		size_t offset = rand31_value(1);		/* Unaligned data */
+		bool reverse = rand31_value(1);
+		const uint8 *op = 0 == rand31_value(7) ? NULL : old + offset;
+		size_t flips = rand31_value(3) * rand31_value(len / 4);
+		bool r1, r2;
+
+		random_bitmap(old + offset, len);
+		memcpy(new + offset, old + offset, len);
+
+		/* Flip a few bits, possibly none */
+		while (len != 0 && flips-- != 0)
+			new[offset + rand31_value(len - 1)] ^= 1 << rand31_value(7);
+
+		r1 = ref_xor(ref, op, new + offset, len, reverse);
+		r2 = bitmap_xor(dst + offset, op, new + offset, len, reverse);
+
+		if (r1 != r2 || 0 != memcmp(ref, dst + offset, len))
+			failed(name, "XOR", len, reverse);
+
+		r1 = ref_diff4(ref, op, new + offset, len);
+		r2 = bitmap_diff4(dst + offset, op, new + offset, len);
+
+		if (r1 != r2 || 0 != memcmp(ref, dst + offset, 4 * len))
+			failed(name, "quartet diff", len, NULL == op);
+	}
+
+	if (verbose_mode)
+		printf("%s: %zu random diffs OK\n", name, loops);
+
+	xfree(old);
+	xfree(new);
+	xfree(dst);
+	xfree(ref);
+}
+
+static void
+test_count(size_t loops)
+{
+	uint8 *buf;
+	size_t i;
+
+	buf = xmalloc(TEST_MAXLEN);
+
+	for (i = 0; i < loops; i++) {
+		size_t len = rand31_value(TEST_MAXLEN);
+		size_t j, count = 0;
+
+		random_bitmap(buf, len);
+
+		for (j = 0; j < 8 * len; j++)
+			count += bit_get(buf, j);
+
+		if (count != bitmap_count(buf, len))
+			failed("count", "bit counting", len, 0);
+	}
+
+	xfree(buf);
+}
+
+struct leaf {
+	uint8 *arena;			/* Compacted table */
+	size_t len;				/* Length of arena, in bytes */
+	uint ratio;				/* Expansion when merging */
+};
+
+/*
+ * Merge the leaf tables as the ultrapeer does to build its last-hop table,
+ * with each backend, and report the time spent per leaf.
+ */
+static void
+benchmark(size_t leaves)
+{
+	struct leaf *leaf;
+	size_t mlen = (1 << BENCH_MAX_BITS) / 8;
+	uint8 *merged, *previous, *patch;
+	const char *name;
+	uint i;
+	size_t j;
+
+	leaf = xmalloc(leaves * sizeof leaf[0]);
+	merged = xmalloc(mlen);
+	previous = xmalloc(mlen);
+	patch = xmalloc(4 * mlen);
+	memset(patch, 0, 4 * mlen);		/* Fault pages in before timing */
+
+	for (j = 0; j < leaves; j++) {
+		uint bits = BENCH_MIN_BITS +
+			rand31_value(BENCH_MAX_BITS - BENCH_MIN_BITS);
+		size_t k;
+
+		leaf[j].len = (1 << bits) / 8;
+		leaf[j].ratio = BENCH_MAX_BITS - bits;
+		leaf[j].arena = xmalloc(leaf[j].len);
+
+		/* Leaf tables are sparse: about 1 slot out of 128 is set */
+		memset(leaf[j].arena, 0, leaf[j].len);
+		for (k = 0; k < leaf[j].len * 8 / 128; k++) {
+			size_t b = rand31_value(8 * leaf[j].len - 1);
+			bit_set(leaf[j].arena, b);
+		}
+	}
+
+	for (i = 0; NULL != (name = bitmap_backend_name(i)); i++) {
+		tm_t start, end;
+		double merge, diff;
+		uint loop;
+
+		if (!bitmap_backend_use(i))
+			continue;
+
+		tm_now_exact(&start);
+		for (loop = 0; loop < BENCH_LOOPS; loop++) {
+			memset(merged, 0, mlen);
+			for (j = 0; j < leaves; j++) {
+				if (j == leaves - 1)
+					memcpy(previous, merged, mlen);
+				bitmap_or_expand(merged,
+					leaf[j].arena, leaf[j].len, leaf[j].ratio);
+			}
+		}
+		tm_now_exact(&end);
+		merge = tm_elapsed_f(&end, &start) / BENCH_LOOPS;
+
+		/*
+		 * Patch between the table merged without the last leaf and the
+		 * full table, as computed when a leaf joins.
+		 */
+
+		tm_now_exact(&start);
+		for (loop = 0; loop < BENCH_LOOPS; loop++) {
+			bitmap_diff4(patch, previous, merged, mlen);
+		}
+		tm_now_exact(&end);
+		diff = tm_elapsed_f(&end, &start) / BENCH_LOOPS;
+
+		printf("%-10s merge: %8.2f us/leaf (%zu leaves, %.2f ms), "
+			"4-bit patch: %.2f ms\n",
+			name, merge * 1e6 / leaves, leaves, merge * 1e3, diff * 1e3);
+	}
+
+	printf("merged table: %zu slots, %zu set\n",
+		8 * mlen, bitmap_count(merged, mlen));
+
+	for (j = 0; j < leaves; j++)
+		xfree(leaf[j].arena);
+	xfree(leaf);
+	xfree(merged);
+	xfree(previous);
+	xfree(patch);
+}
+
+int
+main(int argc, char **argv)
+{
+	extern int optind;
+	extern char *optarg;
+	bool bflag = FALSE;
+	size_t loops = TEST_LOOPS;
+	size_t leaves = BENCH_LEAVES;
+	unsigned rseed = 0;
+	const char *name;
+	uint i;
+	int c;
+	const char options[] = "bhl:n:R:SV";
+
+	progstart(argc, argv);
+
+	while ((c = getopt(argc, argv, options)) != EOF) {
+		switch (c) {
+		case 'b':			/* benchmark */
+			bflag = TRUE;
+			break;
+		case 'l':			/* amount of leaves */
+			leaves = atol(optarg);
+			break;
+		case 'n':			/* amount of loops */
+			loops = atol(optarg);
+			break;
+		case 'R':			/* randomize in a repeatable way */
+			rseed = atoi(optarg);
+			break;
+		case 'S':			/* silent mode */
+			silent_mode = TRUE;
+			break;
+		case 'V':			/* verbose mode */
+			verbose_mode = TRUE;
+			break;
+		case 'h':			/* show help */
+		default:
+			usage();
+			break;
+		}
+	}
+
+	if ((argc -= optind) != 0)
+		usage();
+
+	rand31_set_seed(rseed);
+
+	test_count(loops);
+
+	for (i = 0; NULL != (name = bitmap_backend_name(i)); i++) {
+		if (!bitmap_backend_use(i)) {
+			if (!silent_mode)
+				printf("%s: not supported by this CPU, skipped\n", name);
+			continue;
+		}
+
+		test_or_expand(name, loops);
+		test_diff(name, loops);
+
+		if (!silent_mode)
+			printf("%s: OK\n", name);
+	}
+
+	if (bflag && leaves != 0)
+		benchmark(leaves);
+
+	return 0;
+}
@@ -0,0 +1,856 @@
+/*
+ * Copyright (c) 2026, Raphael Manfredi
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Bulk operations on large bitmaps.
+ *
+ * A bitmap is a plain array of bytes, bits being numbered from the most
+ * significant bit of the first byte: bit #0 is 0x80 in byte 0, bit #7 is
+ * 0x01 in byte 0, bit #8 is 0x80 in byte 1, etc.  This is the layout of
+ * the compacted QRP tables, which are the main users of these routines.
+ *
+ * The operations supported are:
+ *
+ * - OR-ing a bitmap into a larger one, each source bit covering 2^ratio
+ *   consecutive bits in the target (merging of QRP tables of different sizes).
+ *
+ * - XOR-ing two bitmaps, optionally reversing the bit order within each byte
+ *   (1-bit QRP patches).
+ *
+ * - Expanding the differences between two bitmaps into signed quartets,
+ *   where a bit turning on yields 0xf (-1) and a bit turning off yields 0x1
+ *   (+1), unchanged bits giving 0 (4-bit QRP patches).
+ *
+ * On x86, these operations are vectorized with SSSE3 or AVX2 instructions,
+ * the best implementation being selected at runtime the first time one of
+ * the routines is called.
+ *
+ * @author Raphael Manfredi
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "bitmap.h"
+#include "pow2.h"
+
+#if (HAS_GCC(4, 9) || defined(__clang__)) && \
+	(defined(__x86_64__) || defined(__i386__))
+#define BITMAP_X86
+#endif
+
+#ifdef BITMAP_X86
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+#include "override.h"		/* Must be the last header included */
+
+/**
+ * Spreading of a nibble into a byte, each bit being doubled.
+ */
+static const uint8 bitmap_spread2[16] = {
+	0x00, 0x03, 0x0c, 0x0f, 0x30, 0x33, 0x3c, 0x3f,
+	0xc0, 0xc3, 0xcc, 0xcf, 0xf0, 0xf3, 0xfc, 0xff,
+};
+
+/**
+ * Spreading of 2 bits into a byte, each bit being repeated 4 times.
+ */
+static const uint8 bitmap_spread4[4] = { 0x00, 0x0f, 0xf0, 0xff };
+
+/**
+ * Nibble bit reversal, and the same shifted into the upper nibble.
+ */
+static const uint8 bitmap_rev4[16] = {
+	0x0, 0x8, 0x4, 0xc, 0x2, 0xa, 0x6, 0xe,
+	0x1, 0x9, 0x5, 0xd, 0x3, 0xb, 0x7, 0xf,
+};
+static const uint8 bitmap_rev4_hi[16] = {
+	0x00, 0x80, 0x40, 0xc0, 0x20, 0xa0, 0x60, 0xe0,
+	0x10, 0x90, 0x50, 0xd0, 0x30, 0xb0, 0x70, 0xf0,
+};
+
+/**
+ * Signed quartets for 2 consecutive bits, indexed by (x << 2) | o, where
+ * `x' holds the 2 bits that changed and `o' the 2 bits of the old bitmap.
+ * The first bit goes to the upper nibble.
+ *
+ * Each bit maps to a quartet as:
+ *
+ *     changed      old bit      quartet
+ *        0            -          0x0     (no change)
+ *        1            0          0xf     (-1, bit turned on)
+ *        1            1          0x1     (+1, bit turned off)
+ */
+static const uint8 bitmap_quartet[16] = {
+	0x00, 0x00, 0x00, 0x00,		/* x = 00 */
+	0x0f, 0x01, 0x0f, 0x01,		/* x = 01 */
+	0xf0, 0xf0, 0x10, 0x10,		/* x = 10 */
+	0xff, 0xf1, 0x1f, 0x11,		/* x = 11 */
+};
+
+/**
+ * OR bitmap `s' of `len' bytes into `d', each source bit being expanded
+ * to 2^ratio bits, with ratio >= 3 (each bit covering whole bytes).
+ */
+static void
+bitmap_or_fill(uint8 *d, const uint8 *s, size_t len, uint ratio)
+{
+	size_t n = (size_t) 1 << (ratio - 3);	/* Bytes per source bit */
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		uint8 b = s[i];
+		uint mask;
+
+		if G_LIKELY(0 == b) {
+			d += 8 * n;
+			continue;
+		}
+
+		for (mask = 0x80; mask != 0; mask >>= 1, d += n) {
+			if (b & mask)
+				memset(d, 0xff, n);
+		}
+	}
+}
+
+/**
+ * Portable OR-ing of `len' bytes from `s' into `d', 64 bits at a time.
+ */
+static void
+bitmap_or_words(uint8 *d, const uint8 *s, size_t len)
+{
+	for (; len >= 8; d += 8, s += 8, len -= 8) {
+		uint64 a, b;
+
+		memcpy(&a, d, 8);
+		memcpy(&b, s, 8);
+		a |= b;
+		memcpy(d, &a, 8);
+	}
+
+	while (len-- != 0)
+		*d++ |= *s++;
+}
+
+static void
+bitmap_or_expand_portable(uint8 *d, const uint8 *s, size_t len, uint ratio)
+{
+	size_t i;
+
+	switch (ratio) {
+	case 0:
+		bitmap_or_words(d, s, len);
+		break;
+	case 1:
+		for (i = 0; i < len; i++, d += 2) {
+			uint8 b = s[i];
+
+			if G_LIKELY(0 == b)
+				continue;
+
+			d[0] |= bitmap_spread2[b >> 4];
+			d[1] |= bitmap_spread2[b & 0xf];
+		}
+		break;
+	case 2:
+		for (i = 0; i < len; i++, d += 4) {
+			uint8 b = s[i];
+
+			if G_LIKELY(0 == b)
+				continue;
+
+			d[0] |= bitmap_spread4[b >> 6];
+			d[1] |= bitmap_spread4[(b >> 4) & 0x3];
+			d[2] |= bitmap_spread4[(b >> 2) & 0x3];
+			d[3] |= bitmap_spread4[b & 0x3];
+		}
+		break;
+	default:
+		bitmap_or_fill(d, s, len, ratio);
+		break;
+	}
+}
+
+static bool
+bitmap_xor_portable(uint8 *d, const uint8 *a, const uint8 *b,
+	size_t len, bool reverse)
+{
+	uint64 changed = 0;
+	size_t i = 0;
+
+	for (; i + 8 <= len; i += 8) {
+		uint64 x = 0, y;
+
+		if (a != NULL)
+			memcpy(&x, &a[i], 8);
+		memcpy(&y, &b[i], 8);
+		x ^= y;
+		changed |= x;
+		memcpy(&d[i], &x, 8);
+	}
+
+	for (; i < len; i++) {
+		uint8 x = (NULL == a ? 0 : a[i]) ^ b[i];
+		changed |= x;
+		d[i] = x;
+	}
+
+	if (reverse && changed != 0) {
+		for (i = 0; i < len; i++) {
+			uint8 x = d[i];
+			if (x != 0)
+				d[i] = bitmap_rev4_hi[x & 0xf] | bitmap_rev4[x >> 4];
+		}
+	}
+
+	return changed != 0;
+}
+
+/**
+ * Expand one byte of differences into 4 bytes of signed quartets.
+ *
+ * @param d		where the 4 bytes are written
+ * @param x		the changed bits
+ * @param o		the old bits
+ */
+static inline void
+bitmap_diff4_byte(uint8 *d, uint8 x, uint8 o)
+{
+	d[0] = bitmap_quartet[((x >> 4) & 0xc) | (o >> 6)];
+	d[1] = bitmap_quartet[((x >> 2) & 0xc) | ((o >> 4) & 0x3)];
+	d[2] = bitmap_quartet[(x & 0xc) | ((o >> 2) & 0x3)];
+	d[3] = bitmap_quartet[((x << 2) & 0xc) | (o & 0x3)];
+}
+
+static bool
+bitmap_diff4_portable(uint8 *d, const uint8 *o, const uint8 *n, size_t len)
+{
+	bool changed = FALSE;
+	size_t i = 0;
+
+	while (i < len) {
+		uint8 ob, x;
+
+		/*
+		 * Skip identical 64-bit words quickly: they produce 32 bytes of 0.
+		 */
+
+		if (i + 8 <= len) {
+			uint64 ow = 0, nw;
+
+			if (o != NULL)
+				memcpy(&ow, &o[i], 8);
+			memcpy(&nw, &n[i], 8);
+
+			if G_LIKELY(ow == nw) {
+				memset(d, 0, 32);
+				d += 32;
+				i += 8;
+				continue;
+			}
+		}
+
+		ob = NULL == o ? 0 : o[i];
+		x = ob ^ n[i];
+
+		if (x != 0) {
+			bitmap_diff4_byte(d, x, ob);
+			changed = TRUE;
+		} else {
+			memset(d, 0, 4);
+		}
+
+		d += 4;
+		i++;
+	}
+
+	return changed;
+}
+
+#ifdef BITMAP_X86
+
+#define LOADU(p)		_mm_loadu_si128((const __m128i *) (p))
+#define STOREU(p,v)		_mm_storeu_si128((__m128i *) (p), (v))
+#define ORU(p,v)		STOREU((p), _mm_or_si128(LOADU(p), (v)))
+#define LOADU256(p)		_mm256_loadu_si256((const __m256i *) (p))
+#define STOREU256(p,v)	_mm256_storeu_si256((__m256i *) (p), (v))
+
+/**
+ * @return whether 128-bit vector is all zeroes.
+ */
+static inline bool __attribute__((target("ssse3")))
+bitmap_zero_128(__m128i v)
+{
+	return 0xffff == _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128()));
+}
+
+/**
+ * Interleave the bytes of 4 vectors, so that the 64 resulting bytes are
+ * a[0], b[0], c[0], e[0], a[1], b[1], etc., and OR them into `d' or store
+ * them there, depending on `merge'.
+ */
+static inline void __attribute__((target("ssse3")))
+bitmap_interleave4(uint8 *d, __m128i a, __m128i b, __m128i c, __m128i e,
+	bool merge)
+{
+	__m128i ab_lo = _mm_unpacklo_epi8(a, b);
+	__m128i ab_hi = _mm_unpackhi_epi8(a, b);
+	__m128i ce_lo = _mm_unpacklo_epi8(c, e);
+	__m128i ce_hi = _mm_unpackhi_epi8(c, e);
+	__m128i r0 = _mm_unpacklo_epi16(ab_lo, ce_lo);
+	__m128i r1 = _mm_unpackhi_epi16(ab_lo, ce_lo);
+	__m128i r2 = _mm_unpacklo_epi16(ab_hi, ce_hi);
+	__m128i r3 = _mm_unpackhi_epi16(ab_hi, ce_hi);
+
+	if (merge) {
+		ORU(d +  0, r0);
+		ORU(d + 16, r1);
+		ORU(d + 32, r2);
+		ORU(d + 48, r3);
+	} else {
+		STOREU(d +  0, r0);
+		STOREU(d + 16, r1);
+		STOREU(d + 32, r2);
+		STOREU(d + 48, r3);
+	}
+}
+
+/**
+ * Expand 16 source bytes with 1 <= ratio <= 3 and OR them into `d'.
+ */
+static inline void __attribute__((target("ssse3")))
+bitmap_expand_128(uint8 *d, __m128i v, uint ratio)
+{
+	const __m128i m4 = _mm_set1_epi8(0x0f);
+	const __m128i m2 = _mm_set1_epi8(0x03);
+
+	switch (ratio) {
+	case 1:
+		{
+			const __m128i lut = LOADU(bitmap_spread2);
+			__m128i hi = _mm_shuffle_epi8(lut,
+				_mm_and_si128(_mm_srli_epi16(v, 4), m4));
+			__m128i lo = _mm_shuffle_epi8(lut, _mm_and_si128(v, m4));
+
+			ORU(d +  0, _mm_unpacklo_epi8(hi, lo));
+			ORU(d + 16, _mm_unpackhi_epi8(hi, lo));
+		}
+		break;
+	case 2:
+		{
+			const __m128i lut = _mm_setr_epi8(
+				0x00, 0x0f, (char) 0xf0, (char) 0xff, 0, 0, 0, 0,
+				0, 0, 0, 0, 0, 0, 0, 0);
+
+			bitmap_interleave4(d,
+				_mm_shuffle_epi8(lut,
+					_mm_and_si128(_mm_srli_epi16(v, 6), m2)),
+				_mm_shuffle_epi8(lut,
+					_mm_and_si128(_mm_srli_epi16(v, 4), m2)),
+				_mm_shuffle_epi8(lut,
+					_mm_and_si128(_mm_srli_epi16(v, 2), m2)),
+				_mm_shuffle_epi8(lut, _mm_and_si128(v, m2)),
+				TRUE);
+		}
+		break;
+	case 3:
+		{
+			/*
+			 * Each output vector covers 2 source bytes, broadcast over 8
+			 * lanes each, where we isolate the bit of each lane.
+			 */
+
+			const __m128i bits = _mm_setr_epi8(
+				(char) 0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01,
+				(char) 0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01);
+			const __m128i two = _mm_set1_epi8(2);
+			__m128i idx = _mm_setr_epi8(
+				0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1);
+			uint k;
+
+			for (k = 0; k < 8; k++, d += 16) {
+				__m128i b = _mm_and_si128(_mm_shuffle_epi8(v, idx), bits);
+				ORU(d, _mm_cmpeq_epi8(b, bits));
+				idx = _mm_add_epi8(idx, two);
+			}
+		}
+		break;
+	default:
+		g_assert_not_reached();
+	}
+}
+
+/**
+ * Compute the signed quartets of 16 bytes of differences `x', given the
+ * old bits `o', into the 64 bytes at `d'.
+ */
+static inline void __attribute__((target("ssse3")))
+bitmap_diff4_128(uint8 *d, __m128i x, __m128i o)
+{
+	const __m128i lut = LOADU(bitmap_quartet);
+	const __m128i m2 = _mm_set1_epi8(0x03);
+	const __m128i m12 = _mm_set1_epi8(0x0c);
+
+#define QUARTETS(s) \
+	_mm_shuffle_epi8(lut, _mm_or_si128( \
+		_mm_and_si128(_mm_slli_epi16(_mm_srli_epi16(x, (s)), 2), m12), \
+		_mm_and_si128(_mm_srli_epi16(o, (s)), m2)))
+
+	bitmap_interleave4(d,
+		QUARTETS(6), QUARTETS(4), QUARTETS(2), QUARTETS(0), FALSE);
+
+#undef QUARTETS
+}
+
+/**
+ * Reverse the bits within each byte of the vector.
+ */
+static inline __m128i __attribute__((target("ssse3")))
+bitmap_reverse_128(__m128i v)
+{
+	const __m128i m4 = _mm_set1_epi8(0x0f);
+
+	return _mm_or_si128(
+		_mm_shuffle_epi8(LOADU(bitmap_rev4_hi), _mm_and_si128(v, m4)),
+		_mm_shuffle_epi8(LOADU(bitmap_rev4),
+			_mm_and_si128(_mm_srli_epi16(v, 4), m4)));
+}
+
+static void G_HOT __attribute__((target("ssse3")))
+bitmap_or_expand_ssse3(uint8 *d, const uint8 *s, size_t len, uint ratio)
+{
+	size_t step;
+
+	if (ratio > 3) {
+		bitmap_or_fill(d, s, len, ratio);
+		return;
+	}
+
+	step = 16 << ratio;			/* Output bytes per 16 input bytes */
+
+	for (; len >= 16; s += 16, d += step, len -= 16) {
+		__m128i v = LOADU(s);
+
+		if (0 == ratio)
+			ORU(d, v);
+		else if (!bitmap_zero_128(v))
+			bitmap_expand_128(d, v, ratio);
+	}
+
+	bitmap_or_expand_portable(d, s, len, ratio);
+}
+
+static bool G_HOT __attribute__((target("ssse3")))
+bitmap_xor_ssse3(uint8 *d, const uint8 *a, const uint8 *b,
+	size_t len, bool reverse)
+{
+	__m128i acc = _mm_setzero_si128();
+	bool changed;
+
+	for (; len >= 16; a = NULL == a ? a : a + 16, b += 16, d += 16, len -= 16) {
+		__m128i x = LOADU(b);
+
+		if (a != NULL)
+			x = _mm_xor_si128(x, LOADU(a));
+
+		acc = _mm_or_si128(acc, x);
+		STOREU(d, reverse ? bitmap_reverse_128(x) : x);
+	}
+
+	changed = !bitmap_zero_128(acc);
+
+	return bitmap_xor_portable(d, a, b, len, reverse) || changed;
+}
+
+static bool G_HOT __attribute__((target("ssse3")))
+bitmap_diff4_ssse3(uint8 *d, const uint8 *o, const uint8 *n, size_t len)
+{
+	const __m128i zero = _mm_setzero_si128();
+	bool changed = FALSE;
+
+	for (; len >= 16; o = NULL == o ? o : o + 16, n += 16, d += 64, len -= 16) {
+		__m128i ov = NULL == o ? zero : LOADU(o);
+		__m128i x = _mm_xor_si128(ov, LOADU(n));
+
+		if G_LIKELY(bitmap_zero_128(x)) {
+			STOREU(d +  0, zero);
+			STOREU(d + 16, zero);
+			STOREU(d + 32, zero);
+			STOREU(d + 48, zero);
+			continue;
+		}
+
+		bitmap_diff4_128(d, x, ov);
+		changed = TRUE;
+	}
+
+	return bitmap_diff4_portable(d, o, n, len) || changed;
+}
+
+static void G_HOT __attribute__((target("avx2")))
+bitmap_or_expand_avx2(uint8 *d, const uint8 *s, size_t len, uint ratio)
+{
+	if (ratio != 0) {
+		bitmap_or_expand_ssse3(d, s, len, ratio);
+		return;
+	}
+
+	for (; len >= 32; s += 32, d += 32, len -= 32) {
+		STOREU256(d, _mm256_or_si256(LOADU256(d), LOADU256(s)));
+	}
+
+	bitmap_or_words(d, s, len);
+}
+
+static bool G_HOT __attribute__((target("avx2")))
+bitmap_xor_avx2(uint8 *d, const uint8 *a, const uint8 *b,
+	size_t len, bool reverse)
+{
+	const __m256i m4 = _mm256_set1_epi8(0x0f);
+	const __m256i rev = _mm256_broadcastsi128_si256(LOADU(bitmap_rev4));
+	const __m256i rev_hi = _mm256_broadcastsi128_si256(LOADU(bitmap_rev4_hi));
+	__m256i acc = _mm256_setzero_si256();
+	bool changed;
+
+	for (; len >= 32; a = NULL == a ? a : a + 32, b += 32, d += 32, len -= 32) {
+		__m256i x = LOADU256(b);
+
+		if (a != NULL)
+			x = _mm256_xor_si256(x, LOADU256(a));
+
+		acc = _mm256_or_si256(acc, x);
+
+		if (reverse) {
+			x = _mm256_or_si256(
+				_mm256_shuffle_epi8(rev_hi, _mm256_and_si256(x, m4)),
+				_mm256_shuffle_epi8(rev,
+					_mm256_and_si256(_mm256_srli_epi16(x, 4), m4)));
+		}
+
+		STOREU256(d, x);
+	}
+
+	changed = !_mm256_testz_si256(acc, acc);
+
+	return bitmap_xor_portable(d, a, b, len, reverse) || changed;
+}
+
+static bool G_HOT __attribute__((target("avx2")))
+bitmap_diff4_avx2(uint8 *d, const uint8 *o, const uint8 *n, size_t len)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	bool changed = FALSE;
+
+	for (; len >= 32; o = NULL == o ? o : o + 32, n += 32, d += 128, len -= 32) {
+		__m256i ov = NULL == o ? zero : LOADU256(o);
+		__m256i x = _mm256_xor_si256(ov, LOADU256(n));
+
+		if G_LIKELY(_mm256_testz_si256(x, x)) {
+			STOREU256(d +  0, zero);
+			STOREU256(d + 32, zero);
+			STOREU256(d + 64, zero);
+			STOREU256(d + 96, zero);
+			continue;
+		}
+
+		bitmap_diff4_128(d,
+			_mm256_castsi256_si128(x), _mm256_castsi256_si128(ov));
+		bitmap_diff4_128(d + 64,
+			_mm256_extracti128_si256(x, 1), _mm256_extracti128_si256(ov, 1));
+		changed = TRUE;
+	}
+
+	return bitmap_diff4_ssse3(d, o, n, len) || changed;
+}
+
+#undef LOADU
+#undef STOREU
+#undef ORU
+#undef LOADU256
+#undef STOREU256
+
+#define CPUID1_ECX_SSSE3	(1U << 9)
+#define CPUID1_ECX_OSXSAVE	(1U << 27)
+#define CPUID1_ECX_AVX		(1U << 28)
+#define CPUID7_EBX_AVX2		(1U << 5)
+#define XCR0_SSE_AVX		0x6		/* XMM and YMM states enabled */
+
+/**
+ * @return whether the CPU supports the SSSE3 instructions.
+ */
+static bool
+bitmap_cpu_has_ssse3(void)
+{
+	uint a, b, c, d;
+
+	if (!__get_cpuid(1, &a, &b, &c, &d))
+		return FALSE;
+
+	return 0 != (c & CPUID1_ECX_SSSE3);
+}
+
+/**
+ * @return whether the CPU supports the AVX2 instructions and the kernel
+ * saves the YMM registers on context switches.
+ */
+static bool
+bitmap_cpu_has_avx2(void)
+{
+	uint a, b, c, d;
+	uint32 lo, hi;
+
+	if (!__get_cpuid(1, &a, &b, &c, &d))
+		return FALSE;
+
+	if (
+		0 == (c & CPUID1_ECX_SSSE3) ||
+		0 == (c & CPUID1_ECX_OSXSAVE) ||
+		0 == (c & CPUID1_ECX_AVX) ||
+		__get_cpuid_max(0, NULL) < 7
+	)
+		return FALSE;
+
+	__asm__ __volatile__ ("xgetbv" : "=a" (lo), "=d" (hi) : "c" (0));
+	(void) hi;
+
+	if (XCR0_SSE_AVX != (lo & XCR0_SSE_AVX))
+		return FALSE;
+
+	__cpuid_count(7, 0, a, b, c, d);
+
+	return 0 != (b & CPUID7_EBX_AVX2);
+}
+#endif	/* BITMAP_X86 */
+
+/**
+ * Known bitmap kernels, by order of preference.
+ */
+static const struct bitmap_backend {
+	const char *name;			/**< Backend name */
+	void (*or_expand)(uint8 *, const uint8 *, size_t, uint);
+	bool (*xor)(uint8 *, const uint8 *, const uint8 *, size_t, bool);
+	bool (*diff4)(uint8 *, const uint8 *, const uint8 *, size_t);
+	bool (*supported)(void);	/**< Whether CPU can run it, NULL if always */
+} bitmap_backends[] = {
+#ifdef BITMAP_X86
+	{ "avx2",
+		bitmap_or_expand_avx2, bitmap_xor_avx2, bitmap_diff4_avx2,
+		bitmap_cpu_has_avx2 },
+	{ "ssse3",
+		bitmap_or_expand_ssse3, bitmap_xor_ssse3, bitmap_diff4_ssse3,
+		bitmap_cpu_has_ssse3 },
+#endif
+	{ "portable",
+		bitmap_or_expand_portable, bitmap_xor_portable, bitmap_diff4_portable,
+		NULL },
+};
+
+static const struct bitmap_backend *bitmap_backend_used;
+
+/**
+ * @return whether backend can run on this CPU.
+ */
+static bool
+bitmap_backend_supported(const struct bitmap_backend *bb)
+{
+	return NULL == bb->supported || (*bb->supported)();
+}
+
+/**
+ * Select the best backend for the CPU.
+ */
+static void
+bitmap_backend_select(void)
+{
+	uint i;
+
+	for (i = 0; i < N_ITEMS(bitmap_backends); i++) {
+		const struct bitmap_backend *bb = &bitmap_backends[i];
+
+		if (bitmap_backend_supported(bb)) {
+			bitmap_backend_used = bb;
+			break;
+		}
+	}
+
+	g_assert(bitmap_backend_used != NULL);
+}
+
+/**
+ * @return the backend to use, selecting it on first call.
+ */
+static inline const struct bitmap_backend *
+bitmap_ops(void)
+{
+	if G_UNLIKELY(NULL == bitmap_backend_used)
+		bitmap_backend_select();
+
+	return bitmap_backend_used;
+}
+
+/**
+ * OR bitmap `src' into `dst', each source bit being expanded to 2^ratio
+ * consecutive bits in the target.
+ *
+ * @param dst		the target bitmap, which must be (len << ratio) bytes long
+ * @param src		the bitmap to merge into the target
+ * @param len		length of the source bitmap, in bytes
+ * @param ratio		log2 of the expansion factor of each source bit
+ */
+void
+bitmap_or_expand(void *dst, const void *src, size_t len, uint ratio)
+{
+	g_assert(dst != NULL);
+	g_assert(src != NULL);
+	g_assert(ratio < 8 * sizeof(size_t) - 3);
+
+	(*bitmap_ops()->or_expand)(dst, src, len, ratio);
+}
+
+/**
+ * XOR two bitmaps of `len' bytes.
+ *
+ * @param dst		where the result is written
+ * @param a			first bitmap, NULL standing for a bitmap filled with 0s
+ * @param b			second bitmap
+ * @param len		length of the bitmaps, in bytes
+ * @param reverse	whether to reverse the bit order within each result byte
+ *
+ * @return whether the result has at least one bit set, i.e. whether the
+ * two bitmaps differ.
+ */
+bool
+bitmap_xor(void *dst, const void *a, const void *b, size_t len, bool reverse)
+{
+	g_assert(dst != NULL);
+	g_assert(b != NULL);
+
+	return (*bitmap_ops()->xor)(dst, a, b, len, reverse);
+}
+
+/**
+ * Expand the differences between two bitmaps of `len' bytes into signed
+ * quartets, two per result byte, the first bit going to the upper nibble.
+ *
+ * A bit turning on from `old' to `new' yields 0xf, a bit turning off
+ * yields 0x1 and an unchanged bit yields 0x0.
+ *
+ * @param dst		where the 4 * len bytes of quartets are written
+ * @param old		the old bitmap, NULL standing for a bitmap filled with 0s
+ * @param new		the new bitmap
+ * @param len		length of the bitmaps, in bytes
+ *
+ * @return whether the two bitmaps differ.
+ */
+bool
+bitmap_diff4(void *dst, const void *old, const void *new, size_t len)
+{
+	g_assert(dst != NULL);
+	g_assert(new != NULL);
+
+	return (*bitmap_ops()->diff4)(dst, old, new, len);
+}
+
+/**
+ * Count the bits set in a bitmap.
+ *
+ * @param p		the bitmap
+ * @param len	length of the bitmap, in bytes
+ *
+ * @return the amount of bits set.
+ */
+size_t
+bitmap_count(const void *p, size_t len)
+{
+	const uint8 *s = p;
+	size_t count = 0;
+
+	g_assert(p != NULL || 0 == len);
+
+	for (; len >= 4; s += 4, len -= 4) {
+		uint32 w;
+
+		memcpy(&w, s, 4);
+		count += popcount(w);
+	}
+
+	while (len-- != 0)
+		count += popcount(*s++);
+
+	return count;
+}
+
+/**
+ * Get the name of a known bitmap backend.
+ *
+ * @param i		the backend index, starting at 0
+ *
+ * @return the name of the backend, NULL if the index is out of range.
+ */
+const char *
+bitmap_backend_name(uint i)
+{
+	return i < N_ITEMS(bitmap_backends) ? bitmap_backends[i].name : NULL;
+}
+
+/**
+ * Force usage of a given bitmap backend, for testing and benchmarking.
+ *
+ * @param i		the backend index, starting at 0
+ *
+ * @return TRUE if OK, FALSE if the backend does not exist or cannot be run
+ * on this CPU.
+ */
+bool
+bitmap_backend_use(uint i)
+{
+	const struct bitmap_backend *bb;
+
+	if (i >= N_ITEMS(bitmap_backends))
+		return FALSE;
+
+	bb = &bitmap_backends[i];
+
+	if (!bitmap_backend_supported(bb))
+		return FALSE;
+
+	bitmap_backend_used = bb;
+	return TRUE;
+}
+
+/**
+ * @return the name of the bitmap backend in use, NULL if not selected yet.
+ */
+const char *
+bitmap_backend(void)
+{
+	return NULL == bitmap_backend_used ? NULL : bitmap_backend_used->name;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2026, Raphael Manfredi
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Bulk operations on large bitmaps.
+ *
+ * @author Raphael Manfredi
+ * @date 2026
+ */
+
+#ifndef _bitmap_h_
+#define _bitmap_h_
+
+/*
+ * Public interface.
+ */
+
+void bitmap_or_expand(void *dst, const void *src, size_t len, uint ratio);
+bool bitmap_xor(void *dst, const void *a, const void *b,
+	size_t len, bool reverse);
+bool bitmap_diff4(void *dst, const void *old, const void *new, size_t len);
+size_t bitmap_count(const void *p, size_t len);
+
+const char *bitmap_backend(void);
+const char *bitmap_backend_name(uint i);
+bool bitmap_backend_use(uint i);
+
+#endif /* _bitmap_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */
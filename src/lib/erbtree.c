@@ -521,6 +521,45 @@ erbtree_lookup(const erbtree_t *tree, const void *key)
 	return NULL == rn ? NULL : ptr_add_offset(rn, -tree->offset);
 }
 
+/**
+ * Look up the smallest item in the tree that does not compare below the key.
+ *
+ * When the key is present, this is the same as erbtree_lookup().  Otherwise
+ * the item immediately following the key in the tree order is returned.
+ *
+ * @param tree		the red-black tree
+ * @param key		pointer to the key structure (NOT a node)
+ *
+ * @return the ceiling item for key, NULL if all items are below the key.
+ */
+void *
+erbtree_lookup_ceil(const erbtree_t *tree, const void *key)
+{
+	rbnode_t *parent;
+	bool is_left;
+	rbnode_t *rn;
+
+	erbtree_check(tree);
+	g_assert(key != NULL);
+
+	if (erbtree_is_extended(tree)) {
+		rn = do_lookup_ext(ERBTREE_E(tree), key, &parent, &is_left);
+	} else {
+		rn = do_lookup(tree, key, &parent, &is_left);
+	}
+
+	/*
+	 * When the key is missing, it would have been inserted as a child of
+	 * "parent": if on its left, the parent follows the key, otherwise the
+	 * parent's successor does.
+	 */
+
+	if (NULL == rn && parent != NULL)
+		rn = is_left ? parent : erbtree_next(parent);
+
+	return NULL == rn ? NULL : ptr_add_offset(rn, -tree->offset);
+}
+
 /**
  * Look up key in the tree, returning the associated node pointer.
  *
@@ -106,6 +106,11 @@ typedef struct {
 #include <sys/devpoll.h>
 #endif /* HAS_DEV_POLL */
 
+#ifdef HAS_IO_URING
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif /* HAS_IO_URING */
+
 #include "inputevt.h"
 
 #include "bit_array.h"
@@ -123,6 +128,7 @@ typedef struct {
 #include "stringify.h"
 #include "thread.h"			/* For thread_in_syscall_set() */
 #include "tm.h"
+#include "vmm.h"
 #include "walloc.h"
 #include "xmalloc.h"
 
@@ -238,6 +244,11 @@ struct poll_ctx {
 	struct epoll_event *ep_arr;
 #endif	/* HAS_EPOLL */
 
+#ifdef HAS_IO_URING
+	struct uring *ur;			/**< The io_uring context, if used */
+	struct event *ur_arr;		/**< Events collected from completions */
+#endif	/* HAS_IO_URING */
+
 	struct pollfd *pfd_arr;
 
 	/**
@@ -545,6 +556,518 @@ event_check_all_with_epoll(struct poll_ctx *ctx)
 }
 #endif	/* HAS_EPOLL */
 
+#ifdef HAS_IO_URING
+/*
+ * The io_uring backend uses one-shot poll requests rather than epoll_ctl()
+ * calls.  Requests for mask changes are queued in the submission ring and
+ * sent to the kernel in a single io_uring_enter() call, either when we are
+ * about to collect events or before the main loop goes to sleep.
+ *
+ * One-shot requests are re-armed once the event they reported has been
+ * dispatched, which gives the same level-triggered semantics as poll() and
+ * epoll(): a descriptor still readable after a partial read is reported
+ * again.  Multishot requests would only fire on new activity.
+ *
+ * Each request is tagged with the descriptor and a generation number, so
+ * that completions from stale requests (cancelled, or for a descriptor
+ * number that has since been recycled) can be ignored.
+ */
+
+#define URING_SQ_ENTRIES	1024	/**< Submission ring size */
+#define URING_CQ_ENTRIES	8192	/**< Completion ring size */
+
+#define URING_IGNORE		((uint64) -1)	/**< Tag for ignored completions */
+
+/**
+ * Poll request state for a file descriptor.
+ */
+struct uring_fd {
+	uint32 gen;					/**< Generation of last poll request */
+	uint8 mask;					/**< Monitored INPUT_EVENT_RW conditions */
+	uint8 armed;				/**< Whether a poll request is pending */
+};
+
+struct uring {
+	int fd;						/**< The io_uring file descriptor */
+	void *ring;					/**< Mapped submission and completion rings */
+	size_t ring_len;			/**< Length of the ring mapping */
+	struct io_uring_sqe *sqes;	/**< Mapped submission queue entries */
+	size_t sqes_len;			/**< Length of the entries mapping */
+	uint *sq_head;
+	uint *sq_tail;
+	uint *sq_flags;
+	uint *sq_array;
+	uint sq_mask;
+	uint sq_entries;
+	uint *cq_head;
+	uint *cq_tail;
+	uint cq_mask;
+	struct io_uring_cqe *cqes;
+	uint pending;				/**< Queued entries not yet submitted */
+	uint ready;					/**< Events reported by last collection */
+	uint32 gen;					/**< Last generation number used */
+	struct uring_fd *fds;		/**< Poll state, indexed by fd */
+	uint fds_count;				/**< Length of the "fds" array */
+};
+
+#define URING_PTR(base, off)	ptr_add_offset((base), (off))
+
+static inline uint
+uring_load_acquire(const uint *p)
+{
+	return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static inline void
+uring_store_release(uint *p, uint v)
+{
+	__atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+static inline int
+uring_enter(const struct uring *ur, uint to_submit, uint flags)
+{
+	return syscall(__NR_io_uring_enter, ur->fd, to_submit, 0, flags, NULL, 0);
+}
+
+/**
+ * Submit all the queued entries.
+ *
+ * @return 0 if OK (including when the kernel cannot take them right now,
+ * in which case they remain queued), -1 on error with errno set.
+ */
+static int
+uring_submit(struct uring *ur)
+{
+	while (ur->pending != 0) {
+		int ret = uring_enter(ur, ur->pending, 0);
+
+		if (-1 == ret) {
+			if (EINTR == errno)
+				continue;
+			if (EAGAIN == errno || EBUSY == errno)
+				return 0;
+			return -1;
+		}
+
+		g_assert(UNSIGNED(ret) <= ur->pending);
+		ur->pending -= ret;
+
+		if (0 == ret)
+			break;
+	}
+
+	return 0;
+}
+
+/**
+ * @return a free submission queue entry, NULL if none is available.
+ */
+static struct io_uring_sqe *
+uring_sqe_get(struct uring *ur)
+{
+	static const struct io_uring_sqe zero_sqe;
+	struct io_uring_sqe *sqe;
+	uint tail = *ur->sq_tail;
+
+	if (tail - uring_load_acquire(ur->sq_head) >= ur->sq_entries) {
+		if (-1 == uring_submit(ur))
+			return NULL;
+		if (tail - uring_load_acquire(ur->sq_head) >= ur->sq_entries) {
+			errno = EAGAIN;
+			return NULL;
+		}
+	}
+
+	sqe = &ur->sqes[tail & ur->sq_mask];
+	*sqe = zero_sqe;
+	return sqe;
+}
+
+/**
+ * Make the last entry returned by uring_sqe_get() visible to the kernel.
+ */
+static void
+uring_sqe_commit(struct uring *ur)
+{
+	uint tail = *ur->sq_tail;
+	uint idx = tail & ur->sq_mask;
+
+	ur->sq_array[idx] = idx;
+	uring_store_release(ur->sq_tail, tail + 1);
+	ur->pending++;
+}
+
+/**
+ * @return the poll state for fd, extending the array as needed.
+ */
+static struct uring_fd *
+uring_fd_get(struct uring *ur, int fd)
+{
+	g_assert(is_valid_fd(fd));
+
+	if G_UNLIKELY(UNSIGNED(fd) >= ur->fds_count) {
+		uint n = MAX(ur->fds_count * 2, UNSIGNED(fd) + 1);
+
+		n = MAX(n, 64);
+		XREALLOC_ARRAY(ur->fds, n);
+		memset(&ur->fds[ur->fds_count], 0,
+			(n - ur->fds_count) * sizeof ur->fds[0]);
+		ur->fds_count = n;
+	}
+
+	return &ur->fds[fd];
+}
+
+static inline uint64
+uring_tag(int fd, uint32 gen)
+{
+	return ((uint64) gen << 32) | (uint32) fd;
+}
+
+static int
+uring_poll_add(struct uring *ur, int fd, struct uring_fd *uf)
+{
+	struct io_uring_sqe *sqe;
+	uint32 events = 0;
+
+	g_assert(!uf->armed);
+	g_assert(0 != uf->mask);
+
+	if (NULL == (sqe = uring_sqe_get(ur)))
+		return -1;
+
+	if (INPUT_EVENT_R & uf->mask)
+		events |= POLLIN | POLLPRI;
+	if (INPUT_EVENT_W & uf->mask)
+		events |= POLLOUT;
+
+#if IS_BIG_ENDIAN
+	events = (events << 16) | (events >> 16);	/* Word-swapped on BE */
+#endif
+
+	uf->gen = ++ur->gen;
+	uf->armed = TRUE;
+
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+	sqe->poll32_events = events;
+	sqe->user_data = uring_tag(fd, uf->gen);
+	uring_sqe_commit(ur);
+
+	return 0;
+}
+
+static int
+uring_poll_remove(struct uring *ur, int fd, struct uring_fd *uf)
+{
+	struct io_uring_sqe *sqe;
+
+	g_assert(uf->armed);
+
+	if (NULL == (sqe = uring_sqe_get(ur)))
+		return -1;
+
+	uf->armed = FALSE;
+
+	sqe->opcode = IORING_OP_POLL_REMOVE;
+	sqe->fd = -1;
+	sqe->addr = uring_tag(fd, uf->gen);
+	sqe->user_data = URING_IGNORE;
+	uring_sqe_commit(ur);
+
+	return 0;
+}
+
+/**
+ * Re-arm the poll requests of descriptors reported by the last collection,
+ * if they are still monitored.
+ */
+static void
+uring_rearm(struct poll_ctx *ctx)
+{
+	struct uring *ur = ctx->ur;
+	uint i;
+
+	g_assert(CTX_IS_LOCKED(ctx));
+
+	for (i = 0; i < ur->ready; i++) {
+		int fd = ctx->ur_arr[i].fd;
+		struct uring_fd *uf = &ur->fds[fd];
+
+		if (uf->armed || 0 == uf->mask)
+			continue;
+
+		if (-1 == uring_poll_add(ur, fd, uf)) {
+			s_warning("%s(): cannot re-arm poll for fd #%d: %m",
+				G_STRFUNC, fd);
+		}
+	}
+
+	ur->ready = 0;
+}
+
+/**
+ * Submit all the pending requests, including the re-arming of descriptors
+ * for which events were dispatched.
+ */
+static void
+uring_flush(struct poll_ctx *ctx)
+{
+	g_assert(CTX_IS_LOCKED(ctx));
+
+	uring_rearm(ctx);
+
+	if (-1 == uring_submit(ctx->ur))
+		s_warning("%s(): io_uring_enter() failed: %m", G_STRFUNC);
+}
+
+/**
+ * Convert a completion into an event.
+ *
+ * @return TRUE if the completion reports an event, FALSE if it is stale.
+ */
+static bool
+uring_cqe_event(struct uring *ur, const struct io_uring_cqe *cqe,
+	struct event *ev)
+{
+	struct uring_fd *uf;
+	uint32 fd, gen;
+
+	if (URING_IGNORE == cqe->user_data)
+		return FALSE;
+
+	fd = cqe->user_data & 0xffffffffU;
+	gen = cqe->user_data >> 32;
+
+	if (fd >= ur->fds_count)
+		return FALSE;
+
+	uf = &ur->fds[fd];
+
+	if (!uf->armed || uf->gen != gen)
+		return FALSE;			/* Removed or superseded request */
+
+	uf->armed = FALSE;
+
+	ev->fd = fd;
+	ev->data_available = 0;
+
+	if (cqe->res < 0) {
+		if (inputevt_debug) {
+			s_debug("%s(): poll on fd #%d failed: %s",
+				G_STRFUNC, fd, g_strerror(-cqe->res));
+		}
+		if (-EBADF == cqe->res)
+			uf->mask = 0;		/* Closed: do not re-arm */
+		ev->condition = INPUT_EVENT_EXCEPTION;
+	} else {
+		ev->condition =
+			((POLLIN | POLLPRI | POLLHUP) & cqe->res ? INPUT_EVENT_R : 0)
+			| (POLLOUT & cqe->res ? INPUT_EVENT_W : 0)
+			| ((POLLERR | POLLNVAL) & cqe->res ? INPUT_EVENT_EXCEPTION : 0);
+	}
+
+	return TRUE;
+}
+
+static struct event
+event_get_with_uring(const struct poll_ctx *ctx, unsigned idx)
+{
+	g_assert(CTX_IS_LOCKED(ctx));
+	g_assert(idx < ctx->num_ev);
+
+	return ctx->ur_arr[idx];
+}
+
+static int
+event_set_mask_with_uring(struct poll_ctx *ctx, int fd,
+	inputevt_cond_t old, inputevt_cond_t cur)
+{
+	struct uring *ur = ctx->ur;
+	struct uring_fd *uf;
+
+	g_assert(CTX_IS_LOCKED(ctx));
+
+	old &= INPUT_EVENT_RW;
+	cur &= INPUT_EVENT_RW;
+	if (cur == old)
+		return 0;
+
+	uf = uring_fd_get(ur, fd);
+	uf->mask = cur;
+
+	if (uf->armed && -1 == uring_poll_remove(ur, fd, uf))
+		return -1;
+
+	/*
+	 * When the descriptor is no longer monitored, submit at once: a pending
+	 * poll request holds a reference on the file, which would otherwise delay
+	 * the actual closing of the descriptor.
+	 *
+	 * Changes made from another thread are also submitted immediately since
+	 * the event loop may be sleeping.
+	 */
+
+	if (0 != cur && -1 == uring_poll_add(ur, fd, uf))
+		return -1;
+
+	if (0 == cur || thread_small_id() != inputevt_stid)
+		return uring_submit(ur);
+
+	return 0;
+}
+
+static int
+event_check_all_with_uring(struct poll_ctx *ctx)
+{
+	struct uring *ur = ctx->ur;
+	uint head, tail, n = 0;
+
+	g_assert(ctx);
+	g_assert(ctx->initialized);
+	g_assert(CTX_IS_LOCKED(ctx));
+
+	uring_flush(ctx);
+
+	/*
+	 * If completions overflowed the ring, the kernel keeps them aside
+	 * and moves them to the ring when asked to.
+	 */
+
+	if (IORING_SQ_CQ_OVERFLOW & uring_load_acquire(ur->sq_flags))
+		(void) uring_enter(ur, 0, IORING_ENTER_GETEVENTS);
+
+	head = *ur->cq_head;
+	tail = uring_load_acquire(ur->cq_tail);
+
+	while (head != tail && n < ctx->num_ev) {
+		const struct io_uring_cqe *cqe = &ur->cqes[head & ur->cq_mask];
+
+		if (uring_cqe_event(ur, cqe, &ctx->ur_arr[n]))
+			n++;
+		head++;
+	}
+
+	uring_store_release(ur->cq_head, head);
+	ur->ready = n;
+
+	return n;
+}
+
+/**
+ * Poll function for the GLib main loop, making sure all our requests are
+ * submitted before going to sleep.
+ */
+static int
+poll_func_with_uring(GPollFD *gfds, unsigned n, int timeout_ms)
+{
+	struct poll_ctx *ctx = get_global_poll_ctx();
+
+	CTX_LOCK(ctx);
+	if (ctx->ur != NULL)
+		uring_flush(ctx);
+	CTX_UNLOCK(ctx);
+
+	return default_poll_func(gfds, n, timeout_ms);
+}
+
+static void
+uring_free(struct uring *ur)
+{
+	if (ur->sqes != NULL)
+		vmm_munmap(ur->sqes, ur->sqes_len);
+	if (ur->ring != NULL)
+		vmm_munmap(ur->ring, ur->ring_len);
+	fd_close(&ur->fd);
+	XFREE_NULL(ur->fds);
+	WFREE(ur);
+}
+
+/**
+ * Create the io_uring rings.
+ *
+ * @return the new context, NULL on error with errno set.
+ */
+static struct uring *
+uring_new(void)
+{
+	struct io_uring_params params;
+	struct uring *ur;
+	size_t sq_len, cq_len;
+	void *p;
+
+	ZERO(&params);
+	params.flags = IORING_SETUP_CQSIZE;
+	params.cq_entries = URING_CQ_ENTRIES;
+
+	WALLOC0(ur);
+	ur->fd = syscall(__NR_io_uring_setup, URING_SQ_ENTRIES, &params);
+
+	if (!is_valid_fd(ur->fd)) {
+		s_warning("%s(): io_uring_setup() failed: %m", G_STRFUNC);
+		goto failed;
+	}
+
+	/*
+	 * We need the rings to be mappable at once (Linux 5.4) and completions
+	 * to never be dropped when the ring is full (Linux 5.5).
+	 */
+
+	if (
+		0 == (IORING_FEAT_SINGLE_MMAP & params.features) ||
+		0 == (IORING_FEAT_NODROP & params.features)
+	) {
+		s_warning("%s(): io_uring lacks required features", G_STRFUNC);
+		errno = ENOTSUP;
+		goto failed;
+	}
+
+	sq_len = params.sq_off.array + params.sq_entries * sizeof(uint);
+	cq_len = params.cq_off.cqes +
+		params.cq_entries * sizeof(struct io_uring_cqe);
+	ur->ring_len = MAX(sq_len, cq_len);
+
+	p = vmm_mmap(NULL, ur->ring_len, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ur->fd, IORING_OFF_SQ_RING);
+	if (MAP_FAILED == p) {
+		s_warning("%s(): cannot map rings: %m", G_STRFUNC);
+		goto failed;
+	}
+	ur->ring = p;
+
+	ur->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+	p = vmm_mmap(NULL, ur->sqes_len, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ur->fd, IORING_OFF_SQES);
+	if (MAP_FAILED == p) {
+		s_warning("%s(): cannot map submission entries: %m", G_STRFUNC);
+		goto failed;
+	}
+	ur->sqes = p;
+
+	ur->sq_head    = URING_PTR(ur->ring, params.sq_off.head);
+	ur->sq_tail    = URING_PTR(ur->ring, params.sq_off.tail);
+	ur->sq_flags   = URING_PTR(ur->ring, params.sq_off.flags);
+	ur->sq_array   = URING_PTR(ur->ring, params.sq_off.array);
+	ur->sq_mask    = *(uint *) URING_PTR(ur->ring, params.sq_off.ring_mask);
+	ur->sq_entries = params.sq_entries;
+	ur->cq_head    = URING_PTR(ur->ring, params.cq_off.head);
+	ur->cq_tail    = URING_PTR(ur->ring, params.cq_off.tail);
+	ur->cq_mask    = *(uint *) URING_PTR(ur->ring, params.cq_off.ring_mask);
+	ur->cqes       = URING_PTR(ur->ring, params.cq_off.cqes);
+
+	return ur;
+
+failed:
+	{
+		int saved_errno = errno;
+		uring_free(ur);
+		errno = saved_errno;
+	}
+	return NULL;
+}
+#endif	/* HAS_IO_URING */
+
 #ifdef HAS_DEV_POLL
 static int
 event_set_mask_with_dev_poll(struct poll_ctx *ctx, int fd,
@@ -1320,6 +1843,10 @@ inputevt_add_source(struct poll_ctx *ctx, inputevt_relay_t *relay, uint id)
 		XREALLOC_ARRAY(ctx->ep_arr, ctx->num_ev);
 #endif
 
+#ifdef HAS_IO_URING
+		XREALLOC_ARRAY(ctx->ur_arr, ctx->num_ev);
+#endif
+
 		XREALLOC_ARRAY(ctx->pfd_arr, ctx->num_ev);
 
 		for (i = n; i < ctx->num_ev; i++) {
@@ -1531,6 +2058,35 @@ init_with_epoll(struct poll_ctx *ctx)
 }
 #endif	/* HAS_EPOLL */
 
+static int
+init_with_uring(struct poll_ctx *ctx)
+#ifdef HAS_IO_URING
+{
+	struct uring *ur = uring_new();
+
+	if (NULL == ur)
+		return -1;
+
+	g_assert(CTX_IS_LOCKED(ctx));
+
+	g_main_context_set_poll_func(NULL, poll_func_with_uring);
+	ctx->ur = ur;
+	ctx->master_fd = ur->fd;
+	ctx->polling_method = "io_uring";
+	ctx->collect_events = NULL; /* master fd can be polled */
+	ctx->event_check_all = event_check_all_with_uring;
+	ctx->event_get = event_get_with_uring;
+	ctx->event_set_mask = event_set_mask_with_uring;
+	return 0;
+}
+#else
+{
+	(void) ctx;
+	errno = ENOTSUP;
+	return -1;
+}
+#endif	/* HAS_IO_URING */
+
 static int
 init_with_poll(struct poll_ctx *ctx)
 {
@@ -1596,7 +2152,7 @@ inputevt_init(int use_poll)
 
 	if (!use_poll) {
 		if (init_with_kqueue(ctx)) {
-			if (init_with_epoll(ctx)) {
+			if (init_with_uring(ctx) && init_with_epoll(ctx)) {
 				init_with_devpoll(ctx);
 			}
 		}
@@ -1759,6 +2315,14 @@ inputevt_close(void)
 	G_FREE_NULL(ctx->used_event_id);
 	XFREE_NULL(ctx->relay);
 	XFREE_NULL(ctx->pfd_arr);
+#ifdef HAS_IO_URING
+	if (ctx->ur != NULL) {
+		ctx->master_fd = -1;	/* Closed by uring_free() */
+		uring_free(ctx->ur);
+		ctx->ur = NULL;
+	}
+	XFREE_NULL(ctx->ur_arr);
+#endif
 	fd_close(&ctx->master_fd);
 	ctx->initialized = FALSE;
 
@@ -0,0 +1,281 @@
+/*
+ * sha1-test -- SHA1 backend tests and benchmarking.
+ *
+ * Copyright (c) 2026 Raphael Manfredi <Raphael_Manfredi@pobox.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the authors nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "common.h"
+
+#include "lib/base16.h"
+#include "lib/misc.h"
+#include "lib/progname.h"
+#include "lib/rand31.h"
+#include "lib/sha1.h"
+#include "lib/tm.h"
+#include "lib/xmalloc.h"
+
+#define TEST_LOOPS		64
+#define TEST_MAXLEN		4096
+
+#define BENCH_SIZE		(64 * 1024 * 1024)	/* Default benchmark size */
+#define BENCH_CHUNK		(64 * 1024)			/* Bytes per SHA1_input() call */
+
+static bool silent_mode, verbose_mode;
+
+/*
+ * Test vectors from RFC 3174.
+ */
+static const struct {
+	const char *input;
+	size_t repeat;
+	const char *digest;
+} vectors[] = {
+	{ "abc", 1,
+		"a9993e364706816aba3e25717850c26c9cd0d89d" },
+	{ "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", 1,
+		"84983e441c3bd26ebaae4aa1f95129e5e54670f1" },
+	{ "a", 1000000,
+		"34aa973cd4c4daa4f61eeb2bdbad27316534016f" },
+	{ "0123456701234567012345670123456701234567012345670123456701234567", 10,
+		"dea356a2cddd90c7a7ecedc5ebb563934f460452" },
+};
+
+static void G_NORETURN
+usage(void)
+{
+	fprintf(stderr,
+		"Usage: %s [-hbSV] [-n loops] [-s size] [-R seed]\n"
+		"  -b : benchmark each backend\n"
+		"  -h : prints this help message\n"
+		"  -n : sets amount of random loops\n"
+		"  -s : sets benchmark size, in bytes\n"
+		"  -R : seed for repeatable random data\n"
+		"  -S : silent mode -- do not print anything for successful tests\n"
+		"  -V : verbose mode -- print status after each successful test\n"
+		, getprogname());
+	exit(EXIT_FAILURE);
+}
+
+static void
+digest_of(struct sha1 *digest, const void *data, size_t len, size_t repeat)
+{
+	SHA1_context ctx;
+
+	SHA1_reset(&ctx);
+	while (repeat-- != 0)
+		SHA1_input(&ctx, data, len);
+	SHA1_result(&ctx, digest);
+}
+
+/*
+ * Compute digest by feeding the data in randomly-sized pieces, to exercise
+ * both the buffered path and the multi-block fast path.
+ */
+static void
+digest_split(struct sha1 *digest, const void *data, size_t len)
+{
+	SHA1_context ctx;
+	const char *p = data;
+
+	SHA1_reset(&ctx);
+	while (len != 0) {
+		size_t n = 1 + rand31_value(len - 1);
+
+		SHA1_input(&ctx, p, n);
+		p += n;
+		len -= n;
+	}
+	SHA1_result(&ctx, digest);
+}
+
+static void
+test_vectors(const char *name)
+{
+	uint i;
+
+	for (i = 0; i < N_ITEMS(vectors); i++) {
+		struct sha1 digest;
+		const char *hex;
+
+		digest_of(&digest, vectors[i].input,
+			strlen(vectors[i].input), vectors[i].repeat);
+
+		hex = sha1_base16(&digest);
+
+		if (0 != strcmp(hex, vectors[i].digest)) {
+			printf("%s: vector #%u FAILED\n", name, i);
+			printf("got      %s\n", hex);
+			printf("expected %s\n", vectors[i].digest);
+			exit(EXIT_FAILURE);
+		}
+
+		if (verbose_mode)
+			printf("%s: vector #%u OK\n", name, i);
+	}
+}
+
+static void
+test_random(const char *name, uint portable, uint idx, size_t loops)
+{
+	char *buf;
+	size_t i;
+
+	buf = xmalloc(TEST_MAXLEN + 1);
+
+	for (i = 0; i < loops; i++) {
+		size_t len = rand31_value(TEST_MAXLEN);
+		size_t offset = rand31_value(1);		/* Unaligned input */
+		struct sha1 expected, got;
+
+		rand31_bytes(buf, TEST_MAXLEN + 1);
+
+		SHA1_backend_use(portable);
+		digest_of(&expected, buf + offset, len, 1);
+		SHA1_backend_use(idx);
+		digest_split(&got, buf + offset, len);
+
+		if (0 != memcmp(&expected, &got, sizeof got)) {
+			printf("%s: random data of %zu bytes at offset %zu FAILED\n",
+				name, len, offset);
+			printf("use '-R %u' to reproduce problem.\n",
+				rand31_initial_seed());
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (verbose_mode)
+		printf("%s: %zu random messages OK\n", name, loops);
+
+	xfree(buf);
+}
+
+static void
+benchmark(const char *name, size_t size)
+{
+	SHA1_context ctx;
+	struct sha1 digest;
+	char *buf;
+	size_t done;
+	tm_t start, end;
+	double elapsed;
+
+	buf = xmalloc(BENCH_CHUNK);
+	rand31_bytes(buf, BENCH_CHUNK);
+
+	tm_now_exact(&start);
+	SHA1_reset(&ctx);
+	for (done = 0; done < size; done += BENCH_CHUNK) {
+		SHA1_input(&ctx, buf, MIN(BENCH_CHUNK, size - done));
+	}
+	SHA1_result(&ctx, &digest);
+	tm_now_exact(&end);
+
+	elapsed = tm_elapsed_f(&end, &start);
+	printf("%-10s %8.1f MB/s\n", name,
+		elapsed > 0.0 ? size / elapsed / (1024.0 * 1024.0) : 0.0);
+
+	xfree(buf);
+}
+
+int
+main(int argc, char **argv)
+{
+	extern int optind;
+	extern char *optarg;
+	bool bflag = FALSE;
+	size_t loops = TEST_LOOPS;
+	size_t size = BENCH_SIZE;
+	uint i, portable = 0;
+	unsigned rseed = 0;
+	const char *name;
+	int c;
+	const char options[] = "bhn:s:R:SV";
+
+	progstart(argc, argv);
+
+	while ((c = getopt(argc, argv, options)) != EOF) {
+		switch (c) {
+		case 'b':			/* benchmark */
+			bflag = TRUE;
+			break;
+		case 'n':			/* amount of loops */
+			loops = atol(optarg);
+			break;
+		case 's':			/* benchmark size */
+			size = atol(optarg);
+			break;
+		case 'R':			/* randomize in a repeatable way */
+			rseed = atoi(optarg);
+			break;
+		case 'S':			/* silent mode */
+			silent_mode = TRUE;
+			break;
+		case 'V':			/* verbose mode */
+			verbose_mode = TRUE;
+			break;
+		case 'h':			/* show help */
+		default:
+			usage();
+			break;
+		}
+	}
+
+	if ((argc -= optind) != 0)
+		usage();
+
+	rand31_set_seed(rseed);
+
+	for (i = 0; NULL != (name = SHA1_backend_name(i)); i++) {
+		if (0 == strcmp(name, "portable"))
+			portable = i;
+	}
+
+	for (i = 0; NULL != (name = SHA1_backend_name(i)); i++) {
+		if (!SHA1_backend_use(i)) {
+			if (!silent_mode)
+				printf("%s: not supported by this CPU, skipped\n", name);
+			continue;
+		}
+
+		test_vectors(name);
+		test_random(name, portable, i, loops);
+
+		if (!silent_mode)
+			printf("%s: OK\n", name);
+	}
+
+	if (bflag) {
+		for (i = 0; NULL != (name = SHA1_backend_name(i)); i++) {
+			if (SHA1_backend_use(i))
+				benchmark(name, size);
+		}
+	}
+
+	return 0;
+}
@@ -68,6 +68,23 @@
 #include "endian.h"
 #include "sha1.h"
 #include "misc.h"			/* For RCSID */
+#include "once.h"
+
+/*
+ * On x86, the compression function can use the SHA extensions or SSSE3
+ * instructions when the CPU supports them.  The proper implementation is
+ * selected once at runtime, before the first message digest is computed.
+ */
+#if (HAS_GCC(4, 9) || defined(__clang__)) && \
+	(defined(__x86_64__) || defined(__i386__))
+#define SHA1_X86
+#endif
+
+#ifdef SHA1_X86
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
 #include "override.h"		/* Must be the last header included */
 
 #define SHA1_BLEN	64		/**< Message block length */
@@ -76,6 +93,17 @@
 static void SHA1_pad_message(SHA1_context *);
 static void SHA1_process_message_block(SHA1_context *, const void *mblock);
 
+/**
+ * A compression routine processes `blocks' consecutive 64-byte message
+ * blocks, updating the intermediate message digest `ihash'.
+ */
+typedef void (*SHA1_compress_t)(uint32 *ihash, const void *data, size_t blocks);
+
+static void SHA1_init_once(void);
+
+static SHA1_compress_t SHA1_compress;
+static once_flag_t SHA1_inited;
+
 /**
  *  SHA1_reset
  *
@@ -103,6 +131,8 @@ SHA1_reset(SHA1_context *context)
 	 */
 	STATIC_ASSERT(0 == offsetof(struct SHA1_context, mblock) % 4);
 
+	ONCE_FLAG_RUN(SHA1_inited, SHA1_init_once);
+
 	ZERO(context);
 
 	context->magic     = SHA1_CONTEXT_MAGIC;
@@ -252,16 +282,20 @@ SHA1_input(SHA1_context *context, const void *data, size_t length)
 		goto slowpath;
 
 fastpath:
-	for (/**/; length >= SHA1_BLEN; mp += SHA1_BLEN, length -= SHA1_BLEN) {
-		context->length += 8 * SHA1_BLEN;		/* Counts bits, not bytes */
+	if (length >= SHA1_BLEN) {
+		size_t blocks = length / SHA1_BLEN;
+		uint64 bits = context->length + (uint64) blocks * 8 * SHA1_BLEN;
 
-		if G_UNLIKELY(context->length < 8 * SHA1_BLEN) {
+		if G_UNLIKELY(bits < context->length) {
 			/* Message is too long */
 			context->corrupted = SHA_INPUT_TOO_LONG;
 			return SHA_INPUT_TOO_LONG;
 		}
 
-		SHA1_process_message_block(context, mp);
+		context->length = bits;		/* Counts bits, not bytes */
+		(*SHA1_compress)(context->ihash, mp, blocks);
+		mp += blocks * SHA1_BLEN;
+		length -= blocks * SHA1_BLEN;
 	}
 
 	/* FALL THROUGH */
@@ -291,16 +325,58 @@ slowpath:
 	return SHA_SUCCESS;
 }
 
+static const uint32 SHA1_K[] = {	/* Constants defined in SHA-1 */
+	0x5A827999,
+	0x6ED9EBA1,
+	0x8F1BBCDC,
+	0xCA62C1D6
+};
+
+/*
+ * Optimizing "(B & C) | (~B & D)" into "D ^ (B & (C ^ D))" in M0
+ * Optimizing "(B & C) | (B & D)" into "B & (C | D)" in M2
+ */
+#define M0(B, C, D)		(D ^ (B & (C ^ D)))
+#define M1(B, C, D)		(B ^ C ^ D)
+#define M2(B, C, D)		((B & (C | D)) | (C & D))
+#define M3(B, C, D)		(B ^ C ^ D)
+
+/*
+ * Another optimization: get rid of the temporary variable to circulate
+ * the value.  Instead, we rotate the macro arguments, saving one
+ * assignment per ROTATE() macro.
+ *		--RAM, 2015-03-13
+ *
+ * The ROTATE() macro is supplied by the caller, to let it control how the
+ * round constant is added.
+ */
+#define ROTATE5(k, mix) \
+	ROTATE(k, a, b, c, d, e, mix); \
+	ROTATE(k, e, a, b, c, d, mix); \
+	ROTATE(k, d, e, a, b, c, mix); \
+	ROTATE(k, c, d, e, a, b, mix); \
+	ROTATE(k, b, c, d, e, a, mix);
+
+#define ROUNDS20(k, mix) \
+	ROTATE5(k, mix) ROTATE5(k, mix) ROTATE5(k, mix) ROTATE5(k, mix)
+
+#define ROUNDS80 \
+	ROUNDS20(0, M0) ROUNDS20(1, M1) ROUNDS20(2, M2) ROUNDS20(3, M3)
+
 /**
- *  SHA1_process_message_block
+ *  SHA1_compress_portable
  *
  *  Description:
- *      This function will process the next 512 bits of the message
+ *      This function will process the next 512-bit blocks of the message
  *      stored in the mblock parameter.
  *
  *  Parameters:
+ *      ihash: [in/out]
+ *          The intermediate message digest
  *      mblock: [in]
- *          Start of the next 64 message bytes to process
+ *          Start of the next message blocks to process
+ *      blocks: [in]
+ *          Amount of 64-byte blocks to process
  *
  *  Returns:
  *      Nothing.
@@ -311,190 +387,414 @@ slowpath:
  *      names used in the publication.
  */
 static void G_HOT
-SHA1_process_message_block(SHA1_context *context, const void *mblock)
+SHA1_compress_portable(uint32 *ihash, const void *mblock, size_t blocks)
 {
-	const uint32 K[] = {       /* Constants defined in SHA-1 */
-		0x5A827999,
-		0x6ED9EBA1,
-		0x8F1BBCDC,
-		0xCA62C1D6
-	};
+	const uint32 *K = SHA1_K;
 	int    t;                 /* Loop counter              */
 	uint32 W[80];             /* Word sequence             */
 	uint32 a, b, c, d, e;     /* Word buffers              */
 	uint32 *wp;               /* Pointer in word sequence  */
+	const uint32 *mp = mblock;
 
 	/*
 	 *  Initialize the first 16 words in the array W
 	 */
 
 #ifdef IS_LITTLE_ENDIAN
-#define INIT(x)			W[x] = UINT32_SWAP(*wp); wp++
+#define INIT(x)			W[x] = UINT32_SWAP(*mp); mp++
 #else
-#define INIT(x)			W[x] = *wp++
+#define INIT(x)			W[x] = *mp++
 #endif
 
-	wp = (uint32 *) mblock;
-
-	/* Unrolling this loop saves time */
-	INIT(0);  INIT(1);  INIT(2);  INIT(3);
-	INIT(4);  INIT(5);  INIT(6);  INIT(7);
-	INIT(8);  INIT(9);  INIT(10); INIT(11);
-	INIT(12); INIT(13); INIT(14); INIT(15);
-
 #define CRUNCH \
 	*wp = UINT32_ROTL(wp[-3] ^ wp[-8] ^ wp[-14] ^ wp[-16], 1)
 
-	wp = &W[16];
-	CRUNCH; wp++;		/* 16 */
-	CRUNCH; wp++;		/* 17 */
-	CRUNCH; wp++;		/* 18 */
-	CRUNCH; wp++;		/* 19 */
-
-	/* Fully unrolling this loop does NOT save time due to I-cache misses */
-	for (t = 20; t < 80; t += 10) {
-		CRUNCH; wp++;		/* t+0 */
-		CRUNCH; wp++;		/* t+1 */
-		CRUNCH; wp++;		/* t+2 */
-		CRUNCH; wp++;		/* t+3 */
-		CRUNCH; wp++;		/* t+4 */
-		CRUNCH; wp++;		/* t+5 */
-		CRUNCH; wp++;		/* t+6 */
-		CRUNCH; wp++;		/* t+7 */
-		CRUNCH; wp++;		/* t+8 */
-		CRUNCH; wp++;		/* t+9 */
+#define ROTATE(k, A, B, C, D, E, mix) \
+	E += UINT32_ROTL(A, 5) + mix(B, C, D) + *wp++ + K[k]; \
+	B = UINT32_ROTL(B, 30);
+
+	while (blocks-- != 0) {
+		/* Unrolling this loop saves time */
+		INIT(0);  INIT(1);  INIT(2);  INIT(3);
+		INIT(4);  INIT(5);  INIT(6);  INIT(7);
+		INIT(8);  INIT(9);  INIT(10); INIT(11);
+		INIT(12); INIT(13); INIT(14); INIT(15);
+
+		wp = &W[16];
+		CRUNCH; wp++;		/* 16 */
+		CRUNCH; wp++;		/* 17 */
+		CRUNCH; wp++;		/* 18 */
+		CRUNCH; wp++;		/* 19 */
+
+		/* Fully unrolling this loop does NOT save time due to I-cache misses */
+		for (t = 20; t < 80; t += 10) {
+			CRUNCH; wp++;		/* t+0 */
+			CRUNCH; wp++;		/* t+1 */
+			CRUNCH; wp++;		/* t+2 */
+			CRUNCH; wp++;		/* t+3 */
+			CRUNCH; wp++;		/* t+4 */
+			CRUNCH; wp++;		/* t+5 */
+			CRUNCH; wp++;		/* t+6 */
+			CRUNCH; wp++;		/* t+7 */
+			CRUNCH; wp++;		/* t+8 */
+			CRUNCH; wp++;		/* t+9 */
+		}
+
+		a = ihash[0];
+		b = ihash[1];
+		c = ihash[2];
+		d = ihash[3];
+		e = ihash[4];
+
+		wp = &W[0];
+
+		ROUNDS80
+
+		ihash[0] += a;
+		ihash[1] += b;
+		ihash[2] += c;
+		ihash[3] += d;
+		ihash[4] += e;
 	}
 
-	a = context->ihash[0];
-	b = context->ihash[1];
-	c = context->ihash[2];
-	d = context->ihash[3];
-	e = context->ihash[4];
+#undef INIT
+#undef CRUNCH
+#undef ROTATE
+}
 
-	wp = &W[0];
+#ifdef SHA1_X86
+/**
+ * Compression routine computing the message schedule with SSSE3, four
+ * words at a time, the rounds being computed with regular instructions.
+ */
+static void G_HOT __attribute__((target("ssse3")))
+SHA1_compress_ssse3(uint32 *ihash, const void *mblock, size_t blocks)
+{
+	const __m128i bswap =
+		_mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+	uint32 W[80];             /* Word sequence */
+	uint32 WK[80];            /* Word sequence, plus round constant */
+	uint32 a, b, c, d, e;
+	const uint32 *wp;
+	const uint8 *mp = mblock;
+	int t;
+
+#define LOADU(p)	_mm_loadu_si128((const __m128i *) (p))
+#define STOREU(p,v)	_mm_storeu_si128((__m128i *) (p), (v))
+#define ROTL1(v)	_mm_or_si128(_mm_slli_epi32((v), 1), _mm_srli_epi32((v), 31))
 
 #define ROTATE(k, A, B, C, D, E, mix) \
-	E += UINT32_ROTL(A, 5) + mix(B, C, D) + *wp++ + K[k]; \
+	E += UINT32_ROTL(A, 5) + mix(B, C, D) + *wp++; \
 	B = UINT32_ROTL(B, 30);
 
-	/*
-	 * Optimizing "(B & C) | (~B & D)" into "D ^ (B & (C ^ D))" in M0
-	 * Optimizing "(B & C) | (B & D)" into "B & (C | D)" in M2
-	 */
-#define M0(B, C, D)		(D ^ (B & (C ^ D)))
-#define M1(B, C, D)		(B ^ C ^ D)
-#define M2(B, C, D)		((B & (C | D)) | (C & D))
-#define M3(B, C, D)		(B ^ C ^ D)
+	while (blocks-- != 0) {
+		for (t = 0; t < 16; t += 4) {
+			__m128i w = _mm_shuffle_epi8(LOADU(&mp[4 * t]), bswap);
 
-	/*
-	 * Another optimization: get rid of the temporary variable to circulate
-	 * the value.  Instead, we rotate the macro arguments, saving one
-	 * assignment per ROTATE() macro.
-	 *		--RAM, 2015-03-13
-	 */
+			STOREU(&W[t], w);
+			STOREU(&WK[t], _mm_add_epi32(w, _mm_set1_epi32(SHA1_K[0])));
+		}
+
+		/*
+		 * W[t+3] depends on W[t], which is computed in the same vector:
+		 * we compute it with W[t] taken as 0, then fix the last lane by
+		 * XOR-ing in ROTL1(W[t]), since rotation distributes over XOR.
+		 */
+
+		for (t = 16; t < 80; t += 4) {
+			__m128i w3 = _mm_srli_si128(LOADU(&W[t - 4]), 4);
+			__m128i w, r;
+
+			w = _mm_xor_si128(w3, LOADU(&W[t - 8]));
+			w = _mm_xor_si128(w, LOADU(&W[t - 14]));
+			w = _mm_xor_si128(w, LOADU(&W[t - 16]));
+			w = ROTL1(w);
+			r = _mm_slli_si128(w, 12);
+			w = _mm_xor_si128(w, ROTL1(r));
+
+			STOREU(&W[t], w);
+			STOREU(&WK[t], _mm_add_epi32(w, _mm_set1_epi32(SHA1_K[t / 20])));
+		}
+
+		a = ihash[0];
+		b = ihash[1];
+		c = ihash[2];
+		d = ihash[3];
+		e = ihash[4];
+
+		wp = &WK[0];
+
+		ROUNDS80
+
+		ihash[0] += a;
+		ihash[1] += b;
+		ihash[2] += c;
+		ihash[3] += d;
+		ihash[4] += e;
+
+		mp += SHA1_BLEN;
+	}
+
+#undef ROTATE
+#undef ROTL1
+}
+
+/*
+ * Four rounds with the SHA extensions, also advancing the message schedule.
+ */
+#define SHA1_NI_ROUNDS(E0, E1, MSG0, MSG1, MSG2, MSG3, f) \
+	E0 = _mm_sha1nexte_epu32(E0, MSG0); \
+	E1 = abcd; \
+	MSG1 = _mm_sha1msg2_epu32(MSG1, MSG0); \
+	abcd = _mm_sha1rnds4_epu32(abcd, E0, f); \
+	MSG3 = _mm_sha1msg1_epu32(MSG3, MSG0); \
+	MSG2 = _mm_xor_si128(MSG2, MSG0);
+
+/**
+ * Compression routine using the SHA extensions.
+ */
+static void G_HOT __attribute__((target("sha,sse4.1,ssse3")))
+SHA1_compress_shani(uint32 *ihash, const void *mblock, size_t blocks)
+{
+	const __m128i bswap =
+		_mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+	__m128i abcd, abcd_save, e0, e0_save, e1;
+	__m128i m0, m1, m2, m3;
+	const uint8 *mp = mblock;
+
+	abcd = _mm_shuffle_epi32(LOADU(ihash), 0x1B);
+	e0 = _mm_set_epi32(ihash[4], 0, 0, 0);
+
+	while (blocks-- != 0) {
+		abcd_save = abcd;
+		e0_save = e0;
+
+		/* Rounds 0-3 */
+		m0 = _mm_shuffle_epi8(LOADU(&mp[0]), bswap);
+		e0 = _mm_add_epi32(e0, m0);
+		e1 = abcd;
+		abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+
+		/* Rounds 4-7 */
+		m1 = _mm_shuffle_epi8(LOADU(&mp[16]), bswap);
+		e1 = _mm_sha1nexte_epu32(e1, m1);
+		e0 = abcd;
+		abcd = _mm_sha1rnds4_epu32(abcd, e1, 0);
+		m0 = _mm_sha1msg1_epu32(m0, m1);
+
+		/* Rounds 8-11 */
+		m2 = _mm_shuffle_epi8(LOADU(&mp[32]), bswap);
+		e0 = _mm_sha1nexte_epu32(e0, m2);
+		e1 = abcd;
+		abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+		m1 = _mm_sha1msg1_epu32(m1, m2);
+		m0 = _mm_xor_si128(m0, m2);
+
+		/* Rounds 12-15 */
+		m3 = _mm_shuffle_epi8(LOADU(&mp[48]), bswap);
+		e1 = _mm_sha1nexte_epu32(e1, m3);
+		e0 = abcd;
+		m0 = _mm_sha1msg2_epu32(m0, m3);
+		abcd = _mm_sha1rnds4_epu32(abcd, e1, 0);
+		m2 = _mm_sha1msg1_epu32(m2, m3);
+		m1 = _mm_xor_si128(m1, m3);
+
+		/* Rounds 16-67 */
+		SHA1_NI_ROUNDS(e0, e1, m0, m1, m2, m3, 0)
+		SHA1_NI_ROUNDS(e1, e0, m1, m2, m3, m0, 1)
+		SHA1_NI_ROUNDS(e0, e1, m2, m3, m0, m1, 1)
+		SHA1_NI_ROUNDS(e1, e0, m3, m0, m1, m2, 1)
+		SHA1_NI_ROUNDS(e0, e1, m0, m1, m2, m3, 1)
+		SHA1_NI_ROUNDS(e1, e0, m1, m2, m3, m0, 1)
+		SHA1_NI_ROUNDS(e0, e1, m2, m3, m0, m1, 2)
+		SHA1_NI_ROUNDS(e1, e0, m3, m0, m1, m2, 2)
+		SHA1_NI_ROUNDS(e0, e1, m0, m1, m2, m3, 2)
+		SHA1_NI_ROUNDS(e1, e0, m1, m2, m3, m0, 2)
+		SHA1_NI_ROUNDS(e0, e1, m2, m3, m0, m1, 2)
+		SHA1_NI_ROUNDS(e1, e0, m3, m0, m1, m2, 3)
+		SHA1_NI_ROUNDS(e0, e1, m0, m1, m2, m3, 3)
+
+		/* Rounds 68-71 */
+		e1 = _mm_sha1nexte_epu32(e1, m1);
+		e0 = abcd;
+		m2 = _mm_sha1msg2_epu32(m2, m1);
+		abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+		m3 = _mm_xor_si128(m3, m1);
+
+		/* Rounds 72-75 */
+		e0 = _mm_sha1nexte_epu32(e0, m2);
+		e1 = abcd;
+		m3 = _mm_sha1msg2_epu32(m3, m2);
+		abcd = _mm_sha1rnds4_epu32(abcd, e0, 3);
+
+		/* Rounds 76-79 */
+		e1 = _mm_sha1nexte_epu32(e1, m3);
+		e0 = abcd;
+		abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+
+		/* Add the intermediate state */
+		e0 = _mm_sha1nexte_epu32(e0, e0_save);
+		abcd = _mm_add_epi32(abcd, abcd_save);
+
+		mp += SHA1_BLEN;
+	}
 
-	ROTATE(0, a, b, c, d, e, M0);
-	ROTATE(0, e, a, b, c, d, M0);
-	ROTATE(0, d, e, a, b, c, M0);
-	ROTATE(0, c, d, e, a, b, M0);
-	ROTATE(0, b, c, d, e, a, M0);
-
-	ROTATE(0, a, b, c, d, e, M0);
-	ROTATE(0, e, a, b, c, d, M0);
-	ROTATE(0, d, e, a, b, c, M0);
-	ROTATE(0, c, d, e, a, b, M0);
-	ROTATE(0, b, c, d, e, a, M0);
-
-	ROTATE(0, a, b, c, d, e, M0);
-	ROTATE(0, e, a, b, c, d, M0);
-	ROTATE(0, d, e, a, b, c, M0);
-	ROTATE(0, c, d, e, a, b, M0);
-	ROTATE(0, b, c, d, e, a, M0);
-
-	ROTATE(0, a, b, c, d, e, M0);
-	ROTATE(0, e, a, b, c, d, M0);
-	ROTATE(0, d, e, a, b, c, M0);
-	ROTATE(0, c, d, e, a, b, M0);
-	ROTATE(0, b, c, d, e, a, M0);
-
-	ROTATE(1, a, b, c, d, e, M1);
-	ROTATE(1, e, a, b, c, d, M1);
-	ROTATE(1, d, e, a, b, c, M1);
-	ROTATE(1, c, d, e, a, b, M1);
-	ROTATE(1, b, c, d, e, a, M1);
-
-	ROTATE(1, a, b, c, d, e, M1);
-	ROTATE(1, e, a, b, c, d, M1);
-	ROTATE(1, d, e, a, b, c, M1);
-	ROTATE(1, c, d, e, a, b, M1);
-	ROTATE(1, b, c, d, e, a, M1);
-
-	ROTATE(1, a, b, c, d, e, M1);
-	ROTATE(1, e, a, b, c, d, M1);
-	ROTATE(1, d, e, a, b, c, M1);
-	ROTATE(1, c, d, e, a, b, M1);
-	ROTATE(1, b, c, d, e, a, M1);
-
-	ROTATE(1, a, b, c, d, e, M1);
-	ROTATE(1, e, a, b, c, d, M1);
-	ROTATE(1, d, e, a, b, c, M1);
-	ROTATE(1, c, d, e, a, b, M1);
-	ROTATE(1, b, c, d, e, a, M1);
-
-	ROTATE(2, a, b, c, d, e, M2);
-	ROTATE(2, e, a, b, c, d, M2);
-	ROTATE(2, d, e, a, b, c, M2);
-	ROTATE(2, c, d, e, a, b, M2);
-	ROTATE(2, b, c, d, e, a, M2);
-
-	ROTATE(2, a, b, c, d, e, M2);
-	ROTATE(2, e, a, b, c, d, M2);
-	ROTATE(2, d, e, a, b, c, M2);
-	ROTATE(2, c, d, e, a, b, M2);
-	ROTATE(2, b, c, d, e, a, M2);
-
-	ROTATE(2, a, b, c, d, e, M2);
-	ROTATE(2, e, a, b, c, d, M2);
-	ROTATE(2, d, e, a, b, c, M2);
-	ROTATE(2, c, d, e, a, b, M2);
-	ROTATE(2, b, c, d, e, a, M2);
-
-	ROTATE(2, a, b, c, d, e, M2);
-	ROTATE(2, e, a, b, c, d, M2);
-	ROTATE(2, d, e, a, b, c, M2);
-	ROTATE(2, c, d, e, a, b, M2);
-	ROTATE(2, b, c, d, e, a, M2);
-
-	ROTATE(3, a, b, c, d, e, M3);
-	ROTATE(3, e, a, b, c, d, M3);
-	ROTATE(3, d, e, a, b, c, M3);
-	ROTATE(3, c, d, e, a, b, M3);
-	ROTATE(3, b, c, d, e, a, M3);
-
-	ROTATE(3, a, b, c, d, e, M3);
-	ROTATE(3, e, a, b, c, d, M3);
-	ROTATE(3, d, e, a, b, c, M3);
-	ROTATE(3, c, d, e, a, b, M3);
-	ROTATE(3, b, c, d, e, a, M3);
-
-	ROTATE(3, a, b, c, d, e, M3);
-	ROTATE(3, e, a, b, c, d, M3);
-	ROTATE(3, d, e, a, b, c, M3);
-	ROTATE(3, c, d, e, a, b, M3);
-	ROTATE(3, b, c, d, e, a, M3);
-
-	ROTATE(3, a, b, c, d, e, M3);
-	ROTATE(3, e, a, b, c, d, M3);
-	ROTATE(3, d, e, a, b, c, M3);
-	ROTATE(3, c, d, e, a, b, M3);
-	ROTATE(3, b, c, d, e, a, M3);
-
-	context->ihash[0] += a;
-	context->ihash[1] += b;
-	context->ihash[2] += c;
-	context->ihash[3] += d;
-	context->ihash[4] += e;
+	STOREU(ihash, _mm_shuffle_epi32(abcd, 0x1B));
+	ihash[4] = _mm_extract_epi32(e0, 3);
 
+#undef LOADU
+#undef STOREU
+}
+
+#define CPUID1_ECX_SSSE3	(1U << 9)
+#define CPUID1_ECX_SSE41	(1U << 19)
+#define CPUID7_EBX_SHA		(1U << 29)
+
+/**
+ * @return whether the CPU supports the SSSE3 instructions.
+ */
+static bool
+SHA1_cpu_has_ssse3(void)
+{
+	uint a, b, c, d;
+
+	if (!__get_cpuid(1, &a, &b, &c, &d))
+		return FALSE;
+
+	return 0 != (c & CPUID1_ECX_SSSE3);
+}
+
+/**
+ * @return whether the CPU supports the SHA extensions, and the SSE4.1
+ * and SSSE3 instructions required by our implementation.
+ */
+static bool
+SHA1_cpu_has_shani(void)
+{
+	uint a, b, c, d;
+
+	if (!__get_cpuid(1, &a, &b, &c, &d))
+		return FALSE;
+
+	if (
+		0 == (c & CPUID1_ECX_SSSE3) ||
+		0 == (c & CPUID1_ECX_SSE41) ||
+		__get_cpuid_max(0, NULL) < 7
+	)
+		return FALSE;
+
+	__cpuid_count(7, 0, a, b, c, d);
+
+	return 0 != (b & CPUID7_EBX_SHA);
+}
+#endif	/* SHA1_X86 */
+
+/**
+ * Known compression routines, by order of preference.
+ */
+static const struct SHA1_backend {
+	const char *name;				/**< Backend name */
+	SHA1_compress_t compress;		/**< Compression routine */
+	bool (*supported)(void);		/**< Whether CPU can run it, NULL if always */
+} SHA1_backends[] = {
+#ifdef SHA1_X86
+	{ "sha-ni",		SHA1_compress_shani,	SHA1_cpu_has_shani },
+	{ "ssse3",		SHA1_compress_ssse3,	SHA1_cpu_has_ssse3 },
+#endif
+	{ "portable",	SHA1_compress_portable,	NULL },
+};
+
+static const struct SHA1_backend *SHA1_backend_used;
+
+/**
+ * @return whether backend can run on this CPU.
+ */
+static bool
+SHA1_backend_supported(const struct SHA1_backend *sb)
+{
+	return NULL == sb->supported || (*sb->supported)();
+}
+
+/**
+ * Select the best compression backend for the CPU, once.
+ */
+static void
+SHA1_init_once(void)
+{
+	uint i;
+
+	for (i = 0; i < N_ITEMS(SHA1_backends); i++) {
+		const struct SHA1_backend *sb = &SHA1_backends[i];
+
+		if (SHA1_backend_supported(sb)) {
+			SHA1_backend_used = sb;
+			SHA1_compress = sb->compress;
+			break;
+		}
+	}
+
+	g_assert(SHA1_compress != NULL);
+}
+
+/**
+ * Get the name of a known SHA1 backend.
+ *
+ * @param i		the backend index, starting at 0
+ *
+ * @return the name of the backend, NULL if the index is out of range.
+ */
+const char *
+SHA1_backend_name(uint i)
+{
+	return i < N_ITEMS(SHA1_backends) ? SHA1_backends[i].name : NULL;
+}
+
+/**
+ * Force usage of a given SHA1 backend, for testing and benchmarking.
+ *
+ * @param i		the backend index, starting at 0
+ *
+ * @return TRUE if OK, FALSE if the backend does not exist or cannot be run
+ * on this CPU.
+ */
+bool
+SHA1_backend_use(uint i)
+{
+	const struct SHA1_backend *sb;
+
+	if (i >= N_ITEMS(SHA1_backends))
+		return FALSE;
+
+	sb = &SHA1_backends[i];
+
+	if (!SHA1_backend_supported(sb))
+		return FALSE;
+
+	ONCE_FLAG_RUN(SHA1_inited, SHA1_init_once);	/* Must not override us */
+
+	SHA1_backend_used = sb;
+	SHA1_compress = sb->compress;
+	return TRUE;
+}
+
+/**
+ * @return the name of the SHA1 backend in use.
+ */
+const char *
+SHA1_backend(void)
+{
+	ONCE_FLAG_RUN(SHA1_inited, SHA1_init_once);
+
+	return SHA1_backend_used->name;
+}
+
+/**
+ * Process the 64-byte message block held in the context.
+ */
+static void
+SHA1_process_message_block(SHA1_context *context, const void *mblock)
+{
+	(*SHA1_compress)(context->ihash, mblock, 1);
 	context->midx = 0;
 }
 
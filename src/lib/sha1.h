@@ -85,6 +85,10 @@ int SHA1_input(SHA1_context *, const void *, size_t);
 int SHA1_result(SHA1_context *, struct sha1 *digest);
 int SHA1_intermediate(const SHA1_context *, struct sha1 *digest);
 
+const char *SHA1_backend(void);
+const char *SHA1_backend_name(uint i);
+bool SHA1_backend_use(uint i);
+
 /**
  * Feed the SHA1 context with the content of a variable.
  */
@@ -82,6 +82,7 @@
 #include "endian.h"
 #include "halloc.h"
 #include "misc.h"
+#include "tiger.h"
 #include "tigertree.h"
 #include "override.h"		/* Must be the last header included */
 
@@ -102,7 +103,8 @@ enum {
 struct TTH_CONTEXT {
 	filesize_t bpl;       	/* blocks per leave at TTH_MAX_DEPTH */
 	filesize_t n;         	/* number of blocks processed */
-	unsigned block_fill;  	/* amount of bytes written to block[] */
+	unsigned block_fill;  	/* amount of bytes written to current block */
+	unsigned pending;		/* full blocks in block[] not hashed yet */
 	unsigned si;          	/* current stack index */
 	unsigned li;         	/* current leave index */
 	unsigned depth;			/* current tree depth */
@@ -111,7 +113,7 @@ struct TTH_CONTEXT {
 	union {
 		uint64 u64;	/* Better alignment */
 		char bytes[TTH_BLOCKSIZE + 1];
-	} block;
+	} block[TIGER_LANES];	/* leaf blocks, hashed TIGER_LANES at a time */
 	struct tth stack[56];
 	struct tth leaves[TTH_MAX_LEAVES];
 };
@@ -271,19 +273,20 @@ tt_collapse(TTH_CONTEXT *ctx)
 	}
 }
 
+/**
+ * Record the hash of the next leaf block.
+ */
 static void
-tt_block(TTH_CONTEXT *ctx)
+tt_leaf(TTH_CONTEXT *ctx, const struct tth *hash)
 {
 	g_assert(ctx);
 
-	tiger(ctx->block.bytes, ctx->block_fill, ctx->stack[ctx->si].data);
+	ctx->stack[ctx->si] = *hash;
 	if (ctx->bpl == 1) {
 		ctx->leaves[ctx->li] = ctx->stack[ctx->si];
 		ctx->li++;
 	}
 
-	ctx->block_fill = 1;
-
 	ctx->si++;
 	ctx->n++;
 
@@ -294,11 +297,53 @@ tt_block(TTH_CONTEXT *ctx)
 	tt_collapse(ctx);
 }
 
+/**
+ * Hash the full leaf blocks pending in the context, in order.
+ */
+static void
+tt_flush(TTH_CONTEXT *ctx)
+{
+	struct tth hash[TIGER_LANES];
+	unsigned i;
+
+	g_assert(ctx);
+	g_assert(ctx->pending <= TIGER_LANES);
+
+	if (TIGER_LANES == ctx->pending) {
+		const void *data[TIGER_LANES];
+		char *h[TIGER_LANES];
+
+		for (i = 0; i < TIGER_LANES; i++) {
+			data[i] = ctx->block[i].bytes;
+			h[i] = hash[i].data;
+		}
+		tiger_lanes(data, sizeof ctx->block[0].bytes, h);
+	} else {
+		for (i = 0; i < ctx->pending; i++) {
+			tiger(ctx->block[i].bytes, sizeof ctx->block[i].bytes,
+				hash[i].data);
+		}
+	}
+
+	for (i = 0; i < ctx->pending; i++) {
+		tt_leaf(ctx, &hash[i]);
+	}
+
+	ctx->pending = 0;
+}
+
 static void
 tt_finish(TTH_CONTEXT *ctx)
 {
+	unsigned last = ctx->pending;
+
+	tt_flush(ctx);
+
 	if (0 == ctx->n || ctx->block_fill > 1) {
-		tt_block(ctx);
+		struct tth hash;
+
+		tiger(ctx->block[last].bytes, ctx->block_fill, hash.data);
+		tt_leaf(ctx, &hash);
 	}
 
 	if (ctx->bpl > 1) {
@@ -340,7 +385,36 @@ tt_compute_parents(struct tth *dst, const struct tth *src, size_t src_leaves)
 	size_t i, n;
 
 	n = src_leaves / 2;
-	for (i = 0; i < n; i++) {
+
+	/*
+	 * Compute TIGER_LANES parents at a time.
+	 *
+	 * This works when ``dst'' and ``src'' are the same since all the
+	 * children are copied before the parents are written, and parents
+	 * are written below the position of the next children to read.
+	 */
+
+	for (i = 0; i + TIGER_LANES <= n; i += TIGER_LANES) {
+		union {
+			uint64 u64;	/* Better alignment */
+			char bytes[TIGER_LANES][TTH_NODESIZE + 1];
+		} buf;
+		const void *data[TIGER_LANES];
+		char *hash[TIGER_LANES];
+		int l;
+
+		for (l = 0; l < TIGER_LANES; l++) {
+			buf.bytes[l][0] = 0x01;
+			memcpy(&buf.bytes[l][1], &src[(i + l) * 2], TTH_NODESIZE);
+			data[l] = buf.bytes[l];
+		}
+		for (l = 0; l < TIGER_LANES; l++)
+			hash[l] = dst[i + l].data;
+
+		tiger_lanes(data, TTH_NODESIZE + 1, hash);
+	}
+
+	for (/* empty */; i < n; i++) {
 		tt_internal_hash(&src[i * 2], &src[i * 2 + 1], &dst[i]);
 	}
 	if (src_leaves & 1) {
@@ -375,10 +449,14 @@ tt_root_hash(const struct tth *src, size_t n_leaves)
 void
 tt_init(TTH_CONTEXT *ctx, filesize_t filesize)
 {
+	unsigned i;
+
 	g_assert(ctx);
 
 	ctx->block_fill = 1;
-	ctx->block.bytes[0] = 0x00;
+	ctx->pending = 0;
+	for (i = 0; i < N_ITEMS(ctx->block); i++)
+		ctx->block[i].bytes[0] = 0x00;
 	ctx->si = 0;
 	ctx->li = 0;
 	ctx->n = 0;
@@ -399,16 +477,19 @@ tt_update(TTH_CONTEXT *ctx, const void *data, size_t size)
 	g_assert(size == 0 || NULL != data);
 
 	while (size > 0) {
-		size_t n = sizeof ctx->block.bytes - ctx->block_fill;
+		char *bytes = ctx->block[ctx->pending].bytes;
+		size_t n = sizeof ctx->block[0].bytes - ctx->block_fill;
 
 		n = MIN(n, size);
-		memmove(&ctx->block.bytes[ctx->block_fill], block, n);
+		memmove(&bytes[ctx->block_fill], block, n);
 		ctx->block_fill += n;
 		block += n;
 		size -= n;
 
-		if (sizeof ctx->block.bytes == ctx->block_fill) {
-			tt_block(ctx);
+		if (sizeof ctx->block[0].bytes == ctx->block_fill) {
+			ctx->block_fill = 1;
+			if (TIGER_LANES == ++ctx->pending)
+				tt_flush(ctx);
 		}
 	}
 }
@@ -496,6 +577,29 @@ tt_check(void)
 		memset(buf, 'A', sizeof buf);
 		tt_check_digest("PZMRYHGY6LTBEH63ZWAHDORHSYTLO4LEFUIKHWY", buf, sizeof buf);
 	}
+
+	/* test cases: several leaves, hashed TIGER_LANES at a time */
+	{
+		static const struct {
+			const char *digest;
+			size_t size;
+		} tests[] = {
+			{ "KPD6JINICDSRSRL3KS6Z5OB3365GGMDDCXRWLKY", 4096 },
+			{ "I4CVKEZ7IYUZTT7V2EJC3DSR7NEWBI7SELPAEQI", 5 * 1024 + 17 },
+			{ "RDKCZVCLMECQXCE5XDTEEZQY23JQ7GZ6MJFB4KI", 9 * 1024 },
+			{ "MZFD7XESZEDFCGGR7WOES7HXG5HLYKDSMWZWJQQ", 64 * 1024 - 1 },
+		};
+		char *buf = halloc(64 * 1024);
+		size_t i, j;
+
+		for (i = 0; i < 64 * 1024; i++)
+			buf[i] = (char) (i * 7 + (i >> 8));
+
+		for (j = 0; j < N_ITEMS(tests); j++)
+			tt_check_digest(tests[j].digest, buf, tests[j].size);
+
+		HFREE_NULL(buf);
+	}
 }
 
 /* vi: set ts=4 sw=4 cindent: */
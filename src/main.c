@@ -101,6 +101,7 @@
 #include "core/upload_stats.h"
 #include "core/urpc.h"
 #include "core/verify_sha1.h"
+#include "core/verify_sha1_tth.h"
 #include "core/verify_tth.h"
 #include "core/version.h"
 #include "core/vmsg.h"
@@ -714,6 +715,7 @@ gtk_gnutella_exit(int exit_code)
 	DO(upload_stats_close);
 	DO(parq_close_pre);
 	DO(verify_sha1_close);
+	DO(verify_sha1_tth_close);
 	DO(verify_tth_shutdown);
 	DO(download_close);
 	DO(file_info_store_if_dirty);	/* In case downloads had buffered data */
@@ -967,7 +969,6 @@ gtk_gnutella_exit(int exit_code)
 	DO(tls_global_close);
 	DO(misc_close);
 	DO(mingw_close);
-	DO(verify_tth_close);
 	DO(inputevt_close);
 	DO(locale_close);
 	DO(wq_close);
@@ -1552,6 +1553,7 @@ slow_main_timer(time_t now)
 	i = (i + 1) % 6;
 
 	download_store_if_dirty();		/* Important, so always attempt it */
+	file_info_journal_flush();		/* Cheap, only appends what changed */
 	settings_save_if_dirty();		/* Nice to have, and file is small */
 	if (!running_topless) {
 		settings_gui_save_if_dirty();	/* Ditto */
@@ -2498,6 +2500,7 @@ main(int argc, char **argv)
 	ghc_init();
 	gwc_init();
 	verify_sha1_init();
+	verify_sha1_tth_init();
 	verify_tth_init();
 	move_init();
 	ignore_init();
@@ -2576,6 +2579,7 @@ main(int argc, char **argv)
 	http_test();
 	vxml_test();
 	g2_tree_test();
+	routing_test();
 
 	if (running_topless) {
 		topless_main_run();
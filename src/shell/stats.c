@@ -54,7 +54,7 @@ shell_exec_stats_general(struct gnutella_shell *sh,
 	};
 	int parsed;
 	int i;
-	gnet_stats_t *stats;
+	uint64 *general;
 
 	shell_check(sh);
 	g_assert(argv);
@@ -66,24 +66,27 @@ shell_exec_stats_general(struct gnutella_shell *sh,
 
 	/*
 	 * Since this command now runs in a separated thread with a rather small
-	 * stack, we allocate the gnet_stats_t variable on the heap because it
-	 * is large enough to cause an overflow.
+	 * stack, we allocate the counters on the heap.
 	 *		--RAM, 2013-11-30
+	 *
+	 * Only the general counters are needed here, so we do not snapshot the
+	 * whole gnet_stats_t structure: the counters are aggregated from the
+	 * per-thread shards directly into our array.
 	 */
 
-	XMALLOC(stats);
-	gnet_stats_get(stats);
+	XMALLOC_ARRAY(general, GNR_TYPE_COUNT);
+	gnet_stats_general_get(general);
 
 	for (i = 0; i < GNR_TYPE_COUNT; i++) {
 		shell_write(sh, gnet_stats_general_to_string(i));
 		shell_write(sh, " ");
 		shell_write(sh, pretty ?
-			uint64_to_gstring(stats->general[i]) :
-			uint64_to_string(stats->general[i]));
+			uint64_to_gstring(general[i]) :
+			uint64_to_string(general[i]));
 		shell_write(sh, "\n");
 	}
 
-	XFREE_NULL(stats);
+	XFREE_NULL(general);
 	return REPLY_READY;
 }
 